@@ -0,0 +1,116 @@
+/*
+ * Allocations and bytes per operation of the users table and the state,
+ * counted by alloc_counter, and the time to build and drop a table with
+ * libc against a bump arena, presized to the users.
+ *
+ * Usage: alloc [users]
+ */
+#include "bench.h"
+#include "../src/lib/alloc.h"
+#include "../src/lib/users.h"
+#include "../src/lib/state.h"
+
+#include <unistd.h>
+
+#define HEX "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+
+static void report(const char *name, alloc_counter_t *counter, size_t ops) {
+        alloc_stats_t stats;
+        alloc_counter_stats(counter, &stats);
+        printf("%-28s n=%-8zu %6.2f allocs/op %6.2f reallocs/op %6.2f frees/op %8.1f bytes/op"
+               "  peak=%zu\n",
+               name, ops, (double)stats.allocs / ops, (double)stats.reallocs / ops,
+               (double)stats.frees / ops, (double)stats.bytes / ops, stats.peak);
+        alloc_counter_reset(counter);
+}
+
+static void fill(users_t *users, size_t nusers) {
+        kdf_params_t kdf;
+        kdf_default(&kdf);
+        char name[32];
+        for (size_t i = 0; i < nusers; i++) {
+                snprintf(name, sizeof(name), "user.%09zu", i);
+                if (users_set(users, name, &kdf, (const uint8_t*)HEX) != 0) {
+                        exit(1);
+                }
+        }
+}
+
+static void count(size_t nusers, const char *path) {
+        alloc_counter_t *counter = alloc_counter_new(NULL);
+        if (counter == NULL) {
+                exit(1);
+        }
+        const alloc_t *alloc = alloc_counter(counter);
+
+        users_t *users = users_new_alloc(0, alloc);
+        fill(users, nusers);
+        report("users_set new", counter, nusers);
+        fill(users, nusers);
+        report("users_set existing", counter, nusers);
+        if (users_dump(users, path) != 0) {
+                exit(1);
+        }
+        users_free(users);
+        report("users_free", counter, nusers);
+
+        users = users_new_alloc(0, alloc);
+        if (users_load(users, path) != 0) {
+                exit(1);
+        }
+        report("users_load", counter, nusers);
+        users_free(users);
+        alloc_counter_reset(counter);
+        users = users_new_alloc(0, alloc);
+        if (users_load_threads(users, path, 0) != 0) {
+                exit(1);
+        }
+        report("users_load_threads", counter, nusers);
+        users_free(users);
+        alloc_counter_reset(counter);
+
+        state_t *state = state_new_alloc(alloc);
+        char name[32];
+        for (size_t i = 0; i < nusers; i++) {
+                snprintf(name, sizeof(name), "user.%09zu", i);
+                state_set_attempts(state, name, 1);
+        }
+        report("state_set_attempts", counter, nusers);
+        state_free(state);
+        alloc_counter_free(counter);
+}
+
+static void build(const char *label, size_t nusers, bool arena) {
+        uint64_t samples[5];
+        for (int run = 0; run < 5; run++) {
+                const uint64_t t0 = bench_now_ns();
+                alloc_arena_t *a = arena ? alloc_arena_new(0) : NULL;
+                users_t *users = users_new_alloc(nusers, a != NULL ? alloc_arena(a) : NULL);
+                fill(users, nusers);
+                users_free(users);
+                alloc_arena_free(a);
+                samples[run] = bench_now_ns() - t0;
+        }
+        uint64_t wall = 0;
+        for (int run = 0; run < 5; run++) {
+                wall += samples[run];
+        }
+        bench_report(label, samples, 5, wall);
+}
+
+int main(int argc, char **argv) {
+        const size_t nusers = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+        if (nusers == 0) {
+                return 1;
+        }
+        char *dir = bench_tmpdir();
+        char path[64];
+        snprintf(path, sizeof(path), "%s/users", dir);
+        printf("users=%zu\n", nusers);
+        count(nusers, path);
+        build("build+free libc", nusers, false);
+        build("build+free arena", nusers, true);
+        unlink(path);
+        rmdir(dir);
+        return 0;
+}
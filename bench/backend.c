@@ -0,0 +1,142 @@
+/*
+ * The same workload against every registered storage backend. Each
+ * operation opens a fresh store the way pam_pin.so does for a login,
+ * so the numbers include what a backend pays to open and load.
+ *
+ * Usage: backend [users] [iterations]
+ */
+#include "bench.h"
+#include "../src/lib/backend.h"
+#include "../src/lib/crypt.h"
+
+// set_attempts first, get_attempts reads the state file it writes
+enum { OP_LOOKUP, OP_SET_ATTEMPTS, OP_GET_ATTEMPTS, OP_UPSERT, OP_ITERATE, OP_LEN };
+
+static const char * const op_names[] = {
+        [OP_LOOKUP] = "lookup",
+        [OP_GET_ATTEMPTS] = "get_attempts",
+        [OP_SET_ATTEMPTS] = "set_attempts+commit",
+        [OP_UPSERT] = "upsert+commit",
+        [OP_ITERATE] = "iterate",
+};
+
+static int count_user(void *ctx, user_t *user) {
+        (*(size_t*)ctx)++;
+        return 0;
+}
+
+static int run(int op, const char *uri, const char *statepath, size_t nusers,
+               const kdf_params_t *kdf, const pin_hash_t pin_hash, size_t i) {
+        char name[32];
+        // spread over the users, the same sequence for every backend
+        snprintf(name, sizeof(name), "user%06zu", (i * 7919) % nusers);
+        backend_t *store = NULL;
+        int err = backend_open(&store, uri, statepath);
+        if (err != 0) {
+                return err;
+        }
+        user_t *user = user_new();
+        uint8_t attempts = 0;
+        size_t listed = 0;
+        switch (op) {
+                case OP_LOOKUP:
+                        err = backend_lookup(store, name, user);
+                        break;
+                case OP_GET_ATTEMPTS:
+                        err = backend_get_attempts(store, name, &attempts);
+                        break;
+                case OP_SET_ATTEMPTS:
+                        err = backend_set_attempts(store, name, i % 3);
+                        if (err == 0) {
+                                err = backend_commit(store, 0);
+                        }
+                        break;
+                case OP_UPSERT:
+                        err = backend_upsert(store, name, kdf, pin_hash);
+                        if (err == 0) {
+                                err = backend_commit(store, 0);
+                        }
+                        break;
+                default:
+                        err = backend_iterate(store, count_user, &listed);
+                        if (err == 0 && listed != nusers) {
+                                err = -1;
+                        }
+                        break;
+        }
+        user_free(user);
+        backend_close(store);
+        return err;
+}
+
+int main(int argc, char **argv) {
+        const size_t nusers = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000;
+        const size_t iters = argc > 2 ? strtoul(argv[2], NULL, 10) : 100;
+
+        const pin_source_t pin = {1, 2, 3, 4};
+        pin_hash_t pin_hash;
+        hash_pin(pin, pin_hash);
+        kdf_params_t kdf;
+        kdf_default(&kdf);
+        uint64_t *samples = malloc(iters * sizeof(uint64_t));
+        if (samples == NULL || nusers == 0) {
+                perror("malloc");
+                return 1;
+        }
+
+        printf("users=%zu iterations=%zu\n", nusers, iters);
+        int ret = 0;
+        for (size_t b = 0; backend_list(b) != NULL; b++) {
+                const backend_ops_t *ops = backend_list(b);
+                char *dir = bench_tmpdir();
+                char uri[300], statepath[256];
+                snprintf(uri, sizeof(uri), "%s:%s/users", ops->scheme, dir);
+                snprintf(statepath, sizeof(statepath), "%s/state", dir);
+
+                backend_t *store = NULL;
+                int err = backend_open(&store, uri, statepath);
+                for (size_t i = 0; err == 0 && i < nusers; i++) {
+                        char name[32];
+                        snprintf(name, sizeof(name), "user%06zu", i);
+                        err = backend_upsert(store, name, &kdf, pin_hash);
+                }
+                if (err == 0) {
+                        err = backend_commit(store, 0);
+                }
+                backend_close(store);
+                if (err != 0) {
+                        fprintf(stderr, "%s: initial fill failed: %d\n", ops->scheme, err);
+                        return 1;
+                }
+
+                for (int op = 0; op < OP_LEN; op++) {
+                        size_t failed = 0;
+                        const uint64_t start = bench_now_ns();
+                        for (size_t i = 0; i < iters; i++) {
+                                const uint64_t t0 = bench_now_ns();
+                                if (run(op, uri, statepath, nusers, &kdf, pin_hash, i) != 0) {
+                                        failed++;
+                                }
+                                samples[i] = bench_now_ns() - t0;
+                        }
+                        const uint64_t wall = bench_now_ns() - start;
+                        char name[64];
+                        snprintf(name, sizeof(name), "%s %s", ops->scheme, op_names[op]);
+                        bench_report(name, samples, iters, wall);
+                        if (failed > 0) {
+                                printf("%-28s %zu of %zu failed\n", "", failed, iters);
+                                ret = 1;
+                        }
+                }
+
+                char cmd[300];
+                snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+                if (system(cmd) != 0) {
+                        fprintf(stderr, "failed to remove %s\n", dir);
+                }
+                // bench_tmpdir reuses its template
+                memcpy(dir + strlen(dir) - 6, "XXXXXX", 6);
+        }
+        free(samples);
+        return ret;
+}
@@ -0,0 +1,52 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+static inline uint64_t bench_now_ns(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int bench_cmp_u64(const void *a, const void *b) {
+        const uint64_t x = *(const uint64_t*)a;
+        const uint64_t y = *(const uint64_t*)b;
+        return x < y ? -1 : x > y ? 1 : 0;
+}
+
+// sorts samples in place
+static inline uint64_t bench_percentile(uint64_t *samples, size_t len, double p) {
+        if (len == 0) {
+                return 0;
+        }
+        qsort(samples, len, sizeof(uint64_t), bench_cmp_u64);
+        size_t idx = (size_t)(p / 100.0 * (len - 1) + 0.5);
+        return samples[idx];
+}
+
+static inline void bench_report(const char *name, uint64_t *samples, size_t len,
+                                uint64_t wall_ns) {
+        printf("%-28s n=%-8zu %10.0f op/s  p50=%8.1fus  p99=%8.1fus  max=%8.1fus\n",
+               name, len, wall_ns > 0 ? len * 1e9 / wall_ns : 0.0,
+               bench_percentile(samples, len, 50) / 1e3,
+               bench_percentile(samples, len, 99) / 1e3,
+               bench_percentile(samples, len, 100) / 1e3);
+}
+
+// temporary directory for the benchmark files
+static inline char* bench_tmpdir(void) {
+        static char dir[] = "/tmp/pinpam-bench-XXXXXX";
+        if (mkdtemp(dir) == NULL) {
+                perror("mkdtemp");
+                exit(1);
+        }
+        return dir;
+}
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * Scan rate of fsck over a generated users file with a few problems
+ * spread through it, and a state entry for every tenth user.
+ *
+ * Usage: fsck [users] [threads]
+ */
+#include "bench.h"
+#include "../src/lib/fsck.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define HEX "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+
+int main(int argc, char **argv) {
+        const size_t nusers = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000;
+        const int threads = argc > 2 ? atoi(argv[2]) : 0;
+
+        char *dir = bench_tmpdir();
+        char userspath[256], statepath[256];
+        snprintf(userspath, sizeof(userspath), "%s/users", dir);
+        snprintf(statepath, sizeof(statepath), "%s/state", dir);
+        FILE *users = fopen(userspath, "w");
+        FILE *state = fopen(statepath, "w");
+        if (users == NULL || state == NULL) {
+                perror("fopen");
+                return 1;
+        }
+        for (size_t i = 0; i < nusers; i++) {
+                // one in a million is a duplicate of an earlier user
+                const size_t id = i % 1000000 == 999999 ? i / 2 : i;
+                fprintf(users, "user.%09zu:" HEX "\n", id);
+                if (i % 10 == 0) {
+                        fprintf(state, "user.%09zu:%zu\n", i, i % 4);
+                }
+        }
+        fclose(users);
+        fclose(state);
+        struct stat st;
+        stat(userspath, &st);
+
+        uint64_t samples[3];
+        size_t problems = 0;
+        for (int run = 0; run < 3; run++) {
+                const uint64_t t0 = bench_now_ns();
+                fsck_t *fsck = NULL;
+                if (fsck_run(&fsck, userspath, statepath, threads) != 0) {
+                        fprintf(stderr, "fsck failed\n");
+                        return 1;
+                }
+                samples[run] = bench_now_ns() - t0;
+                problems = fsck_report(fsck)->problems[FSCK_DUPLICATE];
+                fsck_free(fsck);
+        }
+        printf("users=%zu size=%.1f MiB threads=%d duplicates=%zu\n", nusers,
+               st.st_size / 1048576.0, threads, problems);
+        bench_report("fsck_run", samples, 3, samples[0] + samples[1] + samples[2]);
+        printf("%-28s %10.1f MiB/s\n", "", st.st_size / 1048576.0 /
+               (bench_percentile(samples, 3, 50) / 1e9));
+
+        unlink(userspath);
+        unlink(statepath);
+        rmdir(dir);
+        return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * Latency of the file I/O paths: users_load, users_dump and state_save.
+ * Run it under the fault injection shim to see them on a slow or
+ * failing disk, e.g.
+ *
+ *   LD_PRELOAD=build/test/faultio.so PINPAM_FAULT='fsync:delay=5000' build/bench/io
+ *
+ * Failed calls are counted, not fatal; the run fails if a failed write
+ * left a users file different from the one it was replacing. Delay
+ * faults with @n if they break writing the initial file.
+ *
+ * Usage: io [users] [iterations]
+ */
+#include "bench.h"
+#include "../src/lib/users.h"
+#include "../src/lib/state.h"
+#include "../src/lib/crypt.h"
+
+#include <sys/stat.h>
+
+enum { OP_LOAD, OP_DUMP, OP_STATE_SAVE };
+
+static const char * const op_names[] = {
+        [OP_LOAD] = "users_load",
+        [OP_DUMP] = "users_dump",
+        [OP_STATE_SAVE] = "state_save",
+};
+
+static int run(int op, users_t *storage, state_t *state, const char *usersfile,
+               const char *statefile, size_t i) {
+        switch (op) {
+                case OP_LOAD: {
+                        users_t *loaded = users_new(10);
+                        int err = users_load(loaded, usersfile);
+                        users_free(loaded);
+                        return err;
+                }
+                case OP_DUMP:
+                        return users_dump(storage, usersfile);
+                default:
+                        state_set_attempts(state, "user000000", i % 3);
+                        return state_save(state, statefile);
+        }
+}
+
+int main(int argc, char **argv) {
+        const size_t nusers = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000;
+        const size_t iters = argc > 2 ? strtoul(argv[2], NULL, 10) : 100;
+
+        char *dir = bench_tmpdir();
+        char usersfile[256], statefile[256];
+        snprintf(usersfile, sizeof(usersfile), "%s/users", dir);
+        snprintf(statefile, sizeof(statefile), "%s/state", dir);
+
+        const pin_source_t pin = {1, 2, 3, 4};
+        pin_hash_t pin_hash;
+        hash_pin(pin, pin_hash);
+        users_t *storage = users_new(nusers);
+        state_t *state = state_new();
+        uint64_t *samples = malloc(iters * sizeof(uint64_t));
+        if (storage == NULL || state == NULL || samples == NULL) {
+                perror("malloc");
+                return 1;
+        }
+        for (size_t i = 0; i < nusers; i++) {
+                char name[32];
+                snprintf(name, sizeof(name), "user%06zu", i);
+                users_update(storage, name, pin_hash);
+                state_set_attempts(state, name, 0);
+        }
+        // the file to load, dumps below replace it with the same users
+        struct stat st;
+        if (users_dump(storage, usersfile) != 0 || stat(usersfile, &st) != 0) {
+                fprintf(stderr, "initial users_dump failed\n");
+                return 1;
+        }
+        // every dump writes the same content
+        const off_t size = st.st_size;
+
+        printf("users=%zu iterations=%zu faults=%s\n", nusers, iters,
+               getenv("PINPAM_FAULT") != NULL ? getenv("PINPAM_FAULT") : "none");
+        for (int op = OP_LOAD; op <= OP_STATE_SAVE; op++) {
+                size_t failed = 0;
+                const uint64_t start = bench_now_ns();
+                for (size_t i = 0; i < iters; i++) {
+                        const uint64_t t0 = bench_now_ns();
+                        if (run(op, storage, state, usersfile, statefile, i) != 0) {
+                                failed++;
+                        }
+                        samples[i] = bench_now_ns() - t0;
+                }
+                const uint64_t wall = bench_now_ns() - start;
+                bench_report(op_names[op], samples, iters, wall);
+                if (failed > 0) {
+                        printf("%-28s %zu of %zu failed\n", "", failed, iters);
+                }
+        }
+
+        // failed dumps must leave the previous file in place, stat it
+        // since reads may be failing
+        const bool intact = stat(usersfile, &st) == 0 && st.st_size == size;
+
+        char cmd[300];
+        snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+        if (system(cmd) != 0) {
+                fprintf(stderr, "failed to remove %s\n", dir);
+        }
+        state_free(state);
+        users_free(storage);
+        free(samples);
+        if (!intact) {
+                fprintf(stderr, "users file is damaged: %lld of %lld bytes\n",
+                        (long long)st.st_size, (long long)size);
+                return 1;
+        }
+        return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Users file load time, users_load against users_load_threads with 1 to
+ * N threads on the same file. One CPU runs the chunks one after another,
+ * the rows then show the cost of the split and the merge.
+ *
+ * Usage: load [users] [max threads]
+ */
+#include "bench.h"
+#include "../src/lib/users.h"
+#include "../src/lib/crypt.h"
+
+#include <unistd.h>
+
+#define RUNS 3
+
+static uint64_t load_ns(const char *path, int threads) {
+        uint64_t best = UINT64_MAX;
+        for (int run = 0; run < RUNS; run++) {
+                users_t *users = users_new(10);
+                const uint64_t t0 = bench_now_ns();
+                const int err = threads < 0 ?
+                        users_load(users, path) : users_load_threads(users, path, threads);
+                const uint64_t t = bench_now_ns() - t0;
+                if (err != 0) {
+                        fprintf(stderr, "failed to load %s\n", path);
+                        exit(1);
+                }
+                users_free(users);
+                best = t < best ? t : best;
+        }
+        return best;
+}
+
+int main(int argc, char **argv) {
+        const size_t nusers = argc > 1 ? strtoul(argv[1], NULL, 10) : 2000000;
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        const int max = argc > 2 ? atoi(argv[2]) : cpus > 1 ? (int)cpus : 4;
+
+        char *dir = bench_tmpdir();
+        char path[256];
+        snprintf(path, sizeof(path), "%s/users", dir);
+        const pin_source_t pin = {1, 2, 3, 4};
+        pin_hash_t pin_hash;
+        hash_pin(pin, pin_hash);
+        users_t *users = users_new(nusers);
+        for (size_t i = 0; i < nusers; i++) {
+                char name[32];
+                snprintf(name, sizeof(name), "user.%08zu", (i * 7919) % nusers);
+                users_update(users, name, pin_hash);
+        }
+        if (users_dump(users, path) != 0) {
+                fprintf(stderr, "failed to write %s\n", path);
+                return 1;
+        }
+        users_free(users);
+
+        printf("users=%zu cpus=%ld best of %d\n", nusers, cpus, RUNS);
+        const uint64_t base = load_ns(path, -1);
+        printf("%-28s %8.1f ms\n", "users_load", base / 1e6);
+        for (int threads = 1; threads <= max; threads++) {
+                char name[32];
+                snprintf(name, sizeof(name), "users_load_threads(%d)", threads);
+                const uint64_t t = load_ns(path, threads);
+                printf("%-28s %8.1f ms  %5.2fx\n", name, t / 1e6, (double)base / t);
+        }
+
+        unlink(path);
+        rmdir(dir);
+        return 0;
+}
@@ -0,0 +1,59 @@
+/*
+ * Time of a diff of two generated users files, in different orders and
+ * with a change every hundredth user, sorted within a small memory budget
+ * and within one that holds both files.
+ *
+ * Usage: merge [users]
+ */
+#include "bench.h"
+#include "../src/lib/merge.h"
+
+#include <unistd.h>
+
+#define HEX "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+#define HEX2 "fedcba9876543210fedcba9876543210fedcba9876543210fedcba9876543210"
+
+int main(int argc, char **argv) {
+        const size_t nusers = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+
+        char *dir = bench_tmpdir();
+        char apath[256], bpath[256];
+        snprintf(apath, sizeof(apath), "%s/a", dir);
+        snprintf(bpath, sizeof(bpath), "%s/b", dir);
+        FILE *a = fopen(apath, "w");
+        FILE *b = fopen(bpath, "w");
+        if (a == NULL || b == NULL) {
+                perror("fopen");
+                return 1;
+        }
+        for (size_t i = 0; i < nusers; i++) {
+                fprintf(a, "user.%09zu:" HEX "\n", (i * 7919) % nusers);
+                const size_t j = nusers - 1 - i;
+                fprintf(b, "user.%09zu:%s\n", j, j % 100 == 0 ? HEX2 : HEX);
+        }
+        fclose(a);
+        fclose(b);
+
+        const size_t budgets[] = {8 << 20, 512 << 20};
+        for (size_t k = 0; k < 2; k++) {
+                uint64_t samples[3];
+                merge_report_t report;
+                for (int run = 0; run < 3; run++) {
+                        const uint64_t t0 = bench_now_ns();
+                        if (merge_diff(apath, bpath, budgets[k], NULL, NULL, &report) != 0) {
+                                fprintf(stderr, "diff failed\n");
+                                return 1;
+                        }
+                        samples[run] = bench_now_ns() - t0;
+                }
+                printf("users=%zu mem=%zuMiB runs=%zu changed=%zu\n", nusers, budgets[k] >> 20,
+                       report.runs, report.changes[MERGE_CHANGED]);
+                bench_report(k == 0 ? "merge_diff_spill" : "merge_diff_memory", samples, 3,
+                             samples[0] + samples[1] + samples[2]);
+        }
+
+        unlink(apath);
+        unlink(bpath);
+        rmdir(dir);
+        return 0;
+}
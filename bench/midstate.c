@@ -0,0 +1,133 @@
+/*
+ * PIN verification throughput of salted and peppered SHA-256 records:
+ * recomputing the whole hash for every attempt against finishing it
+ * from the per user midstate cached in the users table.
+ *
+ * Usage: midstate [users] [verifications]
+ */
+#include "bench.h"
+#include "../src/lib/users.h"
+#include "../src/lib/crypt.h"
+#include "../src/lib/kdf.h"
+
+#include <openssl/evp.h>
+
+enum { MODE_LEGACY, MODE_EVP, MODE_FULL, MODE_MIDSTATE };
+
+static const char * const mode_names[] = {
+        [MODE_LEGACY] = "sha256 (legacy, unsalted)",
+        [MODE_EVP] = "pepper full (openssl)",
+        [MODE_FULL] = "pepper full (recompute)",
+        [MODE_MIDSTATE] = "pepper midstate (cached)",
+};
+
+static const uint8_t pepper[PIN_PEPPER_LEN] = {
+        0x5e, 0x11, 0x7a, 0x02, 0x9c, 0x44, 0xd1, 0x3b, 0x80, 0x0f, 0x6e, 0x27, 0xb9, 0x58, 0xc3, 0x14,
+        0x21, 0xfa, 0x93, 0x6d, 0x0a, 0xe7, 0x35, 0xcc, 0x4f, 0x82, 0x19, 0xb0, 0x76, 0xde, 0x03, 0x9a,
+};
+
+static int verify(int mode, users_t *storage, user_t *user, const char *username,
+                  const pin_source_t pin, bool *valid) {
+        kdf_params_t kdf;
+        pin_hash_t expect, hash;
+        switch (mode) {
+                case MODE_LEGACY:
+                        users_find(storage, username, user);
+                        user_get_pin_hash(user, expect);
+                        if (hash_pin(pin, hash) != 0) {
+                                return -1;
+                        }
+                        *valid = memcmp(hash, expect, PIN_HASH_LEN) == 0;
+                        return 0;
+                case MODE_EVP: {
+                        users_find(storage, username, user);
+                        user_get_kdf(user, &kdf);
+                        user_get_pin_hash(user, expect);
+                        uint8_t msg[PIN_PREFIX_LEN + PIN_SOURCE_LEN] = {0};
+                        memcpy(msg, pepper, PIN_PEPPER_LEN);
+                        memcpy(msg + PIN_PEPPER_LEN, kdf.salt, KDF_SALT_LEN);
+                        memcpy(msg + PIN_PREFIX_LEN, pin, PIN_SOURCE_LEN);
+                        uint8_t raw[32];
+                        if (EVP_Digest(msg, sizeof(msg), raw, NULL, EVP_sha256(), NULL) != 1) {
+                                return -1;
+                        }
+                        static const char hex[] = "0123456789abcdef";
+                        for (int i = 0; i < 32; i++) {
+                                hash[i * 2] = hex[raw[i] >> 4];
+                                hash[i * 2 + 1] = hex[raw[i] & 0x0f];
+                        }
+                        *valid = memcmp(hash, expect, PIN_HASH_LEN) == 0;
+                        return 0;
+                }
+                case MODE_FULL:
+                        users_find(storage, username, user);
+                        user_get_kdf(user, &kdf);
+                        user_get_pin_hash(user, expect);
+                        if (kdf_hash(&kdf, pin, hash) != 0) {
+                                return -1;
+                        }
+                        *valid = memcmp(hash, expect, PIN_HASH_LEN) == 0;
+                        return 0;
+                default:
+                        return users_verify_pin(storage, username, pin, valid);
+        }
+}
+
+int main(int argc, char **argv) {
+        const size_t nusers = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000;
+        const size_t nverify = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000000;
+        kdf_set_pepper(pepper);
+
+        const pin_source_t pin = {1, 2, 3, 4};
+        users_t *legacy = users_new(nusers);
+        users_t *peppered = users_new(nusers);
+        char (*names)[32] = malloc(nusers * sizeof(*names));
+        uint64_t *samples = malloc(nverify * sizeof(uint64_t));
+        if (legacy == NULL || peppered == NULL || names == NULL || samples == NULL) {
+                perror("malloc");
+                return 1;
+        }
+        kdf_params_t kdf;
+        kdf_parse_spec("$sha256-pepper$$", &kdf);
+        pin_hash_t pin_hash;
+        for (size_t i = 0; i < nusers; i++) {
+                snprintf(names[i], sizeof(names[i]), "user%06zu", i);
+                hash_pin(pin, pin_hash);
+                users_update(legacy, names[i], pin_hash);
+                if (kdf_salt(&kdf) != 0 || kdf_hash(&kdf, pin, pin_hash) != 0) {
+                        fprintf(stderr, "kdf_hash failed\n");
+                        return 1;
+                }
+                users_set(peppered, names[i], &kdf, pin_hash);
+        }
+
+        printf("users=%zu verifications=%zu\n", nusers, nverify);
+        user_t *user = user_new();
+        for (int mode = MODE_LEGACY; mode <= MODE_MIDSTATE; mode++) {
+                users_t *storage = mode == MODE_LEGACY ? legacy : peppered;
+                size_t failed = 0;
+                const uint64_t start = bench_now_ns();
+                for (size_t i = 0; i < nverify; i++) {
+                        const uint64_t t0 = bench_now_ns();
+                        bool valid = false;
+                        if (verify(mode, storage, user, names[i % nusers], pin, &valid) != 0 ||
+                                        !valid) {
+                                failed++;
+                        }
+                        samples[i] = bench_now_ns() - t0;
+                }
+                const uint64_t wall = bench_now_ns() - start;
+                bench_report(mode_names[mode], samples, nverify, wall);
+                if (failed > 0) {
+                        fprintf(stderr, "%zu verifications failed\n", failed);
+                        return 1;
+                }
+        }
+
+        user_free(user);
+        users_free(legacy);
+        users_free(peppered);
+        free(names);
+        free(samples);
+        return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * Time of a prune dry run over a generated users file, a state entry for
+ * every tenth user and a passwd file that lists nine of every ten users.
+ *
+ * Usage: prune [users]
+ */
+#include "bench.h"
+#include "../src/lib/prune.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define HEX "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+
+int main(int argc, char **argv) {
+        const size_t nusers = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+
+        char *dir = bench_tmpdir();
+        char userspath[256], statepath[256], passwdpath[256];
+        snprintf(userspath, sizeof(userspath), "%s/users", dir);
+        snprintf(statepath, sizeof(statepath), "%s/state", dir);
+        snprintf(passwdpath, sizeof(passwdpath), "%s/passwd", dir);
+        FILE *users = fopen(userspath, "w");
+        FILE *state = fopen(statepath, "w");
+        FILE *passwd = fopen(passwdpath, "w");
+        if (users == NULL || state == NULL || passwd == NULL) {
+                perror("fopen");
+                return 1;
+        }
+        for (size_t i = 0; i < nusers; i++) {
+                fprintf(users, "user.%09zu:" HEX "\n", i);
+                if (i % 10 == 0) {
+                        fprintf(state, "user.%09zu:%zu\n", i, i % 4);
+                }
+                if (i % 10 != 9) {
+                        fprintf(passwd, "user.%09zu:x:%zu:100::/home/u:/bin/sh\n", i, 10000 + i);
+                }
+        }
+        fclose(users);
+        fclose(state);
+        fclose(passwd);
+
+        uint64_t samples[3];
+        prune_report_t report;
+        for (int run = 0; run < 3; run++) {
+                const uint64_t t0 = bench_now_ns();
+                if (prune_run(userspath, statepath, passwdpath, true, NULL, NULL, &report) != 0) {
+                        fprintf(stderr, "prune failed\n");
+                        return 1;
+                }
+                samples[run] = bench_now_ns() - t0;
+        }
+        printf("users=%zu accounts=%zu orphans=%zu\n", nusers, report.accounts,
+               report.removed[PRUNE_USERS]);
+        bench_report("prune_run", samples, 3, samples[0] + samples[1] + samples[2]);
+
+        unlink(userspath);
+        unlink(statepath);
+        unlink(passwdpath);
+        rmdir(dir);
+        return 0;
+}
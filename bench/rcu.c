@@ -0,0 +1,150 @@
+/*
+ * Reader throughput of a shared rcu snapshot with 1, 2, 4 ... threads up
+ * to the online CPUs, while a writer publishes updates continuously.
+ * Every read pins the snapshot, finds a random user with its attempts
+ * and unpins.
+ *
+ * Usage: rcu [users] [seconds per run]
+ */
+#include "bench.h"
+#include "../src/lib/rcu.h"
+
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define HEX "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+
+struct run {
+        rcu_t           *rcu;
+        size_t          nusers;
+        atomic_bool     done;
+        atomic_size_t   reads;
+        size_t          updates;
+        uint64_t        update_ns;
+};
+
+static int fill(void *ctx, users_t *users, state_t *state) {
+        const size_t *nusers = ctx;
+        kdf_params_t kdf;
+        kdf_default(&kdf);
+        char name[32];
+        for (size_t i = 0; i < *nusers; i++) {
+                snprintf(name, sizeof(name), "user.%09zu", i);
+                if (users_set(users, name, &kdf, (const uint8_t*)HEX) != 0) {
+                        return -1;
+                }
+                if (i % 16 == 0) {
+                        state_set_attempts(state, name, 1);
+                }
+        }
+        return 0;
+}
+
+// a failed attempt of one user
+static int touch(void *ctx, users_t *users, state_t *state) {
+        (void) users;
+        struct run *run = ctx;
+        char name[32];
+        snprintf(name, sizeof(name), "user.%09zu", (size_t)random() % run->nusers);
+        state_set_attempts(state, name, run->updates % 3);
+        return 0;
+}
+
+static void* read_loop(void *arg) {
+        struct run *run = arg;
+        rcu_reader_t *reader = rcu_reader_new(run->rcu);
+        if (reader == NULL) {
+                exit(1);
+        }
+        user_t *user = user_new();
+        unsigned int seed = (unsigned int)(uintptr_t)&seed;
+        char name[32];
+        size_t reads = 0;
+        while (!atomic_load_explicit(&run->done, memory_order_relaxed)) {
+                snprintf(name, sizeof(name), "user.%09zu", (size_t)rand_r(&seed) % run->nusers);
+                const rcu_snapshot_t *snap = rcu_pin(reader);
+                if (rcu_find(snap, name, user) != 0) {
+                        fprintf(stderr, "%s not found\n", name);
+                        exit(1);
+                }
+                (void) rcu_attempts(snap, name);
+                rcu_unpin(reader);
+                reads++;
+        }
+        atomic_fetch_add(&run->reads, reads);
+        user_free(user);
+        rcu_reader_free(reader);
+        return NULL;
+}
+
+static void* write_loop(void *arg) {
+        struct run *run = arg;
+        while (!atomic_load(&run->done)) {
+                const uint64_t t0 = bench_now_ns();
+                if (rcu_update(run->rcu, touch, run) != 0) {
+                        fprintf(stderr, "update failed\n");
+                        exit(1);
+                }
+                run->update_ns += bench_now_ns() - t0;
+                run->updates++;
+        }
+        return NULL;
+}
+
+static void measure(rcu_t *rcu, size_t nusers, int threads, double seconds) {
+        struct run run;
+        run.rcu = rcu;
+        run.nusers = nusers;
+        atomic_init(&run.done, false);
+        atomic_init(&run.reads, 0);
+        run.updates = 0;
+        run.update_ns = 0;
+
+        pthread_t readers[threads], writer;
+        const uint64_t start = bench_now_ns();
+        for (int i = 0; i < threads; i++) {
+                if (pthread_create(&readers[i], NULL, read_loop, &run) != 0) {
+                        exit(1);
+                }
+        }
+        if (pthread_create(&writer, NULL, write_loop, &run) != 0) {
+                exit(1);
+        }
+        usleep((useconds_t)(seconds * 1e6));
+        atomic_store(&run.done, true);
+        for (int i = 0; i < threads; i++) {
+                pthread_join(readers[i], NULL);
+        }
+        pthread_join(writer, NULL);
+        const uint64_t wall = bench_now_ns() - start;
+
+        const double reads = atomic_load(&run.reads) * 1e9 / wall;
+        printf("readers=%-3d %12.0f reads/s %10.0f reads/s/thread  %6.1f updates/s  update=%8.1fms\n",
+               threads, reads, reads / threads, run.updates * 1e9 / wall,
+               run.updates > 0 ? run.update_ns / 1e6 / run.updates : 0.0);
+}
+
+int main(int argc, char **argv) {
+        size_t nusers = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+        const double seconds = argc > 2 ? atof(argv[2]) : 1.0;
+        const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (nusers == 0) {
+                nusers = 1;
+        }
+        rcu_t *rcu = rcu_new();
+        if (rcu == NULL || rcu_update(rcu, fill, &nusers) != 0) {
+                fprintf(stderr, "setup failed\n");
+                return 1;
+        }
+        printf("users=%zu cpus=%ld\n", nusers, cpus);
+        for (int threads = 1; ; threads *= 2) {
+                const int n = threads < cpus ? threads : (int)cpus;
+                measure(rcu, nusers, n < RCU_READERS_MAX ? n : RCU_READERS_MAX, seconds);
+                if (n >= cpus || n >= RCU_READERS_MAX) {
+                        break;
+                }
+        }
+        rcu_free(rcu);
+        return 0;
+}
@@ -0,0 +1,71 @@
+/*
+ * Latency of removing 10% of a table of users, from the front of the
+ * file and spread over it, and of writing the table out afterwards.
+ *
+ * Usage: remove [users]
+ */
+#include "bench.h"
+#include "../src/lib/users.h"
+
+#define HEX "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+
+static users_t* make_users(size_t nusers) {
+        users_t *users = users_new(nusers);
+        if (users == NULL) {
+                exit(1);
+        }
+        kdf_params_t kdf;
+        kdf_default(&kdf);
+        char name[32];
+        for (size_t i = 0; i < nusers; i++) {
+                snprintf(name, sizeof(name), "user.%09zu", i);
+                if (users_set(users, name, &kdf, (const uint8_t*)HEX) != 0) {
+                        exit(1);
+                }
+        }
+        return users;
+}
+
+static void remove_users(const char *label, size_t nusers, size_t step) {
+        users_t *users = make_users(nusers);
+        const size_t count = nusers / 10;
+        uint64_t *samples = malloc(count * sizeof(uint64_t));
+        if (samples == NULL) {
+                exit(1);
+        }
+        char name[32];
+        const uint64_t start = bench_now_ns();
+        for (size_t i = 0; i < count; i++) {
+                snprintf(name, sizeof(name), "user.%09zu", i * step);
+                const uint64_t t0 = bench_now_ns();
+                if (users_remove(users, name) != 0) {
+                        fprintf(stderr, "remove %s failed\n", name);
+                        exit(1);
+                }
+                samples[i] = bench_now_ns() - t0;
+        }
+        bench_report(label, samples, count, bench_now_ns() - start);
+
+        uint64_t writes[3];
+        FILE *null = fopen("/dev/null", "w");
+        for (int run = 0; run < 3; run++) {
+                const uint64_t t0 = bench_now_ns();
+                if (null == NULL || users_write(users, null) != 0) {
+                        fprintf(stderr, "write failed\n");
+                        exit(1);
+                }
+                writes[run] = bench_now_ns() - t0;
+        }
+        fclose(null);
+        bench_report("  users_write", writes, 3, writes[0] + writes[1] + writes[2]);
+        free(samples);
+        users_free(users);
+}
+
+int main(int argc, char **argv) {
+        const size_t nusers = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+        printf("users=%zu removed=%zu\n", nusers, nusers / 10);
+        remove_users("users_remove_front", nusers, 1);
+        remove_users("users_remove_spread", nusers, 10);
+        return 0;
+}
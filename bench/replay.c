@@ -0,0 +1,469 @@
+/*
+ * Replay recorded authentication traffic and users file edits through
+ * the same path as pam_pin.so: snapshot lookup, the auth session and
+ * the attempts state file, with temporary users, state and snapshot
+ * files. Reports latency per operation type.
+ *
+ * A trace line is either
+ *   <seconds> auth <user> ok|bad       - session with a right or wrong PIN
+ *   <seconds> add|remove|reset <user>  - ppedit edit
+ * or a `ppedit audit` line, or a syslog line of pam_pin.so written when
+ * the audit log is not available; the result selects the PIN: ok is
+ * right, invalid and locked are wrong. Lines starting with # are
+ * skipped.
+ * Users are enrolled with PIN 1234 unless the first operation on them
+ * is add. Without a trace a built-in mix is replayed: a few admins
+ * authenticating constantly, lockout bursts and edits in between.
+ *
+ * With --speed S > 0 operations start at their trace time divided by
+ * S and latency counts from that time, so a slow operation delays the
+ * following ones as it would on the host; 0 replays back to back.
+ *
+ * Usage: replay [--speed S] [--users N] [trace|-]
+ */
+#include "bench.h"
+#include "../src/lib/users.h"
+#include "../src/lib/crypt.h"
+#include "../src/lib/state.h"
+#include "../src/lib/auth.h"
+#include "../src/lib/snapshot.h"
+
+#define REPLAY_USER_LEN 64
+
+typedef enum {
+        OP_AUTH_OK = 0,
+        OP_AUTH_BAD,
+        OP_ADD,
+        OP_REMOVE,
+        OP_RESET,
+        OP_COUNT,
+} op_t;
+
+// results reported separately from the operation
+typedef enum {
+        KIND_AUTH_OK = 0,
+        KIND_AUTH_BAD,
+        KIND_AUTH_LOCKED,       // locked before the PIN was asked
+        KIND_AUTH_NO_USER,
+        KIND_ADD,
+        KIND_REMOVE,
+        KIND_RESET,
+        KIND_COUNT,
+} kind_t;
+
+static const char * const kind_names[] = {
+        [KIND_AUTH_OK] = "auth ok",
+        [KIND_AUTH_BAD] = "auth bad",
+        [KIND_AUTH_LOCKED] = "auth locked",
+        [KIND_AUTH_NO_USER] = "auth no user",
+        [KIND_ADD] = "add",
+        [KIND_REMOVE] = "remove",
+        [KIND_RESET] = "reset",
+};
+
+struct op {
+        double  ts;
+        op_t    op;
+        char    user[REPLAY_USER_LEN];
+};
+
+struct trace {
+        struct op       *ops;
+        size_t          len;
+        size_t          cap;
+};
+
+struct paths {
+        char users[256];
+        char state[256];
+        char snap[256];
+};
+
+static const pin_source_t right_pin = {1, 2, 3, 4};
+static const pin_source_t wrong_pin = {4, 3, 2, 1};
+
+static void trace_push(struct trace *trace, double ts, op_t op, const char *user) {
+        if (trace->len == trace->cap) {
+                trace->cap = trace->cap == 0 ? 1024 : trace->cap * 2;
+                trace->ops = realloc(trace->ops, trace->cap * sizeof(struct op));
+                if (trace->ops == NULL) {
+                        perror("realloc");
+                        exit(1);
+                }
+        }
+        struct op *o = &trace->ops[trace->len++];
+        o->ts = ts;
+        o->op = op;
+        snprintf(o->user, REPLAY_USER_LEN, "%s", user);
+}
+
+static int result_op(const char *result, op_t *op) {
+        if (strcmp(result, "ok") == 0) {
+                *op = OP_AUTH_OK;
+        } else if (strcmp(result, "invalid") == 0 || strcmp(result, "locked") == 0) {
+                *op = OP_AUTH_BAD;
+        } else {
+                // no_user, error and timestamp sessions did not get to the PIN
+                return 0;
+        }
+        return 1;
+}
+
+/*
+ * 2026-10-18T20:50:04.682Z <user> result=<result> ...
+ * 1 if it is an operation, 0 if the line is skipped, -1 if it is not an
+ * audit line.
+ */
+static int parse_audit_line(const char *line, double *ts, char *user, op_t *op) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(struct tm));
+        const char *rest = strptime(line, "%Y-%m-%dT%H:%M:%S", &tm);
+        unsigned ms = 0;
+        char result[16];
+        if (rest == NULL || sscanf(rest, ".%3uZ %63s result=%15s", &ms, user, result) != 3) {
+                return -1;
+        }
+        *ts = timegm(&tm) + ms / 1000.0;
+        return result_op(result, op);
+}
+
+// Oct 18 20:50:04 host sudo: pam_pin(sudo:auth): User <user> authentication: <result>, ...
+static int parse_syslog_line(const char *line, double *ts, char *user, op_t *op) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(struct tm));
+        const char *rest = strptime(line, "%b %d %H:%M:%S", &tm);
+        if (rest == NULL) {
+                return -1;
+        }
+        // other messages of the module and other services
+        const char *msg = strstr(rest, "User ");
+        char result[16];
+        if (msg == NULL ||
+                        sscanf(msg, "User %63s authentication: %15[^,]", user, result) != 2) {
+                return 0;
+        }
+        // no year in the line, it is the same for the whole trace
+        tm.tm_year = 70;
+        *ts = timegm(&tm);
+        return result_op(result, op);
+}
+
+static int parse_trace(FILE *in, struct trace *trace) {
+        char *line = NULL;
+        size_t cap = 0;
+        size_t lineno = 0;
+        while (getline(&line, &cap, in) != -1) {
+                lineno++;
+                if (line[0] == '#' || line[0] == '\n') {
+                        continue;
+                }
+                double ts;
+                char user[REPLAY_USER_LEN], opname[16], result[16] = {0};
+                op_t op;
+                int logged = parse_audit_line(line, &ts, user, &op);
+                if (logged < 0) {
+                        logged = parse_syslog_line(line, &ts, user, &op);
+                }
+                if (logged >= 0) {
+                        if (logged > 0) {
+                                trace_push(trace, ts, op, user);
+                        }
+                        continue;
+                }
+                if (sscanf(line, "%lf %15s %63s %15s", &ts, opname, user, result) < 3) {
+                        fprintf(stderr, "line %zu: invalid operation\n", lineno);
+                        free(line);
+                        return -1;
+                }
+                if (strcmp(opname, "auth") == 0 && strcmp(result, "ok") == 0) {
+                        op = OP_AUTH_OK;
+                } else if (strcmp(opname, "auth") == 0 && strcmp(result, "bad") == 0) {
+                        op = OP_AUTH_BAD;
+                } else if (strcmp(opname, "add") == 0) {
+                        op = OP_ADD;
+                } else if (strcmp(opname, "remove") == 0) {
+                        op = OP_REMOVE;
+                } else if (strcmp(opname, "reset") == 0) {
+                        op = OP_RESET;
+                } else {
+                        fprintf(stderr, "line %zu: unknown operation %s %s\n",
+                                lineno, opname, result);
+                        free(line);
+                        return -1;
+                }
+                trace_push(trace, ts, op, user);
+        }
+        free(line);
+        // audit and hand written traces start at arbitrary times
+        for (size_t i = 1; i < trace->len; i++) {
+                trace->ops[i].ts -= trace->ops[0].ts;
+        }
+        if (trace->len > 0) {
+                trace->ops[0].ts = 0;
+        }
+        return 0;
+}
+
+// a minute of traffic, see the header
+static void builtin_trace(struct trace *trace) {
+        char user[REPLAY_USER_LEN];
+        for (int t = 0; t < 60000; t += 50) {
+                const double ts = t / 1000.0;
+                // three admins, one session every 150ms each
+                if (t % 150 == 0) {
+                        snprintf(user, sizeof(user), "admin%d", t / 150 % 3);
+                        trace_push(trace, ts, t % 900 == 0 ? OP_AUTH_BAD : OP_AUTH_OK, user);
+                }
+                // a lockout burst every 5s, unlocked 2s later
+                if (t % 5000 == 0) {
+                        snprintf(user, sizeof(user), "victim%d", t / 5000);
+                        for (int i = 0; i < 5; i++) {
+                                trace_push(trace, ts + i * 0.01, OP_AUTH_BAD, user);
+                        }
+                }
+                if (t % 5000 == 2000) {
+                        snprintf(user, sizeof(user), "victim%d", t / 5000);
+                        trace_push(trace, ts, OP_RESET, user);
+                        trace_push(trace, ts + 0.01, OP_AUTH_OK, user);
+                }
+                // onboarding and offboarding
+                if (t % 7000 == 3500) {
+                        snprintf(user, sizeof(user), "temp%d", t / 7000);
+                        trace_push(trace, ts, OP_ADD, user);
+                        trace_push(trace, ts + 0.02, OP_AUTH_OK, user);
+                }
+                if (t % 7000 == 6500) {
+                        snprintf(user, sizeof(user), "temp%d", t / 7000);
+                        trace_push(trace, ts, OP_REMOVE, user);
+                }
+        }
+        // pushed slightly out of order, stable by construction otherwise
+        for (size_t i = 1; i < trace->len; i++) {
+                struct op o = trace->ops[i];
+                size_t j = i;
+                while (j > 0 && trace->ops[j - 1].ts > o.ts) {
+                        trace->ops[j] = trace->ops[j - 1];
+                        j--;
+                }
+                trace->ops[j] = o;
+        }
+}
+
+static int find_user(void *ctx, const char *username, user_t *user) {
+        const struct paths *paths = ctx;
+        snapshot_t *snap = NULL;
+        int err = snapshot_open(&snap, paths->users, paths->snap);
+        if (err == 0) {
+                err = snapshot_find(snap, username, user);
+                snapshot_close(snap);
+        }
+        return err;
+}
+
+static int load_attempts(void *ctx, const char *username, uint8_t *attempts) {
+        return pinpam_auth_state_load(((struct paths*)ctx)->state, username, attempts);
+}
+
+static int update_attempts(void *ctx, const char *username, bool valid,
+                           uint8_t *attempts) {
+        return pinpam_auth_state_update(((struct paths*)ctx)->state, username, valid, attempts);
+}
+
+static int auth(struct paths *paths, const struct op *op, kind_t *kind) {
+        const pinpam_auth_io_t io = {
+                .ctx = paths,
+                .find_user = find_user,
+                .load_attempts = load_attempts,
+                .update_attempts = update_attempts,
+        };
+        pinpam_auth_t *session = NULL;
+        pinpam_auth_status_t status;
+        *kind = op->op == OP_AUTH_OK ? KIND_AUTH_OK : KIND_AUTH_BAD;
+        int err = pinpam_auth_begin(&session, op->user, &io, &status);
+        if (err == ERR_AUTH_USER && pinpam_auth_cause(session) == ERR_USERS_USER_NOT_FOUND) {
+                *kind = KIND_AUTH_NO_USER;
+                err = 0;
+        } else if (err == 0 && status == PINPAM_AUTH_LOCKED) {
+                *kind = KIND_AUTH_LOCKED;
+        } else if (err == 0) {
+                err = pinpam_auth_submit(session,
+                                         op->op == OP_AUTH_OK ? right_pin : wrong_pin,
+                                         &status);
+                if (err == 0 && (status == PINPAM_AUTH_OK) != (op->op == OP_AUTH_OK)) {
+                        err = -1;
+                }
+        }
+        pinpam_auth_finish(session);
+        return err;
+}
+
+static int edit(struct paths *paths, const struct op *op) {
+        if (op->op == OP_RESET) {
+                return pinpam_auth_state_save(paths->state, op->user, 0);
+        }
+        users_t *storage = users_new(10);
+        int err = users_load(storage, paths->users);
+        if (err == 0 && op->op == OP_ADD) {
+                pin_hash_t pin_hash;
+                err = hash_pin(right_pin, pin_hash);
+                if (err == 0) {
+                        err = users_update(storage, op->user, pin_hash);
+                }
+        } else if (err == 0) {
+                err = users_remove(storage, op->user);
+        }
+        if (err == 0) {
+                err = users_dump(storage, paths->users);
+        }
+        users_free(storage);
+        return err;
+}
+
+// enroll the trace users which are not added by the trace itself
+static void enroll(const struct trace *trace, size_t filler, const char *path) {
+        pin_hash_t pin_hash;
+        hash_pin(right_pin, pin_hash);
+        users_t *storage = users_new(filler + 16);
+        users_t *seen = users_new(16);
+        for (size_t i = 0; i < filler; i++) {
+                char name[32];
+                snprintf(name, sizeof(name), "user%06zu", i);
+                users_update(storage, name, pin_hash);
+        }
+        for (size_t i = 0; i < trace->len; i++) {
+                const struct op *op = &trace->ops[i];
+                if (users_find(seen, op->user, NULL) == 0) {
+                        continue;
+                }
+                users_update(seen, op->user, pin_hash);
+                if (op->op != OP_ADD) {
+                        users_update(storage, op->user, pin_hash);
+                }
+        }
+        if (users_dump(storage, path) != 0) {
+                fprintf(stderr, "failed to write %s\n", path);
+                exit(1);
+        }
+        users_free(seen);
+        users_free(storage);
+}
+
+static void sleep_until(uint64_t ns) {
+        const uint64_t now = bench_now_ns();
+        if (ns > now) {
+                struct timespec ts = {
+                        .tv_sec = (ns - now) / 1000000000,
+                        .tv_nsec = (ns - now) % 1000000000,
+                };
+                nanosleep(&ts, NULL);
+        }
+}
+
+int main(int argc, char **argv) {
+        double speed = 0;
+        size_t filler = 10000;
+        const char *tracepath = NULL;
+        for (int i = 1; i < argc; i++) {
+                if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+                        speed = strtod(argv[++i], NULL);
+                } else if (strcmp(argv[i], "--users") == 0 && i + 1 < argc) {
+                        filler = strtoul(argv[++i], NULL, 10);
+                } else if (argv[i][0] != '-' || strcmp(argv[i], "-") == 0) {
+                        tracepath = argv[i];
+                } else {
+                        fprintf(stderr, "Usage: %s [--speed S] [--users N] [trace|-]\n", argv[0]);
+                        return 1;
+                }
+        }
+
+        struct trace trace = {0};
+        if (tracepath == NULL) {
+                builtin_trace(&trace);
+        } else {
+                FILE *in = strcmp(tracepath, "-") == 0 ? stdin : fopen(tracepath, "r");
+                if (in == NULL) {
+                        perror(tracepath);
+                        return 1;
+                }
+                int err = parse_trace(in, &trace);
+                if (in != stdin) {
+                        fclose(in);
+                }
+                if (err != 0) {
+                        return 1;
+                }
+        }
+
+        char *dir = bench_tmpdir();
+        struct paths paths;
+        snprintf(paths.users, sizeof(paths.users), "%s/users", dir);
+        snprintf(paths.state, sizeof(paths.state), "%s/state", dir);
+        snprintf(paths.snap, sizeof(paths.snap), "%s/users.snap", dir);
+        enroll(&trace, filler, paths.users);
+
+        uint64_t *samples[KIND_COUNT];
+        size_t counts[KIND_COUNT] = {0};
+        size_t failed[KIND_COUNT] = {0};
+        for (int k = 0; k < KIND_COUNT; k++) {
+                samples[k] = malloc((trace.len + 1) * sizeof(uint64_t));
+                if (samples[k] == NULL) {
+                        perror("malloc");
+                        return 1;
+                }
+        }
+
+        printf("replay: %zu operations, %zu other users, speed %g (0 is max)\n",
+               trace.len, filler, speed);
+        const uint64_t start = bench_now_ns();
+        for (size_t i = 0; i < trace.len; i++) {
+                const struct op *op = &trace.ops[i];
+                uint64_t t0 = bench_now_ns();
+                if (speed > 0) {
+                        // latency includes the wait behind slower operations
+                        const uint64_t due = start + (uint64_t)(op->ts / speed * 1e9);
+                        sleep_until(due);
+                        t0 = due;
+                }
+                kind_t kind;
+                int err;
+                switch (op->op) {
+                        case OP_AUTH_OK:
+                        case OP_AUTH_BAD:
+                                err = auth(&paths, op, &kind);
+                                break;
+                        default:
+                                kind = op->op == OP_ADD ? KIND_ADD :
+                                        op->op == OP_REMOVE ? KIND_REMOVE : KIND_RESET;
+                                err = edit(&paths, op);
+                                break;
+                }
+                samples[kind][counts[kind]++] = bench_now_ns() - t0;
+                if (err != 0) {
+                        failed[kind]++;
+                }
+        }
+        const uint64_t wall = bench_now_ns() - start;
+
+        printf("%-28s n=%-8zu %10.0f op/s\n", "total", trace.len,
+               wall > 0 ? trace.len * 1e9 / wall : 0.0);
+        size_t total_failed = 0;
+        for (int k = 0; k < KIND_COUNT; k++) {
+                if (counts[k] == 0) {
+                        continue;
+                }
+                bench_report(kind_names[k], samples[k], counts[k], wall);
+                if (failed[k] > 0) {
+                        printf("%-28s FAILED=%zu\n", "", failed[k]);
+                        total_failed += failed[k];
+                }
+                free(samples[k]);
+        }
+
+        free(trace.ops);
+        char cmd[300];
+        snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+        if (system(cmd) != 0) {
+                fprintf(stderr, "failed to remove %s\n", dir);
+        }
+        return total_failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * Concurrent authentications: every process looks the user up either
+ * by parsing the users file or through the shared snapshot, then checks
+ * the PIN. Processes are released at once to model a sudo storm.
+ *
+ * Usage: snapshot [users] [processes]
+ */
+#include "bench.h"
+#include "../src/lib/users.h"
+#include "../src/lib/crypt.h"
+#include "../src/lib/snapshot.h"
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+enum { MODE_LOAD, MODE_SNAPSHOT };
+
+static int auth(int mode, const char *srcpath, const char *snappath,
+                const char *username, bool *rebuilt) {
+        user_t *user = user_new();
+        int err;
+        if (mode == MODE_SNAPSHOT) {
+                snapshot_t *snap = NULL;
+                err = snapshot_open(&snap, srcpath, snappath);
+                if (err == 0) {
+                        *rebuilt = snapshot_rebuilt(snap);
+                        err = snapshot_find(snap, username, user);
+                        snapshot_close(snap);
+                }
+        } else {
+                users_t *storage = users_new(10);
+                err = users_load(storage, srcpath);
+                if (err == 0) {
+                        err = users_find(storage, username, user);
+                }
+                users_free(storage);
+        }
+        if (err == 0) {
+                pin_source_t pin = {1, 2, 3, 4};
+                pin_hash_t pin_hash;
+                err = hash_pin(pin, pin_hash);
+                if (err == 0 && !user_check_pin(user, pin_hash)) {
+                        err = -1;
+                }
+        }
+        user_free(user);
+        return err;
+}
+
+static void run(const char *name, int mode, const char *srcpath, const char *snappath,
+                size_t users, size_t procs) {
+        uint64_t *latency = mmap(NULL, procs * sizeof(uint64_t) * 2,
+                                 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        uint64_t *rebuilds = latency + procs;
+        int barrier[2];
+        if (latency == MAP_FAILED || pipe(barrier) != 0) {
+                perror("setup");
+                exit(1);
+        }
+        for (size_t i = 0; i < procs; i++) {
+                pid_t pid = fork();
+                if (pid < 0) {
+                        perror("fork");
+                        exit(1);
+                }
+                if (pid == 0) {
+                        close(barrier[1]);
+                        char c;
+                        if (read(barrier[0], &c, 1) != 1) {
+                                _exit(1);
+                        }
+                        char username[32];
+                        snprintf(username, sizeof(username), "user%zu", (i * 7919) % users);
+                        bool rebuilt = false;
+                        uint64_t start = bench_now_ns();
+                        int err = auth(mode, srcpath, snappath, username, &rebuilt);
+                        latency[i] = bench_now_ns() - start;
+                        rebuilds[i] = rebuilt;
+                        _exit(err == 0 ? 0 : 1);
+                }
+        }
+        close(barrier[0]);
+        uint64_t start = bench_now_ns();
+        char go[256];
+        memset(go, 'x', sizeof(go));
+        for (size_t left = procs; left > 0;) {
+                size_t n = left < sizeof(go) ? left : sizeof(go);
+                if (write(barrier[1], go, n) != (ssize_t)n) {
+                        perror("write");
+                        exit(1);
+                }
+                left -= n;
+        }
+        close(barrier[1]);
+        size_t failed = 0;
+        for (size_t i = 0; i < procs; i++) {
+                int status;
+                wait(&status);
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                        failed++;
+                }
+        }
+        uint64_t wall = bench_now_ns() - start;
+        size_t rebuilt = 0;
+        for (size_t i = 0; i < procs; i++) {
+                rebuilt += rebuilds[i];
+        }
+        bench_report(name, latency, procs, wall);
+        if (mode == MODE_SNAPSHOT) {
+                printf("%-28s rebuilds=%zu\n", "", rebuilt);
+        }
+        if (failed > 0) {
+                printf("%-28s FAILED=%zu\n", "", failed);
+        }
+        munmap(latency, procs * sizeof(uint64_t) * 2);
+}
+
+int main(int argc, char **argv) {
+        size_t users = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000;
+        size_t procs = argc > 2 ? strtoul(argv[2], NULL, 10) : 256;
+
+        char *dir = bench_tmpdir();
+        char srcpath[128], snappath[128];
+        snprintf(srcpath, sizeof(srcpath), "%s/users", dir);
+        snprintf(snappath, sizeof(snappath), "%s/run/users.snap", dir);
+
+        pin_source_t pin = {1, 2, 3, 4};
+        pin_hash_t pin_hash;
+        hash_pin(pin, pin_hash);
+        users_t *storage = users_new(users);
+        for (size_t i = 0; i < users; i++) {
+                char username[32];
+                snprintf(username, sizeof(username), "user%zu", i);
+                users_update(storage, username, pin_hash);
+        }
+        users_dump(storage, srcpath);
+        users_free(storage);
+
+        printf("snapshot: %zu users, %zu concurrent authentications\n", users, procs);
+        run("parse users file", MODE_LOAD, srcpath, snappath, users, procs);
+        run("snapshot (cold, rebuild)", MODE_SNAPSHOT, srcpath, snappath, users, procs);
+        run("snapshot (warm)", MODE_SNAPSHOT, srcpath, snappath, users, procs);
+
+        char cmd[256];
+        snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+        return system(cmd);
+}
@@ -0,0 +1,116 @@
+/*
+ * Size of a users table in the text users file, parsed on the heap by
+ * users_load and in the mapped snapshot, plus the snapshot lookup cost.
+ * Usernames follow the usual directory prefixes so front coding has
+ * something to share.
+ *
+ * Usage: snapsize [users] [lookups]
+ */
+#include "bench.h"
+#include "../src/lib/users.h"
+#include "../src/lib/crypt.h"
+#include "../src/lib/snapshot.h"
+
+#include <malloc.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static const char * const prefixes[] = {"svc-", "adm-", "ext.contractor.", "user."};
+
+static void username(char *name, size_t len, size_t i) {
+        snprintf(name, len, "%s%07zu", prefixes[i % 4], i);
+}
+
+static size_t file_size(const char *path) {
+        struct stat st;
+        return stat(path, &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+// large blocks are mapped, outside the arena
+static size_t heap_used(void) {
+        const struct mallinfo2 mi = mallinfo2();
+        return mi.uordblks + mi.hblkhd;
+}
+
+static void report(const char *name, size_t bytes, size_t nusers) {
+        printf("%-28s %10.1f MiB  %6.1f B/user\n", name,
+               bytes / 1048576.0, (double)bytes / nusers);
+}
+
+int main(int argc, char **argv) {
+        const size_t nusers = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+        const size_t lookups = argc > 2 ? strtoul(argv[2], NULL, 10) : 100000;
+
+        char *dir = bench_tmpdir();
+        char srcpath[256], snappath[256];
+        snprintf(srcpath, sizeof(srcpath), "%s/users", dir);
+        snprintf(snappath, sizeof(snappath), "%s/users.snap", dir);
+
+        const pin_source_t pin = {1, 2, 3, 4};
+        pin_hash_t pin_hash;
+        hash_pin(pin, pin_hash);
+        users_t *users = users_new(nusers);
+        for (size_t i = 0; i < nusers; i++) {
+                char name[32];
+                username(name, sizeof(name), i);
+                users_update(users, name, pin_hash);
+        }
+        if (users_dump(users, srcpath) != 0) {
+                fprintf(stderr, "failed to write %s\n", srcpath);
+                return 1;
+        }
+        users_free(users);
+
+        // heap of the parsed table
+        const size_t before = heap_used();
+        users = users_new(10);
+        if (users_load(users, srcpath) != 0) {
+                fprintf(stderr, "failed to load %s\n", srcpath);
+                return 1;
+        }
+        const size_t heap = heap_used() - before;
+        users_free(users);
+
+        snapshot_t *snap = NULL;
+        if (snapshot_open(&snap, srcpath, snappath) != 0) {
+                fprintf(stderr, "failed to build %s\n", snappath);
+                return 1;
+        }
+        printf("users=%zu lookups=%zu\n", nusers, lookups);
+        report("text file", file_size(srcpath), nusers);
+        report("users_load heap", heap, nusers);
+        report("snapshot file (mapped)", file_size(snappath), nusers);
+
+        uint64_t *samples = malloc(lookups * sizeof(uint64_t));
+        user_t *user = user_new();
+        if (samples == NULL || user == NULL) {
+                perror("malloc");
+                return 1;
+        }
+        size_t failed = 0;
+        const uint64_t start = bench_now_ns();
+        for (size_t i = 0; i < lookups; i++) {
+                char name[32];
+                username(name, sizeof(name), (i * 7919) % nusers);
+                const uint64_t t0 = bench_now_ns();
+                if (snapshot_find(snap, name, user) != 0) {
+                        failed++;
+                }
+                samples[i] = bench_now_ns() - t0;
+        }
+        bench_report("snapshot_find", samples, lookups, bench_now_ns() - start);
+        if (failed > 0) {
+                printf("%-28s %zu of %zu failed\n", "", failed, lookups);
+        }
+
+        user_free(user);
+        free(samples);
+        snapshot_close(snap);
+        unlink(srcpath);
+        unlink(snappath);
+        char lockpath[300];
+        snprintf(lockpath, sizeof(lockpath), "%s.lock", snappath);
+        unlink(lockpath);
+        rmdir(dir);
+        return failed > 0;
+}
@@ -0,0 +1,69 @@
+/*
+ * Time of the status join over a generated users file with an attempts
+ * state entry for every tenth user and a few entries without a user.
+ *
+ * Usage: status [users]
+ */
+#include "bench.h"
+#include "../src/lib/status.h"
+
+#include <unistd.h>
+
+#define HEX "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+
+struct totals {
+        size_t  users;
+        size_t  locked;
+};
+
+static int count(void *ctx, const status_user_t *user) {
+        struct totals *totals = ctx;
+        totals->users++;
+        totals->locked += user->locked;
+        return 0;
+}
+
+int main(int argc, char **argv) {
+        const size_t nusers = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+
+        char *dir = bench_tmpdir();
+        char userspath[256], statepath[256];
+        snprintf(userspath, sizeof(userspath), "%s/users", dir);
+        snprintf(statepath, sizeof(statepath), "%s/state", dir);
+        FILE *users = fopen(userspath, "w");
+        FILE *state = fopen(statepath, "w");
+        if (users == NULL || state == NULL) {
+                perror("fopen");
+                return 1;
+        }
+        for (size_t i = 0; i < nusers; i++) {
+                fprintf(users, "user.%09zu:" HEX "\n", i);
+                if (i % 10 == 0) {
+                        fprintf(state, "user.%09zu:%zu\n", i, i / 10 % 4);
+                }
+                if (i % 1000 == 0) {
+                        fprintf(state, "gone.%09zu:1\n", i);
+                }
+        }
+        fclose(users);
+        fclose(state);
+
+        uint64_t samples[3];
+        struct totals totals;
+        for (int run = 0; run < 3; run++) {
+                totals = (struct totals){0};
+                const uint64_t t0 = bench_now_ns();
+                if (status_run(userspath, statepath, NULL, count, &totals) != 0) {
+                        fprintf(stderr, "status failed\n");
+                        return 1;
+                }
+                samples[run] = bench_now_ns() - t0;
+        }
+        printf("users=%zu rows=%zu locked=%zu\n", nusers, totals.users, totals.locked);
+        bench_report("status_run", samples, 3, samples[0] + samples[1] + samples[2]);
+
+        unlink(userspath);
+        unlink(statepath);
+        rmdir(dir);
+        return 0;
+}
@@ -8,5 +8,11 @@
 
 #define ETC_USERS_PATH "/etc/pinpam/users"
 #define VAR_USERS_PATH "/var/pinpam/users"
+#define VAR_AUDIT_PATH "/var/pinpam/audit"
+#define RUN_SNAPSHOT_PATH "/run/pinpam/users.snap"
+#define RUN_GROUPS_PATH "/run/pinpam/groups.cache"
+#define RUN_TIMESTAMP_PATH "/run/pinpam/ts"
+#define ETC_KDF_PATH "/etc/pinpam/kdf"
+#define ETC_PEPPER_PATH "/etc/pinpam/pepper"
 
 #endif
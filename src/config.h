@@ -16,11 +16,41 @@
 #define VAR_USERS_PATH "/tmp/var-pinmap-users"
 #endif
 
+#ifndef VAR_AUDIT_PATH
+#define VAR_AUDIT_PATH "/tmp/var-pinpam-audit"
+#endif
+
+#ifndef RUN_SNAPSHOT_PATH
+#define RUN_SNAPSHOT_PATH "/tmp/run-pinpam-users.snap"
+#endif
+
+#ifndef RUN_GROUPS_PATH
+#define RUN_GROUPS_PATH "/tmp/run-pinpam-groups.cache"
+#endif
+
+#ifndef RUN_TIMESTAMP_PATH
+#define RUN_TIMESTAMP_PATH "/tmp/run-pinpam-ts"
+#endif
+
+#ifndef ETC_KDF_PATH
+#define ETC_KDF_PATH "/tmp/etc-pinpam-kdf"
+#endif
+
+#ifndef ETC_PEPPER_PATH
+#define ETC_PEPPER_PATH "/tmp/etc-pinpam-pepper"
+#endif
+
 #ifndef BUILD_VERSION
 #define BUILD_VERSION "local"
 #endif
 
 static const char * const srcfile = ETC_USERS_PATH;
 static const char * const varfile = VAR_USERS_PATH;
+static const char * const auditfile = VAR_AUDIT_PATH;
+static const char * const snapfile = RUN_SNAPSHOT_PATH;
+static const char * const groupsfile = RUN_GROUPS_PATH;
+static const char * const tsdir = RUN_TIMESTAMP_PATH;
+static const char * const kdffile = ETC_KDF_PATH;
+static const char * const pepperfile = ETC_PEPPER_PATH;
 
 #endif
@@ -0,0 +1,290 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#include "alloc.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+
+// size of an allocation kept in front of it, keeps max_align_t alignment
+#define ALLOC_HEADER 16
+
+#define ARENA_BLOCK_DEFAULT (64 << 10)
+
+static void* libc_alloc(void *ctx, size_t size) {
+        (void) ctx;
+        return malloc(size);
+}
+
+static void* libc_realloc(void *ctx, void *ptr, size_t size) {
+        (void) ctx;
+        return realloc(ptr, size);
+}
+
+static void libc_free(void *ctx, void *ptr) {
+        (void) ctx;
+        free(ptr);
+}
+
+const alloc_t alloc_libc = {
+        .alloc = libc_alloc,
+        .realloc = libc_realloc,
+        .free = libc_free,
+        .ctx = NULL,
+};
+
+void* alloc_malloc(const alloc_t *a, size_t size) {
+        return a->alloc(a->ctx, size);
+}
+
+void* alloc_calloc(const alloc_t *a, size_t n, size_t size) {
+        if (size != 0 && n > SIZE_MAX / size) {
+                return NULL;
+        }
+        void *ptr = a->alloc(a->ctx, n * size);
+        if (ptr != NULL) {
+                memset(ptr, 0, n * size);
+        }
+        return ptr;
+}
+
+void* alloc_realloc(const alloc_t *a, void *ptr, size_t size) {
+        return a->realloc(a->ctx, ptr, size);
+}
+
+void alloc_free(const alloc_t *a, void *ptr) {
+        if (ptr != NULL) {
+                a->free(a->ctx, ptr);
+        }
+}
+
+char* alloc_strdup(const alloc_t *a, const char *s) {
+        const size_t len = strlen(s) + 1;
+        char *copy = a->alloc(a->ctx, len);
+        if (copy != NULL) {
+                memcpy(copy, s, len);
+        }
+        return copy;
+}
+
+static inline size_t header_size(const void *ptr) {
+        return *(const size_t*)((const char*)ptr - ALLOC_HEADER);
+}
+
+static inline void* header_set(void *base, size_t size) {
+        *(size_t*)base = size;
+        return (char*)base + ALLOC_HEADER;
+}
+
+// arena
+
+struct arena_block {
+        struct arena_block      *next;
+        size_t                  cap;
+        size_t                  used;
+        size_t                  last;   // offset of the last allocation, used - none
+        _Alignas(ALLOC_HEADER) char data[];
+};
+
+struct alloc_arena {
+        alloc_t                 alloc;
+        struct arena_block      *blocks;        // the current one first
+        size_t                  block;
+        size_t                  size;
+};
+
+static void* arena_alloc(void *ctx, size_t size) {
+        alloc_arena_t *arena = ctx;
+        const size_t need = ALLOC_HEADER + (size + ALLOC_HEADER - 1) / ALLOC_HEADER * ALLOC_HEADER;
+        if (need < size) {
+                return NULL;
+        }
+        struct arena_block *block = arena->blocks;
+        if (block == NULL || block->cap - block->used < need) {
+                const size_t cap = need > arena->block ? need : arena->block;
+                block = malloc(sizeof(struct arena_block) + cap);
+                if (block == NULL) {
+                        return NULL;
+                }
+                block->cap = cap;
+                block->used = 0;
+                block->last = 0;
+                // a dedicated block goes behind the current one, which keeps its room
+                if (cap > arena->block && arena->blocks != NULL) {
+                        block->next = arena->blocks->next;
+                        arena->blocks->next = block;
+                } else {
+                        block->next = arena->blocks;
+                        arena->blocks = block;
+                }
+                arena->size += cap;
+        }
+        block->last = block->used;
+        block->used += need;
+        return header_set(block->data + block->last, size);
+}
+
+// the allocation is the last one of the current block
+static bool arena_is_last(alloc_arena_t *arena, void *ptr) {
+        struct arena_block *block = arena->blocks;
+        return block != NULL && block->last < block->used &&
+                (char*)ptr == block->data + block->last + ALLOC_HEADER;
+}
+
+static void* arena_realloc(void *ctx, void *ptr, size_t size) {
+        alloc_arena_t *arena = ctx;
+        if (ptr == NULL) {
+                return arena_alloc(ctx, size);
+        }
+        const size_t old = header_size(ptr);
+        if (arena_is_last(arena, ptr)) {
+                struct arena_block *block = arena->blocks;
+                const size_t need = ALLOC_HEADER +
+                        (size + ALLOC_HEADER - 1) / ALLOC_HEADER * ALLOC_HEADER;
+                if (need >= size && block->cap - block->last >= need) {
+                        block->used = block->last + need;
+                        return header_set(block->data + block->last, size);
+                }
+        }
+        void *copy = arena_alloc(ctx, size);
+        if (copy != NULL) {
+                memcpy(copy, ptr, old < size ? old : size);
+        }
+        return copy;
+}
+
+static void arena_free(void *ctx, void *ptr) {
+        alloc_arena_t *arena = ctx;
+        if (arena_is_last(arena, ptr)) {
+                arena->blocks->used = arena->blocks->last;
+        }
+}
+
+alloc_arena_t* alloc_arena_new(size_t block) {
+        alloc_arena_t *arena = malloc(sizeof(alloc_arena_t));
+        if (arena == NULL) {
+                return NULL;
+        }
+        arena->alloc.alloc = arena_alloc;
+        arena->alloc.realloc = arena_realloc;
+        arena->alloc.free = arena_free;
+        arena->alloc.ctx = arena;
+        arena->blocks = NULL;
+        arena->block = block > 0 ? block : ARENA_BLOCK_DEFAULT;
+        arena->size = 0;
+        return arena;
+}
+
+const alloc_t* alloc_arena(alloc_arena_t *arena) {
+        return &arena->alloc;
+}
+
+size_t alloc_arena_size(const alloc_arena_t *arena) {
+        return arena->size;
+}
+
+void alloc_arena_free(alloc_arena_t *arena) {
+        if (arena == NULL) {
+                return;
+        }
+        while (arena->blocks != NULL) {
+                struct arena_block *next = arena->blocks->next;
+                free(arena->blocks);
+                arena->blocks = next;
+        }
+        free(arena);
+}
+
+// counter
+
+struct alloc_counter {
+        alloc_t                 alloc;
+        const alloc_t           *parent;
+        alloc_stats_t           stats;
+};
+
+static void counter_live(alloc_counter_t *counter, size_t freed, size_t added) {
+        counter->stats.live = counter->stats.live - freed + added;
+        if (counter->stats.live > counter->stats.peak) {
+                counter->stats.peak = counter->stats.live;
+        }
+}
+
+static void* counter_alloc(void *ctx, size_t size) {
+        alloc_counter_t *counter = ctx;
+        if (size > SIZE_MAX - ALLOC_HEADER) {
+                return NULL;
+        }
+        void *base = alloc_malloc(counter->parent, ALLOC_HEADER + size);
+        if (base == NULL) {
+                return NULL;
+        }
+        counter->stats.allocs++;
+        counter->stats.bytes += size;
+        counter_live(counter, 0, size);
+        return header_set(base, size);
+}
+
+static void* counter_realloc(void *ctx, void *ptr, size_t size) {
+        alloc_counter_t *counter = ctx;
+        if (ptr == NULL) {
+                return counter_alloc(ctx, size);
+        }
+        if (size > SIZE_MAX - ALLOC_HEADER) {
+                return NULL;
+        }
+        const size_t old = header_size(ptr);
+        void *base = alloc_realloc(counter->parent, (char*)ptr - ALLOC_HEADER,
+                                   ALLOC_HEADER + size);
+        if (base == NULL) {
+                return NULL;
+        }
+        counter->stats.reallocs++;
+        counter->stats.bytes += size;
+        counter_live(counter, old, size);
+        return header_set(base, size);
+}
+
+static void counter_free(void *ctx, void *ptr) {
+        alloc_counter_t *counter = ctx;
+        counter->stats.frees++;
+        counter_live(counter, header_size(ptr), 0);
+        alloc_free(counter->parent, (char*)ptr - ALLOC_HEADER);
+}
+
+alloc_counter_t* alloc_counter_new(const alloc_t *parent) {
+        alloc_counter_t *counter = malloc(sizeof(alloc_counter_t));
+        if (counter == NULL) {
+                return NULL;
+        }
+        counter->alloc.alloc = counter_alloc;
+        counter->alloc.realloc = counter_realloc;
+        counter->alloc.free = counter_free;
+        counter->alloc.ctx = counter;
+        counter->parent = parent != NULL ? parent : &alloc_libc;
+        memset(&counter->stats, 0, sizeof(alloc_stats_t));
+        return counter;
+}
+
+const alloc_t* alloc_counter(alloc_counter_t *counter) {
+        return &counter->alloc;
+}
+
+void alloc_counter_stats(const alloc_counter_t *counter, alloc_stats_t *stats) {
+        *stats = counter->stats;
+}
+
+void alloc_counter_reset(alloc_counter_t *counter) {
+        const size_t live = counter->stats.live;
+        memset(&counter->stats, 0, sizeof(alloc_stats_t));
+        counter->stats.live = live;
+        counter->stats.peak = live;
+}
+
+void alloc_counter_free(alloc_counter_t *counter) {
+        free(counter);
+}
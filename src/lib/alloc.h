@@ -0,0 +1,87 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#ifndef _ALLOC_H
+#define _ALLOC_H
+
+#include <stddef.h>
+
+/*
+ * Allocator of the memory a users table, a state or a hash map keeps:
+ * the structure, its arrays and the usernames. Buffers that do not
+ * outlive a call and the user_t copies handed to the caller use libc.
+ *
+ * An allocator is borrowed, it must outlive the tables made with it, and
+ * is called from one thread at a time as the tables are. NULL selects
+ * alloc_libc wherever an allocator is accepted.
+ */
+typedef struct alloc {
+        void*   (*alloc)(void *ctx, size_t size);
+        // NULL ptr allocates
+        void*   (*realloc)(void *ctx, void *ptr, size_t size);
+        // NULL ptr does nothing
+        void    (*free)(void *ctx, void *ptr);
+        void    *ctx;
+} alloc_t;
+
+extern const alloc_t alloc_libc __attribute__((visibility("hidden")));
+
+void* alloc_malloc(const alloc_t *a, size_t size);
+
+// zeroed, NULL on overflow
+void* alloc_calloc(const alloc_t *a, size_t n, size_t size);
+
+void* alloc_realloc(const alloc_t *a, void *ptr, size_t size);
+
+void alloc_free(const alloc_t *a, void *ptr);
+
+char* alloc_strdup(const alloc_t *a, const char *s);
+
+/*
+ * Bump arena: allocations are carved from blocks in order and free gives
+ * back only the last one, all of them go with the arena. A realloc of the
+ * last allocation grows in place while the block has room. It suits
+ * tables built once and dropped as a whole.
+ */
+typedef struct alloc_arena alloc_arena_t;
+
+// block - bytes of a block, 0 - 64 KiB.
+alloc_arena_t* alloc_arena_new(size_t block);
+
+const alloc_t* alloc_arena(alloc_arena_t *arena);
+
+// bytes of the blocks
+size_t alloc_arena_size(const alloc_arena_t *arena);
+
+void alloc_arena_free(alloc_arena_t *arena);
+
+/*
+ * Counting allocator: forwards to a parent allocator and counts calls
+ * and bytes, tests and benchmarks assert them per operation.
+ */
+typedef struct alloc_counter alloc_counter_t;
+
+typedef struct alloc_stats {
+        size_t  allocs;         // allocations, a realloc of NULL included
+        size_t  reallocs;
+        size_t  frees;
+        size_t  bytes;          // requested by allocations and reallocs
+        size_t  live;           // bytes not freed
+        size_t  peak;           // highest live
+} alloc_stats_t;
+
+// parent NULL - alloc_libc.
+alloc_counter_t* alloc_counter_new(const alloc_t *parent);
+
+const alloc_t* alloc_counter(alloc_counter_t *counter);
+
+void alloc_counter_stats(const alloc_counter_t *counter, alloc_stats_t *stats);
+
+// zero the counts, live bytes stay
+void alloc_counter_reset(alloc_counter_t *counter);
+
+void alloc_counter_free(alloc_counter_t *counter);
+
+#endif
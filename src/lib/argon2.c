@@ -0,0 +1,445 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#include "argon2.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARGON2_VERSION 0x13
+#define ARGON2_TYPE_ID 2
+#define ARGON2_BLOCK_SIZE 1024
+#define ARGON2_QWORDS_IN_BLOCK (ARGON2_BLOCK_SIZE / 8)
+#define ARGON2_ADDRESSES_IN_BLOCK 128
+#define ARGON2_SYNC_POINTS 4
+#define ARGON2_PREHASH_LEN 64
+
+// blake2b
+
+#define BLAKE2B_BLOCKBYTES 128
+
+typedef struct blake2b_state {
+        uint64_t        h[8];
+        uint64_t        t[2];
+        uint8_t         buf[BLAKE2B_BLOCKBYTES];
+        size_t          buflen;
+        size_t          outlen;
+} blake2b_state_t;
+
+static const uint64_t blake2b_iv[8] = {
+        0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+        0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+        0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+        0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+};
+
+static const uint8_t blake2b_sigma[12][16] = {
+        { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+        { 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+        { 11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4 },
+        { 7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8 },
+        { 9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13 },
+        { 2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9 },
+        { 12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11 },
+        { 13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10 },
+        { 6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5 },
+        { 10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0 },
+        { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+        { 14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3 },
+};
+
+static inline uint64_t rotr64(uint64_t x, unsigned n) {
+        return (x >> n) | (x << (64 - n));
+}
+
+static inline uint64_t load64(const uint8_t *p) {
+        uint64_t v = 0;
+        for (int i = 7; i >= 0; i--) {
+                v = (v << 8) | p[i];
+        }
+        return v;
+}
+
+static inline void store64(uint8_t *p, uint64_t v) {
+        for (int i = 0; i < 8; i++) {
+                p[i] = (uint8_t)(v >> (8 * i));
+        }
+}
+
+static inline void store32(uint8_t *p, uint32_t v) {
+        for (int i = 0; i < 4; i++) {
+                p[i] = (uint8_t)(v >> (8 * i));
+        }
+}
+
+#define B2B_G(a, b, c, d, x, y) do { \
+        a = a + b + x; d = rotr64(d ^ a, 32); \
+        c = c + d;     b = rotr64(b ^ c, 24); \
+        a = a + b + y; d = rotr64(d ^ a, 16); \
+        c = c + d;     b = rotr64(b ^ c, 63); \
+} while (0)
+
+static void blake2b_compress(blake2b_state_t *s, const uint8_t *block, int last);
+
+static void blake2b_init(blake2b_state_t *s, size_t outlen) {
+        memset(s, 0, sizeof(blake2b_state_t));
+        for (int i = 0; i < 8; i++) {
+                s->h[i] = blake2b_iv[i];
+        }
+        // parameter block: digest length, no key, fanout 1, depth 1
+        s->h[0] ^= 0x01010000ULL ^ outlen;
+        s->outlen = outlen;
+}
+
+static void blake2b_update(blake2b_state_t *s, const void *in, size_t inlen) {
+        const uint8_t *p = in;
+        while (inlen > 0) {
+                // keep the last block buffered, it's compressed with the final flag
+                if (s->buflen == BLAKE2B_BLOCKBYTES) {
+                        s->t[0] += BLAKE2B_BLOCKBYTES;
+                        if (s->t[0] < BLAKE2B_BLOCKBYTES) {
+                                s->t[1]++;
+                        }
+                        blake2b_compress(s, s->buf, 0);
+                        s->buflen = 0;
+                }
+                size_t n = BLAKE2B_BLOCKBYTES - s->buflen;
+                if (n > inlen) {
+                        n = inlen;
+                }
+                memcpy(s->buf + s->buflen, p, n);
+                s->buflen += n;
+                p += n;
+                inlen -= n;
+        }
+}
+
+static void blake2b_final(blake2b_state_t *s, uint8_t *out) {
+        s->t[0] += s->buflen;
+        if (s->t[0] < s->buflen) {
+                s->t[1]++;
+        }
+        memset(s->buf + s->buflen, 0, BLAKE2B_BLOCKBYTES - s->buflen);
+        blake2b_compress(s, s->buf, 1);
+        uint8_t digest[BLAKE2B_OUTBYTES];
+        for (int i = 0; i < 8; i++) {
+                store64(digest + 8 * i, s->h[i]);
+        }
+        memcpy(out, digest, s->outlen);
+        memset(digest, 0, sizeof(digest));
+        memset(s, 0, sizeof(blake2b_state_t));
+}
+
+static void blake2b_compress(blake2b_state_t *s, const uint8_t *block, int last) {
+        uint64_t m[16];
+        uint64_t v[16];
+        for (int i = 0; i < 16; i++) {
+                m[i] = load64(block + 8 * i);
+        }
+        for (int i = 0; i < 8; i++) {
+                v[i] = s->h[i];
+                v[i + 8] = blake2b_iv[i];
+        }
+        v[12] ^= s->t[0];
+        v[13] ^= s->t[1];
+        if (last) {
+                v[14] = ~v[14];
+        }
+        for (int r = 0; r < 12; r++) {
+                const uint8_t *sg = blake2b_sigma[r];
+                B2B_G(v[0], v[4], v[8],  v[12], m[sg[0]],  m[sg[1]]);
+                B2B_G(v[1], v[5], v[9],  v[13], m[sg[2]],  m[sg[3]]);
+                B2B_G(v[2], v[6], v[10], v[14], m[sg[4]],  m[sg[5]]);
+                B2B_G(v[3], v[7], v[11], v[15], m[sg[6]],  m[sg[7]]);
+                B2B_G(v[0], v[5], v[10], v[15], m[sg[8]],  m[sg[9]]);
+                B2B_G(v[1], v[6], v[11], v[12], m[sg[10]], m[sg[11]]);
+                B2B_G(v[2], v[7], v[8],  v[13], m[sg[12]], m[sg[13]]);
+                B2B_G(v[3], v[4], v[9],  v[14], m[sg[14]], m[sg[15]]);
+        }
+        for (int i = 0; i < 8; i++) {
+                s->h[i] ^= v[i] ^ v[i + 8];
+        }
+}
+
+void blake2b(uint8_t *out, size_t outlen, const void *in, size_t inlen) {
+        blake2b_state_t s;
+        blake2b_init(&s, outlen);
+        blake2b_update(&s, in, inlen);
+        blake2b_final(&s, out);
+}
+
+// argon2
+
+typedef struct block {
+        uint64_t v[ARGON2_QWORDS_IN_BLOCK];
+} block_t;
+
+typedef struct instance {
+        block_t         *memory;
+        uint32_t        passes;
+        uint32_t        lanes;
+        uint32_t        memory_blocks;  // m'
+        uint32_t        lane_length;    // q
+        uint32_t        segment_length;
+} instance_t;
+
+typedef struct position {
+        uint32_t pass;
+        uint32_t lane;
+        uint32_t slice;
+        uint32_t index;
+} position_t;
+
+// variable length hash H' built from BLAKE2b
+static void blake2b_long(uint8_t *out, uint32_t outlen, const void *in, size_t inlen) {
+        uint8_t prefix[4];
+        store32(prefix, outlen);
+        blake2b_state_t s;
+        if (outlen <= BLAKE2B_OUTBYTES) {
+                blake2b_init(&s, outlen);
+                blake2b_update(&s, prefix, sizeof(prefix));
+                blake2b_update(&s, in, inlen);
+                blake2b_final(&s, out);
+                return;
+        }
+        uint8_t v[BLAKE2B_OUTBYTES];
+        blake2b_init(&s, BLAKE2B_OUTBYTES);
+        blake2b_update(&s, prefix, sizeof(prefix));
+        blake2b_update(&s, in, inlen);
+        blake2b_final(&s, v);
+        memcpy(out, v, BLAKE2B_OUTBYTES / 2);
+        out += BLAKE2B_OUTBYTES / 2;
+        uint32_t left = outlen - BLAKE2B_OUTBYTES / 2;
+        while (left > BLAKE2B_OUTBYTES) {
+                blake2b(v, BLAKE2B_OUTBYTES, v, BLAKE2B_OUTBYTES);
+                memcpy(out, v, BLAKE2B_OUTBYTES / 2);
+                out += BLAKE2B_OUTBYTES / 2;
+                left -= BLAKE2B_OUTBYTES / 2;
+        }
+        blake2b(v, left, v, BLAKE2B_OUTBYTES);
+        memcpy(out, v, left);
+        memset(v, 0, sizeof(v));
+}
+
+static inline uint64_t fblamka(uint64_t x, uint64_t y) {
+        const uint64_t m = 0xFFFFFFFFULL;
+        return x + y + 2 * ((x & m) * (y & m));
+}
+
+#define BLAMKA_G(a, b, c, d) do { \
+        a = fblamka(a, b); d = rotr64(d ^ a, 32); \
+        c = fblamka(c, d); b = rotr64(b ^ c, 24); \
+        a = fblamka(a, b); d = rotr64(d ^ a, 16); \
+        c = fblamka(c, d); b = rotr64(b ^ c, 63); \
+} while (0)
+
+#define BLAMKA_ROUND(v0, v1, v2, v3, v4, v5, v6, v7, \
+                     v8, v9, v10, v11, v12, v13, v14, v15) do { \
+        BLAMKA_G(v0, v4, v8, v12); \
+        BLAMKA_G(v1, v5, v9, v13); \
+        BLAMKA_G(v2, v6, v10, v14); \
+        BLAMKA_G(v3, v7, v11, v15); \
+        BLAMKA_G(v0, v5, v10, v15); \
+        BLAMKA_G(v1, v6, v11, v12); \
+        BLAMKA_G(v2, v7, v8, v13); \
+        BLAMKA_G(v3, v4, v9, v14); \
+} while (0)
+
+// compression function G, next = G(prev, ref) [^ next]
+static void fill_block(const block_t *prev, const block_t *ref, block_t *next, int with_xor) {
+        block_t r, tmp;
+        for (int i = 0; i < ARGON2_QWORDS_IN_BLOCK; i++) {
+                r.v[i] = prev->v[i] ^ ref->v[i];
+                tmp.v[i] = with_xor ? r.v[i] ^ next->v[i] : r.v[i];
+        }
+        uint64_t *v = r.v;
+        for (int i = 0; i < 8; i++) {
+                uint64_t *p = v + 16 * i;
+                BLAMKA_ROUND(p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7],
+                             p[8], p[9], p[10], p[11], p[12], p[13], p[14], p[15]);
+        }
+        for (int i = 0; i < 8; i++) {
+                uint64_t *p = v + 2 * i;
+                BLAMKA_ROUND(p[0], p[1], p[16], p[17], p[32], p[33], p[48], p[49],
+                             p[64], p[65], p[80], p[81], p[96], p[97], p[112], p[113]);
+        }
+        for (int i = 0; i < ARGON2_QWORDS_IN_BLOCK; i++) {
+                next->v[i] = tmp.v[i] ^ r.v[i];
+        }
+}
+
+static void next_addresses(block_t *address, block_t *input, const block_t *zero) {
+        input->v[6]++;
+        fill_block(zero, input, address, 0);
+        fill_block(zero, address, address, 0);
+}
+
+static uint32_t index_alpha(const instance_t *inst, const position_t *pos,
+                            uint32_t pseudo_rand, int same_lane) {
+        uint32_t area;
+        if (pos->pass == 0) {
+                if (pos->slice == 0) {
+                        area = pos->index - 1;
+                } else if (same_lane) {
+                        area = pos->slice * inst->segment_length + pos->index - 1;
+                } else {
+                        area = pos->slice * inst->segment_length +
+                                (pos->index == 0 ? -1 : 0);
+                }
+        } else {
+                if (same_lane) {
+                        area = inst->lane_length - inst->segment_length + pos->index - 1;
+                } else {
+                        area = inst->lane_length - inst->segment_length +
+                                (pos->index == 0 ? -1 : 0);
+                }
+        }
+        uint64_t rel = pseudo_rand;
+        rel = (rel * rel) >> 32;
+        rel = area - 1 - ((area * rel) >> 32);
+        uint32_t start = 0;
+        if (pos->pass != 0) {
+                start = pos->slice == ARGON2_SYNC_POINTS - 1 ?
+                        0 : (pos->slice + 1) * inst->segment_length;
+        }
+        return (uint32_t)((start + rel) % inst->lane_length);
+}
+
+static void fill_segment(const instance_t *inst, position_t pos) {
+        block_t address, input, zero;
+        // argon2id: data independent addressing for the first half of the first pass
+        const int independent = pos.pass == 0 && pos.slice < ARGON2_SYNC_POINTS / 2;
+        if (independent) {
+                memset(&zero, 0, sizeof(block_t));
+                memset(&input, 0, sizeof(block_t));
+                input.v[0] = pos.pass;
+                input.v[1] = pos.lane;
+                input.v[2] = pos.slice;
+                input.v[3] = inst->memory_blocks;
+                input.v[4] = inst->passes;
+                input.v[5] = ARGON2_TYPE_ID;
+        }
+        uint32_t start = 0;
+        if (pos.pass == 0 && pos.slice == 0) {
+                start = 2;
+                if (independent) {
+                        next_addresses(&address, &input, &zero);
+                }
+        }
+        uint32_t curr = pos.lane * inst->lane_length +
+                pos.slice * inst->segment_length + start;
+        uint32_t prev = curr % inst->lane_length == 0 ?
+                curr + inst->lane_length - 1 : curr - 1;
+        for (uint32_t i = start; i < inst->segment_length; i++, curr++, prev++) {
+                if (curr % inst->lane_length == 1) {
+                        prev = curr - 1;
+                }
+                uint64_t pseudo_rand;
+                if (independent) {
+                        if (i % ARGON2_ADDRESSES_IN_BLOCK == 0) {
+                                next_addresses(&address, &input, &zero);
+                        }
+                        pseudo_rand = address.v[i % ARGON2_ADDRESSES_IN_BLOCK];
+                } else {
+                        pseudo_rand = inst->memory[prev].v[0];
+                }
+                uint32_t ref_lane = (uint32_t)((pseudo_rand >> 32) % inst->lanes);
+                if (pos.pass == 0 && pos.slice == 0) {
+                        ref_lane = pos.lane;
+                }
+                pos.index = i;
+                uint32_t ref_index = index_alpha(inst, &pos, (uint32_t)pseudo_rand,
+                                                 ref_lane == pos.lane);
+                const block_t *ref = &inst->memory[inst->lane_length * ref_lane + ref_index];
+                fill_block(&inst->memory[prev], ref, &inst->memory[curr], pos.pass != 0);
+        }
+}
+
+int argon2id(const argon2_input_t *in, uint8_t *out, size_t outlen) {
+        if (in->lanes == 0 || in->lanes > 0xFFFFFF || in->passes == 0 ||
+                        in->memory < 8 * in->lanes || outlen < 4 || outlen > UINT32_MAX) {
+                return ERR_ARGON2_PARAMS;
+        }
+        instance_t inst;
+        inst.passes = in->passes;
+        inst.lanes = in->lanes;
+        inst.segment_length = in->memory / (in->lanes * ARGON2_SYNC_POINTS);
+        inst.lane_length = inst.segment_length * ARGON2_SYNC_POINTS;
+        inst.memory_blocks = inst.lane_length * in->lanes;
+        inst.memory = malloc((size_t)inst.memory_blocks * sizeof(block_t));
+        if (inst.memory == NULL) {
+                return ERR_ARGON2_MEMORY;
+        }
+
+        // H0
+        uint8_t h0[ARGON2_PREHASH_LEN + 8];
+        uint8_t le[4];
+        blake2b_state_t s;
+        blake2b_init(&s, ARGON2_PREHASH_LEN);
+        const uint32_t header[] = {
+                in->lanes, (uint32_t)outlen, in->memory, in->passes,
+                ARGON2_VERSION, ARGON2_TYPE_ID,
+        };
+        for (size_t i = 0; i < sizeof(header) / sizeof(header[0]); i++) {
+                store32(le, header[i]);
+                blake2b_update(&s, le, sizeof(le));
+        }
+        const struct { const uint8_t *p; size_t len; } fields[] = {
+                { in->pwd, in->pwdlen },
+                { in->salt, in->saltlen },
+                { in->secret, in->secretlen },
+                { in->ad, in->adlen },
+        };
+        for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+                store32(le, (uint32_t)fields[i].len);
+                blake2b_update(&s, le, sizeof(le));
+                if (fields[i].len > 0) {
+                        blake2b_update(&s, fields[i].p, fields[i].len);
+                }
+        }
+        blake2b_final(&s, h0);
+
+        // first two blocks of each lane
+        uint8_t bytes[ARGON2_BLOCK_SIZE];
+        for (uint32_t l = 0; l < inst.lanes; l++) {
+                for (uint32_t j = 0; j < 2; j++) {
+                        store32(h0 + ARGON2_PREHASH_LEN, j);
+                        store32(h0 + ARGON2_PREHASH_LEN + 4, l);
+                        blake2b_long(bytes, ARGON2_BLOCK_SIZE, h0, sizeof(h0));
+                        block_t *b = &inst.memory[l * inst.lane_length + j];
+                        for (int k = 0; k < ARGON2_QWORDS_IN_BLOCK; k++) {
+                                b->v[k] = load64(bytes + 8 * k);
+                        }
+                }
+        }
+
+        for (uint32_t pass = 0; pass < inst.passes; pass++) {
+                for (uint32_t slice = 0; slice < ARGON2_SYNC_POINTS; slice++) {
+                        for (uint32_t lane = 0; lane < inst.lanes; lane++) {
+                                position_t pos = { pass, lane, slice, 0 };
+                                fill_segment(&inst, pos);
+                        }
+                }
+        }
+
+        // xor of the last blocks of all lanes
+        block_t final = inst.memory[inst.lane_length - 1];
+        for (uint32_t l = 1; l < inst.lanes; l++) {
+                const block_t *last = &inst.memory[l * inst.lane_length + inst.lane_length - 1];
+                for (int k = 0; k < ARGON2_QWORDS_IN_BLOCK; k++) {
+                        final.v[k] ^= last->v[k];
+                }
+        }
+        for (int k = 0; k < ARGON2_QWORDS_IN_BLOCK; k++) {
+                store64(bytes + 8 * k, final.v[k]);
+        }
+        blake2b_long(out, (uint32_t)outlen, bytes, ARGON2_BLOCK_SIZE);
+
+        memset(bytes, 0, sizeof(bytes));
+        memset(h0, 0, sizeof(h0));
+        memset(inst.memory, 0, (size_t)inst.memory_blocks * sizeof(block_t));
+        free(inst.memory);
+        return 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#ifndef _ARGON2_H
+#define _ARGON2_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Argon2id (RFC 9106, version 0x13) and the BLAKE2b hash it is built on.
+ */
+
+#define BLAKE2B_OUTBYTES 64
+
+enum {
+        ERR_ARGON2_PARAMS = 1,
+        ERR_ARGON2_MEMORY,
+};
+
+typedef struct argon2_input {
+        const uint8_t   *pwd;
+        size_t          pwdlen;
+        const uint8_t   *salt;
+        size_t          saltlen;
+        const uint8_t   *secret;        // optional key K
+        size_t          secretlen;
+        const uint8_t   *ad;            // optional associated data X
+        size_t          adlen;
+
+        uint32_t        passes;         // t
+        uint32_t        memory;         // m, KiB
+        uint32_t        lanes;          // p
+} argon2_input_t;
+
+int argon2id(const argon2_input_t *in, uint8_t *out, size_t outlen);
+
+// BLAKE2b with 1..64 bytes output and no key.
+void blake2b(uint8_t *out, size_t outlen, const void *in, size_t inlen);
+
+#endif
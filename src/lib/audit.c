@@ -0,0 +1,233 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#define _GNU_SOURCE
+#include "audit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define AUDIT_MAGIC "PPAUDIT1"
+#define AUDIT_MAGIC_LEN 8
+
+struct audit_header {
+        char                    magic[AUDIT_MAGIC_LEN];
+        uint32_t                capacity;
+        uint32_t                slot_size;
+        _Atomic uint64_t        head;           // next sequence
+        uint8_t                 _reserved[40];
+};
+
+// one cache line per record
+struct audit_slot {
+        _Atomic uint64_t        seq;            // sequence + 1, 0 while written
+        uint64_t                time_ns;
+        uint32_t                uid;
+        uint32_t                pid;
+        uint32_t                lookup_us;
+        uint32_t                prompt_us;
+        uint32_t                verify_us;
+        uint32_t                save_us;
+        uint8_t                 result;
+        uint8_t                 attempts;
+        char                    user[AUDIT_USER_LEN];   // not NUL terminated
+};
+
+_Static_assert(sizeof(struct audit_header) == 64, "audit header is one cache line");
+_Static_assert(sizeof(struct audit_slot) == 64, "audit slot is one cache line");
+
+#define AUDIT_SIZE (sizeof(struct audit_header) + AUDIT_CAPACITY * sizeof(struct audit_slot))
+
+struct audit {
+        void                    *base;
+        struct audit_header     *header;
+        struct audit_slot       *slots;
+        bool                    writable;
+};
+
+static const char * const result_names[] = {
+        [AUDIT_RESULT_OK] = "ok",
+        [AUDIT_RESULT_INVALID] = "invalid",
+        [AUDIT_RESULT_LOCKED] = "locked",
+        [AUDIT_RESULT_NO_USER] = "no-user",
+        [AUDIT_RESULT_ERROR] = "error",
+        [AUDIT_RESULT_TIMESTAMP] = "timestamp",
+};
+
+static int audit_init(int fd);
+
+int audit_open(audit_t **log, const char *path, bool writable) {
+        int fd = open(path, writable ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDONLY | O_CLOEXEC, 0600);
+        if (fd < 0) {
+                return ERR_AUDIT_OPEN;
+        }
+        int err = 0;
+        // the creator initializes the file under an exclusive lock
+        if (flock(fd, writable ? LOCK_EX : LOCK_SH) != 0) {
+                err = ERR_AUDIT_LOCK;
+                goto AUDIT_OPEN_RET;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+                err = ERR_AUDIT_OPEN;
+                goto AUDIT_OPEN_UNLOCK;
+        }
+        if (st.st_size == 0 && writable) {
+                err = audit_init(fd);
+                if (err != 0) {
+                        goto AUDIT_OPEN_UNLOCK;
+                }
+        } else if ((size_t)st.st_size != AUDIT_SIZE) {
+                err = ERR_AUDIT_INVALID;
+                goto AUDIT_OPEN_UNLOCK;
+        }
+
+        void *base = mmap(NULL, AUDIT_SIZE, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                          MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+                err = ERR_AUDIT_MAP;
+                goto AUDIT_OPEN_UNLOCK;
+        }
+        struct audit_header *header = base;
+        if (memcmp(header->magic, AUDIT_MAGIC, AUDIT_MAGIC_LEN) != 0 ||
+                        header->capacity != AUDIT_CAPACITY ||
+                        header->slot_size != sizeof(struct audit_slot)) {
+                munmap(base, AUDIT_SIZE);
+                err = ERR_AUDIT_INVALID;
+                goto AUDIT_OPEN_UNLOCK;
+        }
+        audit_t *l = malloc(sizeof(audit_t));
+        if (l == NULL) {
+                munmap(base, AUDIT_SIZE);
+                err = -1;
+                goto AUDIT_OPEN_UNLOCK;
+        }
+        l->base = base;
+        l->header = header;
+        l->slots = (struct audit_slot*)(header + 1);
+        l->writable = writable;
+        *log = l;
+
+AUDIT_OPEN_UNLOCK:
+        flock(fd, LOCK_UN);
+AUDIT_OPEN_RET:
+        close(fd);
+        return err;
+}
+
+int audit_append(audit_t *log, audit_event_t *event) {
+        if (!log->writable) {
+                return ERR_AUDIT_READONLY;
+        }
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        event->time_ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+        event->seq = atomic_fetch_add_explicit(&log->header->head, 1, memory_order_relaxed);
+
+        struct audit_slot *slot = &log->slots[event->seq % AUDIT_CAPACITY];
+        // readers of the previous record in the slot see it changing
+        atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        slot->time_ns = event->time_ns;
+        slot->uid = event->uid;
+        slot->pid = event->pid;
+        slot->lookup_us = event->lookup_us;
+        slot->prompt_us = event->prompt_us;
+        slot->verify_us = event->verify_us;
+        slot->save_us = event->save_us;
+        slot->result = event->result;
+        slot->attempts = event->attempts;
+        strncpy(slot->user, event->user, AUDIT_USER_LEN);
+        atomic_store_explicit(&slot->seq, event->seq + 1, memory_order_release);
+        return 0;
+}
+
+uint64_t audit_head(const audit_t *log) {
+        return atomic_load_explicit(&log->header->head, memory_order_acquire);
+}
+
+uint64_t audit_tail(const audit_t *log) {
+        const uint64_t head = audit_head(log);
+        return head > AUDIT_CAPACITY ? head - AUDIT_CAPACITY : 0;
+}
+
+int audit_read(const audit_t *log, uint64_t seq, audit_event_t *event) {
+        if (seq < audit_tail(log)) {
+                return ERR_AUDIT_OVERWRITTEN;
+        }
+        const struct audit_slot *slot = &log->slots[seq % AUDIT_CAPACITY];
+        const uint64_t before = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (before != seq + 1) {
+                return before > seq + 1 ? ERR_AUDIT_OVERWRITTEN : ERR_AUDIT_PENDING;
+        }
+        memset(event, 0, sizeof(audit_event_t));
+        event->seq = seq;
+        event->time_ns = slot->time_ns;
+        event->uid = slot->uid;
+        event->pid = slot->pid;
+        event->lookup_us = slot->lookup_us;
+        event->prompt_us = slot->prompt_us;
+        event->verify_us = slot->verify_us;
+        event->save_us = slot->save_us;
+        event->result = slot->result;
+        event->attempts = slot->attempts;
+        memcpy(event->user, slot->user, AUDIT_USER_LEN);
+        event->user[AUDIT_USER_LEN] = '\0';
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != before) {
+                return ERR_AUDIT_OVERWRITTEN;
+        }
+        return 0;
+}
+
+void audit_close(audit_t *log) {
+        if (log == NULL) {
+                return;
+        }
+        munmap(log->base, AUDIT_SIZE);
+        free(log);
+}
+
+const char* audit_result_name(audit_result_t result) {
+        if (result < AUDIT_RESULT_OK || result > AUDIT_RESULT_TIMESTAMP) {
+                return "unknown";
+        }
+        return result_names[result];
+}
+
+int audit_parse_result(const char *name, audit_result_t *result) {
+        for (int i = AUDIT_RESULT_OK; i <= AUDIT_RESULT_TIMESTAMP; i++) {
+                if (strcmp(name, result_names[i]) == 0) {
+                        *result = (audit_result_t)i;
+                        return 0;
+                }
+        }
+        return ERR_AUDIT_INVALID;
+}
+
+static int audit_init(int fd) {
+        if (ftruncate(fd, AUDIT_SIZE) != 0) {
+                return ERR_AUDIT_OPEN;
+        }
+        struct audit_header header;
+        memset(&header, 0, sizeof(struct audit_header));
+        memcpy(header.magic, AUDIT_MAGIC, AUDIT_MAGIC_LEN);
+        header.capacity = AUDIT_CAPACITY;
+        header.slot_size = sizeof(struct audit_slot);
+        if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+                return ERR_AUDIT_OPEN;
+        }
+        return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#ifndef _AUDIT_H
+#define _AUDIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Authentication audit log: a fixed-size ring of binary records in a
+ * shared file mapping. Any number of processes append concurrently
+ * without locks: a writer reserves a sequence number with an atomic
+ * increment of the head, fills the slot `seq % capacity` and publishes
+ * it by storing the sequence into the slot. Readers copy a slot and
+ * accept it only if its sequence is the expected one before and after
+ * the copy. The oldest records are overwritten.
+ */
+
+#define AUDIT_CAPACITY 4096
+#define AUDIT_USER_LEN 22
+
+typedef enum {
+        AUDIT_RESULT_OK = 1,
+        AUDIT_RESULT_INVALID,   // wrong PIN, ended before the lock
+        AUDIT_RESULT_LOCKED,
+        AUDIT_RESULT_NO_USER,
+        AUDIT_RESULT_ERROR,
+        AUDIT_RESULT_TIMESTAMP, // verified earlier in the session, not prompted
+} audit_result_t;
+
+typedef struct audit_event {
+        uint64_t        seq;            // set by audit_append
+        uint64_t        time_ns;        // realtime, set by audit_append
+        uint32_t        uid;            // real uid of the requesting process
+        uint32_t        pid;
+        uint8_t         result;         // audit_result_t
+        uint8_t         attempts;       // failed attempts after the session
+        // phase timings, microseconds
+        uint32_t        lookup_us;
+        uint32_t        prompt_us;
+        uint32_t        verify_us;
+        uint32_t        save_us;
+        char            user[AUDIT_USER_LEN + 1];       // truncated
+} audit_event_t;
+
+typedef struct audit audit_t;
+
+enum {
+        ERR_AUDIT_OPEN = 1,
+        ERR_AUDIT_MAP,
+        ERR_AUDIT_LOCK,
+        ERR_AUDIT_INVALID,
+        ERR_AUDIT_READONLY,
+        ERR_AUDIT_OVERWRITTEN,
+        ERR_AUDIT_PENDING,
+};
+
+// map the log, writable logs are created if missing.
+int audit_open(audit_t **log, const char *path, bool writable);
+
+int audit_append(audit_t *log, audit_event_t *event);
+
+// sequence of the next record
+uint64_t audit_head(const audit_t *log);
+
+// sequence of the oldest record which is not overwritten yet
+uint64_t audit_tail(const audit_t *log);
+
+// copy a record: ERR_AUDIT_OVERWRITTEN if it is gone,
+// ERR_AUDIT_PENDING if the writer has not published it yet.
+int audit_read(const audit_t *log, uint64_t seq, audit_event_t *event);
+
+void audit_close(audit_t *log);
+
+const char* audit_result_name(audit_result_t result);
+
+int audit_parse_result(const char *name, audit_result_t *result);
+
+#endif
@@ -0,0 +1,254 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#include "auth.h"
+#include "state.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+typedef enum {
+        STEP_FIND_USER = 0,
+        STEP_LOAD_ATTEMPTS,
+        STEP_WAIT_PIN,
+        STEP_SAVE_ATTEMPTS,
+        STEP_VERIFIED,
+        STEP_DONE,
+} auth_step_t;
+
+struct pinpam_auth {
+        char                    *username;
+        pinpam_auth_io_t        io;
+        user_t                  *user;
+
+        auth_step_t             step;
+        uint8_t                 attempts;
+        bool                    valid;          // of the submitted PIN
+        pin_source_t            pin;            // valid, until verified
+        // result reported once the attempts are saved
+        pinpam_auth_status_t    outcome;
+        // error of the submitted PIN, reported with the outcome
+        int                     err;
+        int                     cause;
+};
+
+static int auth_run(pinpam_auth_t *auth, pinpam_auth_status_t *status);
+
+int pinpam_auth_begin(pinpam_auth_t **auth, const char *username,
+                      const pinpam_auth_io_t *io, pinpam_auth_status_t *status) {
+        if (io->find_user == NULL || io->load_attempts == NULL) {
+                return ERR_AUTH_SEQUENCE;
+        }
+        pinpam_auth_t *a = malloc(sizeof(pinpam_auth_t));
+        if (a == NULL) {
+                return -1;
+        }
+        memset(a, 0, sizeof(pinpam_auth_t));
+        a->username = strdup(username);
+        a->user = user_new();
+        if (a->username == NULL || a->user == NULL) {
+                pinpam_auth_finish(a);
+                return -1;
+        }
+        a->io = *io;
+        a->step = STEP_FIND_USER;
+        *auth = a;
+        return auth_run(a, status);
+}
+
+int pinpam_auth_submit(pinpam_auth_t *auth, const pin_source_t pin,
+                       pinpam_auth_status_t *status) {
+        if (auth->step != STEP_WAIT_PIN) {
+                return ERR_AUTH_SEQUENCE;
+        }
+        bool valid = false;
+        auth->err = 0;
+        if (pin != NULL) {
+                int err = user_verify_pin(auth->user, pin, &valid);
+                if (err != 0) {
+                        // counts as a failed attempt
+                        auth->err = ERR_AUTH_HASH;
+                        auth->cause = err;
+                        valid = false;
+                }
+        }
+        auth->valid = valid;
+        if (valid && auth->io.verified != NULL) {
+                memcpy(auth->pin, pin, PIN_SOURCE_LEN);
+        }
+        auth->step = STEP_SAVE_ATTEMPTS;
+        return auth_run(auth, status);
+}
+
+int pinpam_auth_resume(pinpam_auth_t *auth, pinpam_auth_status_t *status) {
+        return auth_run(auth, status);
+}
+
+uint8_t pinpam_auth_attempts(const pinpam_auth_t *auth) {
+        return auth->attempts;
+}
+
+int pinpam_auth_cause(const pinpam_auth_t *auth) {
+        return auth->cause;
+}
+
+void pinpam_auth_finish(pinpam_auth_t *auth) {
+        if (auth == NULL) {
+                return;
+        }
+        free(auth->username);
+        user_free(auth->user);
+        // the PIN too
+        memset(auth, 0, sizeof(pinpam_auth_t));
+        free(auth);
+}
+
+static int auth_run(pinpam_auth_t *auth, pinpam_auth_status_t *status) {
+        int err = 0;
+        for (;;) {
+                switch (auth->step) {
+                        case STEP_FIND_USER:
+                                err = auth->io.find_user(auth->io.ctx, auth->username, auth->user);
+                                if (err == ERR_AUTH_AGAIN) {
+                                        *status = PINPAM_AUTH_PENDING;
+                                        return 0;
+                                }
+                                if (err != 0) {
+                                        auth->cause = err;
+                                        return ERR_AUTH_USER;
+                                }
+                                auth->step = STEP_LOAD_ATTEMPTS;
+                                break;
+                        case STEP_LOAD_ATTEMPTS:
+                                err = auth->io.load_attempts(auth->io.ctx, auth->username,
+                                                             &auth->attempts);
+                                if (err == ERR_AUTH_AGAIN) {
+                                        *status = PINPAM_AUTH_PENDING;
+                                        return 0;
+                                }
+                                if (err != 0) {
+                                        auth->cause = err;
+                                        return ERR_AUTH_STATE_LOAD;
+                                }
+                                if (auth->attempts >= PINPAM_AUTH_MAX_ATTEMPTS) {
+                                        auth->outcome = PINPAM_AUTH_LOCKED;
+                                        auth->step = STEP_DONE;
+                                        break;
+                                }
+                                auth->outcome = PINPAM_AUTH_NEED_PIN;
+                                auth->step = STEP_WAIT_PIN;
+                                break;
+                        case STEP_WAIT_PIN:
+                        case STEP_DONE:
+                                *status = auth->outcome;
+                                return 0;
+                        case STEP_SAVE_ATTEMPTS: {
+                                // the count of this session unless the stored one is known
+                                uint8_t attempts = auth->valid ? 0 : auth->attempts + 1;
+                                if (auth->io.update_attempts != NULL) {
+                                        uint8_t stored = 0;
+                                        err = auth->io.update_attempts(auth->io.ctx, auth->username,
+                                                                       auth->valid, &stored);
+                                        if (err == ERR_AUTH_AGAIN) {
+                                                *status = PINPAM_AUTH_PENDING;
+                                                return 0;
+                                        }
+                                        if (err == 0) {
+                                                attempts = stored;
+                                        }
+                                }
+                                auth->attempts = attempts;
+                                if (auth->valid && attempts == 0) {
+                                        auth->outcome = PINPAM_AUTH_OK;
+                                } else {
+                                        auth->outcome = attempts >= PINPAM_AUTH_MAX_ATTEMPTS ?
+                                                PINPAM_AUTH_LOCKED : PINPAM_AUTH_RETRY;
+                                }
+                                if (err != 0) {
+                                        // the outcome stands, it is just not persisted
+                                        auth->err = ERR_AUTH_STATE_SAVE;
+                                        auth->cause = err;
+                                }
+                                if (auth->outcome == PINPAM_AUTH_OK && auth->io.verified != NULL) {
+                                        auth->step = STEP_VERIFIED;
+                                        break;
+                                }
+                                memset(auth->pin, 0, PIN_SOURCE_LEN);
+                                auth->step = auth->outcome == PINPAM_AUTH_RETRY ?
+                                        STEP_WAIT_PIN : STEP_DONE;
+                                *status = auth->outcome;
+                                return auth->err;
+                        }
+                        case STEP_VERIFIED:
+                                err = auth->io.verified(auth->io.ctx, auth->username, auth->user,
+                                                        auth->pin);
+                                if (err == ERR_AUTH_AGAIN) {
+                                        *status = PINPAM_AUTH_PENDING;
+                                        return 0;
+                                }
+                                memset(auth->pin, 0, PIN_SOURCE_LEN);
+                                auth->step = STEP_DONE;
+                                *status = auth->outcome;
+                                return auth->err;
+                }
+        }
+}
+
+int pinpam_auth_state_load(void *ctx, const char *username, uint8_t *attempts) {
+        state_t *state = state_new();
+        if (state == NULL) {
+                return -1;
+        }
+        int err = state_load(state, (const char*)ctx);
+        if (err == 0) {
+                state_get_attempts(state, username, attempts);
+        }
+        state_free(state);
+        return err;
+}
+
+int pinpam_auth_state_update(void *ctx, const char *username, bool valid,
+                             uint8_t *attempts) {
+        const char *path = ctx;
+        state_t *state = state_new();
+        if (state == NULL) {
+                return -1;
+        }
+        int fd = -1;
+        int err = state_lock(path, &fd);
+        if (err == 0) {
+                err = state_load(state, path);
+        }
+        if (err == 0) {
+                uint8_t stored = 0;
+                state_get_attempts(state, username, &stored);
+                *attempts = stored;
+                if (stored < PINPAM_AUTH_MAX_ATTEMPTS) {
+                        *attempts = valid ? 0 : stored + 1;
+                }
+                if (*attempts != stored) {
+                        state_set_attempts(state, username, *attempts);
+                        err = state_save(state, path);
+                }
+        }
+        state_unlock(fd);
+        state_free(state);
+        return err;
+}
+
+int pinpam_auth_state_save(void *ctx, const char *username, uint8_t attempts) {
+        state_t *state = state_new();
+        if (state == NULL) {
+                return -1;
+        }
+        int err = state_load(state, (const char*)ctx);
+        if (err == 0) {
+                state_set_attempts(state, username, attempts);
+                err = state_save(state, (const char*)ctx);
+        }
+        state_free(state);
+        return err;
+}
@@ -0,0 +1,106 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#ifndef _AUTH_H
+#define _AUTH_H
+
+#include "types.h"
+#include "users.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * PIN authentication session as a resumable state machine.
+ *
+ * The session never blocks: users and attempts are read and written
+ * through I/O hooks, and a hook which would block returns
+ * ERR_AUTH_AGAIN. The call then reports PINPAM_AUTH_PENDING and the
+ * caller repeats the step with pinpam_auth_resume once the hook is
+ * ready to complete.
+ *
+ *   pinpam_auth_begin      -> NEED_PIN | LOCKED | PENDING
+ *   pinpam_auth_submit     -> OK | RETRY | LOCKED | PENDING
+ *   pinpam_auth_resume     -> the result of the pending step
+ *   pinpam_auth_finish     -  release the session
+ *
+ * After RETRY the session waits for the next PIN.
+ *
+ * Concurrent sessions of a user share one count of failed attempts: a
+ * submitted PIN is counted by update_attempts under the lock of the
+ * stored count, and the result follows the count it returns, not the
+ * one read on begin. Once the count reaches PINPAM_AUTH_MAX_ATTEMPTS
+ * every session is LOCKED, a valid PIN included.
+ */
+
+#define PINPAM_AUTH_MAX_ATTEMPTS 3
+
+typedef enum {
+        PINPAM_AUTH_NEED_PIN = 0,
+        PINPAM_AUTH_OK,
+        PINPAM_AUTH_RETRY,
+        PINPAM_AUTH_LOCKED,
+        PINPAM_AUTH_PENDING,
+} pinpam_auth_status_t;
+
+enum {
+        ERR_AUTH_AGAIN = 1,     // returned by hooks which would block
+        ERR_AUTH_SEQUENCE,
+        ERR_AUTH_USER,
+        ERR_AUTH_STATE_LOAD,
+        ERR_AUTH_STATE_SAVE,
+        ERR_AUTH_HASH,
+};
+
+typedef struct pinpam_auth_io {
+        void *ctx;
+        // fill user, module error code on failure
+        int (*find_user)(void *ctx, const char *username, user_t *user);
+        // failed attempts so far
+        int (*load_attempts)(void *ctx, const char *username, uint8_t *attempts);
+        // optional, attempts are not persisted without it. As one locked
+        // read-modify-write of the stored count: keep a count at
+        // PINPAM_AUTH_MAX_ATTEMPTS, otherwise 0 for a valid PIN and one
+        // more for an invalid one; attempts gets the stored count.
+        int (*update_attempts)(void *ctx, const char *username, bool valid,
+                               uint8_t *attempts);
+        // optional, called with the valid PIN of an OK session before it
+        // is wiped; other errors than ERR_AUTH_AGAIN do not change the result
+        int (*verified)(void *ctx, const char *username, user_t *user,
+                        const pin_source_t pin);
+} pinpam_auth_io_t;
+
+typedef struct pinpam_auth pinpam_auth_t;
+
+// auth is set unless io lacks a required hook or allocation fails,
+// release it with pinpam_auth_finish.
+int pinpam_auth_begin(pinpam_auth_t **auth, const char *username,
+                      const pinpam_auth_io_t *io, pinpam_auth_status_t *status);
+
+// NULL pin is a malformed input, it counts as a failed attempt.
+int pinpam_auth_submit(pinpam_auth_t *auth, const pin_source_t pin,
+                       pinpam_auth_status_t *status);
+
+int pinpam_auth_resume(pinpam_auth_t *auth, pinpam_auth_status_t *status);
+
+uint8_t pinpam_auth_attempts(const pinpam_auth_t *auth);
+
+// module error code of the hook or KDF behind the last error.
+int pinpam_auth_cause(const pinpam_auth_t *auth);
+
+void pinpam_auth_finish(pinpam_auth_t *auth);
+
+/*
+ * Blocking attempts hooks over the state file, ctx is its path. Updates
+ * hold state_lock while they reload, change and replace the file.
+ */
+int pinpam_auth_state_load(void *ctx, const char *username, uint8_t *attempts);
+int pinpam_auth_state_update(void *ctx, const char *username, bool valid,
+                             uint8_t *attempts);
+
+// set the count as is, an administrator's reset
+int pinpam_auth_state_save(void *ctx, const char *username, uint8_t attempts);
+
+#endif
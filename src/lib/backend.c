@@ -0,0 +1,106 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#include "backend.h"
+
+#include <string.h>
+
+// the first one serves plain paths
+static const backend_ops_t * const backends[] = {
+        &backend_text,
+        &backend_btree,
+};
+
+#define BACKENDS_LEN (sizeof(backends) / sizeof(backends[0]))
+
+const backend_ops_t* backend_list(size_t i) {
+        return i < BACKENDS_LEN ? backends[i] : NULL;
+}
+
+int backend_resolve(const char *uri, const backend_ops_t **ops, const char **path) {
+        const char *sep = strchr(uri, ':');
+        const char *slash = strchr(uri, '/');
+        if (sep == NULL || (slash != NULL && slash < sep)) {
+                // plain path, "/etc/pinpam/users" or "./users"
+                *ops = backends[0];
+                *path = uri;
+                return 0;
+        }
+        const size_t len = sep - uri;
+        for (size_t i = 0; i < BACKENDS_LEN; i++) {
+                if (strlen(backends[i]->scheme) == len &&
+                                strncmp(backends[i]->scheme, uri, len) == 0) {
+                        *ops = backends[i];
+                        *path = sep + 1;
+                        return 0;
+                }
+        }
+        return ERR_BACKEND_SCHEME;
+}
+
+int backend_open(backend_t **backend, const char *uri, const char *statepath) {
+        const backend_ops_t *ops;
+        const char *path;
+        int err = backend_resolve(uri, &ops, &path);
+        if (err != 0) {
+                return err;
+        }
+        err = ops->open(backend, path, ops->attempts_apart ? statepath : NULL);
+        if (err == 0) {
+                (*backend)->ops = ops;
+        }
+        return err;
+}
+
+int backend_lookup(backend_t *backend, const char *username, user_t *user) {
+        return backend->ops->lookup(backend, username, user);
+}
+
+int backend_upsert(backend_t *backend, const char *username,
+                   const kdf_params_t *kdf, const pin_hash_t pin_hash) {
+        return backend->ops->upsert(backend, username, kdf, pin_hash);
+}
+
+int backend_remove(backend_t *backend, const char *username) {
+        return backend->ops->remove(backend, username);
+}
+
+int backend_iterate(backend_t *backend, backend_visit_fn visit, void *ctx) {
+        return backend->ops->iterate(backend, visit, ctx);
+}
+
+int backend_scan(backend_t *backend, const char *prefix, const char *after,
+                 backend_visit_fn visit, void *ctx) {
+        return backend->ops->scan(backend, prefix != NULL ? prefix : "", after, visit, ctx);
+}
+
+int backend_get_attempts(backend_t *backend, const char *username, uint8_t *attempts) {
+        return backend->ops->get_attempts(backend, username, attempts);
+}
+
+int backend_set_attempts(backend_t *backend, const char *username, uint8_t attempts) {
+        return backend->ops->set_attempts(backend, username, attempts);
+}
+
+int backend_commit(backend_t *backend, int flags) {
+        return backend->ops->commit(backend, flags);
+}
+
+int backend_lock(backend_t *backend, bool wait) {
+        if (backend->ops->lock == NULL) {
+                return 0;
+        }
+        return backend->ops->lock(backend, wait);
+}
+
+int backend_cause(const backend_t *backend) {
+        return backend->cause;
+}
+
+void backend_close(backend_t *backend) {
+        if (backend != NULL) {
+                backend->ops->close(backend);
+        }
+}
@@ -0,0 +1,131 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#ifndef _BACKEND_H
+#define _BACKEND_H
+
+#include "types.h"
+#include "users.h"
+#include "kdf.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Storage of users and their failed attempts behind a vtable.
+ *
+ * A store is named by "<scheme>:<path>", a plain path is a text store.
+ * Changes are buffered by the backend and become visible to other
+ * processes at once on backend_commit; closing without a commit drops
+ * them. Errors are ERR_BACKEND_*, backend_cause returns the error code
+ * of the underlying module.
+ *
+ *   text   - the users file and the attempts state file, the reference
+ *            implementation (backend_text.c)
+ *   btree  - a single file B+tree of 4 KiB pages with the attempts in
+ *            the records, for millions of users (backend_btree.c)
+ */
+
+enum {
+        ERR_BACKEND_SCHEME = 1,
+        ERR_BACKEND_OPEN,
+        ERR_BACKEND_NOT_FOUND,
+        ERR_BACKEND_READ,
+        ERR_BACKEND_WRITE,
+        ERR_BACKEND_COMMIT,
+        ERR_BACKEND_LOCK,
+        ERR_BACKEND_BUSY,
+        ERR_BACKEND_STATEPATH,
+};
+
+typedef struct backend backend_t;
+
+// backend_commit flags
+enum {
+        // a change of this host only, e.g. a rehash on login: it does not
+        // start a new generation of a tracked users file, see delta.h
+        BACKEND_COMMIT_LOCAL = 1,
+};
+
+// non-zero stops the iteration and is returned by backend_iterate
+typedef int (*backend_visit_fn)(void *ctx, user_t *user);
+
+typedef struct backend_ops {
+        const char *scheme;
+        // the attempts live in a state file apart from the users store
+        bool attempts_apart;
+        // path of the users store, statepath of the attempts file; NULL
+        // unless attempts_apart, a backend keeping them itself rejects it
+        int (*open)(backend_t **backend, const char *path, const char *statepath);
+        int (*lookup)(backend_t *backend, const char *username, user_t *user);
+        int (*upsert)(backend_t *backend, const char *username,
+                      const kdf_params_t *kdf, const pin_hash_t pin_hash);
+        int (*remove)(backend_t *backend, const char *username);
+        // users in the store order
+        int (*iterate)(backend_t *backend, backend_visit_fn visit, void *ctx);
+        // users whose name starts with prefix and is greater than after
+        // (NULL - no bound) in name order, the visitor may read the store
+        int (*scan)(backend_t *backend, const char *prefix, const char *after,
+                    backend_visit_fn visit, void *ctx);
+        int (*get_attempts)(backend_t *backend, const char *username, uint8_t *attempts);
+        int (*set_attempts)(backend_t *backend, const char *username, uint8_t attempts);
+        int (*commit)(backend_t *backend, int flags);
+        void (*close)(backend_t *backend);
+        // writer lock held until close, taken before the first read;
+        // NULL if the backend serialises writers on its own
+        int (*lock)(backend_t *backend, bool wait);
+} backend_ops_t;
+
+// every backend embeds it as the first member, backend_open sets ops
+struct backend {
+        const backend_ops_t     *ops;
+        int                     cause;
+};
+
+// hidden: the library objects are linked into pam_pin.so without -fPIC
+extern const backend_ops_t backend_text __attribute__((visibility("hidden")));
+extern const backend_ops_t backend_btree __attribute__((visibility("hidden")));
+
+// registered backends, NULL past the last one
+const backend_ops_t* backend_list(size_t i);
+
+// find the backend of the store uri, path points into uri.
+int backend_resolve(const char *uri, const backend_ops_t **ops, const char **path);
+
+// statepath is dropped for a backend that keeps the attempts itself
+int backend_open(backend_t **backend, const char *uri, const char *statepath);
+
+int backend_lookup(backend_t *backend, const char *username, user_t *user);
+
+int backend_upsert(backend_t *backend, const char *username,
+                   const kdf_params_t *kdf, const pin_hash_t pin_hash);
+
+int backend_remove(backend_t *backend, const char *username);
+
+int backend_iterate(backend_t *backend, backend_visit_fn visit, void *ctx);
+
+// NULL prefix - every user
+int backend_scan(backend_t *backend, const char *prefix, const char *after,
+                 backend_visit_fn visit, void *ctx);
+
+// 0 attempts for users without a record
+int backend_get_attempts(backend_t *backend, const char *username, uint8_t *attempts);
+
+int backend_set_attempts(backend_t *backend, const char *username, uint8_t attempts);
+
+// flags - BACKEND_COMMIT_* or 0
+int backend_commit(backend_t *backend, int flags);
+
+// serialise with other writers of the store until backend_close, call it
+// before reading what is changed. wait - false fails with ERR_BACKEND_BUSY
+// while another writer holds the lock.
+int backend_lock(backend_t *backend, bool wait);
+
+int backend_cause(const backend_t *backend);
+
+void backend_close(backend_t *backend);
+
+#endif
@@ -0,0 +1,996 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#include "backend.h"
+#include "users.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+/*
+ * Single file B+tree of users, for directories too large to rewrite or
+ * to keep in memory.
+ *
+ * The file is made of 4 KiB pages. Pages 0 and 1 keep two copies of the
+ * meta record and the newest valid one names the root. Changes copy the
+ * pages on the path to a leaf into free or new pages, commit syncs them
+ * and then swaps the root by writing the older meta copy, so a crash
+ * leaves the previous tree in place. Pages replaced by a commit go to
+ * the free list of its meta and are reused from the next commit on.
+ *
+ * Leaves hold fixed size records sorted by name, with the attempts. The
+ * record of a removed user is kept while it has attempts, as the text
+ * state file keeps them. Branches hold the first name of every child
+ * but the first one. Removal only drops empty pages, there is no
+ * rebalancing.
+ *
+ * A writer holds an exclusive flock from its first change until commit
+ * or close, readers take a shared one for every operation and read the
+ * meta again. The file is in the host byte order.
+ */
+
+#define BTREE_PAGE 4096
+#define BTREE_NAME_LEN 64               // with the terminating zero
+#define BTREE_DEPTH_MAX 16
+#define BTREE_MAGIC "PINPAMBT"
+#define BTREE_VERSION 1
+
+enum {
+        PAGE_LEAF = 1,
+        PAGE_BRANCH,
+        PAGE_FREE,
+};
+
+struct page_head {
+        uint16_t        type;
+        uint16_t        count;
+        uint32_t        next;           // free list: the next page, 0 - last
+        uint32_t        reserved[2];
+};
+
+struct record {
+        char            name[BTREE_NAME_LEN];
+        uint32_t        alg;
+        uint32_t        cost;
+        uint32_t        memory;
+        uint32_t        parallel;
+        uint8_t         salt[KDF_SALT_LEN];
+        uint8_t         pin_hash[PIN_HASH_LEN];
+        uint8_t         attempts;
+        uint8_t         enrolled;       // 0 - removed user with attempts
+        uint8_t         reserved[6];
+};
+
+struct entry {
+        char            name[BTREE_NAME_LEN];
+        uint32_t        child;
+};
+
+struct meta {
+        char            magic[8];
+        uint32_t        version;
+        uint32_t        page_size;
+        uint64_t        generation;
+        uint32_t        root;           // 0 - empty tree
+        uint32_t        npages;
+        uint32_t        freelist;       // first free list page, 0 - none
+        uint32_t        nfree;
+        uint32_t        checksum;
+};
+
+#define PAGE_ITEMS(item) ((BTREE_PAGE - sizeof(struct page_head)) / sizeof(item))
+#define LEAF_MAX PAGE_ITEMS(struct record)
+#define BRANCH_MAX PAGE_ITEMS(struct entry)
+#define FREE_MAX PAGE_ITEMS(uint32_t)
+
+#define HEAD(page) ((struct page_head*)(page))
+#define RECORDS(page) ((struct record*)((page) + sizeof(struct page_head)))
+#define ENTRIES(page) ((struct entry*)((page) + sizeof(struct page_head)))
+#define FREES(page) ((uint32_t*)((page) + sizeof(struct page_head)))
+
+_Static_assert(sizeof(struct record) == 168, "btree record layout");
+_Static_assert(sizeof(struct entry) == 68, "btree entry layout");
+
+struct pages {
+        uint32_t        *v;
+        size_t          len;
+        size_t          cap;
+};
+
+// page changed in this transaction, pgno 0 is an empty slot
+struct dirty {
+        uint32_t        pgno;
+        bool            live;
+        uint8_t         *page;
+};
+
+// page on the way from the root to a leaf and the child taken in it
+struct step {
+        uint32_t        pgno;
+        size_t          idx;
+};
+
+struct backend_btree {
+        backend_t       base;
+        int             fd;
+        bool            readonly;
+        bool            writing;        // holds the exclusive lock
+        bool            broken;         // a change failed half way
+        int             reading;        // nested read_begin calls
+        struct meta     meta;           // working copy when writing
+
+        struct dirty    *dirty;
+        size_t          dirty_cap;
+        size_t          dirty_len;
+
+        struct pages    free;           // reusable in this transaction
+        struct pages    freed;          // replaced, reusable after commit
+        struct pages    chain;          // pages of the committed free list
+
+        // read buffers, one per tree level
+        uint8_t         levels[BTREE_DEPTH_MAX][BTREE_PAGE];
+};
+
+static int pages_push(struct pages *pages, uint32_t pgno) {
+        if (pages->len == pages->cap) {
+                const size_t cap = pages->cap > 0 ? pages->cap * 2 : 64;
+                uint32_t *v = realloc(pages->v, cap * sizeof(uint32_t));
+                if (v == NULL) {
+                        return -1;
+                }
+                pages->v = v;
+                pages->cap = cap;
+        }
+        pages->v[pages->len++] = pgno;
+        return 0;
+}
+
+static uint32_t meta_checksum(const struct meta *meta) {
+        // FNV-1a
+        const uint8_t *p = (const uint8_t*)meta;
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < offsetof(struct meta, checksum); i++) {
+                hash = (hash ^ p[i]) * 16777619u;
+        }
+        return hash;
+}
+
+static bool meta_valid(const struct meta *meta) {
+        return memcmp(meta->magic, BTREE_MAGIC, sizeof(meta->magic)) == 0 &&
+                meta->version == BTREE_VERSION && meta->page_size == BTREE_PAGE &&
+                meta->npages >= 2 && meta->checksum == meta_checksum(meta);
+}
+
+static int read_page(struct backend_btree *b, uint32_t pgno, uint8_t *page) {
+        if (pgno < 2 || pgno >= b->meta.npages ||
+                        pread(b->fd, page, BTREE_PAGE, (off_t)pgno * BTREE_PAGE) != BTREE_PAGE) {
+                return ERR_BACKEND_READ;
+        }
+        return 0;
+}
+
+static int meta_load(struct backend_btree *b) {
+        struct meta metas[2];
+        bool valid[2];
+        for (int i = 0; i < 2; i++) {
+                valid[i] = pread(b->fd, &metas[i], sizeof(struct meta),
+                                 (off_t)i * BTREE_PAGE) == sizeof(struct meta) &&
+                        meta_valid(&metas[i]);
+        }
+        if (valid[0] || valid[1]) {
+                const int i = !valid[0] || (valid[1] &&
+                                            metas[1].generation > metas[0].generation);
+                b->meta = metas[i];
+                return 0;
+        }
+        struct stat st;
+        if (fstat(b->fd, &st) != 0 || st.st_size != 0) {
+                return ERR_BACKEND_READ;
+        }
+        // new file
+        memset(&b->meta, 0, sizeof(struct meta));
+        memcpy(b->meta.magic, BTREE_MAGIC, sizeof(b->meta.magic));
+        b->meta.version = BTREE_VERSION;
+        b->meta.page_size = BTREE_PAGE;
+        b->meta.npages = 2;
+        return 0;
+}
+
+// dirty pages: open addressing, pgno keyed
+
+static struct dirty* dirty_slot(struct backend_btree *b, uint32_t pgno) {
+        if (b->dirty_cap == 0) {
+                return NULL;
+        }
+        size_t i = (pgno * 2654435761u) & (b->dirty_cap - 1);
+        while (b->dirty[i].pgno != 0) {
+                if (b->dirty[i].pgno == pgno) {
+                        return &b->dirty[i];
+                }
+                i = (i + 1) & (b->dirty_cap - 1);
+        }
+        return &b->dirty[i];
+}
+
+static uint8_t* dirty_find(struct backend_btree *b, uint32_t pgno) {
+        struct dirty *d = dirty_slot(b, pgno);
+        return d != NULL && d->pgno == pgno && d->live ? d->page : NULL;
+}
+
+static int dirty_put(struct backend_btree *b, uint32_t pgno, uint8_t *page) {
+        if ((b->dirty_len + 1) * 2 > b->dirty_cap) {
+                const size_t cap = b->dirty_cap > 0 ? b->dirty_cap * 2 : 256;
+                struct dirty *old = b->dirty;
+                const size_t oldcap = b->dirty_cap;
+                b->dirty = calloc(cap, sizeof(struct dirty));
+                if (b->dirty == NULL) {
+                        b->dirty = old;
+                        return -1;
+                }
+                b->dirty_cap = cap;
+                b->dirty_len = 0;
+                // dropped pages are in the free list already
+                for (size_t i = 0; i < oldcap; i++) {
+                        if (old[i].live) {
+                                *dirty_slot(b, old[i].pgno) = old[i];
+                                b->dirty_len++;
+                        }
+                }
+                free(old);
+        }
+        struct dirty *d = dirty_slot(b, pgno);
+        if (d->pgno == 0) {
+                b->dirty_len++;
+        }
+        d->pgno = pgno;
+        d->live = true;
+        d->page = page;
+        return 0;
+}
+
+static void dirty_clear(struct backend_btree *b) {
+        for (size_t i = 0; i < b->dirty_cap; i++) {
+                if (b->dirty[i].live) {
+                        free(b->dirty[i].page);
+                }
+        }
+        free(b->dirty);
+        b->dirty = NULL;
+        b->dirty_cap = 0;
+        b->dirty_len = 0;
+}
+
+// the page as of this transaction, read into the buffer of its level
+static const uint8_t* page_get(struct backend_btree *b, uint32_t pgno, int level) {
+        const uint8_t *page = dirty_find(b, pgno);
+        if (page != NULL) {
+                return page;
+        }
+        if (level >= BTREE_DEPTH_MAX || read_page(b, pgno, b->levels[level]) != 0) {
+                return NULL;
+        }
+        return b->levels[level];
+}
+
+static uint32_t page_alloc(struct backend_btree *b) {
+        if (b->free.len > 0) {
+                return b->free.v[--b->free.len];
+        }
+        return b->meta.npages++;
+}
+
+static uint8_t* page_new(struct backend_btree *b, uint16_t type, uint32_t *pgno) {
+        uint8_t *page = calloc(1, BTREE_PAGE);
+        if (page == NULL) {
+                return NULL;
+        }
+        *pgno = page_alloc(b);
+        if (dirty_put(b, *pgno, page) != 0) {
+                free(page);
+                return NULL;
+        }
+        HEAD(page)->type = type;
+        return page;
+}
+
+// writable page, a committed one is copied and pgno changes
+static uint8_t* page_cow(struct backend_btree *b, uint32_t *pgno) {
+        uint8_t *page = dirty_find(b, *pgno);
+        if (page != NULL) {
+                return page;
+        }
+        page = malloc(BTREE_PAGE);
+        if (page == NULL || read_page(b, *pgno, page) != 0 ||
+                        pages_push(&b->freed, *pgno) != 0) {
+                free(page);
+                return NULL;
+        }
+        *pgno = page_alloc(b);
+        if (dirty_put(b, *pgno, page) != 0) {
+                free(page);
+                return NULL;
+        }
+        return page;
+}
+
+static int page_drop(struct backend_btree *b, uint32_t pgno) {
+        struct dirty *d = dirty_slot(b, pgno);
+        if (d != NULL && d->pgno == pgno && d->live) {
+                // new in this transaction, nothing refers to it
+                free(d->page);
+                d->page = NULL;
+                d->live = false;
+                return pages_push(&b->free, pgno);
+        }
+        return pages_push(&b->freed, pgno);
+}
+
+static void write_end(struct backend_btree *b) {
+        dirty_clear(b);
+        b->free.len = 0;
+        b->freed.len = 0;
+        b->chain.len = 0;
+        b->broken = false;
+        if (b->writing) {
+                b->writing = false;
+                flock(b->fd, LOCK_UN);
+        }
+}
+
+static int write_begin(struct backend_btree *b) {
+        if (b->broken) {
+                return ERR_BACKEND_WRITE;
+        }
+        if (b->writing) {
+                return 0;
+        }
+        if (b->readonly || flock(b->fd, LOCK_EX) != 0) {
+                return ERR_BACKEND_WRITE;
+        }
+        b->writing = true;
+        int err = meta_load(b);
+        uint8_t *page = b->levels[0];
+        for (uint32_t pgno = b->meta.freelist; err == 0 && pgno != 0; pgno = HEAD(page)->next) {
+                if (b->chain.len > b->meta.npages || read_page(b, pgno, page) != 0 ||
+                                HEAD(page)->type != PAGE_FREE ||
+                                pages_push(&b->chain, pgno) != 0) {
+                        err = ERR_BACKEND_READ;
+                        break;
+                }
+                for (size_t i = 0; i < HEAD(page)->count && err == 0; i++) {
+                        err = pages_push(&b->free, FREES(page)[i]) != 0 ? ERR_BACKEND_READ : 0;
+                }
+        }
+        if (err != 0) {
+                write_end(b);
+        }
+        return err;
+}
+
+// a scan visitor reads under the lock and the meta of the scan
+static int read_begin(struct backend_btree *b) {
+        if (b->writing || b->reading > 0) {
+                b->reading++;
+                return 0;
+        }
+        if (flock(b->fd, LOCK_SH) != 0) {
+                return ERR_BACKEND_READ;
+        }
+        int err = meta_load(b);
+        if (err != 0) {
+                flock(b->fd, LOCK_UN);
+                return err;
+        }
+        b->reading = 1;
+        return 0;
+}
+
+static void read_end(struct backend_btree *b) {
+        if (--b->reading == 0 && !b->writing) {
+                flock(b->fd, LOCK_UN);
+        }
+}
+
+// index of the first record not less than the name
+static size_t leaf_find(const uint8_t *leaf, const char *name, bool *found) {
+        const struct record *recs = RECORDS(leaf);
+        size_t lo = 0, hi = HEAD(leaf)->count;
+        while (lo < hi) {
+                const size_t mid = (lo + hi) / 2;
+                if (strncmp(recs[mid].name, name, BTREE_NAME_LEN) < 0) {
+                        lo = mid + 1;
+                } else {
+                        hi = mid;
+                }
+        }
+        *found = lo < HEAD(leaf)->count &&
+                strncmp(recs[lo].name, name, BTREE_NAME_LEN) == 0;
+        return lo;
+}
+
+/*
+ * Walk from the root to the leaf of the name, *depth pages long, the
+ * last one is the leaf. An empty tree has no pages.
+ */
+static int descend(struct backend_btree *b, const char *name, struct step *path,
+                   int *depth, const uint8_t **leaf) {
+        *depth = 0;
+        *leaf = NULL;
+        uint32_t pgno = b->meta.root;
+        while (pgno != 0) {
+                const uint8_t *page = page_get(b, pgno, *depth);
+                if (page == NULL) {
+                        return ERR_BACKEND_READ;
+                }
+                path[*depth].pgno = pgno;
+                path[*depth].idx = 0;
+                (*depth)++;
+                if (HEAD(page)->type == PAGE_LEAF) {
+                        *leaf = page;
+                        return 0;
+                }
+                const struct entry *ents = ENTRIES(page);
+                const size_t count = HEAD(page)->count;
+                if (HEAD(page)->type != PAGE_BRANCH || count == 0 || *depth == BTREE_DEPTH_MAX) {
+                        return ERR_BACKEND_READ;
+                }
+                size_t idx = 0;
+                while (idx + 1 < count &&
+                                strncmp(ents[idx + 1].name, name, BTREE_NAME_LEN) <= 0) {
+                        idx++;
+                }
+                path[*depth - 1].idx = idx;
+                pgno = ents[idx].child;
+        }
+        return 0;
+}
+
+static void record_user(const struct record *rec, user_t *user, int *err) {
+        kdf_params_t kdf = {
+                .alg = rec->alg,
+                .cost = rec->cost,
+                .memory = rec->memory,
+                .parallel = rec->parallel,
+        };
+        memcpy(kdf.salt, rec->salt, KDF_SALT_LEN);
+        *err = user_set(user, rec->name, &kdf, rec->pin_hash) != 0 ? ERR_BACKEND_READ : 0;
+}
+
+/*
+ * Insert the record at pos of the leaf, or replace the record there, and
+ * copy the path up to a new root, splitting full pages.
+ */
+static int tree_put(struct backend_btree *b, const struct step *path, int depth,
+                    size_t pos, const struct record *rec, bool insert) {
+        uint32_t child;
+        if (depth == 0) {
+                uint8_t *leaf = page_new(b, PAGE_LEAF, &child);
+                if (leaf == NULL) {
+                        return ERR_BACKEND_WRITE;
+                }
+                RECORDS(leaf)[0] = *rec;
+                HEAD(leaf)->count = 1;
+                b->meta.root = child;
+                return 0;
+        }
+
+        child = path[depth - 1].pgno;
+        uint8_t *leaf = page_cow(b, &child);
+        if (leaf == NULL) {
+                return ERR_BACKEND_WRITE;
+        }
+        struct record *recs = RECORDS(leaf);
+        size_t count = HEAD(leaf)->count;
+        bool split = false;
+        struct entry sep;
+        if (!insert) {
+                recs[pos] = *rec;
+        } else if (count < LEAF_MAX) {
+                memmove(&recs[pos + 1], &recs[pos], (count - pos) * sizeof(struct record));
+                recs[pos] = *rec;
+                HEAD(leaf)->count++;
+        } else {
+                struct record all[LEAF_MAX + 1];
+                memcpy(all, recs, pos * sizeof(struct record));
+                all[pos] = *rec;
+                memcpy(&all[pos + 1], &recs[pos], (count - pos) * sizeof(struct record));
+                const size_t left = (count + 1) / 2;
+                uint8_t *right = page_new(b, PAGE_LEAF, &sep.child);
+                if (right == NULL) {
+                        return ERR_BACKEND_WRITE;
+                }
+                memcpy(recs, all, left * sizeof(struct record));
+                HEAD(leaf)->count = left;
+                memcpy(RECORDS(right), &all[left], (count + 1 - left) * sizeof(struct record));
+                HEAD(right)->count = count + 1 - left;
+                memcpy(sep.name, RECORDS(right)[0].name, BTREE_NAME_LEN);
+                split = true;
+        }
+
+        for (int level = depth - 2; level >= 0; level--) {
+                uint32_t pgno = path[level].pgno;
+                const size_t idx = path[level].idx;
+                uint8_t *page = page_cow(b, &pgno);
+                if (page == NULL) {
+                        return ERR_BACKEND_WRITE;
+                }
+                struct entry *ents = ENTRIES(page);
+                ents[idx].child = child;
+                child = pgno;
+                if (!split) {
+                        continue;
+                }
+                count = HEAD(page)->count;
+                if (count < BRANCH_MAX) {
+                        memmove(&ents[idx + 2], &ents[idx + 1],
+                                (count - idx - 1) * sizeof(struct entry));
+                        ents[idx + 1] = sep;
+                        HEAD(page)->count++;
+                        split = false;
+                        continue;
+                }
+                struct entry all[BRANCH_MAX + 1];
+                memcpy(all, ents, (idx + 1) * sizeof(struct entry));
+                all[idx + 1] = sep;
+                memcpy(&all[idx + 2], &ents[idx + 1], (count - idx - 1) * sizeof(struct entry));
+                const size_t left = (count + 1) / 2;
+                uint8_t *right = page_new(b, PAGE_BRANCH, &sep.child);
+                if (right == NULL) {
+                        return ERR_BACKEND_WRITE;
+                }
+                memcpy(ents, all, left * sizeof(struct entry));
+                HEAD(page)->count = left;
+                memcpy(ENTRIES(right), &all[left], (count + 1 - left) * sizeof(struct entry));
+                HEAD(right)->count = count + 1 - left;
+                memcpy(sep.name, ENTRIES(right)[0].name, BTREE_NAME_LEN);
+        }
+
+        if (split) {
+                uint32_t root;
+                uint8_t *page = page_new(b, PAGE_BRANCH, &root);
+                if (page == NULL) {
+                        return ERR_BACKEND_WRITE;
+                }
+                memset(ENTRIES(page)[0].name, 0, BTREE_NAME_LEN);
+                ENTRIES(page)[0].child = child;
+                ENTRIES(page)[1] = sep;
+                HEAD(page)->count = 2;
+                child = root;
+        }
+        b->meta.root = child;
+        return 0;
+}
+
+// remove the record at pos of the leaf, dropping pages left empty
+static int tree_delete(struct backend_btree *b, const struct step *path, int depth, size_t pos) {
+        uint32_t child = 0;
+        bool removed = false;
+        for (int level = depth - 1; level >= 0; level--) {
+                uint32_t pgno = path[level].pgno;
+                const uint8_t *cur = page_get(b, pgno, level);
+                if (cur == NULL) {
+                        return ERR_BACKEND_WRITE;
+                }
+                const size_t idx = level == depth - 1 ? pos : path[level].idx;
+                if (level == depth - 1 || removed) {
+                        if (HEAD(cur)->count == 1) {
+                                // the page would be left empty
+                                if (page_drop(b, pgno) != 0) {
+                                        return ERR_BACKEND_WRITE;
+                                }
+                                removed = true;
+                                child = 0;
+                                continue;
+                        }
+                        uint8_t *page = page_cow(b, &pgno);
+                        if (page == NULL) {
+                                return ERR_BACKEND_WRITE;
+                        }
+                        const size_t count = HEAD(page)->count;
+                        if (HEAD(page)->type == PAGE_LEAF) {
+                                memmove(&RECORDS(page)[idx], &RECORDS(page)[idx + 1],
+                                        (count - idx - 1) * sizeof(struct record));
+                        } else {
+                                memmove(&ENTRIES(page)[idx], &ENTRIES(page)[idx + 1],
+                                        (count - idx - 1) * sizeof(struct entry));
+                        }
+                        HEAD(page)->count--;
+                        removed = false;
+                } else {
+                        uint8_t *page = page_cow(b, &pgno);
+                        if (page == NULL) {
+                                return ERR_BACKEND_WRITE;
+                        }
+                        ENTRIES(page)[idx].child = child;
+                }
+                child = pgno;
+        }
+        b->meta.root = child;
+
+        // a branch with one child is replaced by it
+        while (b->meta.root != 0) {
+                const uint8_t *page = page_get(b, b->meta.root, 0);
+                if (page == NULL) {
+                        return ERR_BACKEND_WRITE;
+                }
+                if (HEAD(page)->type != PAGE_BRANCH || HEAD(page)->count != 1) {
+                        break;
+                }
+                const uint32_t root = ENTRIES(page)[0].child;
+                if (page_drop(b, b->meta.root) != 0) {
+                        return ERR_BACKEND_WRITE;
+                }
+                b->meta.root = root;
+        }
+        return 0;
+}
+
+/*
+ * Find the record of the name for a change, rec is the current one or
+ * a new empty record.
+ */
+static int record_prepare(struct backend_btree *b, const char *name, struct step *path,
+                          int *depth, size_t *pos, bool *found, struct record *rec) {
+        if (strlen(name) >= BTREE_NAME_LEN) {
+                return ERR_BACKEND_WRITE;
+        }
+        int err = write_begin(b);
+        if (err != 0) {
+                return err;
+        }
+        const uint8_t *leaf = NULL;
+        err = descend(b, name, path, depth, &leaf);
+        if (err != 0) {
+                return err;
+        }
+        *pos = 0;
+        *found = false;
+        if (leaf != NULL) {
+                *pos = leaf_find(leaf, name, found);
+        }
+        if (*found) {
+                *rec = RECORDS(leaf)[*pos];
+        } else {
+                memset(rec, 0, sizeof(struct record));
+                strcpy(rec->name, name);
+        }
+        return 0;
+}
+
+static int btree_open(backend_t **backend, const char *path, const char *statepath) {
+        // the attempts are kept in the records
+        if (statepath != NULL) {
+                return ERR_BACKEND_STATEPATH;
+        }
+        struct backend_btree *b = calloc(1, sizeof(struct backend_btree));
+        if (b == NULL) {
+                return ERR_BACKEND_OPEN;
+        }
+        b->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (b->fd < 0 && errno == EACCES) {
+                b->readonly = true;
+                b->fd = open(path, O_RDONLY | O_CLOEXEC);
+        }
+        if (b->fd < 0) {
+                free(b);
+                return ERR_BACKEND_OPEN;
+        }
+        *backend = &b->base;
+        return 0;
+}
+
+static int btree_lookup(backend_t *backend, const char *username, user_t *user) {
+        struct backend_btree *b = (struct backend_btree*)backend;
+        int err = read_begin(b);
+        if (err != 0) {
+                return err;
+        }
+        struct step path[BTREE_DEPTH_MAX];
+        int depth = 0;
+        const uint8_t *leaf = NULL;
+        err = descend(b, username, path, &depth, &leaf);
+        if (err == 0) {
+                bool found = false;
+                const size_t pos = leaf != NULL ? leaf_find(leaf, username, &found) : 0;
+                if (!found || !RECORDS(leaf)[pos].enrolled) {
+                        err = ERR_BACKEND_NOT_FOUND;
+                } else {
+                        record_user(&RECORDS(leaf)[pos], user, &err);
+                }
+        }
+        read_end(b);
+        return err;
+}
+
+static int btree_upsert(backend_t *backend, const char *username,
+                        const kdf_params_t *kdf, const pin_hash_t pin_hash) {
+        struct backend_btree *b = (struct backend_btree*)backend;
+        struct step path[BTREE_DEPTH_MAX];
+        int depth = 0;
+        size_t pos = 0;
+        bool found = false;
+        struct record rec;
+        int err = record_prepare(b, username, path, &depth, &pos, &found, &rec);
+        if (err != 0) {
+                return err;
+        }
+        rec.alg = kdf->alg;
+        rec.cost = kdf->cost;
+        rec.memory = kdf->memory;
+        rec.parallel = kdf->parallel;
+        memcpy(rec.salt, kdf->salt, KDF_SALT_LEN);
+        memcpy(rec.pin_hash, pin_hash, PIN_HASH_LEN);
+        rec.enrolled = 1;
+        err = tree_put(b, path, depth, pos, &rec, !found);
+        b->broken = err != 0;
+        return err;
+}
+
+static int btree_remove(backend_t *backend, const char *username) {
+        struct backend_btree *b = (struct backend_btree*)backend;
+        if (strlen(username) >= BTREE_NAME_LEN) {
+                return ERR_BACKEND_NOT_FOUND;
+        }
+        struct step path[BTREE_DEPTH_MAX];
+        int depth = 0;
+        size_t pos = 0;
+        bool found = false;
+        struct record rec;
+        int err = record_prepare(b, username, path, &depth, &pos, &found, &rec);
+        if (err != 0) {
+                return err;
+        }
+        if (!found || !rec.enrolled) {
+                return ERR_BACKEND_NOT_FOUND;
+        }
+        if (rec.attempts != 0) {
+                rec.enrolled = 0;
+                err = tree_put(b, path, depth, pos, &rec, false);
+        } else {
+                err = tree_delete(b, path, depth, pos);
+        }
+        b->broken = err != 0;
+        return err;
+}
+
+struct scan {
+        const char              *prefix;
+        size_t                  prefix_len;
+        const char              *from;          // first name to visit
+        const char              *after;         // NULL - none
+        backend_visit_fn        visit;
+        void                    *ctx;
+        user_t                  *user;
+        bool                    done;
+};
+
+static int scan_page(struct backend_btree *b, uint32_t pgno, int level, struct scan *scan) {
+        const uint8_t *cached = page_get(b, pgno, level);
+        if (cached == NULL) {
+                return ERR_BACKEND_READ;
+        }
+        // the visitor may read the store into the level buffers
+        uint8_t page[BTREE_PAGE];
+        memcpy(page, cached, BTREE_PAGE);
+        const size_t count = HEAD(page)->count;
+        int err = 0;
+        if (HEAD(page)->type == PAGE_BRANCH) {
+                // children before the one of the first name are skipped
+                size_t i = 0;
+                while (i + 1 < count &&
+                                strncmp(ENTRIES(page)[i + 1].name, scan->from, BTREE_NAME_LEN) <= 0) {
+                        i++;
+                }
+                for (; i < count && err == 0 && !scan->done; i++) {
+                        err = scan_page(b, ENTRIES(page)[i].child, level + 1, scan);
+                }
+                return err;
+        }
+        if (HEAD(page)->type != PAGE_LEAF) {
+                return ERR_BACKEND_READ;
+        }
+        bool found;
+        for (size_t i = leaf_find(page, scan->from, &found); i < count && err == 0; i++) {
+                const struct record *rec = &RECORDS(page)[i];
+                if (strncmp(rec->name, scan->prefix, scan->prefix_len) != 0) {
+                        scan->done = true;
+                        break;
+                }
+                if (!rec->enrolled || (scan->after != NULL &&
+                                strncmp(rec->name, scan->after, BTREE_NAME_LEN) == 0)) {
+                        continue;
+                }
+                record_user(rec, scan->user, &err);
+                if (err == 0) {
+                        err = scan->visit(scan->ctx, scan->user);
+                }
+        }
+        return err;
+}
+
+static int btree_scan(backend_t *backend, const char *prefix, const char *after,
+                      backend_visit_fn visit, void *ctx) {
+        struct backend_btree *b = (struct backend_btree*)backend;
+        struct scan scan = {
+                .prefix = prefix,
+                .prefix_len = strlen(prefix),
+                .from = after != NULL && strcmp(after, prefix) > 0 ? after : prefix,
+                .after = after,
+                .visit = visit,
+                .ctx = ctx,
+                .user = user_new(),
+        };
+        if (scan.user == NULL) {
+                return ERR_BACKEND_READ;
+        }
+        int err = read_begin(b);
+        if (err == 0) {
+                if (b->meta.root != 0) {
+                        err = scan_page(b, b->meta.root, 0, &scan);
+                }
+                read_end(b);
+        }
+        user_free(scan.user);
+        return err;
+}
+
+static int btree_iterate(backend_t *backend, backend_visit_fn visit, void *ctx) {
+        return btree_scan(backend, "", NULL, visit, ctx);
+}
+
+static int btree_get_attempts(backend_t *backend, const char *username, uint8_t *attempts) {
+        struct backend_btree *b = (struct backend_btree*)backend;
+        *attempts = 0;
+        if (strlen(username) >= BTREE_NAME_LEN) {
+                return 0;
+        }
+        int err = read_begin(b);
+        if (err != 0) {
+                return err;
+        }
+        struct step path[BTREE_DEPTH_MAX];
+        int depth = 0;
+        const uint8_t *leaf = NULL;
+        err = descend(b, username, path, &depth, &leaf);
+        if (err == 0 && leaf != NULL) {
+                bool found = false;
+                const size_t pos = leaf_find(leaf, username, &found);
+                if (found) {
+                        *attempts = RECORDS(leaf)[pos].attempts;
+                }
+        }
+        read_end(b);
+        return err;
+}
+
+static int btree_set_attempts(backend_t *backend, const char *username, uint8_t attempts) {
+        struct backend_btree *b = (struct backend_btree*)backend;
+        struct step path[BTREE_DEPTH_MAX];
+        int depth = 0;
+        size_t pos = 0;
+        bool found = false;
+        struct record rec;
+        int err = record_prepare(b, username, path, &depth, &pos, &found, &rec);
+        if (err != 0 || rec.attempts == attempts) {
+                return err;
+        }
+        rec.attempts = attempts;
+        if (found && !rec.enrolled && attempts == 0) {
+                err = tree_delete(b, path, depth, pos);
+        } else {
+                err = tree_put(b, path, depth, pos, &rec, !found);
+        }
+        b->broken = err != 0;
+        return err;
+}
+
+static int write_at(int fd, const void *buf, size_t len, uint32_t pgno) {
+        return pwrite(fd, buf, len, (off_t)pgno * BTREE_PAGE) == (ssize_t)len ? 0 : -1;
+}
+
+static int btree_commit(backend_t *backend, int flags) {
+        (void) flags;  // btree stores have no generations
+        struct backend_btree *b = (struct backend_btree*)backend;
+        if (!b->writing) {
+                return 0;
+        }
+        if (b->broken) {
+                write_end(b);
+                return ERR_BACKEND_COMMIT;
+        }
+        if (b->dirty_len == 0 && b->freed.len == 0) {
+                write_end(b);
+                return 0;
+        }
+
+        // the new free list: left over, replaced and the old list pages.
+        // Its own pages come from the left over ones, the others are
+        // still referenced by the current meta.
+        struct pages newchain = {0};
+        size_t total = b->free.len + b->freed.len + b->chain.len;
+        int err = 0;
+        while (err == 0 && newchain.len * FREE_MAX < total) {
+                uint32_t pgno;
+                if (b->free.len > 0) {
+                        pgno = b->free.v[--b->free.len];
+                        total--;
+                } else {
+                        pgno = b->meta.npages++;
+                }
+                err = pages_push(&newchain, pgno);
+        }
+        for (size_t i = 0; err == 0 && i < b->freed.len; i++) {
+                err = pages_push(&b->free, b->freed.v[i]);
+        }
+        for (size_t i = 0; err == 0 && i < b->chain.len; i++) {
+                err = pages_push(&b->free, b->chain.v[i]);
+        }
+
+        uint8_t *page = b->levels[0];
+        for (size_t i = 0; err == 0 && i < newchain.len; i++) {
+                memset(page, 0, BTREE_PAGE);
+                const size_t from = i * FREE_MAX;
+                const size_t count = b->free.len - from < FREE_MAX ? b->free.len - from : FREE_MAX;
+                HEAD(page)->type = PAGE_FREE;
+                HEAD(page)->count = count;
+                HEAD(page)->next = i + 1 < newchain.len ? newchain.v[i + 1] : 0;
+                memcpy(FREES(page), &b->free.v[from], count * sizeof(uint32_t));
+                err = write_at(b->fd, page, BTREE_PAGE, newchain.v[i]);
+        }
+        for (size_t i = 0; err == 0 && i < b->dirty_cap; i++) {
+                if (b->dirty[i].live) {
+                        err = write_at(b->fd, b->dirty[i].page, BTREE_PAGE, b->dirty[i].pgno);
+                }
+        }
+        if (err == 0) {
+                err = fdatasync(b->fd);
+        }
+        if (err == 0) {
+                // the root swap
+                b->meta.generation++;
+                b->meta.freelist = newchain.len > 0 ? newchain.v[0] : 0;
+                b->meta.nfree = b->free.len;
+                b->meta.checksum = meta_checksum(&b->meta);
+                err = write_at(b->fd, &b->meta, sizeof(struct meta), b->meta.generation % 2);
+        }
+        if (err == 0) {
+                err = fdatasync(b->fd);
+        }
+        free(newchain.v);
+        write_end(b);
+        return err != 0 ? ERR_BACKEND_COMMIT : 0;
+}
+
+static void btree_close(backend_t *backend) {
+        struct backend_btree *b = (struct backend_btree*)backend;
+        // uncommitted changes are dropped
+        write_end(b);
+        close(b->fd);
+        free(b->free.v);
+        free(b->freed.v);
+        free(b->chain.v);
+        free(b);
+}
+
+const backend_ops_t backend_btree = {
+        .scheme = "btree",
+        .open = btree_open,
+        .lookup = btree_lookup,
+        .upsert = btree_upsert,
+        .remove = btree_remove,
+        .iterate = btree_iterate,
+        .scan = btree_scan,
+        .get_attempts = btree_get_attempts,
+        .set_attempts = btree_set_attempts,
+        .commit = btree_commit,
+        .close = btree_close,
+};
@@ -0,0 +1,310 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#include "backend.h"
+#include "users.h"
+#include "state.h"
+#include "txn.h"
+#include "delta.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Text files backend: the users file and the attempts state file, each
+ * loaded on first use. Commit rewrites the changed files in one txn, with
+ * the next generation of the users file when it is tracked, see delta.h,
+ * unless the commit is BACKEND_COMMIT_LOCAL.
+ */
+
+struct backend_text {
+        backend_t       base;
+        char            *path;
+        char            *statepath;
+
+        users_t         *users;         // NULL until loaded
+        state_t         *state;         // NULL until loaded
+        delta_changes_t *changes;       // users changed since the last commit
+        bool            users_changed;
+        bool            state_changed;
+        int             lockfd;         // users_lock, -1 - not locked
+};
+
+static int text_users(struct backend_text *b) {
+        if (b->users != NULL) {
+                return 0;
+        }
+        b->users = users_new(10);
+        if (b->users == NULL) {
+                return ERR_BACKEND_READ;
+        }
+        int err = users_load_threads(b->users, b->path, 0);
+        if (err != 0) {
+                users_free(b->users);
+                b->users = NULL;
+                b->base.cause = err;
+                return ERR_BACKEND_READ;
+        }
+        return 0;
+}
+
+static int text_state(struct backend_text *b) {
+        if (b->state != NULL) {
+                return 0;
+        }
+        if (b->statepath == NULL) {
+                return ERR_BACKEND_READ;
+        }
+        b->state = state_new();
+        if (b->state == NULL) {
+                return ERR_BACKEND_READ;
+        }
+        int err = state_load(b->state, b->statepath);
+        if (err != 0) {
+                state_free(b->state);
+                b->state = NULL;
+                b->base.cause = err;
+                return ERR_BACKEND_READ;
+        }
+        return 0;
+}
+
+static void text_close(backend_t *backend);
+
+static int text_open(backend_t **backend, const char *path, const char *statepath) {
+        struct backend_text *b = malloc(sizeof(struct backend_text));
+        if (b == NULL) {
+                return ERR_BACKEND_OPEN;
+        }
+        memset(b, 0, sizeof(struct backend_text));
+        b->lockfd = -1;
+        b->path = strdup(path);
+        b->statepath = statepath != NULL ? strdup(statepath) : NULL;
+        b->changes = delta_changes_new();
+        if (b->path == NULL || (statepath != NULL && b->statepath == NULL) ||
+                        b->changes == NULL) {
+                text_close(&b->base);
+                return ERR_BACKEND_OPEN;
+        }
+        *backend = &b->base;
+        return 0;
+}
+
+static int text_lookup(backend_t *backend, const char *username, user_t *user) {
+        struct backend_text *b = (struct backend_text*)backend;
+        int err = text_users(b);
+        if (err != 0) {
+                return err;
+        }
+        err = users_find(b->users, username, user);
+        if (err == ERR_USERS_USER_NOT_FOUND) {
+                return ERR_BACKEND_NOT_FOUND;
+        }
+        if (err != 0) {
+                backend->cause = err;
+                return ERR_BACKEND_READ;
+        }
+        return 0;
+}
+
+static int text_upsert(backend_t *backend, const char *username,
+                       const kdf_params_t *kdf, const pin_hash_t pin_hash) {
+        struct backend_text *b = (struct backend_text*)backend;
+        int err = text_users(b);
+        if (err != 0) {
+                return err;
+        }
+        err = users_set(b->users, username, kdf, pin_hash);
+        if (err != 0) {
+                backend->cause = err;
+                return ERR_BACKEND_WRITE;
+        }
+        if (delta_changes_add(b->changes, username) != 0) {
+                return ERR_BACKEND_WRITE;
+        }
+        b->users_changed = true;
+        return 0;
+}
+
+static int text_remove(backend_t *backend, const char *username) {
+        struct backend_text *b = (struct backend_text*)backend;
+        int err = text_users(b);
+        if (err != 0) {
+                return err;
+        }
+        err = users_remove(b->users, username);
+        if (err == ERR_USERS_USER_NOT_FOUND) {
+                return ERR_BACKEND_NOT_FOUND;
+        }
+        if (err != 0) {
+                backend->cause = err;
+                return ERR_BACKEND_WRITE;
+        }
+        if (delta_changes_add(b->changes, username) != 0) {
+                return ERR_BACKEND_WRITE;
+        }
+        b->users_changed = true;
+        return 0;
+}
+
+static int text_iterate(backend_t *backend, backend_visit_fn visit, void *ctx) {
+        struct backend_text *b = (struct backend_text*)backend;
+        int err = text_users(b);
+        if (err != 0) {
+                return err;
+        }
+        user_t *user = user_new();
+        user_iterator_t *iter = users_iterate(b->users);
+        if (user == NULL || iter == NULL) {
+                user_free(user);
+                users_iterator_free(iter);
+                return ERR_BACKEND_READ;
+        }
+        while (err == 0 && users_iterator_next(iter, user)) {
+                err = visit(ctx, user);
+        }
+        users_iterator_free(iter);
+        user_free(user);
+        return err;
+}
+
+static int text_scan(backend_t *backend, const char *prefix, const char *after,
+                     backend_visit_fn visit, void *ctx) {
+        struct backend_text *b = (struct backend_text*)backend;
+        int err = text_users(b);
+        if (err != 0) {
+                return err;
+        }
+        err = users_scan_prefix(b->users, prefix, after, visit, ctx);
+        if (err == -1) {
+                return ERR_BACKEND_READ;
+        }
+        return err;
+}
+
+static int text_get_attempts(backend_t *backend, const char *username, uint8_t *attempts) {
+        struct backend_text *b = (struct backend_text*)backend;
+        int err = text_state(b);
+        if (err != 0) {
+                return err;
+        }
+        *attempts = 0;
+        state_get_attempts(b->state, username, attempts);
+        return 0;
+}
+
+static int text_set_attempts(backend_t *backend, const char *username, uint8_t attempts) {
+        struct backend_text *b = (struct backend_text*)backend;
+        int err = text_state(b);
+        if (err != 0) {
+                return err;
+        }
+        state_set_attempts(b->state, username, attempts);
+        b->state_changed = true;
+        return 0;
+}
+
+static int text_write(txn_t *txn, const char *path, users_t *users, state_t *state) {
+        const char *tmppath = NULL;
+        if (txn_add(txn, path, &tmppath) != 0) {
+                return ERR_BACKEND_COMMIT;
+        }
+        FILE *f = fopen(tmppath, "w");
+        if (f == NULL) {
+                return ERR_BACKEND_COMMIT;
+        }
+        int err = users != NULL ? users_write(users, f) : state_write(state, f);
+        if (fclose(f) != 0 || err != 0) {
+                return ERR_BACKEND_COMMIT;
+        }
+        return 0;
+}
+
+static int text_commit(backend_t *backend, int flags) {
+        struct backend_text *b = (struct backend_text*)backend;
+        if (!b->users_changed && !b->state_changed) {
+                return 0;
+        }
+        txn_t *txn = txn_new();
+        if (txn == NULL) {
+                return ERR_BACKEND_COMMIT;
+        }
+        int err = 0;
+        if (b->users_changed) {
+                err = text_write(txn, b->path, b->users, NULL);
+        }
+        if (err == 0 && b->state_changed) {
+                err = text_write(txn, b->statepath, NULL, b->state);
+        }
+        if (err == 0 && b->users_changed && !(flags & BACKEND_COMMIT_LOCAL)) {
+                err = delta_changes_commit(b->changes, b->users, b->path, txn);
+                if (err != 0) {
+                        backend->cause = err;
+                        err = ERR_BACKEND_COMMIT;
+                }
+        }
+        if (err == 0) {
+                err = txn_commit(txn);
+                if (err != 0) {
+                        backend->cause = err;
+                        err = ERR_BACKEND_COMMIT;
+                }
+        }
+        txn_free(txn);
+        if (err == 0) {
+                b->users_changed = false;
+                b->state_changed = false;
+                delta_changes_clear(b->changes);
+        }
+        return err;
+}
+
+static int text_lock(backend_t *backend, bool wait) {
+        struct backend_text *b = (struct backend_text*)backend;
+        if (b->lockfd >= 0) {
+                return 0;
+        }
+        int err = users_lock(b->path, wait, &b->lockfd);
+        if (err == ERR_USERS_BUSY) {
+                return ERR_BACKEND_BUSY;
+        }
+        if (err != 0) {
+                backend->cause = err;
+                return ERR_BACKEND_LOCK;
+        }
+        return 0;
+}
+
+static void text_close(backend_t *backend) {
+        struct backend_text *b = (struct backend_text*)backend;
+        users_unlock(b->lockfd);
+        if (b->users != NULL) {
+                users_free(b->users);
+        }
+        if (b->state != NULL) {
+                state_free(b->state);
+        }
+        delta_changes_free(b->changes);
+        free(b->path);
+        free(b->statepath);
+        free(b);
+}
+
+const backend_ops_t backend_text = {
+        .scheme = "text",
+        .attempts_apart = true,
+        .open = text_open,
+        .lookup = text_lookup,
+        .upsert = text_upsert,
+        .remove = text_remove,
+        .iterate = text_iterate,
+        .scan = text_scan,
+        .get_attempts = text_get_attempts,
+        .set_attempts = text_set_attempts,
+        .commit = text_commit,
+        .close = text_close,
+        .lock = text_lock,
+};
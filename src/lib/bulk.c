@@ -0,0 +1,522 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#define _GNU_SOURCE
+#include "bulk.h"
+#include "kdf.h"
+#include "hashmap.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// records per thread: a SHA-256 of a PIN is cheaper than starting a
+// thread, a costly KDF takes milliseconds and is worth a thread per record
+#define BULK_HASH_MIN_CHUNK 1024
+#define BULK_HASH_MIN_CHUNK_KDF 1
+
+struct hash_job {
+        bulk_record_t   *records;
+        const kdf_params_t *kdf;
+        size_t          from;
+        size_t          to;
+        int             err;
+};
+
+static int bulk_push(bulk_t *bulk, bulk_record_t *record);
+static int bulk_scan_csv(char *line, bulk_record_t *record);
+static int bulk_scan_jsonl(char *line, bulk_record_t *record);
+static int json_scan_string(char **pos, char **out);
+static void *bulk_hash_worker(void *arg);
+static size_t bulk_hash_min_chunk(const kdf_params_t *kdf);
+
+bulk_t* bulk_new() {
+        bulk_t *bulk = malloc(sizeof(bulk_t));
+        if (bulk == NULL) {
+                return NULL;
+        }
+        bulk->records = NULL;
+        bulk->len = 0;
+        bulk->cap = 0;
+        bulk->err_line = 0;
+        return bulk;
+}
+
+int bulk_parse_format(const char *name, bulk_format_t *format) {
+        if (strcmp(name, "csv") == 0) {
+                *format = BULK_FORMAT_CSV;
+        } else if (strcmp(name, "jsonl") == 0) {
+                *format = BULK_FORMAT_JSONL;
+        } else {
+                return ERR_BULK_INVALID_FORMAT;
+        }
+        return 0;
+}
+
+int bulk_read(bulk_t *bulk, FILE *in, bulk_format_t format) {
+        int err = 0;
+        hashmap_t *seen = hashmap_new(0);
+        if (seen == NULL) {
+                return -1;
+        }
+
+        char *line = NULL;
+        size_t len = 0;
+        size_t lineno = 0;
+        ssize_t read;
+        while ((read = getline(&line, &len, in)) != -1) {
+                lineno++;
+                while (read > 0 && (line[read - 1] == '\n' || line[read - 1] == '\r')) {
+                        line[--read] = '\0';
+                }
+                if (read == 0 || line[0] == '#') {
+                        continue;
+                }
+
+                bulk_record_t record;
+                memset(&record, 0, sizeof(bulk_record_t));
+                record.line = lineno;
+                if (format == BULK_FORMAT_CSV) {
+                        // optional header line
+                        if (bulk->len == 0 && (strcmp(line, "username,pin") == 0 ||
+                                               strcmp(line, "username,hash") == 0)) {
+                                continue;
+                        }
+                        err = bulk_scan_csv(line, &record);
+                } else {
+                        err = bulk_scan_jsonl(line, &record);
+                }
+                if (err == 0 && hashmap_get(seen, record.username, NULL)) {
+                        err = ERR_BULK_DUPLICATE;
+                }
+                if (err == 0) {
+                        err = bulk_push(bulk, &record);
+                }
+                if (err != 0) {
+                        free(record.username);
+                        bulk->err_line = lineno;
+                        break;
+                }
+                // usernames are separately allocated, safe to borrow
+                err = hashmap_put(seen, bulk->records[bulk->len - 1].username, 0);
+                if (err != 0) {
+                        break;
+                }
+        }
+        if (err == 0 && ferror(in)) {
+                err = ERR_BULK_READ;
+        }
+        free(line);
+        hashmap_free(seen);
+        return err;
+}
+
+int bulk_hash(bulk_t *bulk, const kdf_params_t *kdf, int threads) {
+        if (threads <= 0) {
+                long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                threads = cpus > 0 ? (int)cpus : 1;
+        }
+        const size_t min_chunk = bulk_hash_min_chunk(kdf);
+        size_t max_threads = (bulk->len + min_chunk - 1) / min_chunk;
+        if ((size_t)threads > max_threads) {
+                threads = max_threads > 0 ? (int)max_threads : 1;
+        }
+
+        struct hash_job jobs[threads];
+        pthread_t tids[threads];
+        const size_t chunk = (bulk->len + threads - 1) / threads;
+        int started = 0;
+        int err = 0;
+        for (int i = 0; i < threads; i++) {
+                jobs[i].records = bulk->records;
+                jobs[i].kdf = kdf;
+                jobs[i].from = i * chunk < bulk->len ? i * chunk : bulk->len;
+                jobs[i].to = jobs[i].from + chunk < bulk->len ?
+                        jobs[i].from + chunk : bulk->len;
+                jobs[i].err = 0;
+                if (i == 0) {
+                        continue; // first chunk is hashed by the caller
+                }
+                if (pthread_create(&tids[i], NULL, bulk_hash_worker, &jobs[i]) != 0) {
+                        err = ERR_BULK_THREAD;
+                        break;
+                }
+                started = i;
+        }
+        bulk_hash_worker(&jobs[0]);
+        for (int i = 1; i <= started; i++) {
+                pthread_join(tids[i], NULL);
+        }
+        if (err != 0) {
+                return err;
+        }
+        for (int i = 0; i < threads; i++) {
+                if (jobs[i].err != 0) {
+                        bulk->err_line = bulk->records[jobs[i].from].line;
+                        return ERR_BULK_HASH;
+                }
+        }
+        return 0;
+}
+
+int bulk_apply(bulk_t *bulk, backend_t *store, bool update) {
+        // validate the whole set first to keep the store untouched on error
+        for (size_t i = 0; i < bulk->len; i++) {
+                bulk_record_t *record = &bulk->records[i];
+                if (!record->hashed) {
+                        bulk->err_line = record->line;
+                        return ERR_BULK_HASH;
+                }
+                if (update) {
+                        continue;
+                }
+                int err = backend_lookup(store, record->username, NULL);
+                if (err == 0) {
+                        bulk->err_line = record->line;
+                        return ERR_BULK_EXISTS;
+                }
+                if (err != ERR_BACKEND_NOT_FOUND) {
+                        bulk->err_line = record->line;
+                        return ERR_BULK_STORE;
+                }
+        }
+        for (size_t i = 0; i < bulk->len; i++) {
+                bulk_record_t *record = &bulk->records[i];
+                int err = backend_upsert(store, record->username, &record->kdf,
+                                         record->pin_hash);
+                if (err != 0) {
+                        bulk->err_line = record->line;
+                        return ERR_BULK_STORE;
+                }
+        }
+        return 0;
+}
+
+struct export_ctx {
+        FILE            *out;
+        bulk_format_t   format;
+        int             err;    // bulk error which stopped the export
+};
+
+static int export_user(void *ctx, user_t *user) {
+        struct export_ctx *export = ctx;
+        pin_hash_t pin_hash;
+        kdf_params_t kdf;
+        char prefix[KDF_PREFIX_MAX];
+        const char *name = user_get_name(user);
+        if (name == NULL) {
+                export->err = -1;
+                return -1;
+        }
+        user_get_pin_hash(user, pin_hash);
+        user_get_kdf(user, &kdf);
+        if (kdf_format(&kdf, prefix, sizeof(prefix)) != 0) {
+                free((void*)name);
+                export->err = ERR_BULK_WRITE;
+                return -1;
+        }
+        if (export->format == BULK_FORMAT_CSV) {
+                fprintf(export->out, "%s,%s%.*s\n", name, prefix, PIN_HASH_LEN, pin_hash);
+        } else {
+                fprintf(export->out, "{\"user\":");
+                bulk_json_string(export->out, name);
+                fprintf(export->out, ",\"hash\":\"%s%.*s\"}\n", prefix, PIN_HASH_LEN, pin_hash);
+        }
+        free((void*)name);
+        if (ferror(export->out)) {
+                export->err = ERR_BULK_WRITE;
+                return -1;
+        }
+        return 0;
+}
+
+int bulk_export(backend_t *store, FILE *out, bulk_format_t format) {
+        struct export_ctx export = { .out = out, .format = format, .err = 0 };
+        int err = backend_iterate(store, export_user, &export);
+        if (export.err != 0) {
+                err = export.err;
+        } else if (err != 0) {
+                err = ERR_BULK_STORE;
+        }
+        if (err == 0 && fflush(out) != 0) {
+                err = ERR_BULK_WRITE;
+        }
+        return err;
+}
+
+bool bulk_valid_username(const char *username) {
+        if (username == NULL || *username == '\0') {
+                return false;
+        }
+        for (const unsigned char *p = (const unsigned char*)username; *p; p++) {
+                // ':' separates fields in users file, ',' in CSV
+                if (*p <= ' ' || *p == 0x7f || *p == ':' || *p == ',') {
+                        return false;
+                }
+        }
+        return true;
+}
+
+void bulk_free(bulk_t *bulk) {
+        for (size_t i = 0; i < bulk->len; i++) {
+                free(bulk->records[i].username);
+        }
+        // records may hold plain PINs
+        if (bulk->records != NULL) {
+                memset(bulk->records, 0, bulk->cap * sizeof(bulk_record_t));
+        }
+        free(bulk->records);
+        free(bulk);
+}
+
+static int bulk_push(bulk_t *bulk, bulk_record_t *record) {
+        if (bulk->len == bulk->cap) {
+                const size_t newcap = bulk->cap == 0 ? 64 : bulk->cap * 2;
+                bulk_record_t *records = realloc(bulk->records,
+                                                 newcap * sizeof(bulk_record_t));
+                if (records == NULL) {
+                        return -1;
+                }
+                bulk->records = records;
+                bulk->cap = newcap;
+        }
+        bulk->records[bulk->len++] = *record;
+        return 0;
+}
+
+static int bulk_scan_csv(char *line, bulk_record_t *record) {
+        // <username>,<secret>
+        char *comma = strchr(line, ',');
+        if (comma == NULL) {
+                return ERR_BULK_INVALID_FORMAT;
+        }
+        *comma = '\0';
+        if (!bulk_valid_username(line)) {
+                return ERR_BULK_INVALID_USER;
+        }
+        int err = bulk_parse_secret(comma + 1, record);
+        if (err != 0) {
+                return err;
+        }
+        record->username = strdup(line);
+        if (record->username == NULL) {
+                return -1;
+        }
+        return 0;
+}
+
+static int bulk_scan_jsonl(char *line, bulk_record_t *record) {
+        // flat object with string values only
+        char *pos = line;
+        char *user = NULL;
+        char *secret = NULL;
+        int err = 0;
+
+        while (isspace((unsigned char)*pos)) pos++;
+        if (*pos++ != '{') {
+                return ERR_BULK_INVALID_FORMAT;
+        }
+        for (;;) {
+                while (isspace((unsigned char)*pos)) pos++;
+                if (*pos == '}') {
+                        pos++;
+                        break;
+                }
+                char *key = NULL;
+                char *value = NULL;
+                err = json_scan_string(&pos, &key);
+                if (err != 0) {
+                        goto BULK_SCAN_JSONL_RET;
+                }
+                while (isspace((unsigned char)*pos)) pos++;
+                if (*pos++ != ':') {
+                        free(key);
+                        err = ERR_BULK_INVALID_FORMAT;
+                        goto BULK_SCAN_JSONL_RET;
+                }
+                while (isspace((unsigned char)*pos)) pos++;
+                err = json_scan_string(&pos, &value);
+                if (err != 0) {
+                        free(key);
+                        goto BULK_SCAN_JSONL_RET;
+                }
+                if (strcmp(key, "user") == 0 && user == NULL) {
+                        user = value;
+                } else if ((strcmp(key, "pin") == 0 || strcmp(key, "hash") == 0) &&
+                                secret == NULL) {
+                        secret = value;
+                } else {
+                        free(value);
+                        err = ERR_BULK_INVALID_FORMAT;
+                }
+                free(key);
+                if (err != 0) {
+                        goto BULK_SCAN_JSONL_RET;
+                }
+                while (isspace((unsigned char)*pos)) pos++;
+                if (*pos == ',') {
+                        pos++;
+                }
+        }
+        while (isspace((unsigned char)*pos)) pos++;
+        if (*pos != '\0' || user == NULL || secret == NULL) {
+                err = ERR_BULK_INVALID_FORMAT;
+                goto BULK_SCAN_JSONL_RET;
+        }
+        if (!bulk_valid_username(user)) {
+                err = ERR_BULK_INVALID_USER;
+                goto BULK_SCAN_JSONL_RET;
+        }
+        err = bulk_parse_secret(secret, record);
+        if (err != 0) {
+                goto BULK_SCAN_JSONL_RET;
+        }
+        record->username = user;
+        user = NULL;
+
+BULK_SCAN_JSONL_RET:
+        free(user);
+        if (secret != NULL) {
+                memset(secret, 0, strlen(secret));
+        }
+        free(secret);
+        return err;
+}
+
+int bulk_parse_secret(const char *value, bulk_record_t *record) {
+        const size_t len = strlen(value);
+        if (len == PIN_SOURCE_LEN) {
+                for (size_t i = 0; i < PIN_SOURCE_LEN; i++) {
+                        if (value[i] < '0' || value[i] > '9') {
+                                return ERR_BULK_INVALID_PIN;
+                        }
+                        record->pin[i] = value[i] - '0';
+                }
+                record->hashed = false;
+                return 0;
+        }
+        const char *hash = NULL;
+        if (kdf_parse(value, &record->kdf, &hash) != 0) {
+                return ERR_BULK_INVALID_PIN;
+        }
+        if (strlen(hash) != PIN_HASH_LEN) {
+                return ERR_BULK_INVALID_PIN;
+        }
+        for (size_t i = 0; i < PIN_HASH_LEN; i++) {
+                if (!isxdigit((unsigned char)hash[i])) {
+                        return ERR_BULK_INVALID_PIN;
+                }
+                record->pin_hash[i] = tolower((unsigned char)hash[i]);
+        }
+        record->hashed = true;
+        return 0;
+}
+
+static int json_scan_string(char **pos, char **out) {
+        char *p = *pos;
+        if (*p++ != '"') {
+                return ERR_BULK_INVALID_FORMAT;
+        }
+        // decoded string is never longer than the encoded one
+        char *value = malloc(strlen(p) + 1);
+        if (value == NULL) {
+                return -1;
+        }
+        size_t n = 0;
+        while (*p != '"') {
+                char c = *p++;
+                if (c == '\0') {
+                        free(value);
+                        return ERR_BULK_INVALID_FORMAT;
+                }
+                if (c == '\\') {
+                        c = *p++;
+                        switch (c) {
+                                case '"': case '\\': case '/': break;
+                                case 'n': c = '\n'; break;
+                                case 't': c = '\t'; break;
+                                case 'r': c = '\r'; break;
+                                case 'b': c = '\b'; break;
+                                case 'f': c = '\f'; break;
+                                case 'u': {
+                                        // only ASCII escapes are meaningful here
+                                        unsigned int code = 0;
+                                        for (int i = 0; i < 4; i++) {
+                                                if (!isxdigit((unsigned char)p[i])) {
+                                                        free(value);
+                                                        return ERR_BULK_INVALID_FORMAT;
+                                                }
+                                                code = code * 16 + (isdigit((unsigned char)p[i]) ?
+                                                        p[i] - '0' : (tolower((unsigned char)p[i]) - 'a' + 10));
+                                        }
+                                        if (code == 0 || code > 0x7f) {
+                                                free(value);
+                                                return ERR_BULK_INVALID_FORMAT;
+                                        }
+                                        p += 4;
+                                        c = (char)code;
+                                        break;
+                                }
+                                default:
+                                        free(value);
+                                        return ERR_BULK_INVALID_FORMAT;
+                        }
+                }
+                value[n++] = c;
+        }
+        value[n] = '\0';
+        *pos = p + 1;
+        *out = value;
+        return 0;
+}
+
+void bulk_json_string(FILE *out, const char *value) {
+        fputc('"', out);
+        for (const unsigned char *p = (const unsigned char*)value; *p; p++) {
+                if (*p == '"' || *p == '\\') {
+                        fprintf(out, "\\%c", *p);
+                } else if (*p < 0x20) {
+                        fprintf(out, "\\u%04x", *p);
+                } else {
+                        fputc(*p, out);
+                }
+        }
+        fputc('"', out);
+}
+
+static size_t bulk_hash_min_chunk(const kdf_params_t *kdf) {
+        switch (kdf->alg) {
+                case KDF_SHA256:
+                case KDF_SHA256_PEPPER:
+                        return BULK_HASH_MIN_CHUNK;
+                default:
+                        return BULK_HASH_MIN_CHUNK_KDF;
+        }
+}
+
+static void *bulk_hash_worker(void *arg) {
+        struct hash_job *job = arg;
+        for (size_t i = job->from; i < job->to; i++) {
+                bulk_record_t *record = &job->records[i];
+                if (record->hashed) {
+                        continue;
+                }
+                record->kdf = *job->kdf;
+                int err = kdf_salt(&record->kdf);
+                if (err == 0) {
+                        err = kdf_hash(&record->kdf, record->pin, record->pin_hash);
+                }
+                memset(record->pin, 0, PIN_SOURCE_LEN);
+                if (err != 0) {
+                        job->err = err;
+                        job->from = i; // report the failed record
+                        return NULL;
+                }
+                record->hashed = true;
+        }
+        return NULL;
+}
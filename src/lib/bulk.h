@@ -0,0 +1,92 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#ifndef _BULK_H
+#define _BULK_H
+
+#include "types.h"
+#include "users.h"
+#include "backend.h"
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Bulk import and export of users.
+ *
+ * CSV format, one record per line, `#` starts a comment:
+ *   <username>,<pin:4 digits | pin_hash:[kdf prefix]64 hex>
+ *
+ * JSONL format, one object per line:
+ *   {"user": "<username>", "pin": "<4 digits>"}
+ *   {"user": "<username>", "hash": "[kdf prefix]<64 hex>"}
+ *
+ * Pin hashes are the users file record values, see kdf.h.
+ */
+
+typedef enum {
+        BULK_FORMAT_CSV = 0,
+        BULK_FORMAT_JSONL,
+} bulk_format_t;
+
+typedef enum {
+        ERR_BULK_READ = 1,
+        ERR_BULK_WRITE,
+        ERR_BULK_INVALID_FORMAT,
+        ERR_BULK_INVALID_USER,
+        ERR_BULK_INVALID_PIN,
+        ERR_BULK_DUPLICATE,
+        ERR_BULK_EXISTS,
+        ERR_BULK_HASH,
+        ERR_BULK_THREAD,
+        ERR_BULK_STORE,         // see backend_cause
+} bulk_error_t;
+
+typedef struct bulk_record {
+        char            *username;
+        bool            hashed;         // pin_hash is set, pin is cleared
+        pin_source_t    pin;
+        kdf_params_t    kdf;
+        pin_hash_t      pin_hash;
+        size_t          line;
+} bulk_record_t;
+
+typedef struct bulk {
+        bulk_record_t   *records;
+        size_t          len;
+        size_t          cap;
+
+        size_t          err_line;       // input line of the failed record
+} bulk_t;
+
+bulk_t* bulk_new();
+
+int bulk_parse_format(const char *name, bulk_format_t *format);
+
+// read and validate all records, duplicated usernames are rejected.
+int bulk_read(bulk_t *bulk, FILE *in, bulk_format_t format);
+
+// hash plain PINs with kdf and a fresh salt for each record,
+// using `threads` workers, 0 - one per online CPU.
+int bulk_hash(bulk_t *bulk, const kdf_params_t *kdf, int threads);
+
+// apply hashed records to the store, nothing is changed on error;
+// the caller commits the store.
+int bulk_apply(bulk_t *bulk, backend_t *store, bool update);
+
+int bulk_export(backend_t *store, FILE *out, bulk_format_t format);
+
+bool bulk_valid_username(const char *username);
+
+// print the value as a quoted JSON string.
+void bulk_json_string(FILE *out, const char *value);
+
+// parse 4 digits PIN or a PIN hash record value into the record.
+int bulk_parse_secret(const char *value, bulk_record_t *record);
+
+void bulk_free(bulk_t *bulk);
+
+#endif
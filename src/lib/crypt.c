@@ -42,8 +42,11 @@ int hash_pin(const pin_source_t pin, pin_hash_t output) {
                 goto HASH_PIN_RET;
         }
 
+        // sprintf would write a terminating NUL past the output buffer
+        static const char hex[] = "0123456789abcdef";
         for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-                sprintf((char *)output + (i * 2), "%02x", hash[i]);
+                output[i * 2] = hex[hash[i] >> 4];
+                output[i * 2 + 1] = hex[hash[i] & 0x0f];
         }
 
 HASH_PIN_RET:
@@ -51,3 +54,104 @@ HASH_PIN_RET:
         return err;
 }
 
+bool hash_is_hex(const pin_hash_t pin_hash) {
+        for (size_t i = 0; i < PIN_HASH_LEN; i++) {
+                const uint8_t c = pin_hash[i];
+                if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+static const uint32_t sha256_k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t sha256_iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_compress(uint32_t h[8], const uint8_t block[PIN_PREFIX_LEN]) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+                w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 |
+                        (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+                uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+        uint32_t e = h[4], f = h[5], g = h[6], k = h[7];
+        for (int i = 0; i < 64; i++) {
+                uint32_t s1 = ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25);
+                uint32_t ch = (e & f) ^ (~e & g);
+                uint32_t t1 = k + s1 + ch + sha256_k[i] + w[i];
+                uint32_t s0 = ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22);
+                uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+                uint32_t t2 = s0 + maj;
+                k = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+        h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+int hash_pin_prefix(const uint8_t *pepper, const uint8_t *salt, size_t saltlen,
+                    pin_midstate_t *mid) {
+        if (saltlen > PIN_PREFIX_LEN - PIN_PEPPER_LEN) {
+                return HASH_ERR_DIGEST_UPDATE;
+        }
+        uint8_t block[PIN_PREFIX_LEN];
+        memset(block, 0, PIN_PREFIX_LEN);
+        memcpy(block, pepper, PIN_PEPPER_LEN);
+        memcpy(block + PIN_PEPPER_LEN, salt, saltlen);
+        memcpy(mid->h, sha256_iv, sizeof(sha256_iv));
+        sha256_compress(mid->h, block);
+        memset(block, 0, PIN_PREFIX_LEN);
+        return 0;
+}
+
+void hash_pin_midstate(const pin_midstate_t *mid, const pin_source_t pin,
+                       pin_hash_t output) {
+        // final block: pin, 0x80, zeros, 64-bit big endian message length in bits
+        uint8_t block[PIN_PREFIX_LEN];
+        memset(block, 0, PIN_PREFIX_LEN);
+        memcpy(block, pin, PIN_SOURCE_LEN);
+        block[PIN_SOURCE_LEN] = 0x80;
+        const uint64_t bits = (uint64_t)(PIN_PREFIX_LEN + PIN_SOURCE_LEN) * 8;
+        for (int i = 0; i < 8; i++) {
+                block[PIN_PREFIX_LEN - 1 - i] = (uint8_t)(bits >> (i * 8));
+        }
+        uint32_t h[8];
+        memcpy(h, mid->h, sizeof(h));
+        sha256_compress(h, block);
+        memset(block, 0, PIN_PREFIX_LEN);
+
+        static const char hex[] = "0123456789abcdef";
+        for (int i = 0; i < 8; i++) {
+                for (int j = 0; j < 4; j++) {
+                        const uint8_t byte = (uint8_t)(h[i] >> (24 - j * 8));
+                        output[(i * 4 + j) * 2] = hex[byte >> 4];
+                        output[(i * 4 + j) * 2 + 1] = hex[byte & 0x0f];
+                }
+        }
+}
@@ -8,6 +8,10 @@
 
 #include "types.h"
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
 typedef enum {
         HASH_ERR_CTX = 1,
         HASH_ERR_DIGEST_INIT,
@@ -17,4 +21,31 @@ typedef enum {
 
 int hash_pin(const pin_source_t pin, pin_hash_t output);
 
+// lowercase hex digits, as the hashes write them and ppedit import
+// stores them; no other hash can match a PIN.
+bool hash_is_hex(const pin_hash_t pin_hash);
+
+/*
+ * Salted and peppered SHA-256:
+ *   SHA-256(pepper ‖ salt ‖ zero padding to 64 bytes ‖ pin)
+ * The prefix fills exactly one SHA-256 block, so its midstate can be
+ * computed once per record and verification compresses only the final
+ * block with the PIN.
+ */
+
+#define PIN_PEPPER_LEN 32
+#define PIN_PREFIX_LEN 64
+
+typedef struct pin_midstate {
+        uint32_t h[8];
+} pin_midstate_t;
+
+// absorb pepper ‖ salt, saltlen must not exceed PIN_PREFIX_LEN - PIN_PEPPER_LEN.
+int hash_pin_prefix(const uint8_t *pepper, const uint8_t *salt, size_t saltlen,
+                    pin_midstate_t *mid);
+
+// finish the hash of the pin from the prefix midstate.
+void hash_pin_midstate(const pin_midstate_t *mid, const pin_source_t pin,
+                       pin_hash_t output);
+
 #endif
@@ -0,0 +1,836 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#define _GNU_SOURCE
+#include "delta.h"
+#include "crypt.h"
+#include "hashmap.h"
+#include "kdf.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#define DELTA_MAGIC "PPDELTA2"
+#define DELTA_MAGIC_LEN 8
+#define DELTA_FROM (DELTA_MAGIC_LEN + DELTA_SOURCE_LEN)
+#define DELTA_HEADER_LEN (DELTA_FROM + 8 + 8 + 4)
+#define DELTA_SUM_LEN 32
+
+// longer usernames are not shipped
+#define DELTA_NAME_MAX 1024
+
+// op, name, alg, cost, memory, parallel, salt, pin hash
+#define DELTA_RECORD_MAX (1 + 2 + DELTA_NAME_MAX + 1 + 12 + KDF_SALT_LEN + PIN_HASH_LEN)
+
+enum {
+        DELTA_UPSERT = 1,
+        DELTA_REMOVE,
+};
+
+// the alg byte of an upsert with an unpacked hash
+#define DELTA_RAW_HASH 0x80
+
+struct change {
+        uint8_t         op;
+        const char      *name;          // not terminated
+        size_t          name_len;
+        kdf_params_t    kdf;            // upsert only
+        pin_hash_t      pin_hash;
+};
+
+struct generation {
+        uint64_t        gen;
+        uint64_t        logsize;        // valid bytes of the log
+        uint8_t         source[DELTA_SOURCE_LEN];
+        bool            replica;        // applies the changesets of source
+        bool            tracked;
+};
+
+struct log_writer {
+        FILE            *out;           // holds the lock of the log
+        uint64_t        size;
+};
+
+struct delta_changes {
+        char            **names;
+        size_t          len;
+        size_t          cap;
+        hashmap_t       *set;           // keys are the names
+};
+
+static int gen_read(const char *userspath, struct generation *g);
+static int gen_write(txn_t *txn, const char *userspath, const struct generation *g);
+static int log_open(struct log_writer *w, const char *userspath, uint64_t logsize);
+static int log_append(struct log_writer *w, uint64_t gen, const struct change *c);
+static int log_close(struct log_writer *w, int err);
+static size_t encode(uint8_t *buf, const struct change *c);
+static int decode(const uint8_t *buf, size_t len, size_t *used, struct change *c);
+
+// little endian
+
+static void put_u16(uint8_t *p, uint16_t v) {
+        p[0] = v;
+        p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+        for (int i = 0; i < 4; i++) {
+                p[i] = v >> (8 * i);
+        }
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+        for (int i = 0; i < 8; i++) {
+                p[i] = v >> (8 * i);
+        }
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+        return p[0] | (uint16_t)p[1] << 8;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+        uint32_t v = 0;
+        for (int i = 3; i >= 0; i--) {
+                v = v << 8 | p[i];
+        }
+        return v;
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+        uint64_t v = 0;
+        for (int i = 7; i >= 0; i--) {
+                v = v << 8 | p[i];
+        }
+        return v;
+}
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static uint8_t hex_value(uint8_t c) {
+        return c <= '9' ? c - '0' : c - 'a' + 10;
+}
+
+static char* side_path(const char *userspath, const char *ext) {
+        char *path = NULL;
+        return asprintf(&path, "%s%s", userspath, ext) < 0 ? NULL : path;
+}
+
+int delta_generation(const char *userspath, uint64_t *gen) {
+        struct generation g;
+        int err = gen_read(userspath, &g);
+        *gen = g.gen;
+        return err;
+}
+
+int delta_init(const char *userspath, uint64_t *gen) {
+        struct generation g;
+        int err = gen_read(userspath, &g);
+        if (err != 0 || g.tracked) {
+                *gen = g.gen;
+                return err;
+        }
+
+        users_t *users = users_new(10);
+        user_t *user = user_new();
+        user_iterator_t *iter = NULL;
+        txn_t *txn = txn_new();
+        if (users == NULL || user == NULL || txn == NULL) {
+                err = -1;
+                goto DELTA_INIT_RET;
+        }
+        if (users_load_threads(users, userspath, 0) != 0) {
+                err = ERR_DELTA_USERS;
+                goto DELTA_INIT_RET;
+        }
+        iter = users_iterate(users);
+        if (iter == NULL) {
+                err = -1;
+                goto DELTA_INIT_RET;
+        }
+
+        // every user is a change of the first generation
+        struct log_writer w;
+        err = log_open(&w, userspath, 0);
+        if (err != 0) {
+                goto DELTA_INIT_RET;
+        }
+        while (err == 0 && users_iterator_next(iter, user)) {
+                struct change c = {.op = DELTA_UPSERT};
+                c.name = user_get_name(user);
+                if (c.name == NULL) {
+                        err = -1;
+                        break;
+                }
+                c.name_len = strlen(c.name);
+                user_get_kdf(user, &c.kdf);
+                user_get_pin_hash(user, c.pin_hash);
+                err = log_append(&w, 1, &c);
+                free((void*)c.name);
+        }
+        err = log_close(&w, err);
+        g.gen = 1;
+        g.logsize = w.size;
+        if (err == 0 && RAND_bytes(g.source, DELTA_SOURCE_LEN) != 1) {
+                err = -1;
+        }
+        if (err == 0) {
+                err = gen_write(txn, userspath, &g);
+        }
+        if (err == 0 && txn_commit(txn) != 0) {
+                err = ERR_DELTA_WRITE;
+        }
+        if (err == 0) {
+                *gen = g.gen;
+        }
+
+DELTA_INIT_RET:
+        users_iterator_free(iter);
+        user_free(user);
+        users_free(users);
+        txn_free(txn);
+        return err;
+}
+
+int delta_export(const char *userspath, uint64_t from, uint64_t to, FILE *out,
+                 delta_info_t *info) {
+        memset(info, 0, sizeof(delta_info_t));
+        struct generation g;
+        int err = gen_read(userspath, &g);
+        if (err != 0) {
+                return err;
+        }
+        if (!g.tracked) {
+                return ERR_DELTA_DISABLED;
+        }
+        if (from > to || to > g.gen) {
+                return ERR_DELTA_GENERATION;
+        }
+
+        char *logpath = side_path(userspath, ".log");
+        const uint8_t *log = NULL;
+        struct change *list = NULL;
+        char **keys = NULL;
+        size_t len = 0;
+        size_t cap = 0;
+        hashmap_t *index = hashmap_new(16);
+        EVP_MD_CTX *md = EVP_MD_CTX_new();
+        if (logpath == NULL || index == NULL || md == NULL) {
+                err = -1;
+                goto DELTA_EXPORT_RET;
+        }
+        if (g.logsize > 0) {
+                int fd = open(logpath, O_RDONLY | O_CLOEXEC);
+                struct stat st;
+                if (fd < 0 || fstat(fd, &st) != 0) {
+                        err = ERR_DELTA_OPEN;
+                } else if ((uint64_t)st.st_size < g.logsize) {
+                        err = ERR_DELTA_FORMAT;
+                } else {
+                        void *base = mmap(NULL, g.logsize, PROT_READ, MAP_PRIVATE, fd, 0);
+                        log = base != MAP_FAILED ? base : NULL;
+                        err = log != NULL ? 0 : ERR_DELTA_READ;
+                }
+                if (fd >= 0) {
+                        close(fd);
+                }
+                if (err != 0) {
+                        goto DELTA_EXPORT_RET;
+                }
+        }
+
+        // the last change of every user, in the order of the first ones
+        for (size_t pos = 0; pos < g.logsize;) {
+                if (g.logsize - pos < 8) {
+                        err = ERR_DELTA_FORMAT;
+                        break;
+                }
+                const uint64_t gen = get_u64(log + pos);
+                struct change c;
+                size_t used = 0;
+                err = decode(log + pos + 8, g.logsize - pos - 8, &used, &c);
+                if (err != 0 || gen > to) {
+                        break;
+                }
+                pos += 8 + used;
+                if (gen <= from) {
+                        continue;
+                }
+                char *key = strndup(c.name, c.name_len);
+                if (key == NULL) {
+                        err = -1;
+                        break;
+                }
+                uint32_t at;
+                if (hashmap_get(index, key, &at)) {
+                        list[at] = c;
+                        free(key);
+                        continue;
+                }
+                if (len == cap) {
+                        cap = cap > 0 ? cap * 2 : 64;
+                        struct change *grown = realloc(list, cap * sizeof(struct change));
+                        char **grown_keys = realloc(keys, cap * sizeof(char*));
+                        if (grown != NULL) {
+                                list = grown;
+                        }
+                        if (grown_keys != NULL) {
+                                keys = grown_keys;
+                        }
+                        if (grown == NULL || grown_keys == NULL) {
+                                free(key);
+                                err = -1;
+                                break;
+                        }
+                }
+                keys[len] = key;
+                list[len] = c;
+                if (hashmap_put(index, key, len++) != 0) {
+                        err = -1;
+                        break;
+                }
+        }
+        if (err != 0) {
+                goto DELTA_EXPORT_RET;
+        }
+
+        uint8_t buf[DELTA_RECORD_MAX];
+        memcpy(buf, DELTA_MAGIC, DELTA_MAGIC_LEN);
+        memcpy(buf + DELTA_MAGIC_LEN, g.source, DELTA_SOURCE_LEN);
+        put_u64(buf + DELTA_FROM, from);
+        put_u64(buf + DELTA_FROM + 8, to);
+        put_u32(buf + DELTA_FROM + 16, len);
+        EVP_DigestInit_ex(md, EVP_sha256(), NULL);
+        EVP_DigestUpdate(md, buf, DELTA_HEADER_LEN);
+        fwrite(buf, 1, DELTA_HEADER_LEN, out);
+        for (size_t i = 0; i < len; i++) {
+                const size_t n = encode(buf, &list[i]);
+                EVP_DigestUpdate(md, buf, n);
+                fwrite(buf, 1, n, out);
+        }
+        unsigned char sum[DELTA_SUM_LEN];
+        unsigned int sum_len = DELTA_SUM_LEN;
+        EVP_DigestFinal_ex(md, sum, &sum_len);
+        fwrite(sum, 1, DELTA_SUM_LEN, out);
+        if (fflush(out) != 0 || ferror(out)) {
+                err = ERR_DELTA_WRITE;
+        }
+        info->from = from;
+        info->to = to;
+        info->changes = len;
+
+DELTA_EXPORT_RET:
+        if (log != NULL) {
+                munmap((void*)log, g.logsize);
+        }
+        for (size_t i = 0; i < len; i++) {
+                free(keys[i]);
+        }
+        free(keys);
+        free(list);
+        hashmap_free(index);
+        EVP_MD_CTX_free(md);
+        free(logpath);
+        return err;
+}
+
+static int read_all(FILE *in, uint8_t **data, size_t *len) {
+        size_t cap = 4096;
+        *len = 0;
+        *data = malloc(cap);
+        if (*data == NULL) {
+                return -1;
+        }
+        size_t n;
+        while ((n = fread(*data + *len, 1, cap - *len, in)) > 0) {
+                *len += n;
+                if (*len == cap) {
+                        cap *= 2;
+                        uint8_t *grown = realloc(*data, cap);
+                        if (grown == NULL) {
+                                return -1;
+                        }
+                        *data = grown;
+                }
+        }
+        return ferror(in) ? ERR_DELTA_READ : 0;
+}
+
+int delta_apply(const char *userspath, FILE *in, delta_info_t *info) {
+        memset(info, 0, sizeof(delta_info_t));
+        uint8_t *data = NULL;
+        size_t len = 0;
+        struct change *list = NULL;
+        users_t *users = NULL;
+        txn_t *txn = NULL;
+        int err = read_all(in, &data, &len);
+        if (err != 0) {
+                goto DELTA_APPLY_RET;
+        }
+        if (len < DELTA_HEADER_LEN + DELTA_SUM_LEN ||
+                        memcmp(data, DELTA_MAGIC, DELTA_MAGIC_LEN) != 0) {
+                err = ERR_DELTA_FORMAT;
+                goto DELTA_APPLY_RET;
+        }
+        unsigned char sum[DELTA_SUM_LEN];
+        unsigned int sum_len = DELTA_SUM_LEN;
+        if (EVP_Digest(data, len - DELTA_SUM_LEN, sum, &sum_len, EVP_sha256(), NULL) != 1) {
+                err = -1;
+                goto DELTA_APPLY_RET;
+        }
+        if (memcmp(sum, data + len - DELTA_SUM_LEN, DELTA_SUM_LEN) != 0) {
+                err = ERR_DELTA_CHECKSUM;
+                goto DELTA_APPLY_RET;
+        }
+        const uint8_t *source = data + DELTA_MAGIC_LEN;
+        info->from = get_u64(data + DELTA_FROM);
+        info->to = get_u64(data + DELTA_FROM + 8);
+        const uint32_t count = get_u32(data + DELTA_FROM + 16);
+
+        struct generation g;
+        err = gen_read(userspath, &g);
+        if (err != 0) {
+                goto DELTA_APPLY_RET;
+        }
+        // the generations of a tracked host only count the changes of its
+        // source, another source's numbers mean other users
+        if (g.tracked && memcmp(g.source, source, DELTA_SOURCE_LEN) != 0) {
+                err = ERR_DELTA_SOURCE;
+                goto DELTA_APPLY_RET;
+        }
+        if (g.gen == info->to && info->from != info->to) {
+                // applied before
+                info->current = true;
+                goto DELTA_APPLY_RET;
+        }
+        if (g.gen != info->from || info->from > info->to) {
+                err = ERR_DELTA_GENERATION;
+                goto DELTA_APPLY_RET;
+        }
+
+        // the whole changeset is checked before the users are touched
+        const size_t end = len - DELTA_SUM_LEN;
+        if (count > (end - DELTA_HEADER_LEN) / 3) {
+                err = ERR_DELTA_FORMAT;
+                goto DELTA_APPLY_RET;
+        }
+        list = malloc((count > 0 ? count : 1) * sizeof(struct change));
+        if (list == NULL) {
+                err = -1;
+                goto DELTA_APPLY_RET;
+        }
+        size_t pos = DELTA_HEADER_LEN;
+        for (uint32_t i = 0; i < count && err == 0; i++) {
+                size_t used = 0;
+                err = decode(data + pos, end - pos, &used, &list[i]);
+                pos += used;
+        }
+        if (err == 0 && pos != end) {
+                err = ERR_DELTA_FORMAT;
+        }
+        if (err != 0) {
+                goto DELTA_APPLY_RET;
+        }
+
+        users = users_new(10);
+        txn = txn_new();
+        if (users == NULL || txn == NULL) {
+                err = -1;
+                goto DELTA_APPLY_RET;
+        }
+        if (users_load_threads(users, userspath, 0) != 0) {
+                err = ERR_DELTA_USERS;
+                goto DELTA_APPLY_RET;
+        }
+        for (uint32_t i = 0; i < count && err == 0; i++) {
+                char name[DELTA_NAME_MAX + 1];
+                memcpy(name, list[i].name, list[i].name_len);
+                name[list[i].name_len] = '\0';
+                if (list[i].op == DELTA_UPSERT) {
+                        err = users_set(users, name, &list[i].kdf, list[i].pin_hash);
+                } else if (users_remove(users, name) == ERR_USERS_USER_NOT_FOUND) {
+                        err = 0;
+                }
+                err = err != 0 ? ERR_DELTA_USERS : 0;
+        }
+        if (err != 0) {
+                goto DELTA_APPLY_RET;
+        }
+
+        // the users, then the host's own log and generation
+        const char *tmppath = NULL;
+        if (txn_add(txn, userspath, &tmppath) != 0) {
+                err = ERR_DELTA_WRITE;
+                goto DELTA_APPLY_RET;
+        }
+        FILE *f = fopen(tmppath, "w");
+        if (f == NULL) {
+                err = ERR_DELTA_WRITE;
+                goto DELTA_APPLY_RET;
+        }
+        err = users_write(users, f) != 0 ? ERR_DELTA_WRITE : 0;
+        if (fclose(f) != 0) {
+                err = ERR_DELTA_WRITE;
+        }
+        struct log_writer w;
+        if (err == 0) {
+                err = log_open(&w, userspath, g.logsize);
+        }
+        if (err == 0) {
+                for (uint32_t i = 0; i < count && err == 0; i++) {
+                        err = log_append(&w, info->to, &list[i]);
+                }
+                err = log_close(&w, err);
+        }
+        if (err == 0) {
+                g.gen = info->to;
+                g.logsize = w.size;
+                if (!g.tracked) {
+                        memcpy(g.source, source, DELTA_SOURCE_LEN);
+                        g.replica = true;
+                }
+                err = gen_write(txn, userspath, &g);
+        }
+        if (err == 0 && txn_commit(txn) != 0) {
+                err = ERR_DELTA_WRITE;
+        }
+        if (err == 0) {
+                info->changes = count;
+        }
+
+DELTA_APPLY_RET:
+        txn_free(txn);
+        users_free(users);
+        free(list);
+        free(data);
+        return err;
+}
+
+delta_changes_t* delta_changes_new(void) {
+        delta_changes_t *changes = malloc(sizeof(delta_changes_t));
+        if (changes == NULL) {
+                return NULL;
+        }
+        memset(changes, 0, sizeof(delta_changes_t));
+        changes->set = hashmap_new(16);
+        if (changes->set == NULL) {
+                free(changes);
+                return NULL;
+        }
+        return changes;
+}
+
+int delta_changes_add(delta_changes_t *changes, const char *username) {
+        uint32_t at;
+        if (hashmap_get(changes->set, username, &at)) {
+                return 0;
+        }
+        if (changes->len == changes->cap) {
+                const size_t cap = changes->cap > 0 ? changes->cap * 2 : 16;
+                char **grown = realloc(changes->names, cap * sizeof(char*));
+                if (grown == NULL) {
+                        return -1;
+                }
+                changes->names = grown;
+                changes->cap = cap;
+        }
+        char *name = strdup(username);
+        if (name == NULL) {
+                return -1;
+        }
+        if (hashmap_put(changes->set, name, changes->len) != 0) {
+                free(name);
+                return -1;
+        }
+        changes->names[changes->len++] = name;
+        return 0;
+}
+
+int delta_changes_commit(delta_changes_t *changes, users_t *users, const char *userspath,
+                         txn_t *txn) {
+        struct generation g;
+        int err = gen_read(userspath, &g);
+        if (err != 0 || !g.tracked || changes->len == 0) {
+                return err;
+        }
+        if (g.replica) {
+                return ERR_DELTA_REPLICA;
+        }
+        user_t *user = user_new();
+        if (user == NULL) {
+                return -1;
+        }
+        struct log_writer w;
+        err = log_open(&w, userspath, g.logsize);
+        if (err != 0) {
+                user_free(user);
+                return err;
+        }
+        // the final record of every changed user, the log keeps no history
+        // within a generation
+        for (size_t i = 0; i < changes->len && err == 0; i++) {
+                struct change c = {
+                        .name = changes->names[i],
+                        .name_len = strlen(changes->names[i]),
+                };
+                if (users_find(users, changes->names[i], user) == 0) {
+                        c.op = DELTA_UPSERT;
+                        user_get_kdf(user, &c.kdf);
+                        user_get_pin_hash(user, c.pin_hash);
+                } else {
+                        c.op = DELTA_REMOVE;
+                }
+                err = log_append(&w, g.gen + 1, &c);
+        }
+        user_free(user);
+        err = log_close(&w, err);
+        if (err != 0) {
+                return err;
+        }
+        g.gen++;
+        g.logsize = w.size;
+        return gen_write(txn, userspath, &g);
+}
+
+void delta_changes_clear(delta_changes_t *changes) {
+        for (size_t i = 0; i < changes->len; i++) {
+                free(changes->names[i]);
+        }
+        changes->len = 0;
+        hashmap_clear(changes->set);
+}
+
+void delta_changes_free(delta_changes_t *changes) {
+        if (changes == NULL) {
+                return;
+        }
+        delta_changes_clear(changes);
+        free(changes->names);
+        hashmap_free(changes->set);
+        free(changes);
+}
+
+// "<generation> <log size> <source id> source|replica", a missing file
+// is generation 0
+static int gen_read(const char *userspath, struct generation *g) {
+        memset(g, 0, sizeof(struct generation));
+        char *path = side_path(userspath, ".gen");
+        if (path == NULL) {
+                return -1;
+        }
+        FILE *f = fopen(path, "r");
+        free(path);
+        if (f == NULL) {
+                return errno == ENOENT ? 0 : ERR_DELTA_OPEN;
+        }
+        char source[2 * DELTA_SOURCE_LEN + 1];
+        char role[8];
+        int err = fscanf(f, "%" SCNu64 " %" SCNu64 " %32s %7s", &g->gen, &g->logsize,
+                         source, role) == 4 ? 0 : ERR_DELTA_FORMAT;
+        fclose(f);
+        if (err == 0 && strlen(source) != 2 * DELTA_SOURCE_LEN) {
+                err = ERR_DELTA_FORMAT;
+        }
+        for (size_t i = 0; err == 0 && i < 2 * DELTA_SOURCE_LEN; i++) {
+                if (strchr(hex_digits, source[i]) == NULL) {
+                        err = ERR_DELTA_FORMAT;
+                        break;
+                }
+                g->source[i / 2] = g->source[i / 2] << 4 | hex_value(source[i]);
+        }
+        if (err == 0 && strcmp(role, "source") != 0 && strcmp(role, "replica") != 0) {
+                err = ERR_DELTA_FORMAT;
+        }
+        g->replica = err == 0 && strcmp(role, "replica") == 0;
+        g->tracked = err == 0;
+        return err;
+}
+
+static int gen_write(txn_t *txn, const char *userspath, const struct generation *g) {
+        char *path = side_path(userspath, ".gen");
+        const char *tmppath = NULL;
+        if (path == NULL) {
+                return -1;
+        }
+        int err = txn_add(txn, path, &tmppath) != 0 ? ERR_DELTA_WRITE : 0;
+        free(path);
+        if (err != 0) {
+                return err;
+        }
+        FILE *f = fopen(tmppath, "w");
+        if (f == NULL) {
+                return ERR_DELTA_WRITE;
+        }
+        fprintf(f, "%" PRIu64 " %" PRIu64 " ", g->gen, g->logsize);
+        for (size_t i = 0; i < DELTA_SOURCE_LEN; i++) {
+                fprintf(f, "%02x", g->source[i]);
+        }
+        fprintf(f, " %s\n", g->replica ? "replica" : "source");
+        if (ferror(f)) {
+                err = ERR_DELTA_WRITE;
+        }
+        if (fclose(f) != 0) {
+                err = ERR_DELTA_WRITE;
+        }
+        return err;
+}
+
+// cut what an unfinished commit left past the recorded length
+static int log_open(struct log_writer *w, const char *userspath, uint64_t logsize) {
+        memset(w, 0, sizeof(struct log_writer));
+        char *path = side_path(userspath, ".log");
+        if (path == NULL) {
+                return -1;
+        }
+        int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        free(path);
+        if (fd < 0) {
+                return ERR_DELTA_OPEN;
+        }
+        struct stat st;
+        int err = 0;
+        if (flock(fd, LOCK_EX) != 0 || fstat(fd, &st) != 0) {
+                err = ERR_DELTA_OPEN;
+        } else if ((uint64_t)st.st_size < logsize) {
+                err = ERR_DELTA_FORMAT;
+        } else if (ftruncate(fd, logsize) != 0 || lseek(fd, logsize, SEEK_SET) < 0) {
+                err = ERR_DELTA_WRITE;
+        }
+        if (err == 0) {
+                w->out = fdopen(fd, "w");
+                err = w->out != NULL ? 0 : ERR_DELTA_OPEN;
+        }
+        if (err != 0) {
+                close(fd);
+                return err;
+        }
+        w->size = logsize;
+        return 0;
+}
+
+static int log_append(struct log_writer *w, uint64_t gen, const struct change *c) {
+        if (c->name_len > DELTA_NAME_MAX) {
+                return ERR_DELTA_USERS;
+        }
+        // the rule of fsck and delta_apply, a record no PIN matches is
+        // repaired on the source and not shipped
+        if (c->op == DELTA_UPSERT && !hash_is_hex(c->pin_hash)) {
+                return ERR_DELTA_RECORD;
+        }
+        uint8_t buf[8 + DELTA_RECORD_MAX];
+        put_u64(buf, gen);
+        const size_t n = 8 + encode(buf + 8, c);
+        if (fwrite(buf, 1, n, w->out) != n) {
+                return ERR_DELTA_WRITE;
+        }
+        w->size += n;
+        return 0;
+}
+
+// the log is synced before the generation that covers it is committed
+static int log_close(struct log_writer *w, int err) {
+        if (fflush(w->out) != 0 || fsync(fileno(w->out)) != 0) {
+                err = err != 0 ? err : ERR_DELTA_WRITE;
+        }
+        if (fclose(w->out) != 0) {
+                err = err != 0 ? err : ERR_DELTA_WRITE;
+        }
+        w->out = NULL;
+        return err;
+}
+
+static size_t encode(uint8_t *buf, const struct change *c) {
+        size_t pos = 0;
+        buf[pos++] = c->op;
+        put_u16(buf + pos, c->name_len);
+        pos += 2;
+        memcpy(buf + pos, c->name, c->name_len);
+        pos += c->name_len;
+        if (c->op != DELTA_UPSERT) {
+                return pos;
+        }
+        const bool hex = hash_is_hex(c->pin_hash);
+        buf[pos++] = c->kdf.alg | (hex ? 0 : DELTA_RAW_HASH);
+        if (c->kdf.alg != KDF_SHA256) {
+                put_u32(buf + pos, c->kdf.cost);
+                put_u32(buf + pos + 4, c->kdf.memory);
+                put_u32(buf + pos + 8, c->kdf.parallel);
+                memcpy(buf + pos + 12, c->kdf.salt, KDF_SALT_LEN);
+                pos += 12 + KDF_SALT_LEN;
+        }
+        if (!hex) {
+                memcpy(buf + pos, c->pin_hash, PIN_HASH_LEN);
+                return pos + PIN_HASH_LEN;
+        }
+        for (size_t i = 0; i < PIN_HASH_LEN / 2; i++) {
+                buf[pos + i] = hex_value(c->pin_hash[2 * i]) << 4 |
+                               hex_value(c->pin_hash[2 * i + 1]);
+        }
+        return pos + PIN_HASH_LEN / 2;
+}
+
+static int decode(const uint8_t *buf, size_t len, size_t *used, struct change *c) {
+        memset(c, 0, sizeof(struct change));
+        if (len < 3) {
+                return ERR_DELTA_FORMAT;
+        }
+        c->op = buf[0];
+        c->name_len = get_u16(buf + 1);
+        c->name = (const char*)buf + 3;
+        size_t pos = 3 + c->name_len;
+        if ((c->op != DELTA_UPSERT && c->op != DELTA_REMOVE) || c->name_len == 0 ||
+                        c->name_len > DELTA_NAME_MAX || pos > len ||
+                        memchr(c->name, '\0', c->name_len) != NULL ||
+                        memchr(c->name, ':', c->name_len) != NULL ||
+                        memchr(c->name, '\n', c->name_len) != NULL) {
+                return ERR_DELTA_FORMAT;
+        }
+        if (c->op == DELTA_UPSERT) {
+                if (pos >= len || (buf[pos] & ~DELTA_RAW_HASH) > KDF_SHA256_PEPPER) {
+                        return ERR_DELTA_FORMAT;
+                }
+                const bool raw = buf[pos] & DELTA_RAW_HASH;
+                kdf_default(&c->kdf);
+                c->kdf.alg = buf[pos++] & ~DELTA_RAW_HASH;
+                if (c->kdf.alg != KDF_SHA256) {
+                        if (len - pos < 12 + KDF_SALT_LEN) {
+                                return ERR_DELTA_FORMAT;
+                        }
+                        c->kdf.cost = get_u32(buf + pos);
+                        c->kdf.memory = get_u32(buf + pos + 4);
+                        c->kdf.parallel = get_u32(buf + pos + 8);
+                        memcpy(c->kdf.salt, buf + pos + 12, KDF_SALT_LEN);
+                        pos += 12 + KDF_SALT_LEN;
+                }
+                const size_t hash_len = raw ? PIN_HASH_LEN : PIN_HASH_LEN / 2;
+                if (len - pos < hash_len) {
+                        return ERR_DELTA_FORMAT;
+                }
+                if (raw) {
+                        memcpy(c->pin_hash, buf + pos, PIN_HASH_LEN);
+                }
+                for (size_t i = 0; !raw && i < PIN_HASH_LEN / 2; i++) {
+                        c->pin_hash[2 * i] = hex_digits[buf[pos + i] >> 4];
+                        c->pin_hash[2 * i + 1] = hex_digits[buf[pos + i] & 0xf];
+                }
+                pos += hash_len;
+                // users_write copies the hash verbatim
+                if (!hash_is_hex(c->pin_hash) || !kdf_valid(&c->kdf)) {
+                        return ERR_DELTA_RECORD;
+                }
+        }
+        *used = pos;
+        return 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#ifndef _DELTA_H
+#define _DELTA_H
+
+#include "users.h"
+#include "txn.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Generations of the text users file for shipping changes to other hosts.
+ *
+ * Once enabled with delta_init, `<users>.gen` holds the generation of the
+ * users file, the length of the change log `<users>.log` and the random
+ * id of the source host. Every commit
+ * of the text store that changes users appends the final records of the
+ * changed users to the log as the next generation and replaces the
+ * generation file in the same txn. BACKEND_COMMIT_LOCAL commits, the
+ * rehashes of pam_pin.so, change the users file of the host only. Log
+ * bytes past the recorded length are left by a commit that did not finish
+ * and are cut by the next one.
+ *
+ * A changeset carries the last change of every user between two
+ * generations, little endian:
+ *   "PPDELTA2" source:16 from:u64 to:u64 count:u32 record... sha256:32
+ *   record: op:u8 name_len:u16 name [alg:u8 [cost memory parallel:u32
+ *           salt:16] pin_hash:32]
+ * the kdf parameters and the hash of upserts only, legacy SHA-256 records
+ * without the parameters. Hex hashes are packed to 32 bytes and unpacked
+ * lowercase, others are kept as 64 bytes with the 0x80 bit of alg set and
+ * fail to decode unless they are lowercase hex, as do kdf parameters out
+ * of kdf_valid: a changeset cannot inject records. Log entries are a
+ * generation:u64 and a record.
+ *
+ * A host applies a changeset made from its own generation and moves to
+ * the target one, a host without a generation file is at 0 and becomes a
+ * replica of the changeset's source. A replica takes changesets of that
+ * source only and refuses commits of its own, its generations would no
+ * longer be the source's. The users file is renamed before the generation
+ * file: a changeset interrupted between them is applied again.
+ */
+
+enum {
+        ERR_DELTA_OPEN = 1,
+        ERR_DELTA_READ,
+        ERR_DELTA_WRITE,
+        ERR_DELTA_FORMAT,
+        ERR_DELTA_CHECKSUM,
+        ERR_DELTA_GENERATION,   // not a changeset of this host or range
+        ERR_DELTA_DISABLED,     // no generation file
+        ERR_DELTA_USERS,
+        ERR_DELTA_RECORD,       // a change with a bad pin hash or kdf parameters
+        ERR_DELTA_SOURCE,       // a changeset of another source host
+        ERR_DELTA_REPLICA,      // a commit of a replica
+};
+
+#define DELTA_SOURCE_LEN 16
+
+typedef struct delta_info {
+        uint64_t        from;
+        uint64_t        to;
+        size_t          changes;
+        bool            current;        // apply: already at the target
+} delta_info_t;
+
+// generation of the users file, 0 - not tracked.
+int delta_generation(const char *userspath, uint64_t *gen);
+
+// start tracking with the current users as generation 1, keeps a tracked file.
+int delta_init(const char *userspath, uint64_t *gen);
+
+// the changes of generations (from, to] as a changeset.
+int delta_export(const char *userspath, uint64_t from, uint64_t to, FILE *out,
+                 delta_info_t *info);
+
+// apply a changeset to the users file at its from generation, a file
+// already at its target is left as it is with 0 changes.
+int delta_apply(const char *userspath, FILE *in, delta_info_t *info);
+
+// users changed by a store since its last commit
+typedef struct delta_changes delta_changes_t;
+
+delta_changes_t* delta_changes_new(void);
+
+int delta_changes_add(delta_changes_t *changes, const char *username);
+
+// log the changed users as the next generation and add the generation file
+// to the txn of the users file. Nothing for an untracked file,
+// ERR_DELTA_REPLICA for a replica.
+int delta_changes_commit(delta_changes_t *changes, users_t *users, const char *userspath,
+                         txn_t *txn);
+
+void delta_changes_clear(delta_changes_t *changes);
+
+void delta_changes_free(delta_changes_t *changes);
+
+#endif
@@ -0,0 +1,658 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#define _GNU_SOURCE
+#include "fsck.h"
+#include "crypt.h"
+#include "groups.h"
+#include "kdf.h"
+#include "txn.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// smallest chunk worth a thread when the count is automatic
+#define FSCK_MIN_CHUNK (4 << 20)
+
+// set slot: name tag above the line offset + 1, 0 - empty
+#define SLOT_OFF_BITS 40
+#define SLOT_OFF_MASK ((1ull << SLOT_OFF_BITS) - 1)
+
+// records hashed ahead of their set lookups, enough to hide the misses
+#define FSCK_BATCH 16
+
+struct set {
+        uint64_t        *slots;
+        size_t          mask;
+        const char      *base;          // the mapped file of the offsets
+};
+
+struct mapped {
+        const char      *path;
+        const char      *base;          // NULL - empty or missing
+        size_t          size;
+        struct set      names;
+        size_t          problems;       // lines to drop on repair
+};
+
+struct pending {
+        uint64_t        off;
+        size_t          len;            // of the name
+        uint64_t        hash;
+};
+
+struct sample {
+        uint64_t        off;
+        fsck_problem_t  problem;
+};
+
+struct job {
+        fsck_t          *fsck;
+        fsck_file_t     file;
+        const char      *from;
+        const char      *to;
+        size_t          lines;
+        size_t          problems[FSCK_PROBLEMS];
+        // the issues of the smallest offsets, sorted
+        struct sample   samples[FSCK_ISSUES_MAX];
+        size_t          samples_len;
+        bool            groups;         // users: an @group record seen
+};
+
+struct fsck {
+        struct mapped   files[2];       // fsck_file_t
+        int             threads;
+        bool            per_cpu;        // small files use fewer threads
+        groups_cache_t  *groups;        // NULL - no @group records
+        fsck_report_t   report;
+};
+
+static int map_file(struct mapped *m, const char *path);
+static int check_file(fsck_t *fsck, fsck_file_t file, struct job **jobs, int *njobs);
+static int report_issues(fsck_t *fsck, struct job *jobs[2], const int njobs[2]);
+
+int fsck_run(fsck_t **fsck, const char *userspath, const char *statepath, int threads) {
+        fsck_t *f = malloc(sizeof(fsck_t));
+        if (f == NULL) {
+                return -1;
+        }
+        memset(f, 0, sizeof(fsck_t));
+        if (threads <= 0) {
+                long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                threads = cpus > 0 ? (int)cpus : 1;
+                f->per_cpu = true;
+        }
+        f->threads = threads;
+
+        struct job *jobs[2] = {NULL, NULL};
+        int njobs[2] = {0, 0};
+        int err = map_file(&f->files[FSCK_USERS], userspath);
+        if (err == 0) {
+                err = map_file(&f->files[FSCK_STATE], statepath);
+        }
+        // the state is checked against the complete users set
+        if (err == 0) {
+                err = check_file(f, FSCK_USERS, &jobs[FSCK_USERS], &njobs[FSCK_USERS]);
+        }
+        if (err == 0) {
+                err = check_file(f, FSCK_STATE, &jobs[FSCK_STATE], &njobs[FSCK_STATE]);
+        }
+        if (err == 0) {
+                err = report_issues(f, jobs, njobs);
+        }
+        free(jobs[FSCK_USERS]);
+        free(jobs[FSCK_STATE]);
+        if (err != 0) {
+                fsck_free(f);
+                return err;
+        }
+        *fsck = f;
+        return 0;
+}
+
+const fsck_report_t* fsck_report(const fsck_t *fsck) {
+        return &fsck->report;
+}
+
+const char* fsck_problem_name(fsck_problem_t problem) {
+        switch (problem) {
+                case FSCK_MALFORMED:
+                        return "malformed record";
+                case FSCK_BAD_DIGEST:
+                        return "pin hash is not hex";
+                case FSCK_DUPLICATE:
+                        return "duplicated user";
+                case FSCK_ORPHAN:
+                        return "state of an unknown user";
+                default:
+                        return "unknown problem";
+        }
+}
+
+void fsck_free(fsck_t *fsck) {
+        if (fsck == NULL) {
+                return;
+        }
+        for (int i = 0; i < 2; i++) {
+                struct mapped *m = &fsck->files[i];
+                if (m->base != NULL) {
+                        munmap((void*)m->base, m->size);
+                }
+                free(m->names.slots);
+        }
+        groups_cache_close(fsck->groups);
+        free(fsck);
+}
+
+static int map_file(struct mapped *m, const char *path) {
+        m->path = path;
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+                return errno == ENOENT ? 0 : ERR_FSCK_OPEN;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+                close(fd);
+                return ERR_FSCK_OPEN;
+        }
+        m->size = st.st_size;
+        if (m->size > 0) {
+                void *base = mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (base == MAP_FAILED) {
+                        close(fd);
+                        return ERR_FSCK_MAP;
+                }
+                madvise(base, m->size, MADV_SEQUENTIAL);
+                m->base = base;
+        }
+        close(fd);
+        return 0;
+}
+
+// set
+
+static uint64_t name_hash(const char *name, size_t len) {
+        uint64_t h = 1469598103934665603ull;
+        for (size_t i = 0; i < len; i++) {
+                h ^= (uint8_t)name[i];
+                h *= 1099511628211ull;
+        }
+        return h;
+}
+
+static size_t line_count(const char *base, size_t size) {
+        size_t lines = 1;
+        const char *end = base + size;
+        for (const char *p = base; p < end && (p = memchr(p, '\n', end - p)) != NULL; p++) {
+                lines++;
+        }
+        return lines;
+}
+
+static int set_init(struct set *set, const char *base, size_t records) {
+        size_t cap = 16;
+        while (cap < records * 2) {
+                cap *= 2;
+        }
+        set->slots = calloc(cap, sizeof(uint64_t));
+        if (set->slots == NULL) {
+                return -1;
+        }
+        set->mask = cap - 1;
+        set->base = base;
+        return 0;
+}
+
+static bool slot_is(const struct set *set, uint64_t slot, uint64_t tag,
+                    const char *name, size_t len) {
+        if (slot >> SLOT_OFF_BITS != tag) {
+                return false;
+        }
+        const char *other = set->base + (slot & SLOT_OFF_MASK) - 1;
+        return memcmp(other, name, len) == 0 && other[len] == ':';
+}
+
+/*
+ * Add the name of the line at off, false if it is already there. The
+ * set keeps the smallest offset of a name, *loser is the other one.
+ */
+static bool set_add(struct set *set, const char *name, size_t len, uint64_t h,
+                    uint64_t off, uint64_t *loser) {
+        const uint64_t tag = h >> SLOT_OFF_BITS;
+        const uint64_t mine = tag << SLOT_OFF_BITS | (off + 1);
+        for (size_t i = h & set->mask;; i = (i + 1) & set->mask) {
+                uint64_t slot = __atomic_load_n(&set->slots[i], __ATOMIC_ACQUIRE);
+                while (slot == 0) {
+                        if (__atomic_compare_exchange_n(&set->slots[i], &slot, mine, false,
+                                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                                return true;
+                        }
+                }
+                if (!slot_is(set, slot, tag, name, len)) {
+                        continue;
+                }
+                while ((slot & SLOT_OFF_MASK) > off + 1) {
+                        if (__atomic_compare_exchange_n(&set->slots[i], &slot, mine, false,
+                                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                                *loser = (slot & SLOT_OFF_MASK) - 1;
+                                return false;
+                        }
+                }
+                *loser = off;
+                return false;
+        }
+}
+
+// offset of the first line of the name + 1, 0 - not in the set
+static uint64_t set_find(const struct set *set, const char *name, size_t len, uint64_t h) {
+        if (set->slots == NULL) {
+                return 0;
+        }
+        const uint64_t tag = h >> SLOT_OFF_BITS;
+        for (size_t i = h & set->mask;; i = (i + 1) & set->mask) {
+                const uint64_t slot = __atomic_load_n(&set->slots[i], __ATOMIC_ACQUIRE);
+                if (slot == 0) {
+                        return 0;
+                }
+                if (slot_is(set, slot, tag, name, len)) {
+                        return slot & SLOT_OFF_MASK;
+                }
+        }
+}
+
+// records
+
+static bool valid_name(const char *name, size_t len) {
+        if (len == 0) {
+                return false;
+        }
+        for (size_t i = 0; i < len; i++) {
+                const unsigned char c = name[i];
+                if (c <= ' ' || c == 0x7f) {
+                        return false;
+                }
+        }
+        return true;
+}
+
+// the problem of the users record, -1 - valid
+static int check_user(const char *line, size_t len, size_t *name_len) {
+        const char *colon = memchr(line, ':', len);
+        if (colon == NULL || !valid_name(line, colon - line)) {
+                return FSCK_MALFORMED;
+        }
+        *name_len = colon - line;
+        const char *value = colon + 1;
+        const size_t value_len = line + len - value;
+        const char *hash = value;
+        size_t hash_len = value_len;
+        if (value_len > 0 && value[0] == '$') {
+                char buf[KDF_PREFIX_MAX + PIN_HASH_LEN + 1];
+                if (value_len >= sizeof(buf)) {
+                        return FSCK_MALFORMED;
+                }
+                memcpy(buf, value, value_len);
+                buf[value_len] = '\0';
+                kdf_params_t kdf;
+                const char *rest = NULL;
+                if (kdf_parse(buf, &kdf, &rest) != 0) {
+                        return FSCK_MALFORMED;
+                }
+                hash = value + (rest - buf);
+                hash_len = value_len - (rest - buf);
+        }
+        if (hash_len != PIN_HASH_LEN) {
+                return FSCK_MALFORMED;
+        }
+        if (!hash_is_hex((const uint8_t*)hash)) {
+                return FSCK_BAD_DIGEST;
+        }
+        return -1;
+}
+
+// the problem of the state entry, -1 - valid
+static int check_entry(const char *line, size_t len, size_t *name_len) {
+        const char *colon = memchr(line, ':', len);
+        if (colon == NULL || !valid_name(line, colon - line)) {
+                return FSCK_MALFORMED;
+        }
+        *name_len = colon - line;
+        const char *value = colon + 1;
+        const size_t value_len = line + len - value;
+        if (value_len == 0 || value_len > 3) {
+                return FSCK_MALFORMED;
+        }
+        unsigned int attempts = 0;
+        for (size_t i = 0; i < value_len; i++) {
+                if (value[i] < '0' || value[i] > '9') {
+                        return FSCK_MALFORMED;
+                }
+                attempts = attempts * 10 + (value[i] - '0');
+        }
+        return attempts <= UINT8_MAX ? -1 : FSCK_MALFORMED;
+}
+
+static void job_issue(struct job *job, uint64_t off, fsck_problem_t problem) {
+        job->problems[problem]++;
+        size_t i = job->samples_len;
+        if (i == FSCK_ISSUES_MAX) {
+                if (off >= job->samples[i - 1].off) {
+                        return;
+                }
+                i--;
+        } else {
+                job->samples_len++;
+        }
+        for (; i > 0 && job->samples[i - 1].off > off; i--) {
+                job->samples[i] = job->samples[i - 1];
+        }
+        job->samples[i].off = off;
+        job->samples[i].problem = problem;
+}
+
+struct group_lookup {
+        const struct set        *users;
+        char                    record[GROUPS_NAMES_MAX + 2];
+};
+
+static int find_group_record(void *ctx, const char *group) {
+        struct group_lookup *lookup = ctx;
+        const int len = snprintf(lookup->record, sizeof(lookup->record), "@%s", group);
+        if (len < 0 || (size_t)len >= sizeof(lookup->record)) {
+                return 0;
+        }
+        return set_find(lookup->users, lookup->record, len,
+                        name_hash(lookup->record, len)) != 0 ? 1 : 0;
+}
+
+/*
+ * A state entry without a users record is kept by the members of a group
+ * with an @group record, the attempts are counted under their own name.
+ * Groups come from NSS as pam_pin.so resolves them, a failed lookup keeps
+ * the entry.
+ */
+static bool group_enrolled(const fsck_t *fsck, const char *name, size_t len) {
+        if (fsck->groups == NULL) {
+                return false;
+        }
+        char *username = strndup(name, len);
+        if (username == NULL) {
+                return true;
+        }
+        struct group_lookup lookup = { .users = &fsck->files[FSCK_USERS].names };
+        const int err = groups_visit(fsck->groups, username, find_group_record, &lookup);
+        free(username);
+        return err != 0;
+}
+
+// the set lookups of valid records, their slots are prefetched
+static void check_batch(struct job *job, const struct pending *batch, size_t len) {
+        struct mapped *m = &job->fsck->files[job->file];
+        const struct set *users = &job->fsck->files[FSCK_USERS].names;
+        for (size_t i = 0; i < len; i++) {
+                const struct pending *p = &batch[i];
+                const char *name = m->base + p->off;
+                uint64_t loser;
+                if (job->file == FSCK_STATE && set_find(users, name, p->len, p->hash) == 0 &&
+                                !group_enrolled(job->fsck, name, p->len)) {
+                        job_issue(job, p->off, FSCK_ORPHAN);
+                }
+                if (!set_add(&m->names, name, p->len, p->hash, p->off, &loser)) {
+                        job_issue(job, loser, FSCK_DUPLICATE);
+                }
+        }
+}
+
+static void* check_worker(void *arg) {
+        struct job *job = arg;
+        struct mapped *m = &job->fsck->files[job->file];
+        const struct set *users = &job->fsck->files[FSCK_USERS].names;
+        struct pending batch[FSCK_BATCH];
+        size_t batch_len = 0;
+        for (const char *line = job->from; line < job->to;) {
+                const char *nl = memchr(line, '\n', job->to - line);
+                const char *end = nl != NULL ? nl : job->to;
+                const uint64_t off = line - m->base;
+                size_t name_len = 0;
+                int problem = job->file == FSCK_USERS ?
+                        check_user(line, end - line, &name_len) :
+                        check_entry(line, end - line, &name_len);
+                if (problem >= 0) {
+                        job_issue(job, off, problem);
+                } else {
+                        job->groups |= line[0] == '@';
+                        const uint64_t h = name_hash(line, name_len);
+                        __builtin_prefetch(&m->names.slots[h & m->names.mask], 1);
+                        if (job->file == FSCK_STATE && users->slots != NULL) {
+                                __builtin_prefetch(&users->slots[h & users->mask], 0);
+                        }
+                        batch[batch_len].off = off;
+                        batch[batch_len].len = name_len;
+                        batch[batch_len].hash = h;
+                        if (++batch_len == FSCK_BATCH) {
+                                check_batch(job, batch, batch_len);
+                                batch_len = 0;
+                        }
+                }
+                job->lines++;
+                line = end + 1;
+        }
+        check_batch(job, batch, batch_len);
+        return NULL;
+}
+
+static int check_file(fsck_t *fsck, fsck_file_t file, struct job **jobs, int *njobs) {
+        struct mapped *m = &fsck->files[file];
+        int threads = fsck->threads;
+        if (fsck->per_cpu && m->size / FSCK_MIN_CHUNK + 1 < (size_t)threads) {
+                threads = m->size / FSCK_MIN_CHUNK + 1;
+        }
+        // a line holds at most one name, the set never fills up
+        if (set_init(&m->names, m->base, line_count(m->base, m->size)) != 0) {
+                return -1;
+        }
+        struct job *js = calloc(threads, sizeof(struct job));
+        pthread_t *tids = calloc(threads, sizeof(pthread_t));
+        if (js == NULL || tids == NULL) {
+                free(js);
+                free(tids);
+                return -1;
+        }
+        // chunks start after a line break
+        const char *end = m->base + m->size;
+        const char *from = m->base;
+        for (int i = 0; i < threads; i++) {
+                const char *to = m->base + m->size / threads * (i + 1);
+                if (i == threads - 1 || to >= end) {
+                        to = end;
+                } else if (to < from) {
+                        to = from;
+                } else {
+                        const char *nl = memchr(to, '\n', end - to);
+                        to = nl != NULL ? nl + 1 : end;
+                }
+                js[i].fsck = fsck;
+                js[i].file = file;
+                js[i].from = from;
+                js[i].to = to;
+                from = to;
+        }
+        int started = 0;
+        int err = 0;
+        for (int i = 1; i < threads; i++) {
+                if (pthread_create(&tids[i], NULL, check_worker, &js[i]) != 0) {
+                        err = ERR_FSCK_THREAD;
+                        break;
+                }
+                started = i;
+        }
+        check_worker(&js[0]);
+        for (int i = 1; i <= started; i++) {
+                pthread_join(tids[i], NULL);
+        }
+        free(tids);
+        if (err != 0) {
+                free(js);
+                return err;
+        }
+
+        size_t *lines = file == FSCK_USERS ? &fsck->report.records : &fsck->report.entries;
+        for (int i = 0; i < threads; i++) {
+                *lines += js[i].lines;
+                if (js[i].groups && fsck->groups == NULL &&
+                                groups_cache_open(&fsck->groups, NULL, 0, NULL) != 0) {
+                        err = -1;
+                }
+                for (int p = 0; p < FSCK_PROBLEMS; p++) {
+                        fsck->report.problems[p] += js[i].problems[p];
+                        m->problems += js[i].problems[p];
+                }
+        }
+        *jobs = js;
+        *njobs = threads;
+        return err;
+}
+
+static int issue_cmp(const void *a, const void *b) {
+        const fsck_issue_t *x = a;
+        const fsck_issue_t *y = b;
+        if (x->file != y->file) {
+                return x->file < y->file ? -1 : 1;
+        }
+        // line holds the offset until it is numbered
+        return x->line < y->line ? -1 : x->line > y->line ? 1 : 0;
+}
+
+/*
+ * The first issues in file order, numbered by counting the line breaks
+ * of each chunk up to its last issue.
+ */
+static int report_issues(fsck_t *fsck, struct job *jobs[2], const int njobs[2]) {
+        size_t len = 0;
+        for (int file = 0; file < 2; file++) {
+                for (int i = 0; i < njobs[file]; i++) {
+                        len += jobs[file][i].samples_len;
+                }
+        }
+        fsck_issue_t *all = malloc((len + 1) * sizeof(fsck_issue_t));
+        if (all == NULL) {
+                return -1;
+        }
+        len = 0;
+        for (int file = 0; file < 2; file++) {
+                for (int i = 0; i < njobs[file]; i++) {
+                        for (size_t j = 0; j < jobs[file][i].samples_len; j++) {
+                                all[len].file = file;
+                                all[len].line = jobs[file][i].samples[j].off;
+                                all[len].problem = jobs[file][i].samples[j].problem;
+                                len++;
+                        }
+                }
+        }
+        qsort(all, len, sizeof(fsck_issue_t), issue_cmp);
+        fsck_report_t *report = &fsck->report;
+        report->issues_len = len < FSCK_ISSUES_MAX ? len : FSCK_ISSUES_MAX;
+        memcpy(report->issues, all, report->issues_len * sizeof(fsck_issue_t));
+        free(all);
+
+        int chunk = -1;
+        fsck_file_t file = FSCK_USERS;
+        const char *pos = NULL;
+        size_t line = 0;
+        for (size_t k = 0; k < report->issues_len; k++) {
+                fsck_issue_t *issue = &report->issues[k];
+                const struct mapped *m = &fsck->files[issue->file];
+                const char *at = m->base + issue->line;
+                if (issue->file != file) {
+                        file = issue->file;
+                        chunk = -1;
+                }
+                // lines before the chunk are counted by its predecessors
+                while (chunk < 0 || at >= jobs[file][chunk].to) {
+                        chunk++;
+                        line = 0;
+                        for (int i = 0; i < chunk; i++) {
+                                line += jobs[file][i].lines;
+                        }
+                        pos = jobs[file][chunk].from;
+                }
+                for (const char *nl; (nl = memchr(pos, '\n', at - pos)) != NULL; pos = nl + 1) {
+                        line++;
+                }
+                pos = at;
+                issue->line = line + 1;
+        }
+        return 0;
+}
+
+static int repair_file(fsck_t *fsck, fsck_file_t file, txn_t *txn) {
+        const struct mapped *m = &fsck->files[file];
+        const struct set *users = &fsck->files[FSCK_USERS].names;
+        const char *tmppath = NULL;
+        if (txn_add(txn, m->path, &tmppath) != 0) {
+                return ERR_FSCK_WRITE;
+        }
+        FILE *out = fopen(tmppath, "w");
+        if (out == NULL) {
+                return ERR_FSCK_WRITE;
+        }
+        const char *end = m->base + m->size;
+        for (const char *line = m->base; line < end;) {
+                const char *nl = memchr(line, '\n', end - line);
+                const char *next = nl != NULL ? nl : end;
+                size_t name_len = 0;
+                const int problem = file == FSCK_USERS ?
+                        check_user(line, next - line, &name_len) :
+                        check_entry(line, next - line, &name_len);
+                const uint64_t h = problem < 0 ? name_hash(line, name_len) : 0;
+                // the first line of every valid name, state of known users
+                if (problem < 0 &&
+                                set_find(&m->names, line, name_len, h) == (uint64_t)(line - m->base) + 1 &&
+                                (file == FSCK_USERS || set_find(users, line, name_len, h) != 0 ||
+                                 group_enrolled(fsck, line, name_len))) {
+                        fwrite(line, 1, next - line, out);
+                        fputc('\n', out);
+                }
+                line = next + 1;
+        }
+        int err = ferror(out) ? ERR_FSCK_WRITE : 0;
+        if (fclose(out) != 0) {
+                err = ERR_FSCK_WRITE;
+        }
+        return err;
+}
+
+int fsck_repair(fsck_t *fsck) {
+        const bool users = fsck->files[FSCK_USERS].problems > 0;
+        const bool state = fsck->files[FSCK_STATE].problems > 0;
+        if (!users && !state) {
+                return 0;
+        }
+        txn_t *txn = txn_new();
+        if (txn == NULL) {
+                return ERR_FSCK_WRITE;
+        }
+        int err = 0;
+        if (users) {
+                err = repair_file(fsck, FSCK_USERS, txn);
+        }
+        if (err == 0 && state) {
+                err = repair_file(fsck, FSCK_STATE, txn);
+        }
+        if (err == 0 && txn_commit(txn) != 0) {
+                err = ERR_FSCK_WRITE;
+        }
+        txn_free(txn);
+        return err;
+}
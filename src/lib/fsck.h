@@ -0,0 +1,76 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#ifndef _FSCK_H
+#define _FSCK_H
+
+#include <stddef.h>
+
+/*
+ * Integrity check of the text users file and the attempts state file.
+ *
+ * Each file is mapped and split into one chunk per thread at line
+ * boundaries. Workers validate the records and add the usernames to a
+ * lock free set that keeps the earliest line of every name, so a later
+ * line of the same user is a duplicate whichever thread sees it first.
+ * State entries are then checked against the users for orphans.
+ *
+ * Repair keeps the valid records, the first of duplicated users and the
+ * state of known users, both files are replaced in one txn.
+ */
+
+typedef enum {
+        FSCK_MALFORMED = 0,     // no colon, bad username, kdf prefix or attempts
+        FSCK_BAD_DIGEST,        // pin hash is not 64 lowercase hex digits
+        FSCK_DUPLICATE,         // the user is on an earlier line
+        FSCK_ORPHAN,            // state entry of a user not in the users file
+        FSCK_PROBLEMS,
+} fsck_problem_t;
+
+typedef enum {
+        FSCK_USERS = 0,
+        FSCK_STATE,
+} fsck_file_t;
+
+enum {
+        ERR_FSCK_OPEN = 1,
+        ERR_FSCK_MAP,
+        ERR_FSCK_THREAD,
+        ERR_FSCK_WRITE,
+};
+
+// issues kept for the report, the first ones in file order
+#define FSCK_ISSUES_MAX 32
+
+typedef struct fsck_issue {
+        fsck_file_t     file;
+        size_t          line;           // 1-based
+        fsck_problem_t  problem;
+} fsck_issue_t;
+
+typedef struct fsck_report {
+        size_t          records;        // users file lines
+        size_t          entries;        // state file lines
+        size_t          problems[FSCK_PROBLEMS];
+        fsck_issue_t    issues[FSCK_ISSUES_MAX];
+        size_t          issues_len;
+} fsck_report_t;
+
+typedef struct fsck fsck_t;
+
+// check both files with `threads` workers, 0 - one per online CPU.
+// A missing file is empty.
+int fsck_run(fsck_t **fsck, const char *userspath, const char *statepath, int threads);
+
+const fsck_report_t* fsck_report(const fsck_t *fsck);
+
+const char* fsck_problem_name(fsck_problem_t problem);
+
+// replace both files with the repaired records.
+int fsck_repair(fsck_t *fsck);
+
+void fsck_free(fsck_t *fsck);
+
+#endif
@@ -0,0 +1,335 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#define _GNU_SOURCE
+#include "groups.h"
+#include "hashmap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <libgen.h>
+#include <pwd.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define GROUPS_MAGIC "PPGRP001"
+#define GROUPS_MAGIC_LEN 8
+
+// slots of the table, the file is sparse until they are used
+#define GROUPS_SLOTS 65536
+
+// slots probed from the home slot, the oldest of them is replaced
+#define GROUPS_PROBE 8
+
+struct groups_header {
+        char            magic[GROUPS_MAGIC_LEN];
+        uint32_t        slots;
+        uint32_t        slot_size;
+};
+
+struct groups_slot {
+        uint32_t        hash;
+        uint32_t        len;                            // of names
+        int64_t         expires;                        // 0 - empty
+        char            user[GROUPS_USER_MAX];
+        char            names[GROUPS_NAMES_MAX];
+};
+
+struct groups_cache {
+        int                     fd;             // -1 - no cache
+        struct groups_slot      *slots;
+        size_t                  size;           // of the mapping
+        unsigned int            ttl;
+        groups_resolve_fn       resolve;        // NULL - groups_nss
+};
+
+static int groups_map(groups_cache_t *cache, const char *path);
+static bool groups_safe(const struct stat *st);
+static bool groups_get(groups_cache_t *cache, const char *username, char *names, size_t *len);
+static void groups_put(groups_cache_t *cache, const char *username,
+                       const char *names, size_t len);
+
+int groups_nss(const char *username, char *names, size_t *len) {
+        long bufsize = sysconf(_SC_GETPW_R_SIZE_MAX);
+        if (bufsize < 1024) {
+                bufsize = 16384;
+        }
+        char *buf = malloc(bufsize);
+        gid_t *gids = NULL;
+        int err = 0;
+        size_t used = 0;
+        if (buf == NULL) {
+                return -1;
+        }
+
+        struct passwd pw;
+        struct passwd *found = NULL;
+        int rc;
+        while ((rc = getpwnam_r(username, &pw, buf, bufsize, &found)) == ERANGE) {
+                bufsize *= 2;
+                char *grown = realloc(buf, bufsize);
+                if (grown == NULL) {
+                        err = -1;
+                        goto GROUPS_NSS_RET;
+                }
+                buf = grown;
+        }
+        if (rc != 0) {
+                err = ERR_GROUPS_NSS;
+                goto GROUPS_NSS_RET;
+        }
+        if (found == NULL) {
+                // unknown user, no groups
+                goto GROUPS_NSS_RET;
+        }
+
+        int ngids = 32;
+        for (;;) {
+                gid_t *grown = realloc(gids, ngids * sizeof(gid_t));
+                if (grown == NULL) {
+                        err = -1;
+                        goto GROUPS_NSS_RET;
+                }
+                gids = grown;
+                const int want = ngids;
+                if (getgrouplist(username, pw.pw_gid, gids, &ngids) >= 0) {
+                        break;
+                }
+                if (ngids <= want) {
+                        ngids = want * 2;
+                }
+        }
+
+        for (int i = 0; i < ngids; i++) {
+                struct group gr;
+                struct group *gfound = NULL;
+                while ((rc = getgrgid_r(gids[i], &gr, buf, bufsize, &gfound)) == ERANGE) {
+                        bufsize *= 2;
+                        char *grown = realloc(buf, bufsize);
+                        if (grown == NULL) {
+                                err = -1;
+                                goto GROUPS_NSS_RET;
+                        }
+                        buf = grown;
+                }
+                if (rc != 0) {
+                        err = ERR_GROUPS_NSS;
+                        goto GROUPS_NSS_RET;
+                }
+                if (gfound == NULL) {
+                        // a gid without a name has no @group record
+                        continue;
+                }
+                const size_t name_len = strlen(gr.gr_name) + 1;
+                if (used + name_len > *len) {
+                        err = ERR_GROUPS_TOO_MANY;
+                        goto GROUPS_NSS_RET;
+                }
+                memcpy(names + used, gr.gr_name, name_len);
+                used += name_len;
+        }
+
+GROUPS_NSS_RET:
+        *len = used;
+        free(gids);
+        free(buf);
+        return err;
+}
+
+int groups_cache_open(groups_cache_t **cache, const char *path, unsigned int ttl,
+                      groups_resolve_fn resolve) {
+        groups_cache_t *c = malloc(sizeof(groups_cache_t));
+        if (c == NULL) {
+                return -1;
+        }
+        memset(c, 0, sizeof(groups_cache_t));
+        c->fd = -1;
+        c->ttl = ttl;
+        c->resolve = resolve;
+        if (path != NULL && ttl > 0) {
+                int err = groups_map(c, path);
+                if (err != 0) {
+                        groups_cache_close(c);
+                        return err;
+                }
+        }
+        *cache = c;
+        return 0;
+}
+
+int groups_visit(groups_cache_t *cache, const char *username,
+                 groups_visit_fn visit, void *ctx) {
+        char names[GROUPS_LIST_MAX];
+        size_t len = sizeof(names);
+        if (!groups_get(cache, username, names, &len)) {
+                len = sizeof(names);
+                int err = cache->resolve != NULL ?
+                        cache->resolve(username, names, &len) : groups_nss(username, names, &len);
+                if (err != 0) {
+                        return err;
+                }
+                groups_put(cache, username, names, len);
+        }
+        for (size_t pos = 0; pos < len; pos += strlen(names + pos) + 1) {
+                int ret = visit(ctx, names + pos);
+                if (ret != 0) {
+                        return ret;
+                }
+        }
+        return 0;
+}
+
+void groups_cache_close(groups_cache_t *cache) {
+        if (cache == NULL) {
+                return;
+        }
+        if (cache->slots != NULL) {
+                munmap((void*)((char*)cache->slots - sizeof(struct groups_header)), cache->size);
+        }
+        if (cache->fd >= 0) {
+                close(cache->fd);
+        }
+        free(cache);
+}
+
+/*
+ * Map the table, the first process to open it lays it out under the
+ * exclusive lock. Root maps it into every authentication, so it must be
+ * a regular file of ours that nobody else can write, never a link.
+ */
+static int groups_map(groups_cache_t *cache, const char *path) {
+        int fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+        if (fd < 0 && errno == ENOENT) {
+                // runtime directory is gone after reboot
+                char *dir = strdup(path);
+                if (dir != NULL) {
+                        mkdir(dirname(dir), 0700);
+                        free(dir);
+                }
+                fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+        }
+        if (fd < 0) {
+                return ERR_GROUPS_OPEN;
+        }
+        cache->fd = fd;
+        if (flock(fd, LOCK_EX) != 0) {
+                return ERR_GROUPS_OPEN;
+        }
+
+        const size_t size = sizeof(struct groups_header) +
+                GROUPS_SLOTS * sizeof(struct groups_slot);
+        struct groups_header header;
+        struct stat st;
+        int err = 0;
+        if (fstat(fd, &st) != 0) {
+                err = ERR_GROUPS_OPEN;
+        } else if (!groups_safe(&st)) {
+                err = ERR_GROUPS_UNSAFE;
+        } else if ((size_t)st.st_size != size ||
+                        pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+                        memcmp(header.magic, GROUPS_MAGIC, GROUPS_MAGIC_LEN) != 0 ||
+                        header.slots != GROUPS_SLOTS ||
+                        header.slot_size != sizeof(struct groups_slot)) {
+                // new or of another layout, start empty
+                memset(&header, 0, sizeof(header));
+                memcpy(header.magic, GROUPS_MAGIC, GROUPS_MAGIC_LEN);
+                header.slots = GROUPS_SLOTS;
+                header.slot_size = sizeof(struct groups_slot);
+                if (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0 ||
+                                pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+                        err = ERR_GROUPS_OPEN;
+                }
+        }
+        if (err == 0) {
+                void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (base == MAP_FAILED) {
+                        err = ERR_GROUPS_MAP;
+                } else {
+                        cache->slots = (struct groups_slot*)((char*)base +
+                                                             sizeof(struct groups_header));
+                        cache->size = size;
+                }
+        }
+        flock(fd, LOCK_UN);
+        return err;
+}
+
+// as the timestamps: owned by us, no access for group and others
+static bool groups_safe(const struct stat *st) {
+        return S_ISREG(st->st_mode) && st->st_uid == geteuid() && (st->st_mode & 077) == 0;
+}
+
+static int64_t groups_now(void) {
+        return (int64_t)time(NULL);
+}
+
+// fresh names of the user, an entry from a clock set back is stale
+static bool groups_get(groups_cache_t *cache, const char *username, char *names, size_t *len) {
+        const size_t user_len = strlen(username);
+        if (cache->slots == NULL || user_len >= GROUPS_USER_MAX) {
+                return false;
+        }
+        const uint32_t hash = hashmap_hash(username);
+        const int64_t now = groups_now();
+        bool found = false;
+        if (flock(cache->fd, LOCK_SH) != 0) {
+                return false;
+        }
+        for (size_t i = 0; i < GROUPS_PROBE; i++) {
+                const struct groups_slot *slot = &cache->slots[(hash + i) % GROUPS_SLOTS];
+                if (slot->expires == 0 || slot->hash != hash ||
+                                memcmp(slot->user, username, user_len + 1) != 0) {
+                        continue;
+                }
+                if (slot->expires > now && slot->expires <= now + cache->ttl &&
+                                slot->len <= *len) {
+                        memcpy(names, slot->names, slot->len);
+                        *len = slot->len;
+                        found = true;
+                }
+                break;
+        }
+        flock(cache->fd, LOCK_UN);
+        return found;
+}
+
+// keep the names in the slot of the user, an empty one or the oldest
+static void groups_put(groups_cache_t *cache, const char *username,
+                       const char *names, size_t len) {
+        const size_t user_len = strlen(username);
+        if (cache->slots == NULL || user_len >= GROUPS_USER_MAX || len > GROUPS_NAMES_MAX) {
+                return;
+        }
+        const uint32_t hash = hashmap_hash(username);
+        if (flock(cache->fd, LOCK_EX) != 0) {
+                return;
+        }
+        struct groups_slot *target = NULL;
+        for (size_t i = 0; i < GROUPS_PROBE; i++) {
+                struct groups_slot *slot = &cache->slots[(hash + i) % GROUPS_SLOTS];
+                if (slot->expires != 0 && slot->hash == hash &&
+                                memcmp(slot->user, username, user_len + 1) == 0) {
+                        target = slot;
+                        break;
+                }
+                if (target == NULL || slot->expires < target->expires) {
+                        target = slot;
+                }
+        }
+        target->hash = hash;
+        target->len = len;
+        target->expires = groups_now() + cache->ttl;
+        memcpy(target->user, username, user_len + 1);
+        memcpy(target->names, names, len);
+        flock(cache->fd, LOCK_UN);
+}
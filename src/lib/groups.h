@@ -0,0 +1,58 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#ifndef _GROUPS_H
+#define _GROUPS_H
+
+#include <stddef.h>
+
+/*
+ * Group names of users from NSS, cached for the PAM module.
+ *
+ * `@<group>` records of the users file give a PIN to the members of the
+ * group without a record of their own. The groups of a user take an NSS
+ * round trip for the user and for every group id, which may go to LDAP
+ * or SSSD, so the names are kept for a TTL in a table mapped from a file
+ * (usually on tmpfs) and shared by the concurrent authentications.
+ * Unknown users and users without groups are cached too.
+ */
+
+enum {
+        ERR_GROUPS_OPEN = 1,
+        ERR_GROUPS_MAP,
+        ERR_GROUPS_NSS,
+        ERR_GROUPS_TOO_MANY,
+        ERR_GROUPS_UNSAFE,      // the cache file is not a private file of ours
+};
+
+// longer usernames and name lists are resolved every time
+#define GROUPS_USER_MAX 64
+#define GROUPS_NAMES_MAX 432
+
+// room for the names of a resolved user
+#define GROUPS_LIST_MAX 4096
+
+// NUL terminated group names of the user into names, primary group first.
+// *len is the room on input and the used bytes on return.
+typedef int (*groups_resolve_fn)(const char *username, char *names, size_t *len);
+
+// non-zero stops the visit and is returned by it.
+typedef int (*groups_visit_fn)(void *ctx, const char *group);
+
+typedef struct groups_cache groups_cache_t;
+
+// the groups of the user from NSS.
+int groups_nss(const char *username, char *names, size_t *len);
+
+// NULL path or ttl 0 - no cache, NULL resolve - groups_nss.
+int groups_cache_open(groups_cache_t **cache, const char *path, unsigned int ttl,
+                      groups_resolve_fn resolve);
+
+int groups_visit(groups_cache_t *cache, const char *username,
+                 groups_visit_fn visit, void *ctx);
+
+void groups_cache_close(groups_cache_t *cache);
+
+#endif
@@ -0,0 +1,217 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#include "hashmap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct slot {
+        const char      *key;   // NULL - empty slot
+        uint32_t        hash;
+        uint32_t        value;
+};
+
+struct hashmap {
+        struct slot     *slots;
+        size_t          len;
+        size_t          cap;    // power of two
+        const alloc_t   *alloc;
+};
+
+static int hashmap_grow(hashmap_t *map);
+
+static int hashmap_rehash(hashmap_t *map, size_t newcap);
+
+static struct slot* hashmap_lookup(const hashmap_t *map,
+                                   const char *key,
+                                   uint32_t hash);
+
+hashmap_t* hashmap_new(size_t cap) {
+        return hashmap_new_alloc(cap, NULL);
+}
+
+hashmap_t* hashmap_new_alloc(size_t cap, const alloc_t *alloc) {
+        if (alloc == NULL) {
+                alloc = &alloc_libc;
+        }
+        hashmap_t *map = alloc_malloc(alloc, sizeof(hashmap_t));
+        if (map == NULL) {
+                return NULL;
+        }
+        map->alloc = alloc;
+        // keep load factor below 3/4 for the requested capacity
+        size_t slots = 16;
+        while (slots * 3 < cap * 4) {
+                slots *= 2;
+        }
+        map->slots = alloc_calloc(alloc, slots, sizeof(struct slot));
+        if (map->slots == NULL) {
+                alloc_free(alloc, map);
+                return NULL;
+        }
+        map->len = 0;
+        map->cap = slots;
+        return map;
+}
+
+int hashmap_put(hashmap_t *map, const char *key, uint32_t value) {
+        const uint32_t hash = hashmap_hash(key);
+        struct slot *slot = hashmap_lookup(map, key, hash);
+        if (slot->key != NULL) {
+                slot->value = value;
+                return 0;
+        }
+        if ((map->len + 1) * 4 > map->cap * 3) {
+                if (hashmap_grow(map) != 0) {
+                        return -1;
+                }
+                slot = hashmap_lookup(map, key, hash);
+        }
+        slot->key = key;
+        slot->hash = hash;
+        slot->value = value;
+        map->len++;
+        return 0;
+}
+
+int hashmap_insert(hashmap_t *map, const char *key, uint32_t hash, uint32_t value) {
+        struct slot *slot = hashmap_lookup(map, key, hash);
+        if (slot->key != NULL) {
+                return 1;
+        }
+        if ((map->len + 1) * 4 > map->cap * 3) {
+                if (hashmap_grow(map) != 0) {
+                        return -1;
+                }
+                slot = hashmap_lookup(map, key, hash);
+        }
+        slot->key = key;
+        slot->hash = hash;
+        slot->value = value;
+        map->len++;
+        return 0;
+}
+
+void hashmap_prefetch(const hashmap_t *map, uint32_t hash) {
+        __builtin_prefetch(&map->slots[hash & (map->cap - 1)], 1);
+}
+
+int hashmap_reserve(hashmap_t *map, size_t len) {
+        size_t newcap = map->cap;
+        while (len * 4 > newcap * 3) {
+                newcap *= 2;
+        }
+        return newcap == map->cap ? 0 : hashmap_rehash(map, newcap);
+}
+
+bool hashmap_get(const hashmap_t *map, const char *key, uint32_t *value) {
+        const struct slot *slot = hashmap_lookup(map, key, hashmap_hash(key));
+        if (slot->key == NULL) {
+                return false;
+        }
+        if (value != NULL) {
+                *value = slot->value;
+        }
+        return true;
+}
+
+bool hashmap_remove(hashmap_t *map, const char *key) {
+        struct slot *slot = hashmap_lookup(map, key, hashmap_hash(key));
+        if (slot->key == NULL) {
+                return false;
+        }
+        // backward shift deletion: move following entries of the probe
+        // sequence into the hole, so lookups never need tombstones
+        const size_t mask = map->cap - 1;
+        size_t hole = slot - map->slots;
+        size_t i = hole;
+        for (;;) {
+                i = (i + 1) & mask;
+                struct slot *next = &map->slots[i];
+                if (next->key == NULL) {
+                        break;
+                }
+                const size_t home = next->hash & mask;
+                // entry may move to the hole only if its home slot
+                // is not in the cyclic range (hole, i]
+                if (((i - home) & mask) >= ((i - hole) & mask)) {
+                        map->slots[hole] = *next;
+                        hole = i;
+                }
+        }
+        map->slots[hole].key = NULL;
+        map->len--;
+        return true;
+}
+
+size_t hashmap_len(const hashmap_t *map) {
+        return map->len;
+}
+
+void hashmap_clear(hashmap_t *map) {
+        memset(map->slots, 0, map->cap * sizeof(struct slot));
+        map->len = 0;
+}
+
+void hashmap_free(hashmap_t *map) {
+        if (map == NULL) {
+                return;
+        }
+        alloc_free(map->alloc, map->slots);
+        alloc_free(map->alloc, map);
+}
+
+uint32_t hashmap_hash(const char *key) {
+        // FNV-1a
+        uint32_t hash = 2166136261u;
+        for (const unsigned char *p = (const unsigned char*)key; *p; p++) {
+                hash ^= *p;
+                hash *= 16777619u;
+        }
+        return hash;
+}
+
+static struct slot* hashmap_lookup(const hashmap_t *map,
+                                   const char *key,
+                                   uint32_t hash) {
+        const size_t mask = map->cap - 1;
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+                struct slot *slot = &map->slots[i];
+                if (slot->key == NULL) {
+                        return slot;
+                }
+                if (slot->hash == hash && strcmp(slot->key, key) == 0) {
+                        return slot;
+                }
+        }
+}
+
+static int hashmap_grow(hashmap_t *map) {
+        return hashmap_rehash(map, map->cap * 2);
+}
+
+static int hashmap_rehash(hashmap_t *map, size_t newcap) {
+        struct slot *slots = alloc_calloc(map->alloc, newcap, sizeof(struct slot));
+        if (slots == NULL) {
+                return -1;
+        }
+        const size_t mask = newcap - 1;
+        for (size_t i = 0; i < map->cap; i++) {
+                struct slot *old = &map->slots[i];
+                if (old->key == NULL) {
+                        continue;
+                }
+                size_t j = old->hash & mask;
+                while (slots[j].key != NULL) {
+                        j = (j + 1) & mask;
+                }
+                slots[j] = *old;
+        }
+        alloc_free(map->alloc, map->slots);
+        map->slots = slots;
+        map->cap = newcap;
+        return 0;
+}
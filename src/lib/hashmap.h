@@ -0,0 +1,53 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#ifndef _HASHMAP_H
+#define _HASHMAP_H
+
+#include "alloc.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Open addressing hash map from a string key to a 32-bit value.
+ * Keys are borrowed: the map stores the pointer, the caller keeps
+ * the string alive while it is in the map.
+ */
+struct hashmap;
+typedef struct hashmap hashmap_t;
+
+hashmap_t* hashmap_new(size_t cap);
+
+// the map and its slots from alloc, NULL - alloc_libc
+hashmap_t* hashmap_new_alloc(size_t cap, const alloc_t *alloc);
+
+// insert or replace the value for key
+int hashmap_put(hashmap_t *map, const char *key, uint32_t value);
+
+// insert key with its precomputed hashmap_hash unless it is there,
+// 1 - the key is there and keeps its value
+int hashmap_insert(hashmap_t *map, const char *key, uint32_t hash, uint32_t value);
+
+// start loading the slot of the hash ahead of an insert
+void hashmap_prefetch(const hashmap_t *map, uint32_t hash);
+
+// room for len keys in total without growing
+int hashmap_reserve(hashmap_t *map, size_t len);
+
+bool hashmap_get(const hashmap_t *map, const char *key, uint32_t *value);
+
+bool hashmap_remove(hashmap_t *map, const char *key);
+
+size_t hashmap_len(const hashmap_t *map);
+
+void hashmap_clear(hashmap_t *map);
+
+void hashmap_free(hashmap_t *map);
+
+uint32_t hashmap_hash(const char *key);
+
+#endif
@@ -0,0 +1,638 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#define _GNU_SOURCE
+#include "kdf.h"
+#include "txn.h"
+#include "crypt.h"
+#include "argon2.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <time.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#define KDF_RAW_LEN (PIN_HASH_LEN / 2)
+
+// cost limits, records outside of them are rejected as invalid
+#define PBKDF2_MIN_ITER 1
+#define PBKDF2_MAX_ITER 100000000
+#define SCRYPT_MAX_LN 30
+#define SCRYPT_MAX_R 64
+#define SCRYPT_MAX_P 16
+#define ARGON2_MAX_PASSES 1024
+#define ARGON2_MAX_MEMORY (4u * 1024 * 1024)    // 4 GiB
+#define ARGON2_MAX_LANES 64
+
+// calibration bounds: a PAM module should not take more memory than this
+#define CALIBRATE_ARGON2_MAX_MEMORY (256u * 1024)
+#define CALIBRATE_SAMPLES 3
+
+static const char * const kdf_names[] = {
+        [KDF_SHA256] = "sha256",
+        [KDF_PBKDF2_SHA256] = "pbkdf2-sha256",
+        [KDF_SCRYPT] = "scrypt",
+        [KDF_ARGON2ID] = "argon2id",
+        [KDF_SHA256_PEPPER] = "sha256-pepper",
+};
+
+// host pepper, set once on startup before any hashing
+static uint8_t kdf_pepper[PIN_PEPPER_LEN];
+static uint32_t kdf_pepper_ver;
+
+static int kdf_scan_params(const char *text, size_t len, kdf_params_t *params);
+static int kdf_print_params(const kdf_params_t *params, char *buf, size_t len);
+static double kdf_measure(const kdf_params_t *params);
+static void hex_encode(const uint8_t *in, size_t len, uint8_t *out);
+static int hex_decode(const char *in, size_t len, uint8_t *out);
+
+void kdf_default(kdf_params_t *params) {
+        memset(params, 0, sizeof(kdf_params_t));
+        params->alg = KDF_SHA256;
+}
+
+int kdf_hash(const kdf_params_t *params, const pin_source_t pin, pin_hash_t out) {
+        if (!kdf_valid(params)) {
+                return ERR_KDF_PARAMS;
+        }
+        uint8_t raw[KDF_RAW_LEN];
+        int err = 0;
+        switch (params->alg) {
+                case KDF_SHA256:
+                        return hash_pin(pin, out) == 0 ? 0 : ERR_KDF_HASH;
+                case KDF_PBKDF2_SHA256:
+                        if (PKCS5_PBKDF2_HMAC((const char*)pin, PIN_SOURCE_LEN,
+                                              params->salt, KDF_SALT_LEN, params->cost,
+                                              EVP_sha256(), KDF_RAW_LEN, raw) != 1) {
+                                err = ERR_KDF_HASH;
+                        }
+                        break;
+                case KDF_SCRYPT: {
+                        const uint64_t n = 1ULL << params->cost;
+                        // V and B arrays plus some slack for OpenSSL bookkeeping
+                        const uint64_t maxmem = 128ULL * params->memory *
+                                (n + params->parallel + 2) + (1 << 20);
+                        if (EVP_PBE_scrypt((const char*)pin, PIN_SOURCE_LEN,
+                                           params->salt, KDF_SALT_LEN, n, params->memory,
+                                           params->parallel, maxmem, raw, KDF_RAW_LEN) != 1) {
+                                err = ERR_KDF_HASH;
+                        }
+                        break;
+                }
+                case KDF_SHA256_PEPPER: {
+                        pin_midstate_t mid;
+                        err = kdf_midstate(params, &mid);
+                        if (err == 0) {
+                                hash_pin_midstate(&mid, pin, out);
+                        }
+                        memset(&mid, 0, sizeof(pin_midstate_t));
+                        return err;
+                }
+                case KDF_ARGON2ID: {
+                        argon2_input_t in;
+                        memset(&in, 0, sizeof(argon2_input_t));
+                        in.pwd = pin;
+                        in.pwdlen = PIN_SOURCE_LEN;
+                        in.salt = params->salt;
+                        in.saltlen = KDF_SALT_LEN;
+                        in.passes = params->cost;
+                        in.memory = params->memory;
+                        in.lanes = params->parallel;
+                        if (argon2id(&in, raw, KDF_RAW_LEN) != 0) {
+                                err = ERR_KDF_HASH;
+                        }
+                        break;
+                }
+                default:
+                        return ERR_KDF_PARAMS;
+        }
+        if (err == 0) {
+                hex_encode(raw, KDF_RAW_LEN, out);
+        }
+        memset(raw, 0, sizeof(raw));
+        return err;
+}
+
+int kdf_salt(kdf_params_t *params) {
+        if (RAND_bytes(params->salt, KDF_SALT_LEN) != 1) {
+                return ERR_KDF_SALT;
+        }
+        return 0;
+}
+
+const char* kdf_name(kdf_alg_t alg) {
+        if ((size_t)alg >= sizeof(kdf_names) / sizeof(kdf_names[0])) {
+                return "unknown";
+        }
+        return kdf_names[alg];
+}
+
+int kdf_parse_alg(const char *name, kdf_alg_t *alg) {
+        for (size_t i = 0; i < sizeof(kdf_names) / sizeof(kdf_names[0]); i++) {
+                if (strcmp(name, kdf_names[i]) == 0) {
+                        *alg = (kdf_alg_t)i;
+                        return 0;
+                }
+        }
+        return ERR_KDF_PARAMS;
+}
+
+int kdf_parse(const char *value, kdf_params_t *params, const char **hash) {
+        if (value[0] != '$') {
+                kdf_default(params);
+                *hash = value;
+                return 0;
+        }
+        // $<alg>$<params>$<salt>$<hash>
+        const char *alg = value + 1;
+        const char *opts = strchr(alg, '$');
+        const char *salt = opts != NULL ? strchr(opts + 1, '$') : NULL;
+        const char *end = salt != NULL ? strchr(salt + 1, '$') : NULL;
+        if (end == NULL || end - salt - 1 != KDF_SALT_LEN * 2) {
+                return ERR_KDF_PARAMS;
+        }
+        char name[32];
+        if ((size_t)(opts - alg) >= sizeof(name)) {
+                return ERR_KDF_PARAMS;
+        }
+        memcpy(name, alg, opts - alg);
+        name[opts - alg] = '\0';
+
+        kdf_params_t parsed;
+        memset(&parsed, 0, sizeof(kdf_params_t));
+        kdf_alg_t id;
+        if (kdf_parse_alg(name, &id) != 0 || id == KDF_SHA256) {
+                return ERR_KDF_PARAMS;
+        }
+        parsed.alg = id;
+        int err = kdf_scan_params(opts + 1, salt - opts - 1, &parsed);
+        if (err != 0) {
+                return err;
+        }
+        if (hex_decode(salt + 1, KDF_SALT_LEN * 2, parsed.salt) != 0) {
+                return ERR_KDF_PARAMS;
+        }
+        *params = parsed;
+        *hash = end + 1;
+        return 0;
+}
+
+int kdf_format(const kdf_params_t *params, char *buf, size_t len) {
+        if (params->alg == KDF_SHA256) {
+                if (len < 1) {
+                        return ERR_KDF_PARAMS;
+                }
+                buf[0] = '\0';
+                return 0;
+        }
+        int err = kdf_format_spec(params, buf, len);
+        if (err != 0) {
+                return err;
+        }
+        size_t used = strlen(buf);
+        if (used + KDF_SALT_LEN * 2 + 2 > len) {
+                return ERR_KDF_PARAMS;
+        }
+        hex_encode(params->salt, KDF_SALT_LEN, (uint8_t*)buf + used);
+        buf[used + KDF_SALT_LEN * 2] = '$';
+        buf[used + KDF_SALT_LEN * 2 + 1] = '\0';
+        return 0;
+}
+
+int kdf_parse_spec(const char *spec, kdf_params_t *params) {
+        // $<alg>$<params>$
+        if (spec[0] != '$') {
+                return ERR_KDF_PARAMS;
+        }
+        const char *alg = spec + 1;
+        const char *opts = strchr(alg, '$');
+        const char *end = opts != NULL ? strchr(opts + 1, '$') : NULL;
+        if (end == NULL || end[1] != '\0') {
+                return ERR_KDF_PARAMS;
+        }
+        char name[32];
+        if ((size_t)(opts - alg) >= sizeof(name)) {
+                return ERR_KDF_PARAMS;
+        }
+        memcpy(name, alg, opts - alg);
+        name[opts - alg] = '\0';
+
+        kdf_params_t parsed;
+        memset(&parsed, 0, sizeof(kdf_params_t));
+        kdf_alg_t id;
+        if (kdf_parse_alg(name, &id) != 0) {
+                return ERR_KDF_PARAMS;
+        }
+        parsed.alg = id;
+        int err = kdf_scan_params(opts + 1, end - opts - 1, &parsed);
+        if (err != 0) {
+                return err;
+        }
+        *params = parsed;
+        return 0;
+}
+
+int kdf_format_spec(const kdf_params_t *params, char *buf, size_t len) {
+        if (!kdf_valid(params)) {
+                return ERR_KDF_PARAMS;
+        }
+        char opts[64];
+        int err = kdf_print_params(params, opts, sizeof(opts));
+        if (err != 0) {
+                return err;
+        }
+        int n = snprintf(buf, len, "$%s$%s$", kdf_name(params->alg), opts);
+        if (n < 0 || (size_t)n >= len) {
+                return ERR_KDF_PARAMS;
+        }
+        return 0;
+}
+
+// weakest first: unsalted, keyed, then the costly ones
+static int kdf_strength(uint32_t alg) {
+        switch (alg) {
+                case KDF_SHA256_PEPPER:
+                        return 1;
+                case KDF_PBKDF2_SHA256:
+                        return 2;
+                case KDF_SCRYPT:
+                        return 3;
+                case KDF_ARGON2ID:
+                        return 4;
+                default:
+                        return 0;
+        }
+}
+
+bool kdf_cost_differs(const kdf_params_t *a, const kdf_params_t *b) {
+        if (b->alg == KDF_SHA256) {
+                return false;
+        }
+        if (a->alg != b->alg) {
+                return kdf_strength(b->alg) > kdf_strength(a->alg);
+        }
+        if (b->cost < a->cost || b->memory < a->memory || b->parallel < a->parallel) {
+                return false;
+        }
+        return a->cost != b->cost || a->memory != b->memory || a->parallel != b->parallel;
+}
+
+int kdf_config_load(const char *path, kdf_params_t *params) {
+        const int err = kdf_config_read(path, params);
+        return err == ERR_KDF_CONFIG_MISSING ? 0 : err;
+}
+
+int kdf_config_read(const char *path, kdf_params_t *params) {
+        kdf_default(params);
+        FILE *f = fopen(path, "r");
+        if (f == NULL) {
+                switch (errno) {
+                        case ENOENT:
+                                return ERR_KDF_CONFIG_MISSING;
+                        ERRORS_DEFAULT(ERR_KDF_CONFIG_OPEN);
+                }
+        }
+        char line[KDF_PREFIX_MAX];
+        int err = ERR_KDF_PARAMS;
+        if (fgets(line, sizeof(line), f) != NULL) {
+                line[strcspn(line, "\r\n")] = '\0';
+                err = kdf_parse_spec(line, params);
+        }
+        fclose(f);
+        if (err != 0) {
+                kdf_default(params);
+        }
+        return err;
+}
+
+int kdf_config_save(const char *path, const kdf_params_t *params) {
+        char spec[KDF_PREFIX_MAX];
+        int err = kdf_format_spec(params, spec, sizeof(spec));
+        if (err != 0) {
+                return err;
+        }
+        // a login never reads a half written config
+        const char *tmppath = NULL;
+        txn_t *txn = txn_new();
+        if (txn == NULL) {
+                return ERR_KDF_CONFIG_OPEN;
+        }
+        FILE *f = NULL;
+        if (txn_add(txn, path, &tmppath) != 0 || (f = fopen(tmppath, "w")) == NULL) {
+                err = ERR_KDF_CONFIG_OPEN;
+                goto KDF_CONFIG_SAVE_RET;
+        }
+        if (fprintf(f, "%s\n", spec) < 0) {
+                err = ERR_KDF_CONFIG_WRITE;
+        }
+        if (fclose(f) != 0) {
+                err = ERR_KDF_CONFIG_WRITE;
+        }
+        if (err == 0 && txn_commit(txn) != 0) {
+                err = ERR_KDF_CONFIG_WRITE;
+        }
+
+KDF_CONFIG_SAVE_RET:
+        txn_free(txn);
+        return err;
+}
+
+int kdf_pepper_load(const char *path) {
+        FILE *f = fopen(path, "r");
+        if (f == NULL) {
+                switch (errno) {
+                        case ENOENT:
+                                return 0;
+                        ERRORS_DEFAULT(ERR_KDF_CONFIG_OPEN);
+                }
+        }
+        char line[PIN_PEPPER_LEN * 2 + 2];
+        uint8_t pepper[PIN_PEPPER_LEN];
+        int err = ERR_KDF_PEPPER;
+        if (fgets(line, sizeof(line), f) != NULL) {
+                line[strcspn(line, "\r\n")] = '\0';
+                if (strlen(line) == PIN_PEPPER_LEN * 2 &&
+                                hex_decode(line, PIN_PEPPER_LEN * 2, pepper) == 0) {
+                        kdf_set_pepper(pepper);
+                        err = 0;
+                }
+        }
+        fclose(f);
+        memset(line, 0, sizeof(line));
+        memset(pepper, 0, sizeof(pepper));
+        return err;
+}
+
+void kdf_set_pepper(const uint8_t *pepper) {
+        if (pepper == NULL) {
+                memset(kdf_pepper, 0, PIN_PEPPER_LEN);
+                kdf_pepper_ver = 0;
+                return;
+        }
+        memcpy(kdf_pepper, pepper, PIN_PEPPER_LEN);
+        // skip 0 on wrap around, it means no pepper
+        static uint32_t counter;
+        counter = counter + 1 == 0 ? 1 : counter + 1;
+        kdf_pepper_ver = counter;
+}
+
+uint32_t kdf_pepper_version(void) {
+        return kdf_pepper_ver;
+}
+
+int kdf_midstate(const kdf_params_t *params, pin_midstate_t *mid) {
+        if (params->alg != KDF_SHA256_PEPPER) {
+                return ERR_KDF_PARAMS;
+        }
+        if (kdf_pepper_ver == 0) {
+                return ERR_KDF_PEPPER;
+        }
+        if (hash_pin_prefix(kdf_pepper, params->salt, KDF_SALT_LEN, mid) != 0) {
+                return ERR_KDF_HASH;
+        }
+        return 0;
+}
+
+int kdf_calibrate(kdf_alg_t alg, unsigned int target_ms,
+                  kdf_params_t *params, double *elapsed_ms) {
+        kdf_params_t p;
+        memset(&p, 0, sizeof(kdf_params_t));
+        p.alg = alg;
+        int err = kdf_salt(&p);
+        if (err != 0) {
+                return err;
+        }
+        const double target = target_ms;
+        double t = 0;
+        switch (alg) {
+                case KDF_SHA256:
+                case KDF_SHA256_PEPPER:
+                        t = kdf_measure(&p);
+                        break;
+                case KDF_PBKDF2_SHA256: {
+                        // grow until the cost is measurable, then scale linearly
+                        p.cost = 1000;
+                        t = kdf_measure(&p);
+                        while (t < target / 4 && p.cost < PBKDF2_MAX_ITER / 2) {
+                                p.cost *= 2;
+                                t = kdf_measure(&p);
+                        }
+                        if (t > 0) {
+                                double scaled = p.cost * (target / t) * 0.95;
+                                p.cost = scaled > PBKDF2_MAX_ITER ? PBKDF2_MAX_ITER :
+                                         scaled < PBKDF2_MIN_ITER ? PBKDF2_MIN_ITER :
+                                         (uint32_t)scaled;
+                        }
+                        t = kdf_measure(&p);
+                        while (t > target && p.cost > 1000) {
+                                p.cost = p.cost / 10 * 9;
+                                t = kdf_measure(&p);
+                        }
+                        break;
+                }
+                case KDF_SCRYPT: {
+                        // cost doubles with every step of N
+                        p.memory = 8;
+                        p.parallel = 1;
+                        p.cost = 10;
+                        t = kdf_measure(&p);
+                        while (p.cost < SCRYPT_MAX_LN) {
+                                kdf_params_t next = p;
+                                next.cost++;
+                                double tn = kdf_measure(&next);
+                                if (tn < 0 || tn > target) {
+                                        break;
+                                }
+                                p = next;
+                                t = tn;
+                        }
+                        break;
+                }
+                case KDF_ARGON2ID: {
+                        // memory first, as recommended by RFC 9106, then passes
+                        p.cost = 1;
+                        p.memory = 1024;
+                        p.parallel = 1;
+                        t = kdf_measure(&p);
+                        while (p.memory < CALIBRATE_ARGON2_MAX_MEMORY) {
+                                kdf_params_t next = p;
+                                next.memory *= 2;
+                                double tn = kdf_measure(&next);
+                                if (tn < 0 || tn > target) {
+                                        break;
+                                }
+                                p = next;
+                                t = tn;
+                        }
+                        while (p.cost < ARGON2_MAX_PASSES) {
+                                kdf_params_t next = p;
+                                next.cost++;
+                                double tn = kdf_measure(&next);
+                                if (tn < 0 || tn > target) {
+                                        break;
+                                }
+                                p = next;
+                                t = tn;
+                        }
+                        break;
+                }
+                default:
+                        return ERR_KDF_PARAMS;
+        }
+        if (t < 0) {
+                return ERR_KDF_HASH;
+        }
+        *params = p;
+        if (elapsed_ms != NULL) {
+                *elapsed_ms = t;
+        }
+        return 0;
+}
+
+bool kdf_valid(const kdf_params_t *params) {
+        switch (params->alg) {
+                case KDF_SHA256:
+                case KDF_SHA256_PEPPER:
+                        return true;
+                case KDF_PBKDF2_SHA256:
+                        return params->cost >= PBKDF2_MIN_ITER &&
+                                params->cost <= PBKDF2_MAX_ITER;
+                case KDF_SCRYPT:
+                        return params->cost >= 1 && params->cost <= SCRYPT_MAX_LN &&
+                                params->memory >= 1 && params->memory <= SCRYPT_MAX_R &&
+                                params->parallel >= 1 && params->parallel <= SCRYPT_MAX_P;
+                case KDF_ARGON2ID:
+                        return params->cost >= 1 && params->cost <= ARGON2_MAX_PASSES &&
+                                params->parallel >= 1 && params->parallel <= ARGON2_MAX_LANES &&
+                                params->memory >= 8 * params->parallel &&
+                                params->memory <= ARGON2_MAX_MEMORY;
+                default:
+                        return false;
+        }
+}
+
+static int kdf_scan_params(const char *text, size_t len, kdf_params_t *params) {
+        char buf[64];
+        if (len >= sizeof(buf)) {
+                return ERR_KDF_PARAMS;
+        }
+        memcpy(buf, text, len);
+        buf[len] = '\0';
+
+        unsigned int a = 0, b = 0, c = 0;
+        int n = -1;
+        switch (params->alg) {
+                case KDF_SHA256:
+                case KDF_SHA256_PEPPER:
+                        n = len == 0 ? 0 : -1;
+                        break;
+                case KDF_PBKDF2_SHA256:
+                        if (sscanf(buf, "i=%u%n", &a, &n) != 1) {
+                                n = -1;
+                        }
+                        params->cost = a;
+                        break;
+                case KDF_SCRYPT:
+                        if (sscanf(buf, "ln=%u,r=%u,p=%u%n", &a, &b, &c, &n) != 3) {
+                                n = -1;
+                        }
+                        params->cost = a;
+                        params->memory = b;
+                        params->parallel = c;
+                        break;
+                case KDF_ARGON2ID:
+                        if (sscanf(buf, "t=%u,m=%u,p=%u%n", &a, &b, &c, &n) != 3) {
+                                n = -1;
+                        }
+                        params->cost = a;
+                        params->memory = b;
+                        params->parallel = c;
+                        break;
+        }
+        if (n < 0 || (size_t)n != len || !kdf_valid(params)) {
+                return ERR_KDF_PARAMS;
+        }
+        return 0;
+}
+
+static int kdf_print_params(const kdf_params_t *params, char *buf, size_t len) {
+        int n = 0;
+        switch (params->alg) {
+                case KDF_SHA256:
+                case KDF_SHA256_PEPPER:
+                        n = snprintf(buf, len, "%s", "");
+                        break;
+                case KDF_PBKDF2_SHA256:
+                        n = snprintf(buf, len, "i=%u", params->cost);
+                        break;
+                case KDF_SCRYPT:
+                        n = snprintf(buf, len, "ln=%u,r=%u,p=%u",
+                                     params->cost, params->memory, params->parallel);
+                        break;
+                case KDF_ARGON2ID:
+                        n = snprintf(buf, len, "t=%u,m=%u,p=%u",
+                                     params->cost, params->memory, params->parallel);
+                        break;
+                default:
+                        return ERR_KDF_PARAMS;
+        }
+        if (n < 0 || (size_t)n >= len) {
+                return ERR_KDF_PARAMS;
+        }
+        return 0;
+}
+
+// median time of a few hashes in milliseconds, negative on error
+static double kdf_measure(const kdf_params_t *params) {
+        const pin_source_t pin = {1, 2, 3, 4};
+        pin_hash_t out;
+        double samples[CALIBRATE_SAMPLES];
+        for (int i = 0; i < CALIBRATE_SAMPLES; i++) {
+                struct timespec start, end;
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                if (kdf_hash(params, pin, out) != 0) {
+                        return -1;
+                }
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                samples[i] = (end.tv_sec - start.tv_sec) * 1e3 +
+                        (end.tv_nsec - start.tv_nsec) / 1e6;
+        }
+        // insertion sort of three
+        for (int i = 1; i < CALIBRATE_SAMPLES; i++) {
+                for (int j = i; j > 0 && samples[j] < samples[j - 1]; j--) {
+                        double tmp = samples[j];
+                        samples[j] = samples[j - 1];
+                        samples[j - 1] = tmp;
+                }
+        }
+        return samples[CALIBRATE_SAMPLES / 2];
+}
+
+static void hex_encode(const uint8_t *in, size_t len, uint8_t *out) {
+        static const char hex[] = "0123456789abcdef";
+        for (size_t i = 0; i < len; i++) {
+                out[i * 2] = hex[in[i] >> 4];
+                out[i * 2 + 1] = hex[in[i] & 0x0f];
+        }
+}
+
+static int hex_decode(const char *in, size_t len, uint8_t *out) {
+        for (size_t i = 0; i < len; i += 2) {
+                int hi = isdigit((unsigned char)in[i]) ? in[i] - '0' :
+                        (in[i] >= 'a' && in[i] <= 'f') ? in[i] - 'a' + 10 : -1;
+                int lo = isdigit((unsigned char)in[i + 1]) ? in[i + 1] - '0' :
+                        (in[i + 1] >= 'a' && in[i + 1] <= 'f') ? in[i + 1] - 'a' + 10 : -1;
+                if (hi < 0 || lo < 0) {
+                        return -1;
+                }
+                out[i / 2] = (uint8_t)(hi << 4 | lo);
+        }
+        return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#ifndef _KDF_H
+#define _KDF_H
+
+#include "types.h"
+#include "crypt.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * PIN hashing algorithms.
+ *
+ * Every users file record names the algorithm it was hashed with,
+ * records without a name are legacy unsalted SHA-256:
+ *   <username>:<pin_hash>
+ *   <username>:$pbkdf2-sha256$i=<iterations>$<salt>$<pin_hash>
+ *   <username>:$scrypt$ln=<log2 N>,r=<r>,p=<p>$<salt>$<pin_hash>
+ *   <username>:$argon2id$t=<passes>,m=<KiB>,p=<lanes>$<salt>$<pin_hash>
+ *   <username>:$sha256-pepper$$<salt>$<pin_hash>
+ * Salt and hash are lowercase hex, every algorithm yields 32 bytes.
+ *
+ * sha256-pepper is a single SHA-256 keyed with the host pepper, see
+ * hash_pin_prefix. It is cheap by design and relies on the pepper file
+ * staying secret, unlike the memory hard algorithms.
+ *
+ * New PINs are hashed with the algorithm from the kdf config file,
+ * a single `$<alg>$<params>$` line written by `ppedit calibrate`.
+ */
+
+typedef enum {
+        KDF_SHA256 = 0,
+        KDF_PBKDF2_SHA256,
+        KDF_SCRYPT,
+        KDF_ARGON2ID,
+        KDF_SHA256_PEPPER,
+} kdf_alg_t;
+
+#define KDF_SALT_LEN 16
+
+// longest "$<alg>$<params>$<salt>$" prefix
+#define KDF_PREFIX_MAX 128
+
+typedef struct kdf_params {
+        uint32_t        alg;            // kdf_alg_t
+        uint32_t        cost;           // pbkdf2: iterations, scrypt: log2 N, argon2id: passes
+        uint32_t        memory;         // scrypt: r, argon2id: KiB
+        uint32_t        parallel;       // scrypt, argon2id: p
+        uint8_t         salt[KDF_SALT_LEN];
+} kdf_params_t;
+
+enum {
+        ERR_KDF_PARAMS = 1,
+        ERR_KDF_SALT,
+        ERR_KDF_HASH,
+        ERR_KDF_CONFIG_OPEN,
+        ERR_KDF_CONFIG_WRITE,
+        ERR_KDF_PEPPER,
+        ERR_KDF_CONFIG_MISSING,
+};
+
+// legacy unsalted SHA-256
+void kdf_default(kdf_params_t *params);
+
+int kdf_hash(const kdf_params_t *params, const pin_source_t pin, pin_hash_t out);
+
+// true if the algorithm is known and its cost within the supported limits.
+bool kdf_valid(const kdf_params_t *params);
+
+// fill the salt with random bytes.
+int kdf_salt(kdf_params_t *params);
+
+const char* kdf_name(kdf_alg_t alg);
+
+int kdf_parse_alg(const char *name, kdf_alg_t *alg);
+
+// parse a record value, hash points to the pin hash after the prefix.
+int kdf_parse(const char *value, kdf_params_t *params, const char **hash);
+
+// write the record prefix, empty for legacy SHA-256.
+int kdf_format(const kdf_params_t *params, char *buf, size_t len);
+
+// parse and format the algorithm and cost without salt: "$<alg>$<params>$".
+int kdf_parse_spec(const char *spec, kdf_params_t *params);
+int kdf_format_spec(const kdf_params_t *params, char *buf, size_t len);
+
+// true if a hash made with a should be replaced by one made with b: b is a
+// stronger algorithm, or the same one with a raised and no lowered cost.
+// Never true for a legacy SHA-256 b.
+bool kdf_cost_differs(const kdf_params_t *a, const kdf_params_t *b);
+
+// enrollment parameters, missing file means legacy SHA-256.
+int kdf_config_load(const char *path, kdf_params_t *params);
+// as kdf_config_load, but ERR_KDF_CONFIG_MISSING if there is no file.
+int kdf_config_read(const char *path, kdf_params_t *params);
+// replaces the file through a synced temporary one, see txn.h.
+int kdf_config_save(const char *path, const kdf_params_t *params);
+
+// host pepper: one line of PIN_PEPPER_LEN hex encoded bytes,
+// missing file leaves sha256-pepper records unverifiable.
+int kdf_pepper_load(const char *path);
+
+// replace the pepper, NULL clears it.
+void kdf_set_pepper(const uint8_t *pepper);
+
+// changes every time the pepper is replaced, 0 if there is no pepper.
+uint32_t kdf_pepper_version(void);
+
+// midstate of the sha256-pepper prefix for the record salt.
+int kdf_midstate(const kdf_params_t *params, pin_midstate_t *mid);
+
+// find the most expensive parameters of alg which hash within target_ms.
+int kdf_calibrate(kdf_alg_t alg, unsigned int target_ms,
+                  kdf_params_t *params, double *elapsed_ms);
+
+#endif
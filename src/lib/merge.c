@@ -0,0 +1,533 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#define _GNU_SOURCE
+#include "merge.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MERGE_SIDES_MAX 3
+
+struct record {
+        size_t          off;            // of the line in the chunk buffer
+        size_t          name_len;
+        size_t          len;            // without the newline
+        size_t          seq;            // line number, the first one of a user wins
+};
+
+struct run {
+        FILE            *file;          // NULL - the last chunk in memory
+        char            *line;
+        size_t          cap;
+        const char      *cur;           // NULL - exhausted
+        size_t          name_len;
+        size_t          len;
+};
+
+// an input sorted by username
+typedef struct sorted {
+        struct run      *runs;
+        size_t          runs_len;
+        size_t          spilled;
+        size_t          *heap;          // runs by their current name
+        size_t          heap_len;
+        // the chunk being read, the last one stays for the merge
+        char            *buf;
+        size_t          buf_cap;
+        size_t          buf_len;
+        struct record   *records;
+        size_t          records_len;
+        size_t          records_cap;
+        size_t          next;           // next record of the last chunk
+        // the line returned last, its ':' replaced with '\0'
+        char            *last;
+        size_t          last_cap;
+        size_t          last_name_len;
+        bool            has_last;
+        int             err;
+} sorted_t;
+
+struct value {
+        const char      *data;
+        size_t          len;
+        bool            present;
+};
+
+struct side {
+        sorted_t        sorted;
+        const char      *name;          // NULL - at the end
+        struct value    value;
+};
+
+// called for every user of the inputs with its record in each of them
+typedef int (*join_fn)(void *arg, const char *username, const struct value *values);
+
+struct join_ctx {
+        merge_fn        changed;
+        void            *ctx;
+        merge_report_t  *report;
+        FILE            *out;
+};
+
+static int sorted_open(sorted_t *s, const char *path, size_t mem);
+static const char* sorted_next(sorted_t *s, struct value *value);
+static void sorted_close(sorted_t *s);
+static int join(const char **paths, size_t n, size_t mem, join_fn fn, struct join_ctx *arg);
+
+const char* merge_change_name(merge_change_t change) {
+        switch (change) {
+                case MERGE_ADDED:
+                        return "added";
+                case MERGE_REMOVED:
+                        return "removed";
+                case MERGE_CHANGED:
+                        return "changed";
+                case MERGE_CONFLICT:
+                        return "conflict";
+        }
+        return "unknown";
+}
+
+static bool value_eq(const struct value *a, const struct value *b) {
+        if (a->present != b->present) {
+                return false;
+        }
+        return !a->present || (a->len == b->len && memcmp(a->data, b->data, a->len) == 0);
+}
+
+static void report(struct join_ctx *arg, merge_change_t change, const char *username) {
+        arg->report->changes[change]++;
+        if (arg->changed != NULL) {
+                arg->changed(arg->ctx, change, username);
+        }
+}
+
+static void report_change(struct join_ctx *arg, const char *username,
+                          const struct value *from, const struct value *to) {
+        if (value_eq(from, to)) {
+                return;
+        }
+        if (!from->present) {
+                report(arg, MERGE_ADDED, username);
+        } else if (!to->present) {
+                report(arg, MERGE_REMOVED, username);
+        } else {
+                report(arg, MERGE_CHANGED, username);
+        }
+}
+
+static int diff_user(void *ctx, const char *username, const struct value *values) {
+        report_change(ctx, username, &values[0], &values[1]);
+        return 0;
+}
+
+int merge_diff(const char *a, const char *b, size_t mem,
+               merge_fn changed, void *ctx, merge_report_t *report) {
+        memset(report, 0, sizeof(merge_report_t));
+        struct join_ctx arg = {.changed = changed, .ctx = ctx, .report = report};
+        const char *paths[] = {a, b};
+        return join(paths, 2, mem, diff_user, &arg);
+}
+
+static int merge_user(void *ctx, const char *username, const struct value *values) {
+        struct join_ctx *arg = ctx;
+        const struct value *base = &values[0];
+        const struct value *a = &values[1];
+        const struct value *b = &values[2];
+        const struct value *merged = NULL;
+        if (value_eq(a, b) || value_eq(b, base)) {
+                merged = a;
+        } else if (value_eq(a, base)) {
+                merged = b;
+        } else {
+                merged = base;
+                report(arg, MERGE_CONFLICT, username);
+        }
+        report_change(arg, username, base, merged);
+        if (!merged->present) {
+                return 0;
+        }
+        const size_t name_len = strlen(username);
+        if (fwrite(username, 1, name_len, arg->out) != name_len ||
+                        fputc(':', arg->out) == EOF ||
+                        fwrite(merged->data, 1, merged->len, arg->out) != merged->len ||
+                        fputc('\n', arg->out) == EOF) {
+                return ERR_MERGE_WRITE;
+        }
+        return 0;
+}
+
+int merge_three(const char *base, const char *a, const char *b, size_t mem, FILE *out,
+                merge_fn changed, void *ctx, merge_report_t *report) {
+        memset(report, 0, sizeof(merge_report_t));
+        struct join_ctx arg = {.changed = changed, .ctx = ctx, .report = report, .out = out};
+        const char *paths[] = {base, a, b};
+        int err = join(paths, 3, mem, merge_user, &arg);
+        if (err == 0 && fflush(out) != 0) {
+                err = ERR_MERGE_WRITE;
+        }
+        return err;
+}
+
+static int side_next(struct side *side) {
+        side->name = sorted_next(&side->sorted, &side->value);
+        return side->name == NULL ? side->sorted.err : 0;
+}
+
+static int join(const char **paths, size_t n, size_t mem, join_fn fn, struct join_ctx *arg) {
+        if (mem == 0) {
+                mem = MERGE_MEM_DEFAULT;
+        }
+        mem /= n;
+        if (mem < MERGE_MEM_MIN) {
+                mem = MERGE_MEM_MIN;
+        }
+
+        struct side sides[MERGE_SIDES_MAX];
+        memset(sides, 0, sizeof(sides));
+        int err = 0;
+        for (size_t i = 0; i < n && err == 0; i++) {
+                err = sorted_open(&sides[i].sorted, paths[i], mem);
+                arg->report->runs += sides[i].sorted.spilled;
+                if (err == 0) {
+                        err = side_next(&sides[i]);
+                }
+        }
+
+        while (err == 0) {
+                const char *username = NULL;
+                for (size_t i = 0; i < n; i++) {
+                        if (sides[i].name != NULL &&
+                                        (username == NULL || strcmp(sides[i].name, username) < 0)) {
+                                username = sides[i].name;
+                        }
+                }
+                if (username == NULL) {
+                        break;
+                }
+                struct value values[MERGE_SIDES_MAX];
+                bool matched[MERGE_SIDES_MAX];
+                for (size_t i = 0; i < n; i++) {
+                        matched[i] = sides[i].name != NULL && strcmp(sides[i].name, username) == 0;
+                        values[i] = matched[i] ? sides[i].value : (struct value){0};
+                }
+                arg->report->users++;
+                err = fn(arg, username, values);
+                // the username is the line of a matched side, advance them last
+                for (size_t i = 0; i < n && err == 0; i++) {
+                        if (matched[i]) {
+                                err = side_next(&sides[i]);
+                        }
+                }
+        }
+
+        for (size_t i = 0; i < n; i++) {
+                sorted_close(&sides[i].sorted);
+        }
+        return err;
+}
+
+// external sort
+
+static int name_cmp(const char *a, size_t alen, const char *b, size_t blen) {
+        const int c = memcmp(a, b, alen < blen ? alen : blen);
+        if (c != 0) {
+                return c;
+        }
+        return alen < blen ? -1 : alen > blen;
+}
+
+static int record_cmp(const void *l, const void *r, void *arg) {
+        const char *buf = arg;
+        const struct record *a = l;
+        const struct record *b = r;
+        const int c = name_cmp(buf + a->off, a->name_len, buf + b->off, b->name_len);
+        if (c != 0) {
+                return c;
+        }
+        return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+static bool run_less(const sorted_t *s, size_t i, size_t j) {
+        const struct run *a = &s->runs[i];
+        const struct run *b = &s->runs[j];
+        const int c = name_cmp(a->cur, a->name_len, b->cur, b->name_len);
+        // earlier runs hold earlier lines
+        return c < 0 || (c == 0 && i < j);
+}
+
+static void heap_down(sorted_t *s, size_t pos) {
+        for (;;) {
+                size_t min = pos;
+                const size_t left = 2 * pos + 1;
+                const size_t right = left + 1;
+                if (left < s->heap_len && run_less(s, s->heap[left], s->heap[min])) {
+                        min = left;
+                }
+                if (right < s->heap_len && run_less(s, s->heap[right], s->heap[min])) {
+                        min = right;
+                }
+                if (min == pos) {
+                        return;
+                }
+                const size_t tmp = s->heap[pos];
+                s->heap[pos] = s->heap[min];
+                s->heap[min] = tmp;
+                pos = min;
+        }
+}
+
+static int run_advance(sorted_t *s, struct run *r) {
+        if (r->file == NULL) {
+                if (s->next >= s->records_len) {
+                        r->cur = NULL;
+                        return 0;
+                }
+                const struct record *rec = &s->records[s->next++];
+                r->cur = s->buf + rec->off;
+                r->name_len = rec->name_len;
+                r->len = rec->len;
+                return 0;
+        }
+        const ssize_t n = getline(&r->line, &r->cap, r->file);
+        if (n < 0) {
+                r->cur = NULL;
+                return ferror(r->file) ? ERR_MERGE_READ : 0;
+        }
+        size_t len = n;
+        if (len > 0 && r->line[len - 1] == '\n') {
+                len--;
+        }
+        const char *colon = memchr(r->line, ':', len);
+        if (colon == NULL) {
+                return ERR_MERGE_READ;
+        }
+        r->cur = r->line;
+        r->name_len = colon - r->line;
+        r->len = len;
+        return 0;
+}
+
+static struct run* add_run(sorted_t *s, FILE *file) {
+        struct run *runs = realloc(s->runs, (s->runs_len + 1) * sizeof(struct run));
+        if (runs == NULL) {
+                return NULL;
+        }
+        s->runs = runs;
+        struct run *r = &runs[s->runs_len++];
+        memset(r, 0, sizeof(struct run));
+        r->file = file;
+        return r;
+}
+
+// an unlinked temporary file
+static FILE* run_file(void) {
+        const char *dir = getenv("TMPDIR");
+        char *path = NULL;
+        if (asprintf(&path, "%s/pinpam-merge-XXXXXX",
+                     dir != NULL && dir[0] != '\0' ? dir : "/tmp") < 0) {
+                return NULL;
+        }
+        FILE *f = NULL;
+        const int fd = mkstemp(path);
+        if (fd >= 0) {
+                unlink(path);
+                f = fdopen(fd, "w+");
+                if (f == NULL) {
+                        close(fd);
+                }
+        }
+        free(path);
+        return f;
+}
+
+// sort the chunk into a run file
+static int spill(sorted_t *s) {
+        qsort_r(s->records, s->records_len, sizeof(struct record), record_cmp, s->buf);
+        FILE *f = run_file();
+        if (f == NULL) {
+                return ERR_MERGE_WRITE;
+        }
+        if (add_run(s, f) == NULL) {
+                fclose(f);
+                return -1;
+        }
+        s->spilled++;
+        for (size_t i = 0; i < s->records_len; i++) {
+                const struct record *rec = &s->records[i];
+                if (i > 0 && name_cmp(s->buf + rec->off, rec->name_len,
+                                      s->buf + rec[-1].off, rec[-1].name_len) == 0) {
+                        continue;
+                }
+                fwrite(s->buf + rec->off, 1, rec->len, f);
+                fputc('\n', f);
+        }
+        if (fflush(f) != 0 || ferror(f)) {
+                return ERR_MERGE_WRITE;
+        }
+        rewind(f);
+        s->buf_len = 0;
+        s->records_len = 0;
+        return 0;
+}
+
+static bool chunk_fits(const sorted_t *s, size_t len, size_t mem) {
+        return s->buf_len + len <= s->buf_cap &&
+                s->buf_len + len + (s->records_len + 1) * sizeof(struct record) <= mem;
+}
+
+static int chunk_add(sorted_t *s, const char *line, size_t name_len, size_t len, size_t seq) {
+        if (s->records_len == s->records_cap) {
+                const size_t cap = s->records_cap > 0 ? s->records_cap * 2 : 1024;
+                struct record *records = realloc(s->records, cap * sizeof(struct record));
+                if (records == NULL) {
+                        return -1;
+                }
+                s->records = records;
+                s->records_cap = cap;
+        }
+        memcpy(s->buf + s->buf_len, line, len);
+        s->records[s->records_len++] = (struct record){
+                .off = s->buf_len,
+                .name_len = name_len,
+                .len = len,
+                .seq = seq,
+        };
+        s->buf_len += len;
+        return 0;
+}
+
+static int sorted_open(sorted_t *s, const char *path, size_t mem) {
+        memset(s, 0, sizeof(sorted_t));
+        FILE *in = fopen(path, "r");
+        if (in == NULL) {
+                return ERR_MERGE_OPEN;
+        }
+        // a small file needs a small buffer
+        struct stat st;
+        s->buf_cap = mem;
+        if (fstat(fileno(in), &st) == 0 && (uint64_t)st.st_size < mem) {
+                s->buf_cap = st.st_size + 1;
+        }
+        s->buf = malloc(s->buf_cap);
+        if (s->buf == NULL) {
+                fclose(in);
+                return -1;
+        }
+
+        int err = 0;
+        char *line = NULL;
+        size_t cap = 0;
+        ssize_t n;
+        size_t seq = 0;
+        while (err == 0 && (n = getline(&line, &cap, in)) >= 0) {
+                seq++;
+                size_t len = n;
+                if (len > 0 && line[len - 1] == '\n') {
+                        len--;
+                }
+                const char *colon = memchr(line, ':', len);
+                if (colon == NULL || colon == line) {
+                        continue;
+                }
+                if (!chunk_fits(s, len, mem) && s->records_len > 0) {
+                        err = spill(s);
+                }
+                if (err == 0 && !chunk_fits(s, len, mem)) {
+                        err = ERR_MERGE_LINE;
+                }
+                if (err == 0) {
+                        err = chunk_add(s, line, colon - line, len, seq);
+                }
+        }
+        if (err == 0 && ferror(in)) {
+                err = ERR_MERGE_READ;
+        }
+        free(line);
+        fclose(in);
+        if (err != 0) {
+                return err;
+        }
+
+        qsort_r(s->records, s->records_len, sizeof(struct record), record_cmp, s->buf);
+        if (add_run(s, NULL) == NULL) {
+                return -1;
+        }
+        s->heap = malloc(s->runs_len * sizeof(size_t));
+        if (s->heap == NULL) {
+                return -1;
+        }
+        for (size_t i = 0; i < s->runs_len && err == 0; i++) {
+                err = run_advance(s, &s->runs[i]);
+                if (s->runs[i].cur != NULL) {
+                        s->heap[s->heap_len++] = i;
+                }
+        }
+        for (size_t i = s->heap_len / 2; i-- > 0;) {
+                heap_down(s, i);
+        }
+        return err;
+}
+
+// the next user in order, NULL at the end or on error
+static const char* sorted_next(sorted_t *s, struct value *value) {
+        while (s->heap_len > 0) {
+                struct run *r = &s->runs[s->heap[0]];
+                const bool dup = s->has_last &&
+                        name_cmp(r->cur, r->name_len, s->last, s->last_name_len) == 0;
+                size_t len = r->len;
+                if (!dup) {
+                        if (len + 1 > s->last_cap) {
+                                char *last = realloc(s->last, len + 1);
+                                if (last == NULL) {
+                                        s->err = -1;
+                                        return NULL;
+                                }
+                                s->last = last;
+                                s->last_cap = len + 1;
+                        }
+                        memcpy(s->last, r->cur, len);
+                        s->last[len] = '\0';
+                        s->last[r->name_len] = '\0';
+                        s->last_name_len = r->name_len;
+                        s->has_last = true;
+                }
+                const int err = run_advance(s, r);
+                if (err != 0) {
+                        s->err = err;
+                        return NULL;
+                }
+                if (r->cur == NULL) {
+                        s->heap[0] = s->heap[--s->heap_len];
+                }
+                heap_down(s, 0);
+                if (!dup) {
+                        value->data = s->last + s->last_name_len + 1;
+                        value->len = len - s->last_name_len - 1;
+                        value->present = true;
+                        return s->last;
+                }
+        }
+        return NULL;
+}
+
+static void sorted_close(sorted_t *s) {
+        for (size_t i = 0; i < s->runs_len; i++) {
+                if (s->runs[i].file != NULL) {
+                        fclose(s->runs[i].file);
+                }
+                free(s->runs[i].line);
+        }
+        free(s->runs);
+        free(s->heap);
+        free(s->buf);
+        free(s->records);
+        free(s->last);
+}
@@ -0,0 +1,66 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#ifndef _MERGE_H
+#define _MERGE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Diff and three-way merge of text users files larger than memory.
+ *
+ * Every input is sorted by username with an external merge sort: lines
+ * are read into a buffer until it is full, sorted and written to an
+ * unlinked run file in $TMPDIR, the last chunk stays in memory. The runs
+ * are merged with a heap and the sorted inputs are joined on the username
+ * in one pass, so only the sort buffers and one line per run are held.
+ *
+ * As for the loader the first record of a duplicated user counts, lines
+ * without a username are skipped. Records are compared byte for byte.
+ */
+
+// sort buffers of all inputs together
+#define MERGE_MEM_DEFAULT (64 << 20)
+#define MERGE_MEM_MIN (64 << 10)
+
+enum {
+        ERR_MERGE_OPEN = 1,
+        ERR_MERGE_READ,
+        ERR_MERGE_WRITE,        // run or output file
+        ERR_MERGE_LINE,         // a line does not fit the sort buffer
+};
+
+typedef enum {
+        MERGE_ADDED = 0,
+        MERGE_REMOVED,
+        MERGE_CHANGED,
+        MERGE_CONFLICT,         // both sides changed the user differently
+} merge_change_t;
+
+#define MERGE_CHANGES 4
+
+typedef struct merge_report {
+        size_t          users;                  // distinct users of all inputs
+        size_t          changes[MERGE_CHANGES]; // merge_change_t
+        size_t          runs;                   // spilled sort runs
+} merge_report_t;
+
+// called for every change in username order.
+typedef void (*merge_fn)(void *ctx, merge_change_t change, const char *username);
+
+// changes from a to b. mem - bytes of sort buffers, 0 - MERGE_MEM_DEFAULT.
+int merge_diff(const char *a, const char *b, size_t mem,
+               merge_fn changed, void *ctx, merge_report_t *report);
+
+// merge the changes of a and b since base into out, sorted by username.
+// A user both sides changed differently is a conflict and keeps its base
+// record. Changes are reported against base.
+int merge_three(const char *base, const char *a, const char *b, size_t mem, FILE *out,
+                merge_fn changed, void *ctx, merge_report_t *report);
+
+const char* merge_change_name(merge_change_t change);
+
+#endif
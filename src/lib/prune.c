@@ -0,0 +1,314 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#define _GNU_SOURCE
+#include "prune.h"
+#include "hashmap.h"
+#include "txn.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+struct accounts {
+        char            *names;         // NUL separated
+        size_t          len;
+        size_t          cap;
+        size_t          count;
+        hashmap_t       *set;           // keys point into names
+        bool            nss;            // confirm misses by name
+        char            *buf;           // for the passwd entries
+        size_t          buf_len;
+};
+
+struct joined {
+        const char      *path;
+        const char      *base;          // NULL - empty or missing
+        size_t          size;
+        FILE            *out;           // NULL until the first orphan
+};
+
+static int load_accounts(struct accounts *accounts, const char *passwd);
+static int map_file(struct joined *j, const char *path);
+static int join_file(struct accounts *accounts, struct joined *j, prune_file_t file,
+                     txn_t *txn, prune_removed_fn removed, void *ctx,
+                     prune_report_t *report);
+
+int prune_run(const char *userspath, const char *statepath, const char *passwd,
+              bool dry_run, prune_removed_fn removed, void *ctx, prune_report_t *report) {
+        memset(report, 0, sizeof(prune_report_t));
+        struct accounts accounts;
+        memset(&accounts, 0, sizeof(accounts));
+        struct joined files[2];
+        memset(files, 0, sizeof(files));
+        txn_t *txn = NULL;
+
+        int err = load_accounts(&accounts, passwd);
+        if (err != 0) {
+                goto PRUNE_RUN_RET;
+        }
+        // an empty database would drop everything
+        if (accounts.count == 0) {
+                err = ERR_PRUNE_ACCOUNTS;
+                goto PRUNE_RUN_RET;
+        }
+        report->accounts = accounts.count;
+        if (!dry_run) {
+                txn = txn_new();
+                if (txn == NULL) {
+                        err = ERR_PRUNE_WRITE;
+                        goto PRUNE_RUN_RET;
+                }
+        }
+
+        const char *paths[] = { [PRUNE_USERS] = userspath, [PRUNE_STATE] = statepath };
+        for (int f = PRUNE_USERS; f <= PRUNE_STATE && err == 0; f++) {
+                err = map_file(&files[f], paths[f]);
+                if (err == 0) {
+                        err = join_file(&accounts, &files[f], f, txn, removed, ctx, report);
+                }
+        }
+        if (err == 0 && txn != NULL && report->removed[PRUNE_USERS] + report->removed[PRUNE_STATE] > 0 &&
+                        txn_commit(txn) != 0) {
+                err = ERR_PRUNE_WRITE;
+        }
+
+PRUNE_RUN_RET:
+        for (int f = PRUNE_USERS; f <= PRUNE_STATE; f++) {
+                if (files[f].out != NULL) {
+                        fclose(files[f].out);
+                }
+                if (files[f].base != NULL) {
+                        munmap((void*)files[f].base, files[f].size);
+                }
+        }
+        txn_free(txn);
+        hashmap_free(accounts.set);
+        free(accounts.names);
+        free(accounts.buf);
+        return err;
+}
+
+static int grow_buf(struct accounts *accounts) {
+        const size_t len = accounts->buf_len > 0 ? accounts->buf_len * 2 : 16384;
+        char *grown = realloc(accounts->buf, len);
+        if (grown == NULL) {
+                return -1;
+        }
+        accounts->buf = grown;
+        accounts->buf_len = len;
+        return 0;
+}
+
+static int add_name(struct accounts *accounts, const char *name) {
+        const size_t len = strlen(name) + 1;
+        if (accounts->len + len > accounts->cap) {
+                size_t cap = accounts->cap > 0 ? accounts->cap : 65536;
+                while (accounts->len + len > cap) {
+                        cap *= 2;
+                }
+                char *grown = realloc(accounts->names, cap);
+                if (grown == NULL) {
+                        return -1;
+                }
+                accounts->names = grown;
+                accounts->cap = cap;
+        }
+        memcpy(accounts->names + accounts->len, name, len);
+        accounts->len += len;
+        return 0;
+}
+
+/*
+ * Collect the names first, the set borrows them from the buffer once it
+ * does not move anymore.
+ */
+static int load_accounts(struct accounts *accounts, const char *passwd) {
+        FILE *in = NULL;
+        if (passwd != NULL) {
+                in = fopen(passwd, "r");
+                if (in == NULL) {
+                        return ERR_PRUNE_OPEN;
+                }
+        } else {
+                accounts->nss = true;
+                setpwent();
+        }
+        int err = grow_buf(accounts);
+        while (err == 0) {
+                struct passwd pw;
+                struct passwd *found = NULL;
+                const int rc = in != NULL ?
+                        fgetpwent_r(in, &pw, accounts->buf, accounts->buf_len, &found) :
+                        getpwent_r(&pw, accounts->buf, accounts->buf_len, &found);
+                if (rc == ERANGE) {
+                        err = grow_buf(accounts);
+                        continue;
+                }
+                if (rc == ENOENT) {
+                        break;
+                }
+                if (rc != 0 || found == NULL) {
+                        err = ERR_PRUNE_ACCOUNTS;
+                        break;
+                }
+                err = add_name(accounts, pw.pw_name);
+        }
+        if (in != NULL) {
+                fclose(in);
+        } else {
+                endpwent();
+        }
+        if (err != 0) {
+                return err;
+        }
+
+        size_t names = 0;
+        for (size_t pos = 0; pos < accounts->len; pos += strlen(accounts->names + pos) + 1) {
+                names++;
+        }
+        accounts->set = hashmap_new(16);
+        if (accounts->set == NULL || hashmap_reserve(accounts->set, names) != 0) {
+                return -1;
+        }
+        for (size_t pos = 0; pos < accounts->len; pos += strlen(accounts->names + pos) + 1) {
+                const char *name = accounts->names + pos;
+                const int ret = hashmap_insert(accounts->set, name, hashmap_hash(name), 0);
+                if (ret < 0) {
+                        return -1;
+                }
+                // an account listed by several sources counts once
+                if (ret == 0) {
+                        accounts->count++;
+                }
+        }
+        return 0;
+}
+
+static int account_known(struct accounts *accounts, const char *name, bool *known) {
+        uint32_t value;
+        *known = hashmap_get(accounts->set, name, &value);
+        if (*known || !accounts->nss) {
+                return 0;
+        }
+        // not enumerated, some NSS sources only answer by name
+        struct passwd pw;
+        struct passwd *found = NULL;
+        int rc;
+        while ((rc = getpwnam_r(name, &pw, accounts->buf, accounts->buf_len, &found)) == ERANGE) {
+                if (grow_buf(accounts) != 0) {
+                        return -1;
+                }
+        }
+        if (rc != 0) {
+                return ERR_PRUNE_ACCOUNTS;
+        }
+        *known = found != NULL;
+        return 0;
+}
+
+static int map_file(struct joined *j, const char *path) {
+        j->path = path;
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+                return errno == ENOENT ? 0 : ERR_PRUNE_OPEN;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+                close(fd);
+                return ERR_PRUNE_OPEN;
+        }
+        j->size = st.st_size;
+        if (j->size > 0) {
+                void *base = mmap(NULL, j->size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (base == MAP_FAILED) {
+                        close(fd);
+                        return ERR_PRUNE_MAP;
+                }
+                madvise(base, j->size, MADV_SEQUENTIAL);
+                j->base = base;
+        }
+        close(fd);
+        return 0;
+}
+
+/*
+ * Lines before the first orphan are copied in one write when it is found,
+ * after it every run of kept lines is copied when the next orphan ends it.
+ */
+static int join_file(struct accounts *accounts, struct joined *j, prune_file_t file,
+                     txn_t *txn, prune_removed_fn removed, void *ctx,
+                     prune_report_t *report) {
+        const char *end = j->base + j->size;
+        const char *kept = j->base;     // first line not copied yet
+        char *name = NULL;
+        size_t name_cap = 0;
+        int err = 0;
+        for (const char *line = j->base; line < end && err == 0;) {
+                const char *nl = memchr(line, '\n', end - line);
+                const char *next = nl != NULL ? nl + 1 : end;
+                report->lines[file]++;
+                const char *colon = memchr(line, ':', next - line);
+                // not a record of an account
+                if (colon == NULL || colon == line || line[0] == '@') {
+                        line = next;
+                        continue;
+                }
+                const size_t len = colon - line;
+                if (len + 1 > name_cap) {
+                        char *grown = realloc(name, len + 1);
+                        if (grown == NULL) {
+                                err = -1;
+                                break;
+                        }
+                        name = grown;
+                        name_cap = len + 1;
+                }
+                memcpy(name, line, len);
+                name[len] = '\0';
+                bool known = true;
+                err = account_known(accounts, name, &known);
+                if (err != 0 || known) {
+                        line = next;
+                        continue;
+                }
+
+                report->removed[file]++;
+                if (removed != NULL) {
+                        removed(ctx, file, name);
+                }
+                if (txn != NULL) {
+                        if (j->out == NULL) {
+                                const char *tmppath = NULL;
+                                if (txn_add(txn, j->path, &tmppath) != 0 ||
+                                                (j->out = fopen(tmppath, "w")) == NULL) {
+                                        err = ERR_PRUNE_WRITE;
+                                        break;
+                                }
+                        }
+                        fwrite(kept, 1, line - kept, j->out);
+                }
+                kept = next;
+                line = next;
+        }
+        free(name);
+        if (err != 0 || j->out == NULL) {
+                return err;
+        }
+        fwrite(kept, 1, end - kept, j->out);
+        err = ferror(j->out) ? ERR_PRUNE_WRITE : 0;
+        if (fclose(j->out) != 0) {
+                err = ERR_PRUNE_WRITE;
+        }
+        j->out = NULL;
+        return err;
+}
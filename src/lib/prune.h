@@ -0,0 +1,53 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#ifndef _PRUNE_H
+#define _PRUNE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Drop the records of deleted accounts from the text users file and the
+ * attempts state file.
+ *
+ * The account names are read once into a hash set, then every line of
+ * both mapped files is joined against it in one pass. A file is copied to
+ * its temporary file from the first orphan on, both are replaced in one
+ * txn, so a file without orphans is not written at all. `@<group>` records
+ * and lines without a name are kept.
+ *
+ * Enumerating NSS may skip sources that do not list their users, a name
+ * missing from the set is looked up once more by name before it is
+ * dropped.
+ */
+
+typedef enum {
+        PRUNE_USERS = 0,
+        PRUNE_STATE,
+} prune_file_t;
+
+enum {
+        ERR_PRUNE_OPEN = 1,
+        ERR_PRUNE_MAP,
+        ERR_PRUNE_ACCOUNTS,     // no accounts or NSS failed
+        ERR_PRUNE_WRITE,
+};
+
+typedef struct prune_report {
+        size_t          accounts;
+        size_t          lines[2];       // prune_file_t
+        size_t          removed[2];
+} prune_report_t;
+
+// called for every dropped line with its username.
+typedef void (*prune_removed_fn)(void *ctx, prune_file_t file, const char *username);
+
+// passwd is a file in the passwd format, NULL - the accounts of NSS.
+// A dry run reports the orphans and writes nothing. A missing file is empty.
+int prune_run(const char *userspath, const char *statepath, const char *passwd,
+              bool dry_run, prune_removed_fn removed, void *ctx, prune_report_t *report);
+
+#endif
@@ -0,0 +1,248 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#define _GNU_SOURCE
+#include "rcu.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define RCU_LINE 64
+
+struct rcu_snapshot {
+        users_t         *users;
+        state_t         *state;
+        uint64_t        generation;
+};
+
+// one cache line per reader, pins do not share lines
+struct rcu_slot {
+        _Atomic uint64_t        epoch;          // entered epoch, 0 - outside
+        atomic_bool             used;
+} __attribute__((aligned(RCU_LINE)));
+
+struct rcu {
+        _Atomic(rcu_snapshot_t*)        current;
+        _Atomic uint64_t                epoch;          // from 1
+        pthread_mutex_t                 writer;
+        struct rcu_slot                 slots[RCU_READERS_MAX];
+};
+
+struct rcu_reader {
+        rcu_t                   *rcu;
+        struct rcu_slot         *slot;
+};
+
+static void snapshot_free(rcu_snapshot_t *snap) {
+        if (snap == NULL) {
+                return;
+        }
+        users_free(snap->users);
+        state_free(snap->state);
+        free(snap);
+}
+
+// a snapshot owning users and state, freed on error
+static rcu_snapshot_t* snapshot_new(users_t *users, state_t *state) {
+        rcu_snapshot_t *snap = malloc(sizeof(rcu_snapshot_t));
+        if (snap == NULL) {
+                users_free(users);
+                state_free(state);
+                return NULL;
+        }
+        snap->users = users;
+        snap->state = state;
+        snap->generation = 0;
+        if (users == NULL || state == NULL) {
+                snapshot_free(snap);
+                return NULL;
+        }
+        return snap;
+}
+
+// lookups of a published snapshot must not write to it
+static int snapshot_freeze(rcu_snapshot_t *snap) {
+        if (users_freeze(snap->users) != 0) {
+                return ERR_RCU_USERS;
+        }
+        if (state_freeze(snap->state) != 0) {
+                return ERR_RCU_STATE;
+        }
+        return 0;
+}
+
+// swap in next and free the old snapshot after the grace period, called
+// with the writer lock held
+static void rcu_publish(rcu_t *rcu, rcu_snapshot_t *next) {
+        rcu_snapshot_t *old = atomic_exchange(&rcu->current, next);
+        // a reader entering this epoch or later loads next
+        const uint64_t epoch = atomic_fetch_add(&rcu->epoch, 1) + 1;
+        trace_begin("rcu_grace");
+        for (size_t i = 0; i < RCU_READERS_MAX; i++) {
+                struct rcu_slot *slot = &rcu->slots[i];
+                for (;;) {
+                        const uint64_t entered = atomic_load(&slot->epoch);
+                        if (entered == 0 || entered >= epoch) {
+                                break;
+                        }
+                        sched_yield();
+                }
+        }
+        trace_end("rcu_grace");
+        snapshot_free(old);
+}
+
+rcu_t* rcu_new(void) {
+        const size_t size = (sizeof(rcu_t) + RCU_LINE - 1) / RCU_LINE * RCU_LINE;
+        rcu_t *rcu = aligned_alloc(RCU_LINE, size);
+        if (rcu == NULL) {
+                return NULL;
+        }
+        rcu_snapshot_t *snap = snapshot_new(users_new(0), state_new());
+        if (snap == NULL || snapshot_freeze(snap) != 0) {
+                snapshot_free(snap);
+                free(rcu);
+                return NULL;
+        }
+        atomic_init(&rcu->current, snap);
+        atomic_init(&rcu->epoch, 1);
+        pthread_mutex_init(&rcu->writer, NULL);
+        for (size_t i = 0; i < RCU_READERS_MAX; i++) {
+                atomic_init(&rcu->slots[i].epoch, 0);
+                atomic_init(&rcu->slots[i].used, false);
+        }
+        return rcu;
+}
+
+int rcu_load(rcu_t *rcu, const char *userspath, const char *statepath) {
+        int err = 0;
+        trace_begin("rcu_load");
+        rcu_snapshot_t *next = snapshot_new(users_new(0), state_new());
+        if (next == NULL) {
+                err = ERR_RCU_MEMORY;
+                goto RCU_LOAD_RET;
+        }
+        if (users_load(next->users, userspath) != 0) {
+                err = ERR_RCU_USERS;
+                goto RCU_LOAD_RET;
+        }
+        if (state_load(next->state, statepath) != 0) {
+                err = ERR_RCU_STATE;
+                goto RCU_LOAD_RET;
+        }
+        err = snapshot_freeze(next);
+        if (err != 0) {
+                goto RCU_LOAD_RET;
+        }
+
+        pthread_mutex_lock(&rcu->writer);
+        next->generation = atomic_load(&rcu->current)->generation + 1;
+        rcu_publish(rcu, next);
+        pthread_mutex_unlock(&rcu->writer);
+        next = NULL;
+
+RCU_LOAD_RET:
+        snapshot_free(next);
+        trace_end("rcu_load");
+        return err;
+}
+
+int rcu_update(rcu_t *rcu, rcu_update_fn update, void *ctx) {
+        int err = 0;
+        trace_begin("rcu_update");
+        pthread_mutex_lock(&rcu->writer);
+        const rcu_snapshot_t *cur = atomic_load(&rcu->current);
+        rcu_snapshot_t *next = snapshot_new(users_clone(cur->users), state_clone(cur->state));
+        if (next == NULL) {
+                err = ERR_RCU_MEMORY;
+                goto RCU_UPDATE_RET;
+        }
+        err = update(ctx, next->users, next->state);
+        if (err != 0) {
+                goto RCU_UPDATE_RET;
+        }
+        err = snapshot_freeze(next);
+        if (err != 0) {
+                goto RCU_UPDATE_RET;
+        }
+        next->generation = cur->generation + 1;
+        rcu_publish(rcu, next);
+        next = NULL;
+
+RCU_UPDATE_RET:
+        pthread_mutex_unlock(&rcu->writer);
+        snapshot_free(next);
+        trace_end("rcu_update");
+        return err;
+}
+
+void rcu_free(rcu_t *rcu) {
+        if (rcu == NULL) {
+                return;
+        }
+        snapshot_free(atomic_load(&rcu->current));
+        pthread_mutex_destroy(&rcu->writer);
+        free(rcu);
+}
+
+rcu_reader_t* rcu_reader_new(rcu_t *rcu) {
+        rcu_reader_t *reader = malloc(sizeof(rcu_reader_t));
+        if (reader == NULL) {
+                return NULL;
+        }
+        for (size_t i = 0; i < RCU_READERS_MAX; i++) {
+                bool used = false;
+                if (atomic_compare_exchange_strong(&rcu->slots[i].used, &used, true)) {
+                        reader->rcu = rcu;
+                        reader->slot = &rcu->slots[i];
+                        return reader;
+                }
+        }
+        free(reader);
+        return NULL;
+}
+
+void rcu_reader_free(rcu_reader_t *reader) {
+        if (reader == NULL) {
+                return;
+        }
+        atomic_store(&reader->slot->epoch, 0);
+        atomic_store(&reader->slot->used, false);
+        free(reader);
+}
+
+const rcu_snapshot_t* rcu_pin(rcu_reader_t *reader) {
+        // the slot store is ordered before the pointer load: a writer that
+        // does not see the slot has swapped the pointer already
+        atomic_store(&reader->slot->epoch, atomic_load(&reader->rcu->epoch));
+        return atomic_load(&reader->rcu->current);
+}
+
+void rcu_unpin(rcu_reader_t *reader) {
+        atomic_store(&reader->slot->epoch, 0);
+}
+
+uint64_t rcu_generation(const rcu_snapshot_t *snap) {
+        return snap->generation;
+}
+
+int rcu_find(const rcu_snapshot_t *snap, const char *username, user_t *user) {
+        return users_find(snap->users, username, user);
+}
+
+uint8_t rcu_attempts(const rcu_snapshot_t *snap, const char *username) {
+        uint8_t attempts;
+        state_get_attempts(snap->state, username, &attempts);
+        return attempts;
+}
+
+int rcu_scan_prefix(const rcu_snapshot_t *snap, const char *prefix, const char *after,
+                    users_visit_fn visit, void *ctx) {
+        return users_scan_prefix(snap->users, prefix, after, visit, ctx);
+}
@@ -0,0 +1,83 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#ifndef _RCU_H
+#define _RCU_H
+
+#include "users.h"
+#include "state.h"
+
+#include <stdint.h>
+
+/*
+ * Users and attempts shared by the threads of a service, read without
+ * locks while they change.
+ *
+ * The handle points to an immutable snapshot of a users table and its
+ * attempts. A reader pins the current snapshot by publishing the epoch it
+ * entered in a slot of its own, then loads the snapshot pointer; it takes
+ * no lock and writes no shared cache line. Writers are serialised: an
+ * update copies the current snapshot, changes the copy, freezes its
+ * lookup structures and publishes it with an atomic pointer swap. The old
+ * snapshot is freed once every slot is empty or entered after the swap,
+ * so a long pin delays the writer, never the other readers.
+ *
+ * A reader holds at most one pin, pinning again moves it to the current
+ * snapshot. Readers must not outlive the handle.
+ */
+
+// reader slots of a handle
+#define RCU_READERS_MAX 256
+
+enum {
+        ERR_RCU_MEMORY = 1,
+        ERR_RCU_USERS,
+        ERR_RCU_STATE,
+};
+
+typedef struct rcu rcu_t;
+typedef struct rcu_reader rcu_reader_t;
+typedef struct rcu_snapshot rcu_snapshot_t;
+
+// a handle with an empty snapshot at generation 0.
+rcu_t* rcu_new(void);
+
+// publish the users and state files as the next generation.
+int rcu_load(rcu_t *rcu, const char *userspath, const char *statepath);
+
+// change a private copy of the current snapshot, non-zero drops the copy
+// and is returned by rcu_update.
+typedef int (*rcu_update_fn)(void *ctx, users_t *users, state_t *state);
+
+// publish the changed copy as the next generation, returns after the
+// replaced snapshot is freed.
+int rcu_update(rcu_t *rcu, rcu_update_fn update, void *ctx);
+
+// no reader may be registered.
+void rcu_free(rcu_t *rcu);
+
+// claim a reader slot, NULL - all are taken.
+rcu_reader_t* rcu_reader_new(rcu_t *rcu);
+
+void rcu_reader_free(rcu_reader_t *reader);
+
+// the current snapshot, valid until the next pin or unpin of the reader.
+const rcu_snapshot_t* rcu_pin(rcu_reader_t *reader);
+
+void rcu_unpin(rcu_reader_t *reader);
+
+// reads of a pinned snapshot
+
+uint64_t rcu_generation(const rcu_snapshot_t *snap);
+
+// a copy of the user, verify the pin on it with user_verify_pin.
+int rcu_find(const rcu_snapshot_t *snap, const char *username, user_t *user);
+
+uint8_t rcu_attempts(const rcu_snapshot_t *snap, const char *username);
+
+int rcu_scan_prefix(const rcu_snapshot_t *snap, const char *prefix, const char *after,
+                    users_visit_fn visit, void *ctx);
+
+#endif
@@ -0,0 +1,713 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#define _GNU_SOURCE
+#include "snapshot.h"
+#include "crypt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_MAGIC "PPSNAP03"
+#define SNAPSHOT_MAGIC_LEN 8
+
+// users file may change while it's being parsed
+#define SNAPSHOT_LOAD_RETRIES 3
+
+// usernames in a front coded block
+#define SNAPSHOT_BLOCK 16
+
+/*
+ * Snapshot file layout:
+ *   header
+ *   index[blocks]      - offset of every block in names
+ *   kdfs[kdfs]         - distinct kdf parameters but the salt
+ *   records[count]     - kdf index (u16), salt[salt_len], hash[hash_len]
+ *   names              - blocks of SNAPSHOT_BLOCK sorted usernames
+ *
+ * A name is <shared prefix length><suffix length><suffix> (LEB128
+ * lengths), the shared prefix is with the previous name of the block
+ * and 0 for the first one, so a lookup binary searches the block first
+ * names and decodes only one block. Salts are left out when no record
+ * has one, lowercase hex hashes are packed to 32 bytes.
+ */
+
+struct snapshot_gen {
+        uint64_t        dev;
+        uint64_t        ino;
+        uint64_t        size;
+        int64_t         mtime_sec;
+        int64_t         mtime_nsec;
+        int64_t         ctime_sec;
+        int64_t         ctime_nsec;
+};
+
+struct snapshot_header {
+        char                    magic[SNAPSHOT_MAGIC_LEN];
+        uint64_t                size;   // total file size
+        struct snapshot_gen     gen;    // users file generation
+        uint32_t                count;
+        uint32_t                blocks;
+        uint32_t                kdfs;
+        uint16_t                salt_len;
+        uint16_t                hash_len;
+        uint64_t                index_off;
+        uint64_t                kdfs_off;
+        uint64_t                records_off;
+        uint64_t                names_off;
+};
+
+struct snapshot_kdf {
+        uint32_t        alg;
+        uint32_t        cost;
+        uint32_t        memory;
+        uint32_t        parallel;
+};
+
+struct snapshot {
+        void                            *base;
+        size_t                          size;
+        const struct snapshot_header    *header;
+        const uint32_t                  *index;
+        const struct snapshot_kdf       *kdfs;
+        const uint8_t                   *records;
+        const uint8_t                   *names;
+        size_t                          names_len;
+        size_t                          record_len;
+
+        bool                            rebuilt;
+};
+
+// record of the users table while building the snapshot
+struct build_entry {
+        const char      *name;
+        size_t          pos;    // position in the users file
+        kdf_params_t    kdf;
+        pin_hash_t      pin_hash;
+};
+
+static int snapshot_source_gen(const char *srcpath, struct snapshot_gen *gen);
+static int snapshot_map(snapshot_t *snap, const char *snappath,
+                        const struct snapshot_gen *gen);
+static int snapshot_build(const char *srcpath, const char *snappath);
+static int snapshot_write(const char *snappath, const struct snapshot_gen *gen,
+                          struct build_entry *entries, size_t len);
+static int snapshot_dir(const char *snappath);
+static int snapshot_lock(const char *snappath);
+static bool file_trusted(const struct stat *st);
+static int build_entry_cmp(const void *a, const void *b);
+
+int snapshot_open(snapshot_t **snap, const char *srcpath, const char *snappath) {
+        snapshot_t *s = malloc(sizeof(snapshot_t));
+        if (s == NULL) {
+                return -1;
+        }
+        memset(s, 0, sizeof(snapshot_t));
+
+        struct snapshot_gen gen;
+        int err = snapshot_dir(snappath);
+        if (err == 0) {
+                err = snapshot_source_gen(srcpath, &gen);
+        }
+        if (err != 0) {
+                goto SNAPSHOT_OPEN_ERR;
+        }
+        // fast path: snapshot is fresh
+        err = snapshot_map(s, snappath, &gen);
+        if (err != ERR_SNAPSHOT_INVALID) {
+                goto SNAPSHOT_OPEN_RET;
+        }
+
+        // single flight: one process rebuilds, others wait for the lock
+        int lockfd = snapshot_lock(snappath);
+        if (lockfd < 0) {
+                err = ERR_SNAPSHOT_LOCK;
+                goto SNAPSHOT_OPEN_ERR;
+        }
+        err = snapshot_source_gen(srcpath, &gen);
+        if (err == 0) {
+                err = snapshot_map(s, snappath, &gen);
+        }
+        if (err == ERR_SNAPSHOT_INVALID) {
+                err = snapshot_build(srcpath, snappath);
+                if (err == 0) {
+                        s->rebuilt = true;
+                        err = snapshot_source_gen(srcpath, &gen);
+                }
+                if (err == 0) {
+                        err = snapshot_map(s, snappath, &gen);
+                }
+        }
+        flock(lockfd, LOCK_UN);
+        close(lockfd);
+
+SNAPSHOT_OPEN_RET:
+        if (err == 0) {
+                *snap = s;
+                return 0;
+        }
+SNAPSHOT_OPEN_ERR:
+        free(s);
+        return err;
+}
+
+static size_t varint_get(const uint8_t *p, const uint8_t *end, uint32_t *out) {
+        uint32_t value = 0;
+        for (size_t i = 0; i < 5 && p + i < end; i++) {
+                value |= (uint32_t)(p[i] & 0x7f) << (7 * i);
+                if ((p[i] & 0x80) == 0) {
+                        *out = value;
+                        return i + 1;
+                }
+        }
+        return 0;
+}
+
+static size_t varint_put(uint8_t *p, uint32_t value) {
+        size_t len = 0;
+        do {
+                p[len++] = (value & 0x7f) | (value >= 0x80 ? 0x80 : 0);
+                value >>= 7;
+        } while (value != 0);
+        return len;
+}
+
+/*
+ * Next name of a block: the shared prefix length and the suffix, false
+ * past the end of the names.
+ */
+static bool name_next(const snapshot_t *snap, const uint8_t **p, uint32_t *shared,
+                      uint32_t *len, const uint8_t **suffix) {
+        const uint8_t *end = snap->names + snap->names_len;
+        size_t n = varint_get(*p, end, shared);
+        if (n == 0) {
+                return false;
+        }
+        *p += n;
+        n = varint_get(*p, end, len);
+        if (n == 0 || *len > (size_t)(end - *p - n)) {
+                return false;
+        }
+        *suffix = *p + n;
+        *p = *suffix + *len;
+        return true;
+}
+
+// compare the first name of the block with the username
+static int block_cmp(const snapshot_t *snap, size_t block, const char *username,
+                     size_t namelen, int *cmp) {
+        if (snap->index[block] >= snap->names_len) {
+                return ERR_SNAPSHOT_INVALID;
+        }
+        const uint8_t *p = snap->names + snap->index[block];
+        uint32_t shared, len;
+        const uint8_t *name;
+        if (!name_next(snap, &p, &shared, &len, &name) || shared != 0) {
+                return ERR_SNAPSHOT_INVALID;
+        }
+        *cmp = memcmp(name, username, len < namelen ? len : namelen);
+        if (*cmp == 0) {
+                *cmp = len < namelen ? -1 : len > namelen ? 1 : 0;
+        }
+        return 0;
+}
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static int record_get(const snapshot_t *snap, size_t i, kdf_params_t *kdf,
+                      pin_hash_t pin_hash) {
+        const uint8_t *rec = snap->records + i * snap->record_len;
+        uint16_t k;
+        memcpy(&k, rec, sizeof(k));
+        if (k >= snap->header->kdfs) {
+                return ERR_SNAPSHOT_INVALID;
+        }
+        const struct snapshot_kdf *params = &snap->kdfs[k];
+        memset(kdf, 0, sizeof(kdf_params_t));
+        kdf->alg = params->alg;
+        kdf->cost = params->cost;
+        kdf->memory = params->memory;
+        kdf->parallel = params->parallel;
+        memcpy(kdf->salt, rec + sizeof(k), snap->header->salt_len);
+        const uint8_t *hash = rec + sizeof(k) + snap->header->salt_len;
+        if (snap->header->hash_len == PIN_HASH_LEN) {
+                memcpy(pin_hash, hash, PIN_HASH_LEN);
+                return 0;
+        }
+        for (size_t j = 0; j < PIN_HASH_LEN / 2; j++) {
+                pin_hash[2 * j] = hex_digits[hash[j] >> 4];
+                pin_hash[2 * j + 1] = hex_digits[hash[j] & 0xf];
+        }
+        return 0;
+}
+
+int snapshot_find(const snapshot_t *snap, const char *username, user_t *user) {
+        const uint8_t *target = (const uint8_t*)username;
+        const size_t namelen = strlen(username);
+        // the first block starting after the username
+        size_t lo = 0;
+        size_t hi = snap->header->blocks;
+        while (lo < hi) {
+                const size_t mid = lo + (hi - lo) / 2;
+                int cmp;
+                if (block_cmp(snap, mid, username, namelen, &cmp) != 0) {
+                        return ERR_SNAPSHOT_INVALID;
+                }
+                if (cmp <= 0) {
+                        lo = mid + 1;
+                } else {
+                        hi = mid;
+                }
+        }
+        if (lo == 0) {
+                return ERR_USERS_USER_NOT_FOUND;
+        }
+
+        // scan the block keeping the common prefix of the previous name
+        // and the username, names before it are smaller
+        const size_t first = (lo - 1) * SNAPSHOT_BLOCK;
+        const uint8_t *p = snap->names + snap->index[lo - 1];
+        size_t common = 0;
+        for (size_t i = first; i < first + SNAPSHOT_BLOCK && i < snap->header->count; i++) {
+                uint32_t shared, len;
+                const uint8_t *suffix;
+                if (!name_next(snap, &p, &shared, &len, &suffix)) {
+                        return ERR_SNAPSHOT_INVALID;
+                }
+                if (shared < common) {
+                        // differs from the previous name where it matched
+                        break;
+                }
+                if (shared > common) {
+                        // shares the smaller character of the previous name
+                        continue;
+                }
+                size_t k = 0;
+                while (k < len && common + k < namelen && suffix[k] == target[common + k]) {
+                        k++;
+                }
+                if (k == len && common + k == namelen) {
+                        if (user == NULL) {
+                                return 0;
+                        }
+                        kdf_params_t kdf;
+                        pin_hash_t pin_hash;
+                        if (record_get(snap, i, &kdf, pin_hash) != 0) {
+                                return ERR_SNAPSHOT_INVALID;
+                        }
+                        return user_set(user, username, &kdf, pin_hash);
+                }
+                if (k < len && (common + k == namelen || suffix[k] > target[common + k])) {
+                        break;
+                }
+                common += k;
+        }
+        return ERR_USERS_USER_NOT_FOUND;
+}
+
+size_t snapshot_len(const snapshot_t *snap) {
+        return snap->header->count;
+}
+
+bool snapshot_rebuilt(const snapshot_t *snap) {
+        return snap->rebuilt;
+}
+
+void snapshot_close(snapshot_t *snap) {
+        if (snap == NULL) {
+                return;
+        }
+        if (snap->base != NULL) {
+                munmap(snap->base, snap->size);
+        }
+        free(snap);
+}
+
+static int snapshot_source_gen(const char *srcpath, struct snapshot_gen *gen) {
+        memset(gen, 0, sizeof(struct snapshot_gen));
+        struct stat st;
+        if (stat(srcpath, &st) != 0) {
+                // missing users file is an empty table, see users_load
+                return errno == ENOENT ? 0 : ERR_SNAPSHOT_LOAD;
+        }
+        gen->dev = st.st_dev;
+        gen->ino = st.st_ino;
+        gen->size = st.st_size;
+        gen->mtime_sec = st.st_mtim.tv_sec;
+        gen->mtime_nsec = st.st_mtim.tv_nsec;
+        gen->ctime_sec = st.st_ctim.tv_sec;
+        gen->ctime_nsec = st.st_ctim.tv_nsec;
+        return 0;
+}
+
+static int snapshot_map(snapshot_t *snap, const char *snappath,
+                        const struct snapshot_gen *gen) {
+        int fd = open(snappath, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+        if (fd < 0) {
+                // a symlink is replaced by the rebuilt snapshot
+                return errno == ENOENT || errno == ELOOP ?
+                        ERR_SNAPSHOT_INVALID : ERR_SNAPSHOT_OPEN;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+                close(fd);
+                return ERR_SNAPSHOT_OPEN;
+        }
+        if (!file_trusted(&st) || (size_t)st.st_size < sizeof(struct snapshot_header)) {
+                close(fd);
+                return ERR_SNAPSHOT_INVALID;
+        }
+        void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+                return ERR_SNAPSHOT_MAP;
+        }
+
+        const struct snapshot_header *header = base;
+        const size_t record_len = sizeof(uint16_t) + header->salt_len + header->hash_len;
+        if (memcmp(header->magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN) != 0 ||
+                        header->size != (uint64_t)st.st_size ||
+                        header->blocks != (header->count + SNAPSHOT_BLOCK - 1) / SNAPSHOT_BLOCK ||
+                        (header->salt_len != 0 && header->salt_len != KDF_SALT_LEN) ||
+                        (header->hash_len != PIN_HASH_LEN && header->hash_len != PIN_HASH_LEN / 2) ||
+                        header->index_off != sizeof(struct snapshot_header) ||
+                        header->kdfs_off != header->index_off +
+                                (uint64_t)header->blocks * sizeof(uint32_t) ||
+                        header->records_off != header->kdfs_off +
+                                (uint64_t)header->kdfs * sizeof(struct snapshot_kdf) ||
+                        header->names_off != header->records_off +
+                                (uint64_t)header->count * record_len ||
+                        header->names_off > header->size ||
+                        memcmp(&header->gen, gen, sizeof(struct snapshot_gen)) != 0) {
+                munmap(base, st.st_size);
+                return ERR_SNAPSHOT_INVALID;
+        }
+        snap->base = base;
+        snap->size = st.st_size;
+        snap->header = header;
+        snap->index = (const uint32_t*)((const uint8_t*)base + header->index_off);
+        snap->kdfs = (const struct snapshot_kdf*)((const uint8_t*)base + header->kdfs_off);
+        snap->records = (const uint8_t*)base + header->records_off;
+        snap->names = (const uint8_t*)base + header->names_off;
+        snap->names_len = header->size - header->names_off;
+        snap->record_len = record_len;
+        return 0;
+}
+
+static int snapshot_build(const char *srcpath, const char *snappath) {
+        int err = 0;
+        users_t *storage = NULL;
+        struct snapshot_gen before, after;
+        for (int i = 0; i < SNAPSHOT_LOAD_RETRIES; i++) {
+                users_free(storage);
+                storage = users_new(0);
+                if (storage == NULL) {
+                        return -1;
+                }
+                err = snapshot_source_gen(srcpath, &before);
+                if (err == 0) {
+                        err = users_load(storage, srcpath) == 0 ? 0 : ERR_SNAPSHOT_LOAD;
+                }
+                if (err == 0) {
+                        err = snapshot_source_gen(srcpath, &after);
+                }
+                if (err != 0) {
+                        users_free(storage);
+                        return err;
+                }
+                if (memcmp(&before, &after, sizeof(struct snapshot_gen)) == 0) {
+                        break;
+                }
+                err = ERR_SNAPSHOT_LOAD;
+        }
+        if (err != 0) {
+                users_free(storage);
+                return err;
+        }
+
+        size_t len = 0;
+        size_t cap = 64;
+        struct build_entry *entries = malloc(cap * sizeof(struct build_entry));
+        user_t *user = user_new();
+        user_iterator_t *iter = users_iterate(storage);
+        if (entries == NULL || user == NULL || iter == NULL) {
+                err = -1;
+                goto SNAPSHOT_BUILD_RET;
+        }
+        while (users_iterator_next(iter, user)) {
+                if (len == cap) {
+                        cap *= 2;
+                        struct build_entry *grown = realloc(entries,
+                                        cap * sizeof(struct build_entry));
+                        if (grown == NULL) {
+                                err = -1;
+                                goto SNAPSHOT_BUILD_RET;
+                        }
+                        entries = grown;
+                }
+                entries[len].name = user_get_name(user);
+                if (entries[len].name == NULL) {
+                        err = -1;
+                        goto SNAPSHOT_BUILD_RET;
+                }
+                entries[len].pos = len;
+                user_get_pin_hash(user, entries[len].pin_hash);
+                user_get_kdf(user, &entries[len].kdf);
+                len++;
+        }
+        qsort(entries, len, sizeof(struct build_entry), build_entry_cmp);
+        err = snapshot_write(snappath, &before, entries, len);
+
+SNAPSHOT_BUILD_RET:
+        for (size_t i = 0; entries != NULL && i < len; i++) {
+                free((void*)entries[i].name);
+        }
+        free(entries);
+        if (iter != NULL) {
+                users_iterator_free(iter);
+        }
+        if (user != NULL) {
+                user_free(user);
+        }
+        users_free(storage);
+        return err;
+}
+
+static uint8_t hex_value(uint8_t c) {
+        return c <= '9' ? c - '0' : c - 'a' + 10;
+}
+
+// index of the kdf parameters in kdfs, added if new
+static int kdf_index(struct snapshot_kdf *kdfs, uint32_t *len, const kdf_params_t *kdf) {
+        for (uint32_t i = *len; i > 0; i--) {
+                // records mostly share the latest parameters
+                const struct snapshot_kdf *k = &kdfs[i - 1];
+                if (k->alg == kdf->alg && k->cost == kdf->cost &&
+                                k->memory == kdf->memory && k->parallel == kdf->parallel) {
+                        return i - 1;
+                }
+        }
+        if (*len > UINT16_MAX) {
+                return -1;
+        }
+        kdfs[*len].alg = kdf->alg;
+        kdfs[*len].cost = kdf->cost;
+        kdfs[*len].memory = kdf->memory;
+        kdfs[*len].parallel = kdf->parallel;
+        return (*len)++;
+}
+
+static int snapshot_write(const char *snappath, const struct snapshot_gen *gen,
+                          struct build_entry *entries, size_t len) {
+        // drop duplicated usernames, the first one in the file wins
+        size_t count = 0;
+        size_t names_len = 0;
+        for (size_t i = 0; i < len; i++) {
+                if (count > 0 && strcmp(entries[count - 1].name, entries[i].name) == 0) {
+                        free((void*)entries[i].name);
+                        continue;
+                }
+                entries[count++] = entries[i];
+                names_len += strlen(entries[i].name);
+        }
+        for (size_t i = count; i < len; i++) {
+                entries[i].name = NULL;
+        }
+        if (count > UINT32_MAX || names_len > UINT32_MAX) {
+                return ERR_SNAPSHOT_WRITE;
+        }
+
+        static const uint8_t no_salt[KDF_SALT_LEN];
+        struct snapshot_header header;
+        memset(&header, 0, sizeof(struct snapshot_header));
+        memcpy(header.magic, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN);
+        header.gen = *gen;
+        header.count = count;
+        header.blocks = (count + SNAPSHOT_BLOCK - 1) / SNAPSHOT_BLOCK;
+        header.hash_len = PIN_HASH_LEN / 2;
+        for (size_t i = 0; i < count; i++) {
+                if (memcmp(entries[i].kdf.salt, no_salt, KDF_SALT_LEN) != 0) {
+                        header.salt_len = KDF_SALT_LEN;
+                }
+                if (!hash_is_hex(entries[i].pin_hash)) {
+                        header.hash_len = PIN_HASH_LEN;
+                }
+        }
+        const size_t record_len = sizeof(uint16_t) + header.salt_len + header.hash_len;
+
+        int err = 0;
+        char *tmppath = NULL;
+        FILE *f = NULL;
+        uint32_t *index = malloc((header.blocks + 1) * sizeof(uint32_t));
+        struct snapshot_kdf *kdfs = malloc((count < UINT16_MAX ? count + 1 : UINT16_MAX + 1) *
+                                           sizeof(struct snapshot_kdf));
+        uint8_t *records = malloc(count * record_len + 1);
+        // a name takes at most two 5 byte lengths and its suffix
+        uint8_t *names = malloc(names_len + count * 10 + 1);
+        if (index == NULL || kdfs == NULL || records == NULL || names == NULL) {
+                err = -1;
+                goto SNAPSHOT_WRITE_RET;
+        }
+
+        size_t pos = 0;
+        const char *prev = "";
+        for (size_t i = 0; i < count; i++) {
+                const char *name = entries[i].name;
+                size_t shared = 0;
+                if (i % SNAPSHOT_BLOCK == 0) {
+                        index[i / SNAPSHOT_BLOCK] = pos;
+                } else {
+                        while (prev[shared] != '\0' && prev[shared] == name[shared]) {
+                                shared++;
+                        }
+                }
+                const size_t suffix = strlen(name + shared);
+                pos += varint_put(names + pos, shared);
+                pos += varint_put(names + pos, suffix);
+                memcpy(names + pos, name + shared, suffix);
+                pos += suffix;
+                prev = name;
+
+                const int k = kdf_index(kdfs, &header.kdfs, &entries[i].kdf);
+                if (k < 0) {
+                        err = ERR_SNAPSHOT_WRITE;
+                        goto SNAPSHOT_WRITE_RET;
+                }
+                uint8_t *rec = records + i * record_len;
+                const uint16_t k16 = k;
+                memcpy(rec, &k16, sizeof(k16));
+                memcpy(rec + sizeof(k16), entries[i].kdf.salt, header.salt_len);
+                uint8_t *hash = rec + sizeof(k16) + header.salt_len;
+                if (header.hash_len == PIN_HASH_LEN) {
+                        memcpy(hash, entries[i].pin_hash, PIN_HASH_LEN);
+                        continue;
+                }
+                for (size_t j = 0; j < PIN_HASH_LEN / 2; j++) {
+                        hash[j] = hex_value(entries[i].pin_hash[2 * j]) << 4 |
+                                  hex_value(entries[i].pin_hash[2 * j + 1]);
+                }
+        }
+        header.index_off = sizeof(struct snapshot_header);
+        header.kdfs_off = header.index_off + header.blocks * sizeof(uint32_t);
+        header.records_off = header.kdfs_off + header.kdfs * sizeof(struct snapshot_kdf);
+        header.names_off = header.records_off + count * record_len;
+        header.size = header.names_off + pos;
+
+        if (asprintf(&tmppath, "%s.XXXXXX", snappath) < 0) {
+                tmppath = NULL;
+                err = -1;
+                goto SNAPSHOT_WRITE_RET;
+        }
+        int fd = mkstemp(tmppath);
+        if (fd < 0) {
+                err = ERR_SNAPSHOT_WRITE;
+                goto SNAPSHOT_WRITE_RET;
+        }
+        f = fdopen(fd, "w");
+        if (f == NULL) {
+                close(fd);
+                unlink(tmppath);
+                err = ERR_SNAPSHOT_WRITE;
+                goto SNAPSHOT_WRITE_RET;
+        }
+
+        fwrite(&header, sizeof(struct snapshot_header), 1, f);
+        fwrite(index, sizeof(uint32_t), header.blocks, f);
+        fwrite(kdfs, sizeof(struct snapshot_kdf), header.kdfs, f);
+        fwrite(records, record_len, count, f);
+        fwrite(names, 1, pos, f);
+        if (ferror(f)) {
+                err = ERR_SNAPSHOT_WRITE;
+        }
+        if (fclose(f) != 0) {
+                err = ERR_SNAPSHOT_WRITE;
+        }
+        if (err == 0 && rename(tmppath, snappath) != 0) {
+                err = ERR_SNAPSHOT_WRITE;
+        }
+        if (err != 0) {
+                unlink(tmppath);
+        }
+
+SNAPSHOT_WRITE_RET:
+        free(tmppath);
+        free(names);
+        free(records);
+        free(kdfs);
+        free(index);
+        return err;
+}
+
+static int snapshot_dir(const char *snappath) {
+        char *dir = strdup(snappath);
+        if (dir == NULL) {
+                return -1;
+        }
+        const char *parent = dirname(dir);
+        struct stat st;
+        int err = lstat(parent, &st);
+        if (err != 0 && errno == ENOENT) {
+                // runtime directory is gone after reboot
+                if (mkdir(parent, 0700) == 0 || errno == EEXIST) {
+                        err = lstat(parent, &st);
+                }
+        }
+        free(dir);
+        if (err != 0) {
+                return ERR_SNAPSHOT_OPEN;
+        }
+        const bool shared = (st.st_mode & (S_IWGRP | S_IWOTH)) != 0;
+        if (!S_ISDIR(st.st_mode) || (st.st_uid != geteuid() && st.st_uid != 0) ||
+                        (shared && (st.st_mode & S_ISVTX) == 0)) {
+                return ERR_SNAPSHOT_UNSAFE;
+        }
+        return 0;
+}
+
+static int snapshot_lock(const char *snappath) {
+        char *lockpath = NULL;
+        if (asprintf(&lockpath, "%s.lock", snappath) < 0) {
+                return -1;
+        }
+        int fd = open(lockpath, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+        free(lockpath);
+        if (fd < 0) {
+                return -1;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !file_trusted(&st)) {
+                close(fd);
+                return -1;
+        }
+        if (flock(fd, LOCK_EX) != 0) {
+                close(fd);
+                return -1;
+        }
+        return fd;
+}
+
+static bool file_trusted(const struct stat *st) {
+        return S_ISREG(st->st_mode) && st->st_uid == geteuid() &&
+                (st->st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+static int build_entry_cmp(const void *a, const void *b) {
+        const struct build_entry *ea = a;
+        const struct build_entry *eb = b;
+        int cmp = strcmp(ea->name, eb->name);
+        if (cmp != 0) {
+                return cmp;
+        }
+        return ea->pos < eb->pos ? -1 : ea->pos > eb->pos ? 1 : 0;
+}
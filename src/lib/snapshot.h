@@ -0,0 +1,55 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include "types.h"
+#include "users.h"
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/*
+ * Read-only snapshot of the parsed users file shared between processes.
+ *
+ * The snapshot is a sorted, front coded table mapped from a file
+ * (usually on tmpfs), a lookup decodes one block of usernames. It is
+ * stamped with the generation (device, inode, size, mtime, ctime) of
+ * the users file it was built from. When the generation changes, one
+ * process rebuilds it under an exclusive flock on `<snapshot>.lock`
+ * while the others wait and map the fresh result.
+ *
+ * Only files of this user which no one else can write are trusted: a
+ * symlink, a foreign or group writable snapshot is rebuilt, such a lock
+ * file fails the open. The directory must be owned by this user or root
+ * and not writable by others unless it is sticky.
+ */
+
+typedef struct snapshot snapshot_t;
+
+enum {
+        ERR_SNAPSHOT_OPEN = 1,
+        ERR_SNAPSHOT_LOCK,
+        ERR_SNAPSHOT_MAP,
+        ERR_SNAPSHOT_WRITE,
+        ERR_SNAPSHOT_LOAD,
+        ERR_SNAPSHOT_INVALID,
+        ERR_SNAPSHOT_UNSAFE,
+};
+
+// map the snapshot of srcpath, rebuild it first if it is stale.
+int snapshot_open(snapshot_t **snap, const char *srcpath, const char *snappath);
+
+int snapshot_find(const snapshot_t *snap, const char *username, user_t *user);
+
+size_t snapshot_len(const snapshot_t *snap);
+
+// true if this process rebuilt the snapshot in snapshot_open
+bool snapshot_rebuilt(const snapshot_t *snap);
+
+void snapshot_close(snapshot_t *snap);
+
+#endif
@@ -3,15 +3,23 @@
  * See the LICENSE file in the project root for more information.
  */
 
+#define _GNU_SOURCE
 #include "utils.h"
 
 #include "state.h"
+#include "hashmap.h"
+#include "trace.h"
+#include "txn.h"
 
 #include <stdint.h>
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
 
 struct entry {
         char *user;
@@ -21,146 +29,347 @@ struct entry {
 typedef struct entry entry_t;
 
 struct state {
+        const alloc_t *alloc; // of the state, its entries and their users
+
         entry_t *entries;
-        uint8_t len;
-        uint8_t cap;
+        size_t len;
+        size_t cap;
+
+        // user to the position of its first entry, built by the second
+        // lookup, a single lookup scans
+        hashmap_t *index;
+        size_t lookups;
 
         bool modified;
 };
 
 
 
-static int scan_entry_line(FILE *f, entry_t *entry);
+static int scan_entry_line(FILE *f, char **line, size_t *len,
+                           const alloc_t *alloc, entry_t *entry);
+static int state_grow(state_t *state);
+static void state_clear(state_t *state);
+static int state_load_file(state_t *state, const char *path);
+static int state_save_file(state_t *state, const char *path);
 
 #define ERR_STATE_READ_EOF -101
 
 state_t* state_new() {
-        state_t *state = malloc(sizeof(state_t));
+        return state_new_alloc(NULL);
+}
+
+state_t* state_new_alloc(const alloc_t *alloc) {
+        if (alloc == NULL) {
+                alloc = &alloc_libc;
+        }
+        state_t *state = alloc_malloc(alloc, sizeof(state_t));
         if (state == NULL) {
                 return NULL;
         }
+        state->alloc = alloc;
         state->entries = NULL;
         state->len = 0;
         state->cap = 0;
+        state->index = NULL;
+        state->lookups = 0;
+        state->modified = false;
         return state;
 }
 
+// the first entry of a user wins as for the scan, NULL - no memory
+static hashmap_t* state_index_build(state_t *state) {
+        hashmap_t *index = hashmap_new_alloc(state->len, state->alloc);
+        for (size_t i = 0; index != NULL && i < state->len; i++) {
+                const char *user = state->entries[i].user;
+                if (hashmap_insert(index, user, hashmap_hash(user), i) < 0) {
+                        hashmap_free(index);
+                        index = NULL;
+                }
+        }
+        return index;
+}
+
+// the index of the entries, NULL - scan them
+static hashmap_t* state_index(state_t *state) {
+        if (state->index != NULL || state->lookups++ == 0) {
+                return state->index;
+        }
+        state->index = state_index_build(state);
+        return state->index;
+}
+
+// position of the first entry of user, -1 - none
+static ssize_t state_find(state_t *state, const char *user) {
+        hashmap_t *index = state_index(state);
+        if (index != NULL) {
+                uint32_t pos;
+                return hashmap_get(index, user, &pos) ? (ssize_t)pos : -1;
+        }
+        for (size_t i = 0; i < state->len; i++) {
+                if (strcmp(state->entries[i].user, user) == 0) {
+                        return i;
+                }
+        }
+        return -1;
+}
+
 int state_load(state_t *state, const char *path) {
+        trace_begin("state_load");
+        int err = state_load_file(state, path);
+        trace_end("state_load");
+        return err;
+}
+
+int state_save(state_t *state, const char *path) {
+        trace_begin("state_save");
+        int err = state_save_file(state, path);
+        trace_end("state_save");
+        return err;
+}
+
+int state_lock(const char *path, int *fd) {
+        char *lockpath = NULL;
+        if (asprintf(&lockpath, "%s.lock", path) < 0) {
+                return ERR_STATE_LOCK;
+        }
+        const int lockfd = open(lockpath, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+        free(lockpath);
+        if (lockfd < 0) {
+                return errno == EACCES ? ERR_STATE_FILE_ACCESS : ERR_STATE_LOCK;
+        }
+        if (flock(lockfd, LOCK_EX) != 0) {
+                close(lockfd);
+                return ERR_STATE_LOCK;
+        }
+        *fd = lockfd;
+        return 0;
+}
+
+void state_unlock(int fd) {
+        if (fd >= 0) {
+                // closing the descriptor drops the flock
+                close(fd);
+        }
+}
+
+static int state_load_file(state_t *state, const char *path) {
         FILE *f = fopen(path, "r");
         if (f == NULL) {
                 switch (errno) {
                         case ENOENT:
-                                state->cap = 0;
-                                state->len = 0;
+                                state_clear(state);
                                 return 0; // file not found, no error
                         ERRORS_CASE(EACCES, ERR_STATE_FILE_ACCESS);
                         ERRORS_DEFAULT(ERR_STATE_OPEN);
                 }
         }
 
+        // rebuilt with the new entries
+        hashmap_free(state->index);
+        state->index = NULL;
         int err = 0;
+        // one line buffer for the file, grown by getline
+        char *line = NULL;
+        size_t len = 0;
         while (!feof(f)) {
                 entry_t entry;
                 memset(&entry, 0, sizeof(entry_t));
-                err = scan_entry_line(f, &entry);
+                err = scan_entry_line(f, &line, &len, state->alloc, &entry);
                 if (err != 0) {
                         break;
                 }
-                if (state->cap == state->len) {
-                        state->cap = state->cap == 0 ? 16 : state->cap * 2;
-                        state->entries = realloc(state->entries, state->cap * sizeof(entry_t));
-                        if (state->entries == NULL) {
-                                free(entry.user);
-                                err = -1;
-                                break;
-                        }
+                if (state_grow(state) != 0) {
+                        alloc_free(state->alloc, entry.user);
+                        err = -1;
+                        break;
                 }
                 state->entries[state->len++] = entry;
         }
+        free(line);
         if (err == ERR_STATE_READ_EOF) {
                 err = 0;
         }
 
-        if (fclose(f) != 0) {
-                free(state->entries);
+        // entries read so far stay in the state, caller frees it
+        if (fclose(f) != 0 && err == 0) {
+                err = ERR_STATE_READ;
         }
         return err;
 }
 
-int state_save(state_t *state, const char *path) {
+static int state_save_file(state_t *state, const char *path) {
         if (!state->modified) {
                 return 0;
         }
 
-        // create file if not exist
-        FILE *f = fopen(path, "wb+");
-        if (f == NULL) {
-                switch (errno) {
-                        ERRORS_CASE(ENOENT, ERR_STATE_FILE_NOT_FOUND);
-                        ERRORS_CASE(EACCES, ERR_STATE_FILE_ACCESS);
-                        ERRORS_DEFAULT(ERR_STATE_OPEN);
-                }
+        // a torn file would reset the attempts, replace it atomically
+        const char *tmppath = NULL;
+        txn_t *txn = txn_new();
+        if (txn == NULL) {
+                return ERR_STATE_OPEN;
         }
-
         int err = 0;
-        for (uint8_t i = 0; i < state->len; i++) {
-                entry_t *entry = &state->entries[i];
-                if (fprintf(f, "%s:%d\n", entry->user, entry->attempts) < 0) {
-                        err = ERR_STATE_WRITE;
-                        break;
+        FILE *f = NULL;
+        if (txn_add(txn, path, &tmppath) != 0 || (f = fopen(tmppath, "wb+")) == NULL) {
+                switch (errno) {
+                        case ENOENT:
+                                err = ERR_STATE_FILE_NOT_FOUND;
+                                break;
+                        case EACCES:
+                                err = ERR_STATE_FILE_ACCESS;
+                                break;
+                        default:
+                                err = ERR_STATE_OPEN;
+                                break;
                 }
+                goto STATE_SAVE_RET;
         }
 
+        err = state_write(state, f);
         if (fclose(f) != 0) {
                 err = ERR_STATE_WRITE;
         }
+        if (err == 0 && txn_commit(txn) != 0) {
+                err = ERR_STATE_WRITE;
+        }
+
+STATE_SAVE_RET:
+        txn_free(txn);
         return err;
 }
 
+int state_write(state_t *state, FILE *out) {
+        for (size_t i = 0; i < state->len; i++) {
+                entry_t *entry = &state->entries[i];
+                if (fprintf(out, "%s:%d\n", entry->user, entry->attempts) < 0) {
+                        return ERR_STATE_WRITE;
+                }
+        }
+        return 0;
+}
+
 void state_free(state_t *state) {
-        for (int i = 0; i < state->len; i++) {
-                free(state->entries[i].user);
+        if (state == NULL) {
+                return;
         }
-        free(state->entries);
+        for (size_t i = 0; i < state->len; i++) {
+                alloc_free(state->alloc, state->entries[i].user);
+        }
+        alloc_free(state->alloc, state->entries);
+        hashmap_free(state->index);
+        alloc_free(state->alloc, state);
 }
 
 void state_get_attempts(state_t *state, const char *user, uint8_t *attempts) {
-        for (uint8_t i = 0; i < state->len; i++) {
-                entry_t *entry = &state->entries[i];
-                if (strcmp(entry->user, user) == 0) {
-                        *attempts = entry->attempts;
-                        return;
+        const ssize_t pos = state_find(state, user);
+        *attempts = pos >= 0 ? state->entries[pos].attempts : 0;
+}
+
+int state_visit(state_t *state, state_visit_fn visit, void *ctx) {
+        // a full pass pays for the index
+        if (state->index == NULL) {
+                state->lookups++;
+        }
+        for (size_t i = 0; i < state->len; i++) {
+                const entry_t *entry = &state->entries[i];
+                if (state_find(state, entry->user) != (ssize_t)i) {
+                        continue;
+                }
+                const int err = visit(ctx, entry->user, entry->attempts);
+                if (err != 0) {
+                        return err;
                 }
         }
-        *attempts = 0;
+        return 0;
 }
 
 void state_set_attempts(state_t *state, const char *user, uint8_t attempts) {
         state->modified = true;
 
-        for (uint8_t i = 0; i < state->len; i++) {
-                entry_t *entry = &state->entries[i];
-                if (strcmp(entry->user, user) == 0) {
-                        entry->attempts = attempts;
-                        return;
-                }
-        }
-        if (state->cap == state->len) {
-                state->cap = state->cap == 0 ? 16 : state->cap * 2;
-                state->entries = realloc(state->entries, state->cap * sizeof(entry_t));
+        const ssize_t pos = state_find(state, user);
+        if (pos >= 0) {
+                state->entries[pos].attempts = attempts;
+                return;
         }
         entry_t entry;
-        entry.user = strdup(user);
+        entry.user = alloc_strdup(state->alloc, user);
         entry.attempts = attempts;
+        if (entry.user == NULL || state_grow(state) != 0) {
+                alloc_free(state->alloc, entry.user);
+                return;
+        }
+        if (state->index != NULL &&
+                        hashmap_put(state->index, entry.user, state->len) != 0) {
+                hashmap_free(state->index);
+                state->index = NULL;
+        }
         state->entries[state->len++] = entry;
 }
 
-static int scan_entry_line(FILE *f, entry_t *entry) {
+state_t* state_clone(state_t *state) {
+        state_t *copy = state_new_alloc(state->alloc);
+        if (copy == NULL) {
+                return NULL;
+        }
+        copy->entries = alloc_malloc(copy->alloc, (state->len > 0 ? state->len : 1) * sizeof(entry_t));
+        if (copy->entries == NULL) {
+                state_free(copy);
+                return NULL;
+        }
+        copy->cap = state->len;
+        for (; copy->len < state->len; copy->len++) {
+                entry_t *entry = &copy->entries[copy->len];
+                entry->user = alloc_strdup(copy->alloc, state->entries[copy->len].user);
+                entry->attempts = state->entries[copy->len].attempts;
+                if (entry->user == NULL) {
+                        state_free(copy);
+                        return NULL;
+                }
+        }
+        return copy;
+}
+
+int state_freeze(state_t *state) {
+        if (state->index != NULL) {
+                return 0;
+        }
+        state->index = state_index_build(state);
+        return state->index != NULL ? 0 : -1;
+}
+
+// room for one more entry
+static int state_grow(state_t *state) {
+        if (state->len < state->cap) {
+                return 0;
+        }
+        const size_t cap = state->cap == 0 ? 16 : state->cap * 2;
+        entry_t *entries = alloc_realloc(state->alloc, state->entries, cap * sizeof(entry_t));
+        if (entries == NULL) {
+                return -1;
+        }
+        state->entries = entries;
+        state->cap = cap;
+        return 0;
+}
+
+// drop every entry, the array keeps its capacity
+static void state_clear(state_t *state) {
+        for (size_t i = 0; i < state->len; i++) {
+                alloc_free(state->alloc, state->entries[i].user);
+        }
+        state->len = 0;
+        hashmap_free(state->index);
+        state->index = NULL;
+}
+
+// the line goes into the getline buffer of the caller, the user is
+// allocated from alloc
+static int scan_entry_line(FILE *f, char **lineptr, size_t *len,
+                           const alloc_t *alloc, entry_t *entry) {
         int err = 0;
 
-        char *line = NULL;
-        size_t len = 0;
-        ssize_t r = getline(&line, &len, f);
+        ssize_t r = getline(lineptr, len, f);
+        char *line = *lineptr;
         if (r == -1) {
                 if (feof(f)) {
                         err = ERR_STATE_READ_EOF;
@@ -176,7 +385,7 @@ static int scan_entry_line(FILE *f, entry_t *entry) {
                 goto SCAN_ENTRY_LINE_RET;
         }
         *colon = '\0';
-        entry->user = strdup(line);
+        entry->user = alloc_strdup(alloc, line);
         if (entry->user == NULL) {
                 err = ERR_STATE_READ;
                 goto SCAN_ENTRY_LINE_RET;
@@ -190,8 +399,8 @@ static int scan_entry_line(FILE *f, entry_t *entry) {
 
 SCAN_ENTRY_LINE_RET:
         if (err != 0 && entry->user != NULL) {
-                free(entry->user);
+                alloc_free(alloc, entry->user);
+                entry->user = NULL;
         }
-        free(line);
         return err;
 }
@@ -6,7 +6,10 @@
 #ifndef _STATE_H
 #define _STATE_H
 
+#include "alloc.h"
+
 #include <stdint.h>
+#include <stdio.h>
 
 typedef struct state state_t;
 
@@ -17,13 +20,42 @@ enum {
         ERR_STATE_FILE_NOT_FOUND,
         ERR_STATE_FILE_ACCESS,
         ERR_STATE_WRITE,
+        ERR_STATE_LOCK,
 };
 
 state_t* state_new();
+
+// the state, its entries and their users from alloc, NULL - alloc_libc.
+state_t* state_new_alloc(const alloc_t *alloc);
 int state_load(state_t *state, const char *path);
 int state_save(state_t *state, const char *path);
+// write the entries in the state file format.
+int state_write(state_t *state, FILE *out);
+// the first entry of the user counts, the entries are indexed by the
+// second lookup.
 void state_get_attempts(state_t *state, const char *user, uint8_t *attempts);
+
+// non-zero stops the visit and is returned by it.
+typedef int (*state_visit_fn)(void *ctx, const char *user, uint8_t attempts);
+
+// the first entry of every user in file order.
+int state_visit(state_t *state, state_visit_fn visit, void *ctx);
 void state_set_attempts(state_t *state, const char *user, uint8_t attempts);
+
+// exclusive flock on "<path>.lock", held by sessions from reading the
+// attempts they change until the state file is replaced.
+int state_lock(const char *path, int *fd);
+
+// release the lock of state_lock, -1 does nothing.
+void state_unlock(int fd);
+
+// a copy of the entries, not modified.
+state_t* state_clone(state_t *state);
+
+// build the index now: until the next change, lookups and visits only read
+// the state and may run concurrently.
+int state_freeze(state_t *state);
+// frees the state itself too.
 void state_free(state_t *state);
 
 #endif
@@ -0,0 +1,118 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#include "status.h"
+#include "auth.h"
+#include "groups.h"
+#include "state.h"
+#include "users.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct join {
+        users_t         *users;
+        state_t         *state;
+        const char      *prefix;
+        groups_cache_t  *groups;        // NULL - no @group records
+        status_fn       fn;
+        void            *ctx;
+};
+
+static int find_group_record(void *ctx, const char *group) {
+        struct join *join = ctx;
+        char record[GROUPS_NAMES_MAX + 2];
+        const int len = snprintf(record, sizeof(record), "@%s", group);
+        if (len < 0 || (size_t)len >= sizeof(record)) {
+                return 0;
+        }
+        return users_find(join->users, record, NULL) == 0 ? 1 : 0;
+}
+
+static int stop_visit(void *ctx, user_t *user) {
+        (void) ctx;
+        (void) user;
+        return 1;
+}
+
+static int status_enrolled(void *ctx, user_t *user) {
+        struct join *join = ctx;
+        status_user_t status = {
+                .username = user_get_name(user),
+                .enrolled = true,
+        };
+        if (status.username == NULL) {
+                return -1;
+        }
+        state_get_attempts(join->state, status.username, &status.attempts);
+        status.locked = status.attempts >= PINPAM_AUTH_MAX_ATTEMPTS;
+        const int err = join->fn(join->ctx, &status);
+        free((void*)status.username);
+        return err;
+}
+
+static int status_orphan(void *ctx, const char *username, uint8_t attempts) {
+        struct join *join = ctx;
+        if (join->prefix != NULL && strncmp(username, join->prefix, strlen(join->prefix)) != 0) {
+                return 0;
+        }
+        if (users_find(join->users, username, NULL) == 0) {
+                return 0;
+        }
+        // attempts of a group member are kept under its own name
+        const status_user_t status = {
+                .username = username,
+                .attempts = attempts,
+                .enrolled = join->groups != NULL &&
+                        groups_visit(join->groups, username, find_group_record, join) == 1,
+                .locked = attempts >= PINPAM_AUTH_MAX_ATTEMPTS,
+        };
+        return join->fn(join->ctx, &status);
+}
+
+int status_run(const char *userspath, const char *statepath, const char *prefix,
+               status_fn fn, void *ctx) {
+        int err = 0;
+        struct join join = {
+                .users = users_new(10),
+                .state = state_new(),
+                .prefix = prefix,
+                .fn = fn,
+                .ctx = ctx,
+        };
+        if (join.users == NULL || join.state == NULL) {
+                err = -1;
+                goto STATUS_RUN_RET;
+        }
+        if (users_load_threads(join.users, userspath, 0) != 0) {
+                err = ERR_STATUS_USERS;
+                goto STATUS_RUN_RET;
+        }
+        if (state_load(join.state, statepath) != 0) {
+                err = ERR_STATUS_STATE;
+                goto STATUS_RUN_RET;
+        }
+
+        if (users_scan_prefix(join.users, "@", NULL, stop_visit, NULL) == 1 &&
+                        groups_cache_open(&join.groups, NULL, 0, NULL) != 0) {
+                err = -1;
+                goto STATUS_RUN_RET;
+        }
+
+        err = users_scan_prefix(join.users, prefix != NULL ? prefix : "", NULL,
+                                status_enrolled, &join);
+        if (err == 0) {
+                err = state_visit(join.state, status_orphan, &join);
+        }
+
+STATUS_RUN_RET:
+        groups_cache_close(join.groups);
+        if (join.state != NULL) {
+                state_free(join.state);
+        }
+        users_free(join.users);
+        return err;
+}
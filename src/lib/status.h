@@ -0,0 +1,42 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#ifndef _STATUS_H
+#define _STATUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Attempts of every user of the text users file.
+ *
+ * The users file and the attempts state file are loaded once and joined
+ * on the username through the hash indexes of both in one pass: the
+ * users in name order first, then the state entries of names without a
+ * record in file order. Those of members of a group with an @group
+ * record, resolved through NSS as pam_pin.so does, are enrolled.
+ */
+
+enum {
+        ERR_STATUS_USERS = 1,
+        ERR_STATUS_STATE,
+};
+
+typedef struct status_user {
+        const char      *username;
+        uint8_t         attempts;
+        bool            enrolled;       // has a users record or one of its groups
+        bool            locked;
+} status_user_t;
+
+// non-zero stops the join and is returned by status_run.
+typedef int (*status_fn)(void *ctx, const status_user_t *user);
+
+// users whose name starts with prefix, NULL - all. A missing state file
+// is empty.
+int status_run(const char *userspath, const char *statepath, const char *prefix,
+               status_fn fn, void *ctx);
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#define _GNU_SOURCE
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+struct trace_event {
+        const char      *name;
+        uint64_t        ts_ns;
+        uint32_t        tid;
+        char            phase;          // 'B' or 'E'
+};
+
+static struct trace_event *events = NULL;
+static _Atomic size_t events_len = 0;
+static char *trace_path = NULL;
+
+static void trace_event(const char *name, char phase);
+
+int trace_start(const char *path) {
+        if (events != NULL) {
+                return 0;
+        }
+        trace_path = strdup(path);
+        events = calloc(TRACE_CAPACITY, sizeof(struct trace_event));
+        if (trace_path == NULL || events == NULL) {
+                free(trace_path);
+                free(events);
+                trace_path = NULL;
+                events = NULL;
+                return ERR_TRACE_ALLOC;
+        }
+        atomic_store(&events_len, 0);
+        return 0;
+}
+
+bool trace_enabled(void) {
+        return events != NULL;
+}
+
+void trace_begin(const char *name) {
+        if (events != NULL) {
+                trace_event(name, 'B');
+        }
+}
+
+void trace_end(const char *name) {
+        if (events != NULL) {
+                trace_event(name, 'E');
+        }
+}
+
+int trace_flush(void) {
+        if (events == NULL) {
+                return 0;
+        }
+        size_t len = atomic_load(&events_len);
+        size_t dropped = 0;
+        if (len > TRACE_CAPACITY) {
+                dropped = len - TRACE_CAPACITY;
+                len = TRACE_CAPACITY;
+        }
+
+        // each process has its own trace, the pid is in its name
+        const int pid = getpid();
+        int err = 0;
+        char *path = NULL;
+        char *tmppath = NULL;
+        if (asprintf(&path, "%s.%d", trace_path, pid) < 0) {
+                path = NULL;
+                err = ERR_TRACE_ALLOC;
+                goto TRACE_FLUSH_RET;
+        }
+        // write a new sibling file and rename it over the trace, mkstemp
+        // does not follow a link planted in a shared directory
+        if (asprintf(&tmppath, "%s.XXXXXX", path) < 0) {
+                tmppath = NULL;
+                err = ERR_TRACE_ALLOC;
+                goto TRACE_FLUSH_RET;
+        }
+        const int fd = mkstemp(tmppath);
+        if (fd < 0) {
+                err = ERR_TRACE_OPEN;
+                goto TRACE_FLUSH_RET;
+        }
+        FILE *f = fdopen(fd, "w");
+        if (f == NULL) {
+                close(fd);
+                unlink(tmppath);
+                err = ERR_TRACE_OPEN;
+                goto TRACE_FLUSH_RET;
+        }
+        fprintf(f, "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped\":%zu},\n"
+                "\"traceEvents\":[", dropped);
+        for (size_t i = 0; i < len; i++) {
+                const struct trace_event *e = &events[i];
+                fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"pinpam\",\"ph\":\"%c\","
+                        "\"ts\":%llu.%03llu,\"pid\":%d,\"tid\":%u}",
+                        i == 0 ? "" : ",", e->name, e->phase,
+                        (unsigned long long)(e->ts_ns / 1000),
+                        (unsigned long long)(e->ts_ns % 1000), pid, e->tid);
+        }
+        fprintf(f, "\n]}\n");
+        if (ferror(f)) {
+                err = ERR_TRACE_WRITE;
+        }
+        if (fclose(f) != 0) {
+                err = ERR_TRACE_WRITE;
+        }
+        if (err == 0 && rename(tmppath, path) != 0) {
+                err = ERR_TRACE_WRITE;
+        }
+        if (err != 0) {
+                unlink(tmppath);
+        }
+
+TRACE_FLUSH_RET:
+        free(tmppath);
+        free(path);
+        free(trace_path);
+        free(events);
+        trace_path = NULL;
+        events = NULL;
+        return err;
+}
+
+static void trace_event(const char *name, char phase) {
+        const size_t i = atomic_fetch_add(&events_len, 1);
+        if (i >= TRACE_CAPACITY) {
+                return;
+        }
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        struct trace_event *e = &events[i];
+        e->name = name;
+        e->ts_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+        e->tid = (uint32_t)syscall(SYS_gettid);
+        e->phase = phase;
+}
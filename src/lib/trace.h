@@ -0,0 +1,41 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdbool.h>
+
+/*
+ * Opt-in span tracing in Chrome trace event format, it opens in
+ * chrome://tracing and ui.perfetto.dev.
+ *
+ * trace_start allocates a per-process buffer, trace_begin/trace_end
+ * append events to it from any thread and trace_flush writes the JSON
+ * file `<path>.<pid>` and stops tracing. Spans are no-ops until tracing is started,
+ * names must be string literals. Events past the buffer capacity are
+ * dropped.
+ */
+
+#define TRACE_CAPACITY 65536
+
+enum {
+        ERR_TRACE_ALLOC = 1,
+        ERR_TRACE_OPEN,
+        ERR_TRACE_WRITE,
+};
+
+int trace_start(const char *path);
+
+bool trace_enabled(void);
+
+void trace_begin(const char *name);
+
+void trace_end(const char *name);
+
+// written atomically to the file of this process, <path>.<pid>.
+int trace_flush(void);
+
+#endif
@@ -0,0 +1,247 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#define _GNU_SOURCE
+#include "tstamp.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+struct tstamp_record {
+        uint32_t        uid;
+        int32_t         sid;
+        uint64_t        start;
+        int64_t         verified;               // boot clock ns, 0 - empty
+        char            tty[TSTAMP_TTY_MAX];
+};
+
+static int tstamp_path(const char *dir, const char *username, char *path, size_t size);
+static bool tstamp_safe(const struct stat *st, mode_t type);
+static bool tstamp_match(const struct tstamp_record *record, const tstamp_key_t *key);
+static int64_t tstamp_now(void);
+
+void tstamp_key(tstamp_key_t *key, const char *tty) {
+        memset(key, 0, sizeof(tstamp_key_t));
+        key->uid = getuid();
+        key->sid = getsid(0);
+
+        // starttime is the 22nd field, the name in the 2nd may have spaces
+        char path[64];
+        char stat[512];
+        snprintf(path, sizeof(path), "/proc/%d/stat", (int)key->sid);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+                const ssize_t len = read(fd, stat, sizeof(stat) - 1);
+                close(fd);
+                char *pos = len > 0 ? (stat[len] = '\0', strrchr(stat, ')')) : NULL;
+                for (int field = 2; pos != NULL && field < 22; field++) {
+                        pos = strchr(pos + 1, ' ');
+                }
+                if (pos != NULL) {
+                        key->start = strtoull(pos + 1, NULL, 10);
+                }
+        }
+
+        if (tty == NULL) {
+                tty = ttyname(STDIN_FILENO);
+        }
+        if (tty != NULL) {
+                if (strncmp(tty, "/dev/", 5) == 0) {
+                        tty += 5;
+                }
+                strncpy(key->tty, tty, TSTAMP_TTY_MAX - 1);
+        }
+}
+
+int tstamp_check(const char *dir, const char *username, const tstamp_key_t *key,
+                 unsigned int timeout, bool *fresh) {
+        *fresh = false;
+        char path[PATH_MAX];
+        int err = tstamp_path(dir, username, path, sizeof(path));
+        if (err != 0 || timeout == 0) {
+                return err;
+        }
+        int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0) {
+                // never verified or invalidated
+                return errno == ENOENT ? 0 : ERR_TSTAMP_OPEN;
+        }
+
+        struct tstamp_record records[TSTAMP_RECORDS];
+        struct stat st;
+        ssize_t len = 0;
+        if (fstat(fd, &st) != 0 || flock(fd, LOCK_SH) != 0) {
+                err = ERR_TSTAMP_READ;
+                goto TSTAMP_CHECK_RET;
+        }
+        if (!tstamp_safe(&st, S_IFREG)) {
+                err = ERR_TSTAMP_UNSAFE;
+                goto TSTAMP_CHECK_RET;
+        }
+        len = pread(fd, records, sizeof(records), 0);
+        if (len < 0) {
+                err = ERR_TSTAMP_READ;
+                goto TSTAMP_CHECK_RET;
+        }
+
+        const int64_t now = tstamp_now();
+        const int64_t window = (int64_t)timeout * 1000000000;
+        for (size_t i = 0; i < len / sizeof(struct tstamp_record); i++) {
+                const struct tstamp_record *record = &records[i];
+                if (tstamp_match(record, key) && record->verified <= now &&
+                                now - record->verified < window) {
+                        *fresh = true;
+                        break;
+                }
+        }
+
+TSTAMP_CHECK_RET:
+        close(fd);
+        return err;
+}
+
+int tstamp_update(const char *dir, const char *username, const tstamp_key_t *key) {
+        char path[PATH_MAX];
+        int err = tstamp_path(dir, username, path, sizeof(path));
+        if (err != 0) {
+                return err;
+        }
+        struct stat st;
+        if (lstat(dir, &st) != 0 && errno == ENOENT) {
+                // runtime directory is gone after reboot
+                char *parent = strdup(dir);
+                if (parent != NULL) {
+                        mkdir(dirname(parent), 0700);
+                        free(parent);
+                }
+                mkdir(dir, 0700);
+        }
+        if (lstat(dir, &st) != 0) {
+                return ERR_TSTAMP_OPEN;
+        }
+        if (!tstamp_safe(&st, S_IFDIR)) {
+                return ERR_TSTAMP_UNSAFE;
+        }
+
+        int fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+        if (fd < 0) {
+                return ERR_TSTAMP_OPEN;
+        }
+        struct tstamp_record records[TSTAMP_RECORDS];
+        ssize_t len = 0;
+        if (fstat(fd, &st) != 0 || flock(fd, LOCK_EX) != 0) {
+                err = ERR_TSTAMP_OPEN;
+                goto TSTAMP_UPDATE_RET;
+        }
+        if (!tstamp_safe(&st, S_IFREG)) {
+                err = ERR_TSTAMP_UNSAFE;
+                goto TSTAMP_UPDATE_RET;
+        }
+        len = pread(fd, records, sizeof(records), 0);
+        if (len < 0) {
+                err = ERR_TSTAMP_READ;
+                goto TSTAMP_UPDATE_RET;
+        }
+
+        // the record of the key, a new one or the oldest when all are taken
+        const size_t count = len / sizeof(struct tstamp_record);
+        size_t slot = count < TSTAMP_RECORDS ? count : 0;
+        for (size_t i = 0; i < count; i++) {
+                if (tstamp_match(&records[i], key)) {
+                        slot = i;
+                        break;
+                }
+                if (count == TSTAMP_RECORDS && records[i].verified < records[slot].verified) {
+                        slot = i;
+                }
+        }
+
+        struct tstamp_record record;
+        memset(&record, 0, sizeof(record));
+        record.uid = key->uid;
+        record.sid = key->sid;
+        record.start = key->start;
+        record.verified = tstamp_now();
+        memcpy(record.tty, key->tty, TSTAMP_TTY_MAX);
+        if (pwrite(fd, &record, sizeof(record), slot * sizeof(record)) != sizeof(record)) {
+                err = ERR_TSTAMP_WRITE;
+        }
+
+TSTAMP_UPDATE_RET:
+        close(fd);
+        return err;
+}
+
+int tstamp_invalidate(const char *dir, const char *username) {
+        if (username != NULL) {
+                char path[PATH_MAX];
+                int err = tstamp_path(dir, username, path, sizeof(path));
+                if (err != 0) {
+                        return err;
+                }
+                if (unlink(path) != 0 && errno != ENOENT) {
+                        return ERR_TSTAMP_WRITE;
+                }
+                return 0;
+        }
+
+        DIR *d = opendir(dir);
+        if (d == NULL) {
+                return errno == ENOENT ? 0 : ERR_TSTAMP_OPEN;
+        }
+        int err = 0;
+        struct dirent *entry;
+        while ((entry = readdir(d)) != NULL) {
+                if (entry->d_name[0] == '.') {
+                        continue;
+                }
+                if (unlinkat(dirfd(d), entry->d_name, 0) != 0 && errno != ENOENT) {
+                        err = ERR_TSTAMP_WRITE;
+                }
+        }
+        closedir(d);
+        return err;
+}
+
+// one file per user, names that are not plain file names are not cached
+static int tstamp_path(const char *dir, const char *username, char *path, size_t size) {
+        if (username[0] == '\0' || username[0] == '.' || strchr(username, '/') != NULL ||
+                        strlen(username) > NAME_MAX) {
+                return ERR_TSTAMP_NAME;
+        }
+        if (snprintf(path, size, "%s/%s", dir, username) >= (int)size) {
+                return ERR_TSTAMP_NAME;
+        }
+        return 0;
+}
+
+// written only by us, a planted or loosened file is not trusted
+static bool tstamp_safe(const struct stat *st, mode_t type) {
+        return (st->st_mode & S_IFMT) == type && st->st_uid == geteuid() &&
+                (st->st_mode & 077) == 0;
+}
+
+static bool tstamp_match(const struct tstamp_record *record, const tstamp_key_t *key) {
+        return record->verified != 0 && record->uid == (uint32_t)key->uid &&
+                record->sid == key->sid && record->start == key->start &&
+                strncmp(record->tty, key->tty, TSTAMP_TTY_MAX) == 0;
+}
+
+// time spent suspended counts towards the timeout
+static int64_t tstamp_now(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_BOOTTIME, &ts);
+        return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,58 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#ifndef _TSTAMP_H
+#define _TSTAMP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Timestamps of successful verifications, like the ones of sudo.
+ *
+ * A user who entered the PIN in a login session is not asked again in the
+ * same session for a timeout: the PAM module finds a fresh record with one
+ * open and pread and does not read the users store. Every user has a small
+ * file of records in a root-only directory, usually on tmpfs, a record is
+ * for a calling uid, session and terminal. The session is told apart from
+ * a later one with the same id by the start time of its leader. ppedit
+ * removes the file of a user when the PIN or the attempts change.
+ */
+
+enum {
+        ERR_TSTAMP_OPEN = 1,
+        ERR_TSTAMP_NAME,
+        ERR_TSTAMP_READ,
+        ERR_TSTAMP_WRITE,
+        ERR_TSTAMP_UNSAFE,
+};
+
+#define TSTAMP_TTY_MAX 32
+
+// records of one user, the oldest is replaced when all are taken
+#define TSTAMP_RECORDS 16
+
+typedef struct tstamp_key {
+        uid_t           uid;                    // of the caller
+        pid_t           sid;                    // session of the caller
+        uint64_t        start;                  // of the session leader, clock ticks since boot
+        char            tty[TSTAMP_TTY_MAX];    // empty - none
+} tstamp_key_t;
+
+// the key of the calling process, NULL tty - the controlling terminal.
+void tstamp_key(tstamp_key_t *key, const char *tty);
+
+// *fresh is true when the key verified within the last timeout seconds.
+int tstamp_check(const char *dir, const char *username, const tstamp_key_t *key,
+                 unsigned int timeout, bool *fresh);
+
+// records a successful verification now, the directory is made when missing.
+int tstamp_update(const char *dir, const char *username, const tstamp_key_t *key);
+
+// removes the records of the user, NULL username - of all users.
+int tstamp_invalidate(const char *dir, const char *username);
+
+#endif
@@ -0,0 +1,182 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#define _GNU_SOURCE
+#include "txn.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TXN_MAX_FILES 4
+
+struct txn_file {
+        char    *path;
+        char    *tmppath;
+        char    *bakpath;       // <path>.bak, the original while committing
+        bool    backup;         // the original is kept in bakpath
+};
+
+struct txn {
+        struct txn_file files[TXN_MAX_FILES];
+        size_t          len;
+};
+
+static int txn_sync_file(const char *path);
+static void txn_sync_dir(const char *path);
+static int txn_backup(struct txn_file *file);
+static void txn_rollback(txn_t *txn, size_t renamed);
+
+txn_t* txn_new() {
+        txn_t *txn = malloc(sizeof(txn_t));
+        if (txn == NULL) {
+                return NULL;
+        }
+        memset(txn, 0, sizeof(txn_t));
+        return txn;
+}
+
+int txn_add(txn_t *txn, const char *path, const char **tmppath) {
+        if (txn->len == TXN_MAX_FILES) {
+                return ERR_TXN_TOO_MANY;
+        }
+        struct txn_file *file = &txn->files[txn->len];
+        file->path = strdup(path);
+        if (file->path == NULL ||
+                        asprintf(&file->tmppath, "%s.XXXXXX", path) < 0) {
+                free(file->path);
+                return ERR_TXN_CREATE;
+        }
+        if (asprintf(&file->bakpath, "%s.bak", path) < 0) {
+                free(file->path);
+                free(file->tmppath);
+                return ERR_TXN_CREATE;
+        }
+        int fd = mkstemp(file->tmppath);
+        if (fd < 0) {
+                free(file->path);
+                free(file->tmppath);
+                free(file->bakpath);
+                return ERR_TXN_CREATE;
+        }
+        // keep permissions of the file being replaced
+        struct stat st;
+        if (stat(path, &st) == 0) {
+                fchmod(fd, st.st_mode & 07777);
+        }
+        close(fd);
+        txn->len++;
+        *tmppath = file->tmppath;
+        return 0;
+}
+
+int txn_commit(txn_t *txn) {
+        int err = 0;
+        for (size_t i = 0; i < txn->len; i++) {
+                err = txn_sync_file(txn->files[i].tmppath);
+                if (err != 0) {
+                        return err;
+                }
+        }
+        // the originals stay as hard links until every file is replaced
+        for (size_t i = 0; i < txn->len; i++) {
+                err = txn_backup(&txn->files[i]);
+                if (err != 0) {
+                        txn_rollback(txn, 0);
+                        return err;
+                }
+        }
+        for (size_t i = 0; i < txn->len; i++) {
+                if (rename(txn->files[i].tmppath, txn->files[i].path) != 0) {
+                        txn_rollback(txn, i);
+                        return ERR_TXN_RENAME;
+                }
+        }
+        for (size_t i = 0; i < txn->len; i++) {
+                // renamed file is not temporary anymore
+                free(txn->files[i].tmppath);
+                txn->files[i].tmppath = NULL;
+                if (txn->files[i].backup) {
+                        unlink(txn->files[i].bakpath);
+                        txn->files[i].backup = false;
+                }
+                txn_sync_dir(txn->files[i].path);
+        }
+        return 0;
+}
+
+void txn_free(txn_t *txn) {
+        if (txn == NULL) {
+                return;
+        }
+        for (size_t i = 0; i < txn->len; i++) {
+                if (txn->files[i].tmppath != NULL) {
+                        unlink(txn->files[i].tmppath);
+                        free(txn->files[i].tmppath);
+                }
+                free(txn->files[i].bakpath);
+                free(txn->files[i].path);
+        }
+        free(txn);
+}
+
+static int txn_sync_file(const char *path) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+                return ERR_TXN_SYNC;
+        }
+        int err = fsync(fd) == 0 ? 0 : ERR_TXN_SYNC;
+        close(fd);
+        return err;
+}
+
+static void txn_sync_dir(const char *path) {
+        char *copy = strdup(path);
+        if (copy == NULL) {
+                return;
+        }
+        int fd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+        if (fd >= 0) {
+                fsync(fd);
+                close(fd);
+        }
+        free(copy);
+}
+
+// a target that does not exist or is not a file has nothing to keep
+static int txn_backup(struct txn_file *file) {
+        unlink(file->bakpath);
+        if (link(file->path, file->bakpath) == 0) {
+                file->backup = true;
+                return 0;
+        }
+        return errno == ENOENT || errno == EPERM ? 0 : ERR_TXN_BACKUP;
+}
+
+// put back the originals of the first renamed files, drop the other links
+static void txn_rollback(txn_t *txn, size_t renamed) {
+        for (size_t i = 0; i < txn->len; i++) {
+                struct txn_file *file = &txn->files[i];
+                if (i < renamed) {
+                        if (file->backup) {
+                                rename(file->bakpath, file->path);
+                        } else {
+                                unlink(file->path);
+                        }
+                        free(file->tmppath);
+                        file->tmppath = NULL;
+                        txn_sync_dir(file->path);
+                } else if (file->backup) {
+                        unlink(file->bakpath);
+                }
+                file->backup = false;
+        }
+}
@@ -0,0 +1,39 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+#ifndef _TXN_H
+#define _TXN_H
+
+/*
+ * Replace a set of files at once: every file is written to a temporary
+ * file next to the target, and only after all of them were written and
+ * synced they are renamed over the targets. The originals are hard linked
+ * to <target>.bak first; when a rename fails the replaced targets get
+ * their originals back. A crash between the renames leaves the .bak
+ * links of the set for the administrator to restore.
+ */
+
+typedef struct txn txn_t;
+
+enum {
+        ERR_TXN_CREATE = 1,
+        ERR_TXN_TOO_MANY,
+        ERR_TXN_SYNC,
+        ERR_TXN_RENAME,
+        ERR_TXN_BACKUP,
+};
+
+txn_t* txn_new();
+
+// create a temporary file for path, the content should be written to tmppath.
+int txn_add(txn_t *txn, const char *path, const char **tmppath);
+
+// sync and rename all temporary files over their targets, all or none.
+int txn_commit(txn_t *txn);
+
+// remove temporary files which were not committed.
+void txn_free(txn_t *txn);
+
+#endif
@@ -6,6 +6,9 @@
 #define _GNU_SOURCE
 #include "users.h"
 #include "utils.h"
+#include "hashmap.h"
+#include "trace.h"
+#include "txn.h"
 
 #include <string.h>
 #include <syslog.h>
@@ -13,53 +16,134 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <openssl/crypto.h>
 
 // internal implementation
 
 #define ERR_READ_EOF -101
 
+// lines parsed per users_scan_line trace span
+#define TRACE_SCAN_BATCH 4096
+
+// smallest chunk worth a loader thread when the count is automatic
+#define LOAD_MIN_CHUNK (1 << 20)
+
+// index slots loaded ahead of the merge
+#define LOAD_PREFETCH 8
+
+// tombstones are compacted once they are a quarter of the slots
+#define COMPACT_MIN 64
+#define COMPACT_RATIO 4
+
 struct user {
         const char              *username;
         const pin_hash_t        pin_hash;
+        kdf_params_t            kdf;
+        // sha256-pepper prefix midstate, valid for mid_version pepper
+        pin_midstate_t          mid;
+        uint32_t                mid_version;
 
         bool _allocated;
+        bool _removed;  // tombstone, keeps its name for the sorted view
 };
 
 struct users {
+        const alloc_t *alloc; // of the storage, its arrays and usernames
+
         user_t  *users;
         size_t  ulen;
         size_t  ucap;
+        size_t  dead;   // tombstones in users
+        size_t  dups;   // live records shadowed by an earlier one of their name
+
+        hashmap_t *index; // username -> position in users
+        uint32_t *sorted; // positions in name order, NULL - not built
+        size_t slen;
+
+        char **arenas; // usernames of users_load_threads records
+        size_t alen;
+};
+
+// records of one chunk of the users file, parsed by a loader thread
+struct load_chunk {
+        const char      *from;
+        const char      *to;
+        size_t          lines;
+        user_t          *users;         // lines slots of the storage
+        uint32_t        *hashes;        // hashmap_hash of the usernames
+        size_t          len;
+        char            *names;         // arena of the usernames
+        int             err;            // stops the chunk, its records stay
 };
 
 static int users_add(users_t *storage,
                 const char *username,
+                const kdf_params_t *kdf,
                 const pin_hash_t pin,
                 const bool allocated);
 
 static int users_resize(users_t *storage);
 
-static int users_scan_line(FILE *file, char **username, pin_hash_t pin_hash);
+static int users_load_file(users_t *storage, const char* filepath);
+
+static int users_load_mapped(users_t *storage, const char *base, size_t size,
+                             int threads);
+
+static int users_scan_line(FILE *file, char **line, size_t *len,
+                           const alloc_t *alloc, char **username,
+                           kdf_params_t *kdf, pin_hash_t pin_hash);
 
 static int user_print_line(FILE *file, const user_t *user);
 
 static int user_copy(user_t *dst, const user_t *src);
 
+static int users_sort(users_t *storage);
+
+static void users_compact(users_t *storage);
+
+static void users_clear(users_t *storage);
+
 // public interface
 
 users_t* users_new(const int cap) {
-        users_t *storage = malloc(sizeof(users_t));
+        return users_new_alloc(cap, NULL);
+}
+
+users_t* users_new_alloc(const int cap, const alloc_t *alloc) {
+        if (alloc == NULL) {
+                alloc = &alloc_libc;
+        }
+        users_t *storage = alloc_malloc(alloc, sizeof(users_t));
         if (storage == NULL) {
                 return NULL;
         }
+        storage->alloc = alloc;
         storage->users = NULL;
         storage->ulen = 0;
         storage->ucap = 0;
+        storage->dead = 0;
+        storage->dups = 0;
+        storage->sorted = NULL;
+        storage->slen = 0;
+        storage->arenas = NULL;
+        storage->alen = 0;
+        storage->index = hashmap_new_alloc(cap > 0 ? cap : 0, alloc);
+        if (storage->index == NULL) {
+                alloc_free(alloc, storage);
+                return NULL;
+        }
         if (cap > 0) {
                 storage->ucap = cap;
-                storage->users = malloc(cap * sizeof(user_t));
+                storage->users = alloc_calloc(alloc, cap, sizeof(user_t));
                 if (storage->users == NULL) {
-                        free(storage);
+                        hashmap_free(storage->index);
+                        alloc_free(alloc, storage);
                         return NULL;
                 }
         }
@@ -67,13 +151,19 @@ users_t* users_new(const int cap) {
 }
 
 int users_load(users_t *storage, const char* filepath) {
+        trace_begin("users_load");
+        int err = users_load_file(storage, filepath);
+        trace_end("users_load");
+        return err;
+}
+
+static int users_load_file(users_t *storage, const char* filepath) {
         FILE *file = fopen(filepath, "r");
         if (file == NULL) {
                 switch (errno) {
                         case ENOENT:
                                 // file not found - no error
-                                storage->ucap = 0;
-                                storage->ulen = 0;
+                                users_clear(storage);
                                 return 0;
 
                         ERRORS_CASE(EACCES, ERR_USERS_ACCES);
@@ -83,27 +173,42 @@ int users_load(users_t *storage, const char* filepath) {
 
         /*
          * User file format:
-         * <username:string>:<pin_hash:binary>\n
-         * <username:string>:<pin_hash:binary>\n
-         * <username:string>:<pin_hash:binary>\n
+         * <username:string>:[$<kdf>$<params>$<salt>$]<pin_hash:binary>\n
+         * <username:string>:[$<kdf>$<params>$<salt>$]<pin_hash:binary>\n
+         * <username:string>:[$<kdf>$<params>$<salt>$]<pin_hash:binary>\n
          * EOF
+         * see kdf.h for the algorithm prefix.
          */
         int err = 0;
+        size_t lines = 0;
+        // one line buffer for the file, grown by getline
+        char *line = NULL;
+        size_t len = 0;
 
+        trace_begin("users_scan_line");
         while (!feof(file)) {
+                if (lines > 0 && lines % TRACE_SCAN_BATCH == 0) {
+                        trace_end("users_scan_line");
+                        trace_begin("users_scan_line");
+                }
+                lines++;
                 char *username = NULL;
+                kdf_params_t kdf;
                 pin_hash_t pin_hash;
-                err = users_scan_line(file, &username, pin_hash);
+                err = users_scan_line(file, &line, &len, storage->alloc, &username,
+                                      &kdf, pin_hash);
                 if (err != 0) {
                         break;
                 }
 
-                err = users_add(storage, username, pin_hash, true);
+                err = users_add(storage, username, &kdf, pin_hash, true);
                 if (err != 0) {
-                        free(username);
+                        alloc_free(storage->alloc, username);
                         break;
                 }
         }
+        trace_end("users_scan_line");
+        free(line);
 
         if (err == ERR_READ_EOF) {
                 err = 0;
@@ -123,72 +228,398 @@ int users_load(users_t *storage, const char* filepath) {
         return 0;
 
 USERS_LOAD_ERR:
+        // records loaded so far stay in the storage, caller frees it
         if (file != NULL) {
                 fclose(file);
         }
-        users_free(storage);
         return err;
 }
 
+int users_load_threads(users_t *storage, const char* filepath, int threads) {
+        trace_begin("users_load");
+        int err = 0;
+        const char *base = NULL;
+        struct stat st;
+        int fd = open(filepath, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+                switch (errno) {
+                        case ENOENT:
+                                // same as users_load
+                                users_clear(storage);
+                                goto USERS_LOAD_THREADS_RET;
+
+                        case EACCES:
+                                err = ERR_USERS_ACCES;
+                                goto USERS_LOAD_THREADS_RET;
+                        default:
+                                err = ERR_USERS_OPEN;
+                                goto USERS_LOAD_THREADS_RET;
+                }
+        }
+        if (fstat(fd, &st) != 0) {
+                err = ERR_USERS_READ;
+                goto USERS_LOAD_THREADS_RET;
+        }
+        if (st.st_size > 0) {
+                void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (map == MAP_FAILED) {
+                        err = ERR_USERS_READ;
+                        goto USERS_LOAD_THREADS_RET;
+                }
+                madvise(map, st.st_size, MADV_SEQUENTIAL);
+                base = map;
+        }
+
+        if (threads <= 0) {
+                const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                const size_t chunks = st.st_size / LOAD_MIN_CHUNK + 1;
+                threads = cpus <= 1 ? 1 : (size_t)cpus < chunks ? (int)cpus : (int)chunks;
+        }
+        if (base != NULL) {
+                err = users_load_mapped(storage, base, st.st_size, threads);
+                munmap((void*)base, st.st_size);
+        }
+
+USERS_LOAD_THREADS_RET:
+        if (fd >= 0) {
+                close(fd);
+        }
+        trace_end("users_load");
+        return err;
+}
+
+// count the lines of the chunk, its records go to that many slots
+static void* users_count_chunk(void *arg) {
+        struct load_chunk *chunk = arg;
+        size_t lines = 0;
+        for (const char *p = chunk->from; p < chunk->to; lines++) {
+                const char *nl = memchr(p, '\n', chunk->to - p);
+                p = nl != NULL ? nl + 1 : chunk->to;
+        }
+        chunk->lines = lines;
+        return NULL;
+}
+
+/*
+ * Parse the lines of the chunk as users_scan_line does, into its slots
+ * of the storage. Usernames are copied into the arena of the chunk, a
+ * name is shorter than its line so the arena is the size of the chunk.
+ */
+static void* users_load_chunk(void *arg) {
+        struct load_chunk *chunk = arg;
+        char *names = chunk->names;
+        for (const char *line = chunk->from; line < chunk->to;) {
+                const char *nl = memchr(line, '\n', chunk->to - line);
+                // the length of the getline line, with its line break
+                const size_t len = nl != NULL ? (size_t)(nl + 1 - line) : (size_t)(chunk->to - line);
+                const char *colon = memchr(line, ':', len);
+                if (colon == NULL) {
+                        chunk->err = ERR_USERS_INVALID_FORMAT;
+                        return NULL;
+                }
+                // kdf_parse reads a string, the prefix is enough of it
+                const char *value = colon + 1;
+                const size_t value_len = line + len - value;
+                char buf[KDF_PREFIX_MAX + PIN_HASH_LEN + 1];
+                const size_t copy = value_len < sizeof(buf) ? value_len : sizeof(buf) - 1;
+                memcpy(buf, value, copy);
+                buf[copy] = '\0';
+                kdf_params_t kdf;
+                const char *hash = NULL;
+                if (kdf_parse(buf, &kdf, &hash) != 0 ||
+                                value_len - (size_t)(hash - buf) < PIN_HASH_LEN) {
+                        chunk->err = ERR_USERS_INVALID_FORMAT;
+                        return NULL;
+                }
+                const size_t name_len = colon - line;
+                memcpy(names, line, name_len);
+                names[name_len] = '\0';
+
+                user_t *user = &chunk->users[chunk->len];
+                user->username = names;
+                memcpy((void*)user->pin_hash, value + (hash - buf), PIN_HASH_LEN);
+                user->kdf = kdf;
+                user->mid_version = 0;
+                user->_allocated = false;
+                user->_removed = false;
+                chunk->hashes[chunk->len] = hashmap_hash(names);
+                chunk->len++;
+                names += name_len + 1;
+                line += len;
+        }
+        return NULL;
+}
+
+// run fn over the chunks, the caller takes the first one
+static int users_load_run(struct load_chunk *chunks, int threads, void *(*fn)(void*)) {
+        pthread_t *tids = calloc(threads, sizeof(pthread_t));
+        if (tids == NULL) {
+                return -1;
+        }
+        int err = 0;
+        int started = 0;
+        for (int i = 1; i < threads; i++) {
+                if (pthread_create(&tids[i], NULL, fn, &chunks[i]) != 0) {
+                        err = -1;
+                        break;
+                }
+                started = i;
+        }
+        fn(&chunks[0]);
+        for (int i = 1; i <= started; i++) {
+                pthread_join(tids[i], NULL);
+        }
+        free(tids);
+        return err;
+}
+
+/*
+ * Split the file at line breaks, count the lines of the chunks to place
+ * their records, parse them in parallel and index them in file order up
+ * to the first error. The first record of a name takes the index, as
+ * users_add does.
+ */
+static int users_load_mapped(users_t *storage, const char *base, size_t size,
+                             int threads) {
+        struct load_chunk *chunks = calloc(threads, sizeof(struct load_chunk));
+        if (chunks == NULL) {
+                return -1;
+        }
+        const char *end = base + size;
+        const char *from = base;
+        for (int i = 0; i < threads; i++) {
+                const char *to = base + size / threads * (i + 1);
+                if (i == threads - 1 || to >= end) {
+                        to = end;
+                } else if (to < from) {
+                        to = from;
+                } else {
+                        const char *nl = memchr(to, '\n', end - to);
+                        to = nl != NULL ? nl + 1 : end;
+                }
+                chunks[i].from = from;
+                chunks[i].to = to;
+                from = to;
+        }
+
+        uint32_t *hashes = NULL;
+        char **arenas = NULL;
+        int err = users_load_run(chunks, threads, users_count_chunk);
+        if (err != 0) {
+                goto USERS_LOAD_MAPPED_RET;
+        }
+        size_t lines = 0;
+        for (int i = 0; i < threads; i++) {
+                lines += chunks[i].lines;
+        }
+        hashes = malloc((lines + 1) * sizeof(uint32_t));
+        arenas = alloc_realloc(storage->alloc, storage->arenas,
+                               (storage->alen + threads) * sizeof(char*));
+        if (arenas != NULL) {
+                storage->arenas = arenas;
+        }
+        if (hashes == NULL || arenas == NULL) {
+                err = -1;
+                goto USERS_LOAD_MAPPED_RET;
+        }
+        // the loader threads do not call the allocator
+        for (int i = 0; i < threads; i++) {
+                chunks[i].names = alloc_malloc(storage->alloc, chunks[i].to - chunks[i].from + 1);
+                if (chunks[i].names == NULL) {
+                        err = -1;
+                        goto USERS_LOAD_MAPPED_RET;
+                }
+        }
+        if (storage->ulen + lines > storage->ucap) {
+                user_t *users = alloc_realloc(storage->alloc, storage->users,
+                                              (storage->ulen + lines) * sizeof(user_t));
+                if (users == NULL) {
+                        err = -1;
+                        goto USERS_LOAD_MAPPED_RET;
+                }
+                storage->users = users;
+                storage->ucap = storage->ulen + lines;
+        }
+        size_t pos = 0;
+        for (int i = 0; i < threads; i++) {
+                chunks[i].users = &storage->users[storage->ulen + pos];
+                chunks[i].hashes = &hashes[pos];
+                pos += chunks[i].lines;
+        }
+        err = users_load_run(chunks, threads, users_load_chunk);
+        if (err != 0) {
+                goto USERS_LOAD_MAPPED_RET;
+        }
+
+        trace_begin("users_merge");
+        size_t total = 0;
+        int last = threads - 1;
+        for (int i = 0; i < threads; i++) {
+                total += chunks[i].len;
+                if (chunks[i].err != 0) {
+                        err = chunks[i].err;
+                        last = i;
+                        break;
+                }
+        }
+        if (hashmap_reserve(storage->index, hashmap_len(storage->index) + total) != 0) {
+                trace_end("users_merge");
+                err = -1;
+                goto USERS_LOAD_MAPPED_RET;
+        }
+        for (int i = 0; i <= last; i++) {
+                struct load_chunk *chunk = &chunks[i];
+                for (size_t j = 0; j < chunk->len; j++) {
+                        if (j + LOAD_PREFETCH < chunk->len) {
+                                hashmap_prefetch(storage->index, chunk->hashes[j + LOAD_PREFETCH]);
+                        }
+                        if (hashmap_insert(storage->index, chunk->users[j].username,
+                                           chunk->hashes[j], storage->ulen + j) == 1) {
+                                storage->dups++;
+                        }
+                }
+                storage->ulen += chunk->len;
+                storage->arenas[storage->alen++] = chunk->names;
+                chunk->names = NULL;
+        }
+        alloc_free(storage->alloc, storage->sorted);
+        storage->sorted = NULL;
+        trace_end("users_merge");
+
+USERS_LOAD_MAPPED_RET:
+        // records past the first error are dropped with their names
+        for (int i = 0; i < threads; i++) {
+                alloc_free(storage->alloc, chunks[i].names);
+        }
+        free(chunks);
+        free(hashes);
+        return err;
+}
 
 int users_find(users_t *storage,
                const char *username,
                user_t *user) {
-        for (size_t i = 0; i < storage->ulen; i++) {
-                if (strcmp(storage->users[i].username, username) == 0) {
-                        if (user != NULL) {
-                                int err = user_copy(user, &storage->users[i]);
-                                if (err != 0) {
-                                        return err;
-                                }
-                        }
-                        return 0;
-                }
+        uint32_t pos;
+        int err = 0;
+        trace_begin("users_find");
+        if (!hashmap_get(storage->index, username, &pos)) {
+                err = ERR_USERS_USER_NOT_FOUND;
+        } else if (user != NULL) {
+                err = user_copy(user, &storage->users[pos]);
         }
-        return ERR_USERS_USER_NOT_FOUND;
+        trace_end("users_find");
+        return err;
 }
 
-int users_dump(users_t *storage, const char* filepath) {
-        // TODO: lock the file
+int users_lock(const char *filepath, bool wait, int *fd) {
+        char *lockpath = NULL;
+        if (asprintf(&lockpath, "%s.lock", filepath) < 0) {
+                return ERR_USERS_LOCK;
+        }
+        const int lockfd = open(lockpath, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+        free(lockpath);
+        if (lockfd < 0) {
+                return errno == EACCES ? ERR_USERS_ACCES : ERR_USERS_LOCK;
+        }
+        if (flock(lockfd, wait ? LOCK_EX : LOCK_EX | LOCK_NB) != 0) {
+                const int busy = errno == EWOULDBLOCK;
+                close(lockfd);
+                return busy ? ERR_USERS_BUSY : ERR_USERS_LOCK;
+        }
+        *fd = lockfd;
+        return 0;
+}
 
-        // overwrite the file
-        FILE *file = fopen(filepath, "w");
+void users_unlock(int fd) {
+        if (fd >= 0) {
+                // closing the descriptor drops the flock
+                close(fd);
+        }
+}
+
+// callers changing the records they loaded hold users_lock
+int users_dump(users_t *storage, const char* filepath) {
+        // write a temporary file, the old one stays intact on failure
+        const char *tmppath = NULL;
+        FILE *file = NULL;
+        int err = 0;
+        txn_t *txn = txn_new();
+        if (txn == NULL) {
+                return ERR_USERS_OPEN;
+        }
+        if (txn_add(txn, filepath, &tmppath) != 0) {
+                err = errno == EACCES ? ERR_USERS_ACCES : ERR_USERS_OPEN;
+                goto USERS_DUMP_RET;
+        }
+        file = fopen(tmppath, "w");
         if (file == NULL) {
-                switch (errno) {
-                        ERRORS_CASE(EACCES, ERR_USERS_ACCES);
-                        ERRORS_DEFAULT(ERR_USERS_OPEN);
-                }
+                err = errno == EACCES ? ERR_USERS_ACCES : ERR_USERS_OPEN;
+                goto USERS_DUMP_RET;
+        }
+
+        err = users_write(storage, file);
+        if (err != 0) {
+                goto USERS_DUMP_RET;
+        }
+        int ferr = fclose(file);
+        file = NULL;
+        if (ferr != 0) {
+                err = ERR_USERS_WRITE;
+                goto USERS_DUMP_RET;
+        }
+        if (txn_commit(txn) != 0) {
+                err = ERR_USERS_WRITE;
         }
 
+USERS_DUMP_RET:
+        if (file != NULL) {
+                fclose(file);
+        }
+        txn_free(txn);
+        return err;
+}
+
+int users_write(users_t *storage, FILE *out) {
         for (size_t i = 0; i < storage->ulen; i++) {
-                user_t *user = &storage->users[i];
-                int err = user_print_line(file, user);
+                if (storage->users[i]._removed) {
+                        continue;
+                }
+                int err = user_print_line(out, &storage->users[i]);
                 if (err != 0) {
                         return err;
                 }
         }
-        fclose(file);
         return 0;
 }
 
 int users_update(users_t *storage,
                  const char *username,
                  const pin_hash_t pin_hash) {
-        int err = 0;
+        kdf_params_t kdf;
+        kdf_default(&kdf);
+        return users_set(storage, username, &kdf, pin_hash);
+}
 
-        user_t *user = NULL;
-        for (size_t i = 0; i < storage->ulen; i++) {
-                if (strcmp(storage->users[i].username, username) == 0) {
-                        user = &storage->users[i];
-                        break;
-                }
+int users_set(users_t *storage,
+              const char *username,
+              const kdf_params_t *kdf,
+              const pin_hash_t pin_hash) {
+        uint32_t pos;
+        if (hashmap_get(storage->index, username, &pos)) {
+                memcpy((void*)storage->users[pos].pin_hash, pin_hash, PIN_HASH_LEN);
+                storage->users[pos].kdf = *kdf;
+                storage->users[pos].mid_version = 0;
+                return 0;
         }
-        if (user == NULL) {
-                err = users_add(storage, username, pin_hash, false);
-        } else {
-                memcpy((void*)user->pin_hash, pin_hash, PIN_HASH_LEN);
+
+        // the storage owns its usernames, caller's string may not outlive it
+        char *name = alloc_strdup(storage->alloc, username);
+        if (name == NULL) {
+                return -1;
         }
+        int err = users_add(storage, name, kdf, pin_hash, true);
         if (err != 0) {
+                alloc_free(storage->alloc, name);
                 return err;
         }
         return 0;
@@ -196,28 +627,27 @@ int users_update(users_t *storage,
 
 int users_remove(users_t *storage,
                 const char *username) {
-        int pos = -1;
-        for (size_t i = 0; i < storage->ulen; i++) {
-                if (strcmp(storage->users[i].username, username) == 0) {
-                        pos = i;
-                        break;
-                }
-        }
-        if (pos == -1) {
+        uint32_t pos;
+        if (!hashmap_get(storage->index, username, &pos)) {
                 return ERR_USERS_USER_NOT_FOUND;
         }
-        if (storage->users[pos]._allocated) {
-                free((void*)storage->users[pos].username);
+        hashmap_remove(storage->index, username);
+        // the slot stays until enough of them are compacted at once, the
+        // sorted view stays valid and scans skip it
+        storage->users[pos]._removed = true;
+        storage->dead++;
+        // later records of the name would come back on the next load
+        for (size_t i = pos + 1; storage->dups > 0 && i < storage->ulen; i++) {
+                user_t *user = &storage->users[i];
+                if (!user->_removed && strcmp(user->username, username) == 0) {
+                        user->_removed = true;
+                        storage->dead++;
+                        storage->dups--;
+                }
         }
-        for (size_t i = pos; i < storage->ulen - 1; i++) {
-                storage->users[i].username = storage->users[i + 1].username;
-                memcpy((void*)storage->users[i].pin_hash,
-                       storage->users[i + 1].pin_hash,
-                       PIN_HASH_LEN);
-                storage->users[i]._allocated = storage->users[i + 1]._allocated;
+        if (storage->dead >= COMPACT_MIN && storage->dead * COMPACT_RATIO > storage->ulen) {
+                users_compact(storage);
         }
-        memset(&storage->users[storage->ulen - 1], 0, sizeof(user_t));
-        storage->ulen--;
         return 0;
 }
 
@@ -227,7 +657,10 @@ user_t* user_new() {
                 return NULL;
         }
         user->username = NULL;
+        kdf_default(&user->kdf);
+        user->mid_version = 0;
         user->_allocated = false;
+        user->_removed = false;
         return user;
 }
 
@@ -238,45 +671,121 @@ void user_free(user_t *user) {
         free(user);
 }
 
+// the records are read through the storage, a resize of the array while
+// iterating does not leave the iterator behind
 struct user_iterator {
-        const user_t *users;
-        size_t len;
+        const users_t *storage;
         size_t pos;
 };
 
 user_iterator_t* users_iterate(users_t *storage) {
         user_iterator_t *iter = malloc(sizeof(user_iterator_t));
-        iter->users = storage->users;
-        iter->len = storage->ulen;
+        if (iter == NULL) {
+                return NULL;
+        }
+        iter->storage = storage;
         iter->pos = 0;
         return iter;
 }
 
+void users_iterator_free(user_iterator_t *iter) {
+        free(iter);
+}
+
 bool users_iterator_next(user_iterator_t *iter, user_t *out) {
-        if (iter->pos >= iter->len) {
+        const users_t *storage = iter->storage;
+        while (iter->pos < storage->ulen && storage->users[iter->pos]._removed) {
+                iter->pos++;
+        }
+        if (iter->pos >= storage->ulen) {
                 return false;
         }
-        // reuse username allocated field, realloc username if needed, copy pin hash via memcpy
-        const user_t *src = &iter->users[iter->pos];
-        if (!out->_allocated) {
-                out->username = malloc(strlen(src->username) + 1);
-                if (out->username == NULL) {
+        // reuse username allocated field, grow it if needed, copy pin hash via memcpy
+        const user_t *src = &storage->users[iter->pos];
+        const size_t srclen = strlen(src->username);
+        if (!out->_allocated || strlen(out->username) < srclen) {
+                char *name = out->_allocated ?
+                        realloc((void*)out->username, srclen + 1) : malloc(srclen + 1);
+                if (name == NULL) {
                         return false;
                 }
+                out->username = name;
                 out->_allocated = true;
         }
-        if (strlen(src->username) + 1 > strlen(out->username)) {
-                out->username = realloc((void*)out->username, strlen(src->username) + 1);
-                if (out->username == NULL) {
-                        return false;
-                }
-        }
-        strcpy((char*)out->username, src->username);
+        memcpy((void*)out->username, src->username, srclen + 1);
         memcpy((void*)out->pin_hash, src->pin_hash, PIN_HASH_LEN);
+        out->kdf = src->kdf;
+        out->mid = src->mid;
+        out->mid_version = src->mid_version;
         iter->pos++;
         return true;
 }
 
+// first position of the sorted view not less than (or greater than) the name
+static size_t users_bound(users_t *storage, const char *name, bool after) {
+        size_t lo = 0, hi = storage->slen;
+        while (lo < hi) {
+                const size_t mid = lo + (hi - lo) / 2;
+                const int cmp = strcmp(storage->users[storage->sorted[mid]].username, name);
+                if (cmp < 0 || (after && cmp == 0)) {
+                        lo = mid + 1;
+                } else {
+                        hi = mid;
+                }
+        }
+        return lo;
+}
+
+int users_scan_range(users_t *storage, const char *after, const char *before,
+                     users_visit_fn visit, void *ctx) {
+        int err = users_sort(storage);
+        if (err != 0) {
+                return err;
+        }
+        for (size_t i = after != NULL ? users_bound(storage, after, true) : 0;
+                        i < storage->slen; i++) {
+                user_t *user = &storage->users[storage->sorted[i]];
+                if (before != NULL && strcmp(user->username, before) >= 0) {
+                        break;
+                }
+                if (user->_removed) {
+                        continue;
+                }
+                err = visit(ctx, user);
+                if (err != 0) {
+                        return err;
+                }
+        }
+        return 0;
+}
+
+int users_scan_prefix(users_t *storage, const char *prefix, const char *after,
+                      users_visit_fn visit, void *ctx) {
+        int err = users_sort(storage);
+        if (err != 0) {
+                return err;
+        }
+        const size_t plen = strlen(prefix);
+        size_t i = users_bound(storage, prefix, false);
+        if (after != NULL && strcmp(after, prefix) >= 0) {
+                i = users_bound(storage, after, true);
+        }
+        for (; i < storage->slen; i++) {
+                user_t *user = &storage->users[storage->sorted[i]];
+                if (strncmp(user->username, prefix, plen) != 0) {
+                        break;
+                }
+                if (user->_removed) {
+                        continue;
+                }
+                err = visit(ctx, user);
+                if (err != 0) {
+                        return err;
+                }
+        }
+        return 0;
+}
+
 int user_print(FILE *out, user_t *user, user_print_fmt format) {
         int err = 0;
         if (format & USER_PRINT_USERNAME) {
@@ -310,10 +819,96 @@ const char* user_get_name(user_t *user) {
         return name;
 }
 
+void user_get_pin_hash(user_t *user, pin_hash_t out) {
+        memcpy(out, user->pin_hash, PIN_HASH_LEN);
+}
+
+void user_get_kdf(user_t *user, kdf_params_t *out) {
+        *out = user->kdf;
+}
+
+int user_set(user_t *user, const char *username,
+             const kdf_params_t *kdf, const pin_hash_t pin_hash) {
+        char *name = strdup(username);
+        if (name == NULL) {
+                return -1;
+        }
+        if (user->_allocated) {
+                free((void*)user->username);
+        }
+        user->username = name;
+        user->_allocated = true;
+        memcpy((void*)user->pin_hash, pin_hash, PIN_HASH_LEN);
+        user->kdf = *kdf;
+        user->mid_version = 0;
+        return 0;
+}
+
 bool user_check_pin(user_t *user, pin_hash_t pin_hash) {
         return memcmp(user->pin_hash, pin_hash, PIN_HASH_LEN) == 0;
 }
 
+int user_verify_pin(user_t *user, const pin_source_t pin, bool *valid) {
+        pin_hash_t pin_hash;
+        int err = 0;
+        trace_begin("hash_pin");
+        if (user->kdf.alg == KDF_SHA256_PEPPER) {
+                // absorb pepper and salt once, then one compression per PIN
+                const uint32_t version = kdf_pepper_version();
+                if (user->mid_version != version || version == 0) {
+                        err = kdf_midstate(&user->kdf, &user->mid);
+                        if (err == 0) {
+                                user->mid_version = version;
+                        }
+                }
+                if (err == 0) {
+                        hash_pin_midstate(&user->mid, pin, pin_hash);
+                }
+        } else {
+                err = kdf_hash(&user->kdf, pin, pin_hash);
+        }
+        trace_end("hash_pin");
+        if (err != 0) {
+                return err;
+        }
+        *valid = CRYPTO_memcmp(user->pin_hash, pin_hash, PIN_HASH_LEN) == 0;
+        memset(pin_hash, 0, PIN_HASH_LEN);
+        return 0;
+}
+
+int users_verify_pin(users_t *storage, const char *username,
+                     const pin_source_t pin, bool *valid) {
+        uint32_t pos;
+        if (!hashmap_get(storage->index, username, &pos)) {
+                return ERR_USERS_USER_NOT_FOUND;
+        }
+        return user_verify_pin(&storage->users[pos], pin, valid);
+}
+
+users_t* users_clone(users_t *storage) {
+        users_t *copy = users_new_alloc(storage->ulen - storage->dead, storage->alloc);
+        if (copy == NULL) {
+                return NULL;
+        }
+        for (size_t i = 0; i < storage->ulen; i++) {
+                const user_t *user = &storage->users[i];
+                if (user->_removed) {
+                        continue;
+                }
+                char *name = alloc_strdup(copy->alloc, user->username);
+                if (name == NULL || users_add(copy, name, &user->kdf, user->pin_hash, true) != 0) {
+                        alloc_free(copy->alloc, name);
+                        users_free(copy);
+                        return NULL;
+                }
+        }
+        return copy;
+}
+
+int users_freeze(users_t *storage) {
+        return users_sort(storage);
+}
+
 void users_list_free(user_t *users, const size_t len) {
         for (size_t i = 0; i < len; i++) {
                 if (!users[i]._allocated) {
@@ -325,23 +920,36 @@ void users_list_free(user_t *users, const size_t len) {
 }
 
 void users_free(users_t *storage) {
+        if (storage == NULL) {
+                return;
+        }
+        const alloc_t *alloc = storage->alloc;
         if (storage->users != NULL) {
                 for (size_t i = 0; i < storage->ulen; i++) {
                         if (!storage->users[i]._allocated) {
                                 continue;
                         }
-                        free((void*)(storage->users[i].username));
+                        alloc_free(alloc, (void*)(storage->users[i].username));
                 }
-                free(storage->users);
+                alloc_free(alloc, storage->users);
                 storage->users = NULL;
         }
         storage->ulen = 0;
         storage->ucap = 0;
-        free(storage);
+        storage->dead = 0;
+        storage->dups = 0;
+        alloc_free(alloc, storage->sorted);
+        for (size_t i = 0; i < storage->alen; i++) {
+                alloc_free(alloc, storage->arenas[i]);
+        }
+        alloc_free(alloc, storage->arenas);
+        hashmap_free(storage->index);
+        alloc_free(alloc, storage);
 }
 
 static int users_add(users_t *storage,
                 const char *username,
+                const kdf_params_t *kdf,
                 const pin_hash_t pin,
                 const bool allocated) {
         int err = 0;
@@ -351,20 +959,109 @@ static int users_add(users_t *storage,
                 return err;
         }
 
+        // the first record wins for duplicated usernames
+        if (hashmap_get(storage->index, username, NULL)) {
+                storage->dups++;
+        } else {
+                err = hashmap_put(storage->index, username, storage->ulen);
+                if (err != 0) {
+                        return err;
+                }
+        }
+
+        alloc_free(storage->alloc, storage->sorted);
+        storage->sorted = NULL;
+
         user_t *user = &storage->users[storage->ulen];
         user->username = username;
         memcpy((void*)user->pin_hash, pin, PIN_HASH_LEN);
+        user->kdf = *kdf;
+        user->mid_version = 0;
         user->_allocated = allocated;
+        user->_removed = false;
         storage->ulen++;
         return 0;
 }
 
+static int users_name_cmp(const void *a, const void *b, void *arg) {
+        const user_t *users = arg;
+        return strcmp(users[*(const uint32_t*)a].username, users[*(const uint32_t*)b].username);
+}
+
+// build the sorted view, duplicated usernames keep the record of the index
+static int users_sort(users_t *storage) {
+        if (storage->sorted != NULL) {
+                return 0;
+        }
+        storage->sorted = alloc_malloc(storage->alloc, (storage->ulen + 1) * sizeof(uint32_t));
+        if (storage->sorted == NULL) {
+                return -1;
+        }
+        storage->slen = 0;
+        for (size_t i = 0; i < storage->ulen; i++) {
+                uint32_t pos;
+                if (!storage->users[i]._removed &&
+                                hashmap_get(storage->index, storage->users[i].username, &pos) &&
+                                pos == i) {
+                        storage->sorted[storage->slen++] = i;
+                }
+        }
+        qsort_r(storage->sorted, storage->slen, sizeof(uint32_t), users_name_cmp, storage->users);
+        return 0;
+}
+
+// drop the tombstones keeping the order of the records
+static void users_compact(users_t *storage) {
+        size_t len = 0;
+        for (size_t i = 0; i < storage->ulen; i++) {
+                user_t *user = &storage->users[i];
+                if (user->_removed) {
+                        if (user->_allocated) {
+                                alloc_free(storage->alloc, (void*)user->username);
+                        }
+                        continue;
+                }
+                if (len != i) {
+                        memcpy(&storage->users[len], user, sizeof(user_t));
+                        // re-point the moved record, an existing key never allocates
+                        uint32_t at;
+                        if (hashmap_get(storage->index, user->username, &at) && at == i) {
+                                hashmap_put(storage->index, user->username, len);
+                        }
+                }
+                len++;
+        }
+        storage->ulen = len;
+        storage->dead = 0;
+        alloc_free(storage->alloc, storage->sorted);
+        storage->sorted = NULL;
+}
+
+// drop every record, the array keeps its capacity
+static void users_clear(users_t *storage) {
+        for (size_t i = 0; i < storage->ulen; i++) {
+                if (storage->users[i]._allocated) {
+                        alloc_free(storage->alloc, (void*)storage->users[i].username);
+                }
+        }
+        for (size_t i = 0; i < storage->alen; i++) {
+                alloc_free(storage->alloc, storage->arenas[i]);
+        }
+        storage->alen = 0;
+        storage->ulen = 0;
+        storage->dead = 0;
+        storage->dups = 0;
+        hashmap_clear(storage->index);
+        alloc_free(storage->alloc, storage->sorted);
+        storage->sorted = NULL;
+}
+
 static int users_resize(users_t *storage) {
         if (storage->ulen + 1 <= storage->ucap) {
                 return 0;
         }
         const size_t newcap = storage->ucap == 0 ? 1 : storage->ucap * 2;
-        user_t *new_users = realloc(storage->users, newcap * sizeof(user_t));
+        user_t *new_users = alloc_realloc(storage->alloc, storage->users, newcap * sizeof(user_t));
         if (new_users == NULL) {
                 return -1;
         }
@@ -373,14 +1070,17 @@ static int users_resize(users_t *storage) {
         return 0;
 }
 
-static int users_scan_line(FILE *file, char **username, pin_hash_t pin_hash) {
+// the line goes into the getline buffer of the caller, the username is
+// allocated from alloc
+static int users_scan_line(FILE *file, char **lineptr, size_t *len,
+                           const alloc_t *alloc, char **username,
+                           kdf_params_t *kdf, pin_hash_t pin_hash) {
         // line format
-        // <username:string>:<pin_hash:binary>\n
+        // <username:string>:[<kdf prefix>]<pin_hash:binary>\n
         int err = 0;
 
-        char *line = NULL;
-        size_t len = 0;
-        ssize_t read = getline(&line, &len, file);
+        ssize_t read = getline(lineptr, len, file);
+        char *line = *lineptr;
         if (read == -1) {
                 if (feof(file)) {
                         err = ERR_READ_EOF;
@@ -395,25 +1095,33 @@ static int users_scan_line(FILE *file, char **username, pin_hash_t pin_hash) {
                 goto USERS_SCAN_LINE_ERR;
         }
         *colon = '\0';
-        *username = strdup(line);
+        const char *hash = NULL;
+        if (kdf_parse(colon + 1, kdf, &hash) != 0 ||
+                        line + read - hash < PIN_HASH_LEN) {
+                err = ERR_USERS_INVALID_FORMAT;
+                goto USERS_SCAN_LINE_ERR;
+        }
+        *username = alloc_strdup(alloc, line);
         if (*username == NULL) {
                 err = -1;
                 goto USERS_SCAN_LINE_ERR;
         }
-        memcpy(pin_hash, colon + 1, PIN_HASH_LEN);
+        memcpy(pin_hash, hash, PIN_HASH_LEN);
 
 USERS_SCAN_LINE_ERR:
-        free(line);
-        if (err != 0 && *username != NULL) {
-                free(*username);
-        }
         return err;
 }
 
 static int user_print_line(FILE *file, const user_t *user) {
-        fprintf(file, "%s:", user->username);
-        fwrite(user->pin_hash, 1, PIN_HASH_LEN, file);
-        fprintf(file, "\n");
+        char prefix[KDF_PREFIX_MAX];
+        if (kdf_format(&user->kdf, prefix, sizeof(prefix)) != 0) {
+                return ERR_USERS_WRITE;
+        }
+        if (fprintf(file, "%s:%s", user->username, prefix) < 0 ||
+                        fwrite(user->pin_hash, 1, PIN_HASH_LEN, file) != PIN_HASH_LEN ||
+                        fprintf(file, "\n") < 0) {
+                return ERR_USERS_WRITE;
+        }
         return 0;
 }
 
@@ -421,14 +1129,15 @@ static int user_copy(user_t *dst, const user_t *src) {
         const size_t srclen = strlen(src->username);
         if (dst->_allocated) {
                 const size_t dstlen = dst->username != NULL ?
-                        strlen(dst->username) + 1 : 0;
-                if (srclen > dstlen) {
-                        dst->username = realloc((void*)dst->username, srclen);
-                        if (dst->username == NULL) {
+                        strlen(dst->username) : 0;
+                if (dst->username == NULL || srclen > dstlen) {
+                        char *name = realloc((void*)dst->username, srclen + 1);
+                        if (name == NULL) {
                                 return -1;
                         }
+                        dst->username = name;
                 }
-                memcpy((void*)dst->username, src->username, srclen);
+                memcpy((void*)dst->username, src->username, srclen + 1);
         } else {
                 dst->username = strdup(src->username);
                 if (dst->username == NULL) {
@@ -437,6 +1146,8 @@ static int user_copy(user_t *dst, const user_t *src) {
                 dst->_allocated = true;
         }
         memcpy((void*)dst->pin_hash, src->pin_hash, PIN_HASH_LEN);
+        dst->kdf = src->kdf;
+        dst->mid = src->mid;
+        dst->mid_version = src->mid_version;
         return 0;
 }
-
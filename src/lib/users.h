@@ -7,6 +7,8 @@
 #define _USERS_H
 
 #include "types.h"
+#include "kdf.h"
+#include "alloc.h"
 
 #include <stdint.h>
 #include <stdio.h>
@@ -29,26 +31,61 @@ typedef enum {
 
         ERR_USERS_INVALID_FORMAT,
         ERR_USERS_USER_NOT_FOUND,
+
+        ERR_USERS_LOCK,
+        ERR_USERS_BUSY,
 } users_error_t;
 
 users_t* users_new(const int cap);
 
+// the storage, its records and their usernames from alloc, NULL - alloc_libc.
+users_t* users_new_alloc(const int cap, const alloc_t *alloc);
+
 // load users from file storage.
 int users_load(users_t *storage, const char* filepath);
 
+// load users with `threads` workers over chunks of the mapped file, 0 - one
+// per online CPU for large files. The result matches users_load.
+int users_load_threads(users_t *storage, const char* filepath, int threads);
+
+// replace the file atomically, it is intact on error.
 int users_dump(users_t *storage, const char* filepath);
 
+// write the records in the users file format.
+int users_write(users_t *storage, FILE *out);
+
+// exclusive flock on "<filepath>.lock", held by writers of the users file
+// from loading the records they change until the file is replaced. wait -
+// false fails with ERR_USERS_BUSY while another writer holds it.
+int users_lock(const char *filepath, bool wait, int *fd);
+
+// release the lock of users_lock, -1 does nothing.
+void users_unlock(int fd);
+
 int users_find(users_t *storage,
                const char *username,
                user_t *user);
 
+// add or update user with a legacy SHA-256 pin hash
 int users_update(users_t *storage,
                  const char *username,
                  const pin_hash_t pin_hash);
 
+// add or update user with a pin hash made by kdf
+int users_set(users_t *storage,
+              const char *username,
+              const kdf_params_t *kdf,
+              const pin_hash_t pin_hash);
+
+// remove every record of the user, duplicated ones included
 int users_remove(users_t *storage,
                  const char *username);
 
+// verify the pin against the stored user, keeps the per user
+// sha256-pepper midstate between calls.
+int users_verify_pin(users_t *storage, const char *username,
+                     const pin_source_t pin, bool *valid);
+
 user_t* user_new();
 void user_free(user_t *user);
 
@@ -59,6 +96,28 @@ user_iterator_t* users_iterate(users_t *storage);
 
 bool users_iterator_next(user_iterator_t *iter, user_t *out);
 
+void users_iterator_free(user_iterator_t *iter);
+
+// non-zero stops the scan and is returned by it. The user points into
+// the storage, it is valid until the storage changes.
+typedef int (*users_visit_fn)(void *ctx, user_t *user);
+
+// users with after < name < before in name order, NULL - no bound.
+int users_scan_range(users_t *storage, const char *after, const char *before,
+                     users_visit_fn visit, void *ctx);
+
+// users whose name starts with prefix and is greater than after (NULL - no
+// bound) in name order.
+int users_scan_prefix(users_t *storage, const char *prefix, const char *after,
+                      users_visit_fn visit, void *ctx);
+
+// a copy of the live records, duplicated usernames included.
+users_t* users_clone(users_t *storage);
+
+// build the lookup structures now: until the next change, finds, scans and
+// iterators only read the storage and may run concurrently.
+int users_freeze(users_t *storage);
+
 void users_free(users_t *storage);
 
 typedef enum {
@@ -70,6 +129,17 @@ int user_print(FILE *out, user_t *user, user_print_fmt format);
 
 bool user_check_pin(user_t *user, pin_hash_t pin_hash);
 
+// hash the pin with the user's algorithm and compare with the stored hash,
+// sha256-pepper records cache the prefix midstate in the user.
+int user_verify_pin(user_t *user, const pin_source_t pin, bool *valid);
+
 const char* user_get_name(user_t *user);
 
+void user_get_pin_hash(user_t *user, pin_hash_t out);
+
+void user_get_kdf(user_t *user, kdf_params_t *out);
+
+int user_set(user_t *user, const char *username,
+             const kdf_params_t *kdf, const pin_hash_t pin_hash);
+
 #endif
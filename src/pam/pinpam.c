@@ -6,7 +6,14 @@
 #include "../lib/types.h"
 #include "../lib/users.h"
 #include "../lib/state.h"
-#include "../lib/crypt.h"
+#include "../lib/backend.h"
+#include "../lib/auth.h"
+#include "../lib/snapshot.h"
+#include "../lib/groups.h"
+#include "../lib/tstamp.h"
+#include "../lib/kdf.h"
+#include "../lib/audit.h"
+#include "../lib/trace.h"
 #include "../lib/utils.h"
 #include "../config.h"
 
@@ -19,22 +26,64 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <time.h>
 
 #define pamerr(h, m, e) do { \
         pam_syslog(h, LOG_ERR, "%s: %s", m, e); \
         pam_error(h, "%s", m); \
 } while (0)
 
-const int storage_capacity = 10;
-
-const int pin_retry_attempts = 3;
-
 static bool checkerr_users(pam_handle_t *pamh, int err, const char *msg);
-static bool checkerr_hash(pam_handle_t *pamh, int err, const char *msg);
+static bool checkerr_kdf(pam_handle_t *pamh, int err, const char *msg);
 static bool checkerr_state(pam_handle_t *pamh, int err, const char *msg);
+static bool checkerr_auth(pam_handle_t *pamh, pinpam_auth_t *auth, int err);
 
 static int read_pin_pam(pam_handle_t *pamh, const char *prompt, pin_source_t out);
 
+// group membership is cached this many seconds unless group_ttl=<seconds>
+#define GROUP_TTL_DEFAULT 300
+
+struct options {
+        const char      *store;         // users store uri, see backend.h
+        unsigned int    group_ttl;      // 0 - ask NSS every time
+        unsigned int    timestamp;      // 0 - prompt every time
+};
+
+static int authenticate(pam_handle_t *pamh, const char *username, const struct options *options);
+
+// authentication in progress, it is recorded in the audit log
+struct session {
+        pam_handle_t    *pamh;
+        const char      *store;         // users store uri, see backend.h
+        unsigned int    group_ttl;
+        // the @group record of a user without one, empty - own record
+        char            group[GROUPS_USER_MAX + 1];
+        audit_event_t   event;
+};
+
+// users store of one lookup, the snapshot when it is available
+struct lookup {
+        struct session  *session;
+        snapshot_t      *snap;
+        backend_t       *store;
+        user_t          *user;
+        int             err;
+};
+
+static uint64_t now_us(void);
+static bool check_timestamp(struct session *session, const char *username,
+                            const tstamp_key_t *key, unsigned int timeout);
+static void audit_session(struct session *session);
+static int store_error(backend_t *store, int err);
+
+// pinpam_auth_io_t hooks, ctx is the session
+static int find_user(void *ctx, const char *username, user_t *user);
+static int load_attempts(void *ctx, const char *username, uint8_t *attempts);
+static int update_attempts(void *ctx, const char *username, bool valid,
+                           uint8_t *attempts);
+static int rehash_user(void *ctx, const char *username, user_t *user,
+                       const pin_source_t pin);
+
 /* Define the entry point for the 'authenticate' function */
 PAM_EXTERN int pam_sm_authenticate(pam_handle_t *pamh, int flags, int argc, const char **argv) {
         const char *username;
@@ -47,97 +96,130 @@ PAM_EXTERN int pam_sm_authenticate(pam_handle_t *pamh, int flags, int argc, cons
                 pam_syslog(pamh, LOG_ERR, "Failed to get pam user");
                 return pam_code;
         }
-        pam_syslog(pamh, LOG_INFO, "User '%s' is trying to authenticate", username);
-       
-        int err = 0;
-        users_t *storage = users_new(storage_capacity);
-        pam_syslog(pamh, LOG_INFO, "Loading users file %s", srcfile);
-        err = users_load(storage, srcfile);
-        if (!checkerr_users(pamh, err, "Failed to load users file")) {
-                users_free(storage);
-                return PAM_AUTH_ERR;
+
+        // trace=<path> writes a Chrome trace of this authentication to <path>.<pid>,
+        // store=<scheme>:<path> reads the users from another store,
+        // group_ttl=<seconds> caches the groups of users for @group records,
+        // timestamp=<seconds> skips the prompt after a recent verification
+        // in the same session
+        const char *tracepath = NULL;
+        struct options options = {
+                .store = srcfile,
+                .group_ttl = GROUP_TTL_DEFAULT,
+        };
+        for (int i = 0; i < argc; i++) {
+                if (strncmp(argv[i], "trace=", 6) == 0) {
+                        tracepath = argv[i] + 6;
+                } else if (strncmp(argv[i], "store=", 6) == 0) {
+                        options.store = argv[i] + 6;
+                } else if (strncmp(argv[i], "group_ttl=", 10) == 0) {
+                        options.group_ttl = strtoul(argv[i] + 10, NULL, 10);
+                } else if (strncmp(argv[i], "timestamp=", 10) == 0) {
+                        options.timestamp = strtoul(argv[i] + 10, NULL, 10);
+                } else {
+                        pam_syslog(pamh, LOG_WARNING, "Unknown option %s", argv[i]);
+                }
         }
-        user_t *user = user_new();
-        pam_syslog(pamh, LOG_INFO, "Searching for user %s", username);
-        err = users_find(storage, username, user);
-        if (!checkerr_users(pamh, err, "User not found")) {
-                users_free(storage);
-                user_free(user);
-                return PAM_AUTH_ERR;
+        if (tracepath != NULL) {
+                int err = trace_start(tracepath);
+                if (err != 0) {
+                        pam_syslog(pamh, LOG_WARNING, "Failed to start trace: %d", err);
+                }
         }
 
-        state_t *state = state_new();
-        pam_syslog(pamh, LOG_INFO, "Loading state file %s", varfile);
-        err = state_load(state, varfile);
-        if (!checkerr_state(pamh, err, "Failed to load state file")) {
-                users_free(storage);
-                user_free(user);
-                state_free(state);
-                return PAM_AUTH_ERR;
+        trace_begin("pam_sm_authenticate");
+        pam_code = authenticate(pamh, username, &options);
+        trace_end("pam_sm_authenticate");
+
+        int err = trace_flush();
+        if (err != 0) {
+                pam_syslog(pamh, LOG_WARNING, "Failed to write trace %s: %d", tracepath, err);
+        }
+        return pam_code;
+}
+
+static int authenticate(pam_handle_t *pamh, const char *username, const struct options *options) {
+        struct session session;
+        memset(&session, 0, sizeof(struct session));
+        session.pamh = pamh;
+        session.store = options->store;
+        session.group_ttl = options->group_ttl;
+        session.event.uid = getuid();
+        session.event.pid = getpid();
+        strncpy(session.event.user, username, AUDIT_USER_LEN);
+
+        tstamp_key_t key;
+        if (options->timestamp > 0) {
+                const void *tty = NULL;
+                pam_get_item(pamh, PAM_TTY, &tty);
+                tstamp_key(&key, tty);
+                if (check_timestamp(&session, username, &key, options->timestamp)) {
+                        return PAM_SUCCESS;
+                }
+        }
+
+        int err = kdf_pepper_load(pepperfile);
+        if (err != 0) {
+                // only sha256-pepper records depend on it
+                pam_syslog(pamh, LOG_WARNING, "Failed to load pepper file %s: %d", pepperfile, err);
         }
-        uint8_t attempts;
-        state_get_attempts(state, username, &attempts);
-        if (attempts >= pin_retry_attempts) {
-                pam_syslog(pamh, LOG_INFO, "Too many attempts. Skip PIN auth");
-                users_free(storage);
-                user_free(user);
-                state_free(state);
+        const pinpam_auth_io_t io = {
+                .ctx = &session,
+                .find_user = find_user,
+                .load_attempts = load_attempts,
+                .update_attempts = update_attempts,
+                .verified = rehash_user,
+        };
+        pinpam_auth_t *auth = NULL;
+        pinpam_auth_status_t status = PINPAM_AUTH_PENDING;
+        uint64_t start = now_us();
+        err = pinpam_auth_begin(&auth, username, &io, &status);
+        session.event.lookup_us = now_us() - start;
+        if (!checkerr_auth(pamh, auth, err)) {
+                session.event.result = err == ERR_AUTH_USER &&
+                        pinpam_auth_cause(auth) == ERR_USERS_USER_NOT_FOUND ?
+                        AUDIT_RESULT_NO_USER : AUDIT_RESULT_ERROR;
+                audit_session(&session);
+                pinpam_auth_finish(auth);
                 return PAM_AUTH_ERR;
         }
 
-        bool pin_valid = false;
-        while (attempts < pin_retry_attempts) {
+        while (status == PINPAM_AUTH_NEED_PIN || status == PINPAM_AUTH_RETRY) {
                 pin_source_t pinsrc;
-                pam_syslog(pamh, LOG_INFO, "Reading PIN for user %s", username);
+                start = now_us();
+                trace_begin("prompt");
                 err = read_pin_pam(pamh, "Enter PIN", pinsrc);
-                if (err != 0) {
-                        memset(pinsrc, 0, PIN_SOURCE_LEN);
-                        attempts++;
-                        pam_syslog(pamh, LOG_INFO, "Invalid PIN; too short");
-                        pam_error(pamh, "Invalid PIN; Retry (%d/%d)",
-                                        attempts, pin_retry_attempts);
-                        state_set_attempts(state, username, attempts);
-                        continue;
-                }
-                pam_syslog(pamh, LOG_INFO, "PIN read successfully");
+                trace_end("prompt");
+                session.event.prompt_us += now_us() - start;
 
-                pin_hash_t pinhash;
-                err = hash_pin(pinsrc, pinhash);
+                start = now_us();
+                const uint32_t saved_us = session.event.save_us;
+                err = pinpam_auth_submit(auth, err == 0 ? pinsrc : NULL, &status);
+                session.event.verify_us += now_us() - start -
+                        (session.event.save_us - saved_us);
                 // fill the pinsrc with garbage
                 memset(pinsrc, 0, PIN_SOURCE_LEN);
-                if (!checkerr_hash(pamh, err, "Unknown error, check system logs")) {
-                        // return PAM_AUTH_ERR;
-                        attempts++;
-                        pam_syslog(pamh, LOG_INFO, "Invalid PIN");
-                        pam_error(pamh, "Invalid PIN; Retry (%d/%d)",
-                                        attempts, pin_retry_attempts);
-                        state_set_attempts(state, username, attempts);
-                        continue;
-                }
-
-
-                bool valid = user_check_pin(user, pinhash);
-                if (valid) {
-                        pin_valid = true;
-                        pam_syslog(pamh, LOG_INFO, "PIN verified successfully");
-                        state_set_attempts(state, username, 0);
-                        break;
-                } else {
-                        attempts++;
-                        pam_syslog(pamh, LOG_INFO, "Invalid PIN");
+                // the outcome stands even if it could not be saved
+                checkerr_auth(pamh, auth, err);
+                if (status == PINPAM_AUTH_RETRY || status == PINPAM_AUTH_LOCKED) {
                         pam_error(pamh, "Invalid PIN; Retry (%d/%d)",
-                                        attempts, pin_retry_attempts);
-                        state_set_attempts(state, username, attempts);
-                        continue;
+                                  pinpam_auth_attempts(auth), PINPAM_AUTH_MAX_ATTEMPTS);
                 }
         }
 
-        err = state_save(state, varfile);
-        checkerr_state(pamh, err, "Failed to save state file");
-        state_free(state);
-        user_free(user);
-        users_free(storage);
-        if (pin_valid) {
+        session.event.attempts = pinpam_auth_attempts(auth);
+        session.event.result = status == PINPAM_AUTH_OK ? AUDIT_RESULT_OK :
+                status == PINPAM_AUTH_LOCKED ? AUDIT_RESULT_LOCKED : AUDIT_RESULT_ERROR;
+        audit_session(&session);
+        pinpam_auth_finish(auth);
+        if (status == PINPAM_AUTH_OK) {
+                if (options->timestamp > 0) {
+                        err = tstamp_update(tsdir, username, &key);
+                        if (err != 0 && err != ERR_TSTAMP_NAME) {
+                                pam_syslog(pamh, LOG_WARNING, "Failed to update timestamp of user %s: %d",
+                                           username, err);
+                        }
+                }
                 return PAM_SUCCESS;
         } else {
                 return PAM_AUTH_ERR;
@@ -149,6 +231,304 @@ PAM_EXTERN int pam_sm_setcred(pam_handle_t *pamh, int flags, int argc, const cha
     return PAM_SUCCESS;
 }
 
+/*
+ * Look the user up in the shared snapshot of the default users file, it
+ * is rebuilt by one of the concurrent callers when the file changes.
+ * Other stores, or the default one when the snapshot is not available,
+ * are asked through the backend.
+ */
+static int lookup_open(struct lookup *lookup) {
+        struct session *session = lookup->session;
+        int err = 0;
+        if (strcmp(session->store, srcfile) == 0) {
+                trace_begin("snapshot_open");
+                err = snapshot_open(&lookup->snap, srcfile, snapfile);
+                trace_end("snapshot_open");
+                if (err == 0) {
+                        return 0;
+                }
+                pam_syslog(session->pamh, LOG_WARNING, "Snapshot %s is not available: %d",
+                           snapfile, err);
+        }
+
+        pam_syslog(session->pamh, LOG_INFO, "Loading users store %s", session->store);
+        err = backend_open(&lookup->store, session->store, varfile);
+        return store_error(lookup->store, err);
+}
+
+static int lookup_find(struct lookup *lookup, const char *name) {
+        if (lookup->snap != NULL) {
+                trace_begin("snapshot_find");
+                int err = snapshot_find(lookup->snap, name, lookup->user);
+                trace_end("snapshot_find");
+                return err;
+        }
+        return store_error(lookup->store, backend_lookup(lookup->store, name, lookup->user));
+}
+
+static void lookup_close(struct lookup *lookup) {
+        snapshot_close(lookup->snap);
+        backend_close(lookup->store);
+}
+
+// visits the groups of the user until one has a record
+static int find_group_record(void *ctx, const char *group) {
+        struct lookup *lookup = ctx;
+        char name[sizeof(lookup->session->group)];
+        if (snprintf(name, sizeof(name), "@%s", group) >= (int)sizeof(name)) {
+                return 0;
+        }
+        lookup->err = lookup_find(lookup, name);
+        if (lookup->err == ERR_USERS_USER_NOT_FOUND) {
+                return 0;
+        }
+        if (lookup->err == 0) {
+                memcpy(lookup->session->group, name, sizeof(name));
+        }
+        return 1;
+}
+
+/*
+ * A user without a record takes the one of its first group with an
+ * @group record, the groups come from NSS through the shared cache.
+ */
+static int find_group_user(struct lookup *lookup, const char *username) {
+        struct session *session = lookup->session;
+        groups_cache_t *cache = NULL;
+        int err = groups_cache_open(&cache, groupsfile, session->group_ttl, NULL);
+        if (err != 0) {
+                pam_syslog(session->pamh, LOG_WARNING, "Group cache %s is not available: %d",
+                           groupsfile, err);
+                err = groups_cache_open(&cache, NULL, 0, NULL);
+        }
+        if (err != 0) {
+                return err;
+        }
+        lookup->err = ERR_USERS_USER_NOT_FOUND;
+        trace_begin("groups_visit");
+        err = groups_visit(cache, username, find_group_record, lookup);
+        trace_end("groups_visit");
+        groups_cache_close(cache);
+        if (err == 1) {
+                err = lookup->err;
+        } else if (err != 0) {
+                pam_syslog(session->pamh, LOG_WARNING, "Failed to get groups of user %s: %d",
+                           username, err);
+                err = ERR_USERS_USER_NOT_FOUND;
+        } else {
+                err = ERR_USERS_USER_NOT_FOUND;
+        }
+        if (err == 0) {
+                pam_syslog(session->pamh, LOG_INFO, "User %s authenticates with the PIN of %s",
+                           username, session->group);
+        }
+        return err;
+}
+
+static int find_user(void *ctx, const char *username, user_t *user) {
+        // @group records are not users
+        if (username[0] == '@') {
+                return ERR_USERS_USER_NOT_FOUND;
+        }
+        struct lookup lookup = {
+                .session = ctx,
+                .user = user,
+        };
+        int err = lookup_open(&lookup);
+        if (err == 0) {
+                err = lookup_find(&lookup, username);
+        }
+        if (err == ERR_USERS_USER_NOT_FOUND) {
+                err = find_group_user(&lookup, username);
+        }
+        lookup_close(&lookup);
+        return err;
+}
+
+/*
+ * The attempts are read by a fresh store each time: another login may
+ * have changed them while the PIN was prompted. The count is updated
+ * under the lock of the state file, between reading and writing it no
+ * other login can change it.
+ */
+static int load_attempts(void *ctx, const char *username, uint8_t *attempts) {
+        struct session *session = ctx;
+        backend_t *store = NULL;
+        int err = backend_open(&store, session->store, varfile);
+        if (err == 0) {
+                err = backend_get_attempts(store, username, attempts);
+        }
+        err = store_error(store, err);
+        backend_close(store);
+        return err;
+}
+
+static int update_attempts(void *ctx, const char *username, bool valid,
+                           uint8_t *attempts) {
+        struct session *session = ctx;
+        const uint64_t start = now_us();
+        backend_t *store = NULL;
+        uint8_t stored = 0;
+        int lockfd = -1;
+        int err = state_lock(varfile, &lockfd);
+        if (err == 0) {
+                err = backend_open(&store, session->store, varfile);
+        }
+        if (err == 0) {
+                err = backend_get_attempts(store, username, &stored);
+        }
+        if (err != 0) {
+                goto UPDATE_ATTEMPTS_RET;
+        }
+        // a locked user stays locked until ppedit resets the count
+        *attempts = stored;
+        if (stored < PINPAM_AUTH_MAX_ATTEMPTS) {
+                *attempts = valid ? 0 : stored + 1;
+        }
+        if (*attempts != stored) {
+                err = backend_set_attempts(store, username, *attempts);
+                if (err == 0) {
+                        err = backend_commit(store, 0);
+                }
+        }
+
+UPDATE_ATTEMPTS_RET:
+        err = store_error(store, err);
+        backend_close(store);
+        state_unlock(lockfd);
+        session->event.save_us += now_us() - start;
+        return err;
+}
+
+/*
+ * Migrate the record to the configured KDF after a successful login,
+ * the PIN is known only here. Failures are logged and do not affect
+ * the authentication result. The module runs the session to the end in
+ * the calling thread, so this never asks to be resumed.
+ */
+static int rehash_user(void *ctx, const char *username, user_t *user,
+                       const pin_source_t pin) {
+        struct session *session = ctx;
+        pam_handle_t *pamh = session->pamh;
+        kdf_params_t current, target;
+        user_get_kdf(user, &current);
+        // without a config there is nothing to migrate to
+        int err = kdf_config_read(kdffile, &target);
+        if (err == ERR_KDF_CONFIG_MISSING) {
+                return 0;
+        }
+        if (err != 0) {
+                pam_syslog(pamh, LOG_WARNING, "Failed to load kdf config %s: %d", kdffile, err);
+                return 0;
+        }
+        if (!kdf_cost_differs(&current, &target)) {
+                return 0;
+        }
+
+        pin_hash_t pin_hash;
+        backend_t *store = NULL;
+        err = kdf_salt(&target);
+        if (err == 0) {
+                err = kdf_hash(&target, pin, pin_hash);
+        }
+        if (err != 0) {
+                goto REHASH_USER_RET;
+        }
+        // the PIN of a group member is the one of the @group record
+        if (session->group[0] != '\0') {
+                username = session->group;
+        }
+        err = backend_open(&store, session->store, varfile);
+        if (err == 0) {
+                // never wait for ppedit in a login, the next one rehashes
+                err = backend_lock(store, false);
+        }
+        if (err == 0) {
+                err = backend_upsert(store, username, &target, pin_hash);
+        }
+        memset(pin_hash, 0, PIN_HASH_LEN);
+        if (err == 0) {
+                err = backend_commit(store, BACKEND_COMMIT_LOCAL);
+        }
+
+REHASH_USER_RET:
+        if (err == ERR_BACKEND_BUSY) {
+                pam_syslog(pamh, LOG_INFO, "Users store busy, PIN of user %s not rehashed",
+                           username);
+        } else if (err != 0) {
+                pam_syslog(pamh, LOG_WARNING, "Failed to rehash PIN of user %s: %d", username, err);
+        } else {
+                pam_syslog(pamh, LOG_INFO, "PIN of user %s rehashed with %s",
+                           username, kdf_name(target.alg));
+        }
+        backend_close(store);
+        return 0;
+}
+
+/*
+ * Report store errors by the users and state modules codes, the auth
+ * result and the messages depend on them.
+ */
+static int store_error(backend_t *store, int err) {
+        if (err == ERR_BACKEND_NOT_FOUND) {
+                return ERR_USERS_USER_NOT_FOUND;
+        }
+        if (err != 0 && store != NULL && backend_cause(store) != 0) {
+                return backend_cause(store);
+        }
+        return err;
+}
+
+static uint64_t now_us(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * A fresh timestamp of the session stands for the PIN, the users store is
+ * not read. A timestamp that can not be read is logged and ignored.
+ */
+static bool check_timestamp(struct session *session, const char *username,
+                            const tstamp_key_t *key, unsigned int timeout) {
+        bool fresh = false;
+        const uint64_t start = now_us();
+        trace_begin("tstamp_check");
+        int err = tstamp_check(tsdir, username, key, timeout, &fresh);
+        trace_end("tstamp_check");
+        session->event.lookup_us = now_us() - start;
+        if (err != 0 && err != ERR_TSTAMP_NAME) {
+                pam_syslog(session->pamh, LOG_WARNING, "Failed to check timestamp of user %s: %d",
+                           username, err);
+        }
+        if (fresh) {
+                session->event.result = AUDIT_RESULT_TIMESTAMP;
+                audit_session(session);
+        }
+        return fresh;
+}
+
+/*
+ * Successful and failed authentications go to the audit log, syslog is
+ * kept for errors and for the case when the log is not available.
+ */
+static void audit_session(struct session *session) {
+        audit_t *log = NULL;
+        int err = audit_open(&log, auditfile, true);
+        if (err == 0) {
+                err = audit_append(log, &session->event);
+                audit_close(log);
+        }
+        if (err != 0) {
+                pam_syslog(session->pamh, LOG_INFO, "User %s authentication: %s, attempts %d",
+                           session->event.user,
+                           audit_result_name(session->event.result),
+                           session->event.attempts);
+                pam_syslog(session->pamh, LOG_WARNING, "Audit log %s is not available: %d",
+                           auditfile, err);
+        }
+}
+
 static int read_pin_pam(pam_handle_t *pamh, const char *prompt, pin_source_t out) {
         int ret = 0;
         int pam_code;
@@ -206,24 +586,27 @@ static bool checkerr_users(pam_handle_t *pamh, int err, const char *msg) {
                 case ERR_USERS_USER_NOT_FOUND:
                         pamerr(pamh, msg, "User not found");
                         break;
+                default:
+                        pamerr(pamh, msg, "Unknown error");
+                        break;
         }
         return false;
 }
 
-static bool checkerr_hash(pam_handle_t *pamh, int err, const char *msg) {
+static bool checkerr_kdf(pam_handle_t *pamh, int err, const char *msg) {
         if (err == 0) return true;
         switch (err) {
-                case HASH_ERR_CTX:
-                        pamerr(pamh, msg, "Could not create context");
+                case ERR_KDF_PARAMS:
+                        pamerr(pamh, msg, "Invalid hash parameters");
                         break;
-                case HASH_ERR_DIGEST_INIT:
-                        pamerr(pamh, msg, "Could not initialize digest");
+                case ERR_KDF_HASH:
+                        pamerr(pamh, msg, "Could not hash PIN");
                         break;
-                case HASH_ERR_DIGEST_UPDATE:
-                        pamerr(pamh, msg, "Could not update digest");
+                case ERR_KDF_PEPPER:
+                        pamerr(pamh, msg, "Invalid or missing pepper");
                         break;
-                case HASH_ERR_DIGEST_FINAL:
-                        pamerr(pamh, msg, "Could not finalize digest");
+                default:
+                        pamerr(pamh, msg, "Unknown error");
                         break;
         }
         return false;
@@ -250,7 +633,32 @@ static bool checkerr_state(pam_handle_t *pamh, int err, const char *msg) {
                 case ERR_STATE_WRITE:
                         pamerr(pamh, msg, "Could not write file");
                         break;
+                default:
+                        pamerr(pamh, msg, "Unknown error");
+                        break;
         }
         return false;
 }
 
+static bool checkerr_auth(pam_handle_t *pamh, pinpam_auth_t *auth, int err) {
+        if (err == 0) return true;
+        const int cause = auth != NULL ? pinpam_auth_cause(auth) : 0;
+        switch (err) {
+                case ERR_AUTH_USER:
+                        checkerr_users(pamh, cause, "User not found");
+                        break;
+                case ERR_AUTH_STATE_LOAD:
+                        checkerr_state(pamh, cause, "Failed to load state file");
+                        break;
+                case ERR_AUTH_STATE_SAVE:
+                        checkerr_state(pamh, cause, "Failed to save state file");
+                        break;
+                case ERR_AUTH_HASH:
+                        checkerr_kdf(pamh, cause, "Unknown error, check system logs");
+                        break;
+                default:
+                        pamerr(pamh, "Unknown error, check system logs", "Authentication failed");
+                        break;
+        }
+        return false;
+}
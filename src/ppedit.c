@@ -4,25 +4,53 @@
  */
 
 #include "./lib/users.h"
+#include "./lib/backend.h"
 #include "./lib/types.h"
 #include "./lib/crypt.h"
+#include "./lib/kdf.h"
 #include "./lib/state.h"
+#include "./lib/bulk.h"
+#include "./lib/auth.h"
+#include "./lib/audit.h"
+#include "./lib/trace.h"
+#include "./lib/fsck.h"
+#include "./lib/prune.h"
+#include "./lib/delta.h"
+#include "./lib/merge.h"
+#include "./lib/status.h"
+#include "./lib/tstamp.h"
+#include "./lib/txn.h"
 #include "./config.h"
 
+#include <errno.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <termios.h>
 #include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
 
 
 static void usage(const char *name) __attribute__((noreturn));
 
 static void panic(const char *msg, const char *err) __attribute__((noreturn));
-static void checkerr(int err, const char *msg);
-static void checkerr_hash(int err, const char *msg);
-static void checkerr_state(int err, const char *msg);
+static void checkerr_backend(int err, const char *msg);
+static void checkerr_commit(backend_t *store, int err, const char *msg);
+static void checkerr_bulk(int err, const char *msg, size_t line);
+static void checkerr_kdf(int err, const char *msg);
+static void checkerr_auth(pinpam_auth_t *auth, int err);
+static void checkerr_audit(int err, const char *msg);
+static void checkerr_fsck(int err, const char *msg);
+static void checkerr_prune(int err, const char *msg);
+static void checkerr_delta(int err, const char *msg);
+static void checkerr_merge(int err, const char *msg);
+static void checkerr_status(int err, const char *msg);
+
+static void trace_exit(void);
+static const char* store_uri(void);
 
 typedef enum {
         ACTION_NONE = 0,
@@ -31,6 +59,18 @@ typedef enum {
         ACTION_REMOVE,
         ACTIONS_CHECK,
         ACTION_RESET,
+        ACTION_IMPORT,
+        ACTION_EXPORT,
+        ACTION_BATCH,
+        ACTION_CALIBRATE,
+        ACTION_AUDIT,
+        ACTION_FSCK,
+        ACTION_PRUNE,
+        ACTION_DELTA,
+        ACTION_APPLY,
+        ACTION_DIFF,
+        ACTION_MERGE,
+        ACTION_STATUS,
         ACTION_HELP,
         ACTION_VERSION,
 } action_t;
@@ -39,6 +79,14 @@ typedef struct cli_args {
         const char *cmd;
         action_t action;
         union {
+                struct {
+                        const char *prefix;
+                        const char *after;
+                        size_t limit;           // 0 - all
+                        bool locked;
+                        bool machine;           // format is set
+                        bulk_format_t format;
+                } list;
                 struct {
                         char *user;
                         bool update;
@@ -54,11 +102,76 @@ typedef struct cli_args {
                 struct {
                         char *user;
                 } reset;
+                struct {
+                        bulk_format_t format;
+                        int fd;
+                        bool update;
+                } import;
+                struct {
+                        bulk_format_t format;
+                        int fd;
+                } export;
+                struct {
+                        kdf_alg_t alg;
+                        unsigned int target_ms;
+                        bool save;
+                } calibrate;
+                struct {
+                        const char *user;
+                        audit_result_t result;  // 0 - any
+                        bool follow;
+                } audit;
+                struct {
+                        bool repair;
+                        int threads;            // 0 - one per CPU
+                } fsck;
+                struct {
+                        const char *passwd;     // NULL - NSS
+                        bool dry_run;
+                } prune;
+                struct {
+                        bool init;
+                        bool export;            // --from is set
+                        uint64_t from;
+                        uint64_t to;            // UINT64_MAX - current
+                        int fd;
+                } delta;
+                struct {
+                        const char *paths[3];   // diff: a b, merge: base a b
+                        const char *output;     // merge: NULL - stdout
+                        size_t mem;             // 0 - default
+                } merge;
+                struct {
+                        const char *prefix;
+                        bool locked;
+                        bool failed;            // attempts > 0
+                        bool machine;           // format is set
+                        bulk_format_t format;
+                } status;
         };
 } cli_args_t;
 
 static int read_pin(pin_source_t pin);
 
+static void parse_list_opts(const char *name, int argc, char **argv, int *i,
+                            cli_args_t *args);
+static void parse_bulk_opts(const char *name, int argc, char **argv, int *i,
+                            bulk_format_t *format, int *fd, bool *update);
+static void parse_calibrate_opts(const char *name, int argc, char **argv, int *i,
+                                 cli_args_t *args);
+static void parse_audit_opts(const char *name, int argc, char **argv, int *i,
+                             cli_args_t *args);
+static void parse_fsck_opts(const char *name, int argc, char **argv, int *i,
+                            cli_args_t *args);
+static void parse_prune_opts(const char *name, int argc, char **argv, int *i,
+                             cli_args_t *args);
+static void parse_delta_opts(const char *name, int argc, char **argv, int *i,
+                             cli_args_t *args);
+static void parse_merge_opts(const char *name, int argc, char **argv, int *i,
+                             cli_args_t *args);
+static void parse_status_opts(const char *name, int argc, char **argv, int *i,
+                              cli_args_t *args);
+
 static void parse_args(cli_args_t *args, int argc, char **argv) {
         if (argc < 2) {
                 fprintf(stderr, "Error: command not specified\n");
@@ -77,6 +190,8 @@ static void parse_args(cli_args_t *args, int argc, char **argv) {
                         break;
                 } else if (strcmp(argv[i], "list") == 0) {
                         args->action = ACTION_LIST;
+                        i++;
+                        parse_list_opts(argv[0], argc, argv, &i, args);
                         break;
                 } else if (strcmp(argv[i], "add") == 0) {
                         args->action = ACTION_ADD;
@@ -128,6 +243,66 @@ static void parse_args(cli_args_t *args, int argc, char **argv) {
                         i++;
                         args->reset.user = argv[i];
                         break;
+                } else if (strcmp(argv[i], "import") == 0) {
+                        args->action = ACTION_IMPORT;
+                        i++;
+                        parse_bulk_opts(argv[0], argc, argv, &i, &args->import.format,
+                                        &args->import.fd, &args->import.update);
+                        break;
+                } else if (strcmp(argv[i], "export") == 0) {
+                        args->action = ACTION_EXPORT;
+                        i++;
+                        parse_bulk_opts(argv[0], argc, argv, &i, &args->export.format,
+                                        &args->export.fd, NULL);
+                        break;
+                } else if (strcmp(argv[i], "batch") == 0) {
+                        args->action = ACTION_BATCH;
+                        break;
+                } else if (strcmp(argv[i], "calibrate") == 0) {
+                        args->action = ACTION_CALIBRATE;
+                        i++;
+                        parse_calibrate_opts(argv[0], argc, argv, &i, args);
+                        break;
+                } else if (strcmp(argv[i], "audit") == 0) {
+                        args->action = ACTION_AUDIT;
+                        i++;
+                        parse_audit_opts(argv[0], argc, argv, &i, args);
+                        break;
+                } else if (strcmp(argv[i], "fsck") == 0) {
+                        args->action = ACTION_FSCK;
+                        i++;
+                        parse_fsck_opts(argv[0], argc, argv, &i, args);
+                        break;
+                } else if (strcmp(argv[i], "prune") == 0) {
+                        args->action = ACTION_PRUNE;
+                        i++;
+                        parse_prune_opts(argv[0], argc, argv, &i, args);
+                        break;
+                } else if (strcmp(argv[i], "delta") == 0) {
+                        args->action = ACTION_DELTA;
+                        i++;
+                        parse_delta_opts(argv[0], argc, argv, &i, args);
+                        break;
+                } else if (strcmp(argv[i], "apply") == 0) {
+                        args->action = ACTION_APPLY;
+                        i++;
+                        parse_delta_opts(argv[0], argc, argv, &i, args);
+                        break;
+                } else if (strcmp(argv[i], "diff") == 0) {
+                        args->action = ACTION_DIFF;
+                        i++;
+                        parse_merge_opts(argv[0], argc, argv, &i, args);
+                        break;
+                } else if (strcmp(argv[i], "merge") == 0) {
+                        args->action = ACTION_MERGE;
+                        i++;
+                        parse_merge_opts(argv[0], argc, argv, &i, args);
+                        break;
+                } else if (strcmp(argv[i], "status") == 0) {
+                        args->action = ACTION_STATUS;
+                        i++;
+                        parse_status_opts(argv[0], argc, argv, &i, args);
+                        break;
                 } else {
                         fprintf(stderr, "Error: unknown command: %s\n", argv[i]);
                         usage(argv[0]);
@@ -164,21 +339,41 @@ static void parse_args(cli_args_t *args, int argc, char **argv) {
                                 usage(argv[0]);
                         }
                         break;
+                case ACTION_CALIBRATE:
+                        if (args->calibrate.target_ms == 0) {
+                                fprintf(stderr, "Error: target latency not specified\n");
+                                usage(argv[0]);
+                        }
+                        break;
                 default:
                         break;
         }
 }
 
+static void invalidate_timestamps(cli_args_t *args);
+
 // actions state machine
-typedef void (*action_fn_t)(cli_args_t *args, users_t *storage, bool *modified);
+typedef void (*action_fn_t)(cli_args_t *args, backend_t *store, bool *modified);
 
-static void action_list(cli_args_t *args, users_t *storage, bool *modified);
-static void action_add(cli_args_t *args, users_t *storage, bool *modified);
-static void action_remove(cli_args_t *args, users_t *storage, bool *modified);
-static void action_check(cli_args_t *args, users_t *storage, bool *modified);
-static void action_reset(cli_args_t *args, users_t *storage, bool *modified);
-static void action_help(cli_args_t *args, users_t *storage, bool *modified);
-static void action_version(cli_args_t *args, users_t *storage, bool *modified);
+static void action_list(cli_args_t *args, backend_t *store, bool *modified);
+static void action_add(cli_args_t *args, backend_t *store, bool *modified);
+static void action_remove(cli_args_t *args, backend_t *store, bool *modified);
+static void action_check(cli_args_t *args, backend_t *store, bool *modified);
+static void action_reset(cli_args_t *args, backend_t *store, bool *modified);
+static void action_import(cli_args_t *args, backend_t *store, bool *modified);
+static void action_export(cli_args_t *args, backend_t *store, bool *modified);
+static void action_batch(cli_args_t *args, backend_t *store, bool *modified);
+static void action_calibrate(cli_args_t *args, backend_t *store, bool *modified);
+static void action_audit(cli_args_t *args, backend_t *store, bool *modified);
+static void action_fsck(cli_args_t *args, backend_t *store, bool *modified);
+static void action_prune(cli_args_t *args, backend_t *store, bool *modified);
+static void action_delta(cli_args_t *args, backend_t *store, bool *modified);
+static void action_apply(cli_args_t *args, backend_t *store, bool *modified);
+static void action_diff(cli_args_t *args, backend_t *store, bool *modified);
+static void action_merge(cli_args_t *args, backend_t *store, bool *modified);
+static void action_status(cli_args_t *args, backend_t *store, bool *modified);
+static void action_help(cli_args_t *args, backend_t *store, bool *modified);
+static void action_version(cli_args_t *args, backend_t *store, bool *modified);
 
 static action_fn_t actions[] = {
         [ACTION_LIST] = action_list,
@@ -186,6 +381,18 @@ static action_fn_t actions[] = {
         [ACTION_REMOVE] = action_remove,
         [ACTIONS_CHECK] = action_check,
         [ACTION_RESET] = action_reset,
+        [ACTION_IMPORT] = action_import,
+        [ACTION_EXPORT] = action_export,
+        [ACTION_BATCH] = action_batch,
+        [ACTION_CALIBRATE] = action_calibrate,
+        [ACTION_AUDIT] = action_audit,
+        [ACTION_FSCK] = action_fsck,
+        [ACTION_PRUNE] = action_prune,
+        [ACTION_DELTA] = action_delta,
+        [ACTION_APPLY] = action_apply,
+        [ACTION_DIFF] = action_diff,
+        [ACTION_MERGE] = action_merge,
+        [ACTION_STATUS] = action_status,
         [ACTION_HELP] = action_help,
         [ACTION_VERSION] = action_version,
 };
@@ -193,206 +400,896 @@ static action_fn_t actions[] = {
 /*
  * The program to edit the users file.
  * Usage:
- *   fauth-edit list - print users
+ *   fauth-edit list [--prefix P] [--after U] [--limit N] [--locked] [--format F] - print users
  *   fauth-edit add --update <user> - add or update user, read pin from stdin
  *   fauth-edit remove <user> - remove user
  *   fauth-edit check <user> - check user pin, read pin from stdin
+ *   fauth-edit import [--format csv|jsonl] [--fd N] [--update] - add users in bulk
+ *   fauth-edit export [--format csv|jsonl] [--fd N] - print users with pin hashes
+ *   fauth-edit batch - apply add/remove/reset commands from stdin, all or nothing
+ *   fauth-edit calibrate --target-ms N [--alg A] [--save] - pick PIN hash cost
+ *   fauth-edit audit [--user U] [--result R] [--follow] - print the audit log
+ *   fauth-edit fsck [--repair] [--threads N] - check the users and state files
+ *   fauth-edit prune [--dry-run] [--passwd F] - drop the users of deleted accounts
+ *   fauth-edit delta [--init] [--from G [--to G]] [--fd N] - print the changes between generations
+ *   fauth-edit apply [--fd N] - apply the changes of a delta
+ *   fauth-edit diff [--mem MiB] <a> <b> - print the users changed from file a to b
+ *   fauth-edit merge [--mem MiB] [--output F] <base> <a> <b> - three-way merge of users files
+ *   fauth-edit status [--prefix P] [--locked] [--failed] [--format F] - print attempts of all users
  *   fauth-edit --help - print help
  *   fauth-edit --version - print version
+ *
+ * PINPAM_TRACE=<path> writes a Chrome trace of the run to <path>.<pid> on exit.
+ * PINPAM_STORE=<scheme>:<path> edits another users store, see backend.h.
  */
 int main(int argc, char** argv) {
         cli_args_t args = {0};
         parse_args(&args, argc, argv);
 
+        const char *tracepath = getenv("PINPAM_TRACE");
+        if (tracepath != NULL && tracepath[0] != '\0') {
+                if (trace_start(tracepath) != 0) {
+                        fprintf(stderr, "Warning: failed to start trace\n");
+                } else {
+                        trace_begin("ppedit");
+                        atexit(trace_exit);
+                }
+        }
+
         int err = 0;
-        users_t *storage = users_new(10);
-        bool load_storage = false;
+        backend_t *store = NULL;
+        bool open_store = false;
+        bool lock_store = false;
         switch (args.action) {
-                case ACTION_LIST:
                 case ACTION_ADD:
                 case ACTION_REMOVE:
+                case ACTION_RESET:
+                case ACTION_IMPORT:
+                case ACTION_BATCH:
+                        lock_store = true;
+                        open_store = true;
+                        break;
+                case ACTION_LIST:
                 case ACTIONS_CHECK:
-                        load_storage = true;
+                case ACTION_EXPORT:
+                        open_store = true;
                         break;
                 default:
-                        load_storage = false;
+                        open_store = false;
                         break;
         }
-        if (load_storage) {
-                err = users_load(storage, srcfile);
-                checkerr(err, "Open users file");
+        if (open_store) {
+                err = backend_open(&store, store_uri(), varfile);
+                checkerr_backend(err, "Open users store");
+                if (lock_store) {
+                        err = backend_lock(store, true);
+                        checkerr_backend(err, "Lock users store");
+                }
+                err = kdf_pepper_load(pepperfile);
+                checkerr_kdf(err, "Load pepper file");
         }
 
         bool modified = false;
-        actions[args.action](&args, storage, &modified);
+        actions[args.action](&args, store, &modified);
 
         if (modified) {
-                err = users_dump(storage, srcfile);
-                checkerr(err, "Dump users file");
+                err = backend_commit(store, 0);
+                checkerr_commit(store, err, "Save users store");
+        }
+        // batch commits on its own
+        if (modified || args.action == ACTION_BATCH) {
+                invalidate_timestamps(&args);
         }
 
-        users_free(storage);
+        backend_close(store);
         return 0;
 }
 
+// also runs on panic
+static void trace_exit(void) {
+        trace_end("ppedit");
+        if (trace_flush() != 0) {
+                fprintf(stderr, "Warning: failed to write trace %s\n", getenv("PINPAM_TRACE"));
+        }
+}
+
+/*
+ * A changed PIN or reset attempts must be asked for on the next login,
+ * the timestamps of the changed user are removed. @group records and bulk
+ * changes affect any number of users, all timestamps go.
+ */
+static void invalidate_timestamps(cli_args_t *args) {
+        const char *user = NULL;
+        switch (args->action) {
+                case ACTION_ADD:
+                        user = args->add.user;
+                        break;
+                case ACTION_REMOVE:
+                        user = args->remove.user;
+                        break;
+                case ACTION_RESET:
+                        user = args->reset.user;
+                        break;
+                default:
+                        break;
+        }
+        if (user != NULL && user[0] == '@') {
+                user = NULL;
+        }
+        int err = tstamp_invalidate(tsdir, user);
+        if (err == ERR_TSTAMP_NAME) {
+                // never cached
+                return;
+        }
+        if (err != 0) {
+                fprintf(stderr, "Warning: failed to clear timestamps in %s\n", tsdir);
+        }
+}
+
 static void panic(const char *msg, const char *err) {
         fprintf(stderr, "Panic: %s: %s\n", msg, err);
         exit(1);
 }
 
-static void checkerr_hash(int err, const char *msg) {
+static void checkerr_backend(int err, const char *msg) {
         switch (err) {
-                case HASH_ERR_CTX:
-                        panic(msg, "Could not create hash context");
-                case HASH_ERR_DIGEST_INIT:
-                        panic(msg, "Could not initialize digest");
-                case HASH_ERR_DIGEST_UPDATE:
-                        panic(msg, "Could not update digest");
-                case HASH_ERR_DIGEST_FINAL:
-                        panic(msg, "Could not finalize digest");
+                case ERR_BACKEND_SCHEME:
+                        panic(msg, "Unknown store scheme");
+                case ERR_BACKEND_OPEN:
+                        panic(msg, "Could not open store");
+                case ERR_BACKEND_NOT_FOUND:
+                        panic(msg, "User not found");
+                case ERR_BACKEND_READ:
+                        panic(msg, "Could not read store");
+                case ERR_BACKEND_WRITE:
+                        panic(msg, "Could not update store");
+                case ERR_BACKEND_COMMIT:
+                        panic(msg, "Could not write store");
+                case ERR_BACKEND_LOCK:
+                        panic(msg, "Could not lock store");
+                case ERR_BACKEND_BUSY:
+                        panic(msg, "Store is locked");
                 default:
                         return;
         }
 }
 
-static void checkerr(int err, const char *msg) {
+// a replica refuses changes of its own
+static void checkerr_commit(backend_t *store, int err, const char *msg) {
+        if (err == ERR_BACKEND_COMMIT && backend_cause(store) == ERR_DELTA_REPLICA) {
+                checkerr_delta(ERR_DELTA_REPLICA, msg);
+        }
+        checkerr_backend(err, msg);
+}
+
+static void checkerr_bulk(int err, const char *msg, size_t line) {
+        const char *reason = NULL;
+        switch (err) {
+                case 0:
+                        return;
+                case ERR_BULK_READ:
+                        reason = "Could not read input";
+                        break;
+                case ERR_BULK_WRITE:
+                        reason = "Could not write output";
+                        break;
+                case ERR_BULK_INVALID_FORMAT:
+                        reason = "Invalid record format";
+                        break;
+                case ERR_BULK_INVALID_USER:
+                        reason = "Invalid username";
+                        break;
+                case ERR_BULK_INVALID_PIN:
+                        reason = "Invalid PIN or PIN hash";
+                        break;
+                case ERR_BULK_DUPLICATE:
+                        reason = "Duplicated user";
+                        break;
+                case ERR_BULK_EXISTS:
+                        reason = "User already exists, use --update";
+                        break;
+                case ERR_BULK_HASH:
+                        reason = "Could not hash PIN";
+                        break;
+                case ERR_BULK_THREAD:
+                        reason = "Could not start hashing thread";
+                        break;
+                default:
+                        reason = "Unknown error";
+                        break;
+        }
+        if (line > 0) {
+                fprintf(stderr, "Panic: %s: line %zu: %s\n", msg, line, reason);
+                exit(1);
+        }
+        panic(msg, reason);
+}
+
+static void checkerr_kdf(int err, const char *msg) {
         switch (err) {
-                case ERR_USERS_OPEN:
+                case ERR_KDF_PARAMS:
+                        panic(msg, "Invalid hash parameters");
+                case ERR_KDF_SALT:
+                        panic(msg, "Could not generate salt");
+                case ERR_KDF_HASH:
+                        panic(msg, "Could not hash PIN");
+                case ERR_KDF_CONFIG_OPEN:
                         panic(msg, "Could not open file");
-                case ERR_USERS_ACCES:
-                        panic(msg, "Could not access file");
-                case ERR_USERS_NOT_FOUND:
-                        panic(msg, "File not found");
-                case ERR_USERS_READ:
-                        panic(msg, "Could not read file");
-                case ERR_USERS_WRITE:
+                case ERR_KDF_CONFIG_WRITE:
                         panic(msg, "Could not write file");
-                case ERR_USERS_CLOSE:
-                        panic(msg, "Could not close file");
-                case ERR_USERS_INVALID_FORMAT:
+                case ERR_KDF_PEPPER:
+                        panic(msg, "Invalid or missing pepper");
+                default:
+                        return;
+        }
+}
+
+static void checkerr_auth(pinpam_auth_t *auth, int err) {
+        const int cause = auth != NULL ? pinpam_auth_cause(auth) : 0;
+        switch (err) {
+                case 0:
+                        return;
+                case ERR_AUTH_USER:
+                        checkerr_backend(cause, "Get user");
+                        break;
+                case ERR_AUTH_STATE_LOAD:
+                        checkerr_backend(cause, "Load attempts");
+                        break;
+                case ERR_AUTH_HASH:
+                        checkerr_kdf(cause, "Hash pin");
+                        break;
+        }
+        panic("Check pin", "Authentication failed");
+}
+
+static void checkerr_audit(int err, const char *msg) {
+        switch (err) {
+                case ERR_AUDIT_OPEN:
+                        panic(msg, "Could not open file");
+                case ERR_AUDIT_MAP:
+                        panic(msg, "Could not map file");
+                case ERR_AUDIT_LOCK:
+                        panic(msg, "Could not lock file");
+                case ERR_AUDIT_INVALID:
                         panic(msg, "Invalid file format");
-                case ERR_USERS_USER_NOT_FOUND:
-                        panic(msg, "User not found");
                 default:
                         return;
         }
 }
-static void checkerr_state(int err, const char *msg) {
+
+static void checkerr_fsck(int err, const char *msg) {
         switch (err) {
-                case ERR_STATE_OPEN:
+                case 0:
+                        return;
+                case ERR_FSCK_OPEN:
                         panic(msg, "Could not open file");
-                case ERR_STATE_READ:
+                case ERR_FSCK_MAP:
+                        panic(msg, "Could not map file");
+                case ERR_FSCK_THREAD:
+                        panic(msg, "Could not start checking thread");
+                case ERR_FSCK_WRITE:
+                        panic(msg, "Could not write file");
+                default:
+                        panic(msg, "Unknown error");
+        }
+}
+
+static void checkerr_prune(int err, const char *msg) {
+        switch (err) {
+                case 0:
+                        return;
+                case ERR_PRUNE_OPEN:
+                        panic(msg, "Could not open file");
+                case ERR_PRUNE_MAP:
+                        panic(msg, "Could not map file");
+                case ERR_PRUNE_ACCOUNTS:
+                        panic(msg, "Could not read the accounts");
+                case ERR_PRUNE_WRITE:
+                        panic(msg, "Could not write file");
+                default:
+                        panic(msg, "Unknown error");
+        }
+}
+
+static void checkerr_delta(int err, const char *msg) {
+        switch (err) {
+                case 0:
+                        return;
+                case ERR_DELTA_OPEN:
+                        panic(msg, "Could not open file");
+                case ERR_DELTA_READ:
                         panic(msg, "Could not read file");
-                case ERR_STATE_INVALID_FILE:
-                        panic(msg, "Invalid file format");
-                case ERR_STATE_FILE_NOT_FOUND:
-                        panic(msg, "File not found");
-                case ERR_STATE_FILE_ACCESS:
-                        panic(msg, "Could not access file");
-                case ERR_STATE_WRITE:
+                case ERR_DELTA_WRITE:
                         panic(msg, "Could not write file");
+                case ERR_DELTA_FORMAT:
+                        panic(msg, "Invalid changeset or log format");
+                case ERR_DELTA_CHECKSUM:
+                        panic(msg, "Checksum mismatch");
+                case ERR_DELTA_GENERATION:
+                        panic(msg, "Generation mismatch");
+                case ERR_DELTA_DISABLED:
+                        panic(msg, "Generations are not tracked, run delta --init");
+                case ERR_DELTA_USERS:
+                        panic(msg, "Could not load or update users");
+                case ERR_DELTA_RECORD:
+                        panic(msg, "Invalid PIN hash or hash parameters, run fsck on the source");
+                case ERR_DELTA_SOURCE:
+                        panic(msg, "Changeset of another source host");
+                case ERR_DELTA_REPLICA:
+                        panic(msg, "This host applies changesets, change the users on the source");
                 default:
+                        panic(msg, "Unknown error");
+        }
+}
+
+static void checkerr_merge(int err, const char *msg) {
+        switch (err) {
+                case 0:
                         return;
+                case ERR_MERGE_OPEN:
+                        panic(msg, "Could not open file");
+                case ERR_MERGE_READ:
+                        panic(msg, "Could not read file");
+                case ERR_MERGE_WRITE:
+                        panic(msg, "Could not write file");
+                case ERR_MERGE_LINE:
+                        panic(msg, "Line longer than the sort buffer");
+                default:
+                        panic(msg, "Unknown error");
+        }
+}
+
+static void checkerr_status(int err, const char *msg) {
+        switch (err) {
+                case 0:
+                        return;
+                case ERR_STATUS_USERS:
+                        panic(msg, "Could not load users file");
+                case ERR_STATUS_STATE:
+                        panic(msg, "Could not load state file");
+                default:
+                        panic(msg, "Unknown error");
         }
 }
 
 static void usage(const char *name) {
-        fprintf(stderr, "Usage: %s list\n", name);
+        fprintf(stderr, "Usage: %s list [--prefix <prefix>] [--after <user>] [--limit N] [--locked] [--format text|csv|jsonl]\n", name);
         fprintf(stderr, "       %s add --update <user>\n", name);
         fprintf(stderr, "       %s remove <user>\n", name);
         fprintf(stderr, "       %s check <user>\n", name);
         fprintf(stderr, "       %s --reset <user>\n", name);
+        fprintf(stderr, "       %s import [--format csv|jsonl] [--fd N] [--update]\n", name);
+        fprintf(stderr, "       %s export [--format csv|jsonl] [--fd N]\n", name);
+        fprintf(stderr, "       %s batch < script\n", name);
+        fprintf(stderr, "       %s calibrate --target-ms N [--alg argon2id|scrypt|pbkdf2-sha256] [--save]\n", name);
+        fprintf(stderr, "       %s audit [--user <user>] [--result ok|invalid|locked|no-user|error|timestamp] [--follow]\n", name);
+        fprintf(stderr, "       %s fsck [--repair] [--threads N]\n", name);
+        fprintf(stderr, "       %s prune [--dry-run] [--passwd <file>]\n", name);
+        fprintf(stderr, "       %s delta [--init] [--from <gen> [--to <gen>]] [--fd N]\n", name);
+        fprintf(stderr, "       %s apply [--fd N]\n", name);
+        fprintf(stderr, "       %s diff [--mem <MiB>] <a> <b>\n", name);
+        fprintf(stderr, "       %s merge [--mem <MiB>] [--output <file>] <base> <a> <b>\n", name);
+        fprintf(stderr, "       %s status [--prefix <prefix>] [--locked] [--failed] [--format text|csv|jsonl]\n", name);
         fprintf(stderr, "       %s --help\n", name);
         fprintf(stderr, "       %s --version\n", name);
         exit(1);
 }
 
-static void action_list(cli_args_t *args, users_t *storage, bool *modified) {
-        printf("Users:\n");
-        user_t *user = user_new();
-        user_iterator_t *iter = users_iterate(storage);
-        while (users_iterator_next(iter, user)) {
+// returned by list_user past the limit, not a backend error
+#define LIST_MORE 0x100
+
+struct list {
+        const cli_args_t        *args;
+        backend_t               *store;
+        size_t                  listed;
+        const char              *last;          // cursor of the next page
+};
+
+static int list_user(void *ctx, user_t *user) {
+        struct list *list = ctx;
+        const cli_args_t *args = list->args;
+        const char *name = user_get_name(user);
+        if (name == NULL) {
+                return ERR_BACKEND_READ;
+        }
+        uint8_t attempts = 0;
+        if (args->list.locked || args->list.machine) {
+                int err = backend_get_attempts(list->store, name, &attempts);
+                if (err != 0) {
+                        free((void*)name);
+                        return err;
+                }
+        }
+        if (args->list.locked && attempts < PINPAM_AUTH_MAX_ATTEMPTS) {
+                free((void*)name);
+                return 0;
+        }
+        if (args->list.limit > 0 && list->listed == args->list.limit) {
+                free((void*)name);
+                return LIST_MORE;
+        }
+
+        if (!args->list.machine) {
                 printf(" * ");
-                user_print(stdout, user,
-                           USER_PRINT_USERNAME | USER_PRINT_PINHASH);
+                user_print(stdout, user, USER_PRINT_USERNAME | USER_PRINT_PINHASH);
                 printf("\n");
+        } else {
+                kdf_params_t kdf;
+                user_get_kdf(user, &kdf);
+                if (args->list.format == BULK_FORMAT_CSV) {
+                        printf("%s,%s,%d\n", name, kdf_name(kdf.alg), attempts);
+                } else {
+                        printf("{\"user\":");
+                        bulk_json_string(stdout, name);
+                        printf(",\"kdf\":\"%s\",\"attempts\":%d}\n", kdf_name(kdf.alg), attempts);
+                }
         }
-        user_free(user);
+        free((void*)list->last);
+        list->last = name;
+        list->listed++;
+        return 0;
 }
 
-static void action_add(cli_args_t *args, users_t *storage, bool *modified) {
+static void action_list(cli_args_t *args, backend_t *store, bool *modified) {
+        struct list list = { .args = args, .store = store };
+        if (!args->list.machine) {
+                printf("Users:\n");
+        }
+        int err = backend_scan(store, args->list.prefix, args->list.after, list_user, &list);
+        if (err == LIST_MORE) {
+                // the next page starts after the last listed user
+                if (!args->list.machine) {
+                        fprintf(stderr, "More users, continue with --after %s\n", list.last);
+                } else if (args->list.format == BULK_FORMAT_CSV) {
+                        printf("# next,%s\n", list.last);
+                } else {
+                        printf("{\"next\":");
+                        bulk_json_string(stdout, list.last);
+                        printf("}\n");
+                }
+                err = 0;
+        }
+        free((void*)list.last);
+        checkerr_backend(err, "List users");
+}
+
+static void action_add(cli_args_t *args, backend_t *store, bool *modified) {
         int err = 0;
+        kdf_params_t kdf;
+        err = kdf_config_load(kdffile, &kdf);
+        checkerr_kdf(err, "Load kdf config");
+        err = kdf_salt(&kdf);
+        checkerr_kdf(err, "Hash pin");
         pin_hash_t pin_hash;
-        err = hash_pin(args->add.pin, pin_hash);
-        checkerr_hash(err, "Hash pin");
+        err = kdf_hash(&kdf, args->add.pin, pin_hash);
+        checkerr_kdf(err, "Hash pin");
 
-        err = users_update(storage, args->add.user, pin_hash);
-        checkerr(err, "Add user");
+        err = backend_upsert(store, args->add.user, &kdf, pin_hash);
+        checkerr_backend(err, "Add user");
         *modified = true;
         printf("User %s added\n", args->add.user);
 }
 
-static void action_remove(cli_args_t *args, users_t *storage, bool *modified) {
-        int err = users_remove(storage, args->remove.user);
-        checkerr(err, "Remove user");
+static void action_remove(cli_args_t *args, backend_t *store, bool *modified) {
+        int err = backend_remove(store, args->remove.user);
+        checkerr_backend(err, "Remove user");
         *modified = true;
         printf("User %s removed\n", args->remove.user);
 }
 
-static void action_check(cli_args_t *args, users_t *storage, bool *modified) {
-        user_t *user = user_new();
-        int err = users_find(storage, args->check.user, user);
-        checkerr(err, "Get user");
+// what the check session of ppedit saw
+struct check {
+        backend_t       *store;
+        uint8_t         attempts;
+};
+
+static int check_load_attempts(void *ctx, const char *username, uint8_t *attempts) {
+        struct check *check = ctx;
+        int err = backend_get_attempts(check->store, username, &check->attempts);
+        // the PIN of a locked user is checked too
+        *attempts = 0;
+        return err;
+}
 
-        pin_hash_t pin_hash;
-        err = hash_pin(args->check.pin, pin_hash);
-        checkerr_hash(err, "Hash pin");
+static int check_find_user(void *ctx, const char *username, user_t *user) {
+        return backend_lookup(((struct check*)ctx)->store, username, user);
+}
 
-        bool valid = user_check_pin(user, pin_hash);
-        if (!valid) {
+static void action_check(cli_args_t *args, backend_t *store, bool *modified) {
+        // dry run: attempts are reported, but not counted
+        struct check check = {
+                .store = store,
+        };
+        const pinpam_auth_io_t io = {
+                .ctx = &check,
+                .find_user = check_find_user,
+                .load_attempts = check_load_attempts,
+        };
+        pinpam_auth_t *auth = NULL;
+        pinpam_auth_status_t status;
+        int err = pinpam_auth_begin(&auth, args->check.user, &io, &status);
+        checkerr_auth(auth, err);
+        err = pinpam_auth_submit(auth, args->check.pin, &status);
+        checkerr_auth(auth, err);
+        pinpam_auth_finish(auth);
+        if (status != PINPAM_AUTH_OK) {
                 fprintf(stderr, "Invalid pin\n");
-        } else {
-                printf("Valid pin\n");
-        }
-        user_free(user);
-        if (!valid) {
                 exit(1);
         }
-
-        state_t *state = state_new();
-        err = state_load(state, varfile);
-        checkerr_state(err, "Load state file");
-        uint8_t attempts;
-        state_get_attempts(state, args->check.user, &attempts);
-        fprintf(stderr, "Attempts: %d", attempts);
-        if (attempts >= 3) {
+        printf("Valid pin\n");
+        fprintf(stderr, "Attempts: %d", check.attempts);
+        if (check.attempts >= PINPAM_AUTH_MAX_ATTEMPTS) {
                 fprintf(stderr, " (user %s is locked)", args->check.user);
         }
         fprintf(stderr, "\n");
-        state_free(state);
 }
 
-static void action_reset(cli_args_t *args, users_t *storage, bool *modified) {
-        int err = 0;
-        state_t *state = state_new();
-        err = state_load(state, varfile);
-        checkerr_state(err, "Load state file");
-        state_set_attempts(state, args->reset.user, 0);
-        err = state_save(state, varfile);
-        checkerr_state(err, "Save state file");
-        state_free(state);
+static void action_reset(cli_args_t *args, backend_t *store, bool *modified) {
+        int err = backend_set_attempts(store, args->reset.user, 0);
+        checkerr_backend(err, "Reset attempts");
+        *modified = true;
         printf("User %s hase been reset\n", args->reset.user);
 }
 
-static void action_help(cli_args_t *args, users_t *storage, bool *modified) {
+static void action_import(cli_args_t *args, backend_t *store, bool *modified) {
+        FILE *in = args->import.fd == STDIN_FILENO ?
+                stdin : fdopen(args->import.fd, "r");
+        if (in == NULL) {
+                panic("Import users", "Could not open input descriptor");
+        }
+        bulk_t *bulk = bulk_new();
+        if (bulk == NULL) {
+                panic("Import users", "Out of memory");
+        }
+        kdf_params_t kdf;
+        int err = kdf_config_load(kdffile, &kdf);
+        checkerr_kdf(err, "Load kdf config");
+        err = bulk_read(bulk, in, args->import.format);
+        checkerr_bulk(err, "Read users", bulk->err_line);
+        err = bulk_hash(bulk, &kdf, 0);
+        checkerr_bulk(err, "Hash pins", bulk->err_line);
+        err = bulk_apply(bulk, store, args->import.update);
+        checkerr_bulk(err, "Import users", bulk->err_line);
+        if (bulk->len > 0) {
+                *modified = true;
+        }
+        printf("Imported %zu users\n", bulk->len);
+        bulk_free(bulk);
+        if (in != stdin) {
+                fclose(in);
+        }
+}
+
+static void action_export(cli_args_t *args, backend_t *store, bool *modified) {
+        FILE *out = args->export.fd == STDOUT_FILENO ?
+                stdout : fdopen(args->export.fd, "w");
+        if (out == NULL) {
+                panic("Export users", "Could not open output descriptor");
+        }
+        int err = bulk_export(store, out, args->export.format);
+        checkerr_bulk(err, "Export users", 0);
+        if (out != stdout) {
+                fclose(out);
+        }
+}
+
+/*
+ * Execute one batch script line:
+ *   add <user> <pin|pin_hash>
+ *   remove <user>
+ *   reset <user>
+ * Returns NULL on success or the error reason.
+ */
+static const char* batch_exec(char *line, backend_t *store, const kdf_params_t *kdf) {
+        char *save = NULL;
+        const char *cmd = strtok_r(line, " \t\r\n", &save);
+        const char *user = strtok_r(NULL, " \t\r\n", &save);
+        const char *secret = strtok_r(NULL, " \t\r\n", &save);
+        const char *extra = strtok_r(NULL, " \t\r\n", &save);
+        if (user == NULL || extra != NULL) {
+                return "Invalid command syntax";
+        }
+
+        if (strcmp(cmd, "add") == 0) {
+                if (secret == NULL) {
+                        return "PIN not specified";
+                }
+                if (!bulk_valid_username(user)) {
+                        return "Invalid username";
+                }
+                bulk_record_t record;
+                memset(&record, 0, sizeof(bulk_record_t));
+                if (bulk_parse_secret(secret, &record) != 0) {
+                        return "Invalid PIN or PIN hash";
+                }
+                if (!record.hashed) {
+                        record.kdf = *kdf;
+                        int err = kdf_salt(&record.kdf);
+                        if (err == 0) {
+                                err = kdf_hash(&record.kdf, record.pin, record.pin_hash);
+                        }
+                        memset(record.pin, 0, PIN_SOURCE_LEN);
+                        if (err != 0) {
+                                return "Could not hash PIN";
+                        }
+                }
+                if (backend_upsert(store, user, &record.kdf, record.pin_hash) != 0) {
+                        return "Could not add user";
+                }
+                return NULL;
+        }
+        if (secret != NULL) {
+                return "Invalid command syntax";
+        }
+        if (strcmp(cmd, "remove") == 0) {
+                const int err = backend_remove(store, user);
+                if (err == ERR_BACKEND_NOT_FOUND) {
+                        return "User not found";
+                }
+                if (err != 0) {
+                        return "Could not remove user";
+                }
+                return NULL;
+        }
+        if (strcmp(cmd, "reset") == 0) {
+                if (backend_set_attempts(store, user, 0) != 0) {
+                        return "Could not reset attempts";
+                }
+                return NULL;
+        }
+        return "Unknown command";
+}
+
+static void action_batch(cli_args_t *args, backend_t *store, bool *modified) {
+        kdf_params_t kdf;
+        int err = kdf_config_load(kdffile, &kdf);
+        checkerr_kdf(err, "Load kdf config");
+
+        size_t lineno = 0;
+        size_t applied = 0;
+        size_t failed = 0;
+        char *line = NULL;
+        size_t len = 0;
+        while (getline(&line, &len, stdin) != -1) {
+                lineno++;
+                char *start = line + strspn(line, " \t");
+                if (*start == '#' || strspn(start, " \t\r\n") == strlen(start)) {
+                        continue;
+                }
+                char cmd[sizeof("remove")] = {0};
+                sscanf(start, "%6s", cmd);
+                const char *reason = batch_exec(start, store, &kdf);
+                if (reason != NULL) {
+                        printf("line %zu: %s: error: %s\n", lineno, cmd, reason);
+                        failed++;
+                } else {
+                        printf("line %zu: %s: ok\n", lineno, cmd);
+                        applied++;
+                }
+        }
+        free(line);
+        fflush(stdout);
+        if (failed > 0) {
+                fprintf(stderr, "Batch failed: %zu of %zu commands failed, nothing changed\n",
+                        failed, applied + failed);
+                exit(1);
+        }
+
+        // the store replaces users and attempts together
+        err = backend_commit(store, 0);
+        checkerr_commit(store, err, "Commit batch");
+        printf("Batch applied: %zu commands\n", applied);
+}
+
+static void action_calibrate(cli_args_t *args, backend_t *store, bool *modified) {
+        kdf_params_t kdf;
+        double elapsed_ms = 0;
+        int err = kdf_calibrate(args->calibrate.alg, args->calibrate.target_ms,
+                                &kdf, &elapsed_ms);
+        checkerr_kdf(err, "Calibrate");
+        char spec[KDF_PREFIX_MAX];
+        err = kdf_format_spec(&kdf, spec, sizeof(spec));
+        checkerr_kdf(err, "Calibrate");
+        printf("%s %.1fms\n", spec, elapsed_ms);
+        if (elapsed_ms > args->calibrate.target_ms) {
+                fprintf(stderr, "Warning: cheapest parameters exceed %ums\n",
+                        args->calibrate.target_ms);
+        }
+        if (args->calibrate.save) {
+                err = kdf_config_save(kdffile, &kdf);
+                checkerr_kdf(err, "Save kdf config");
+                printf("Saved to %s\n", kdffile);
+        }
+}
+
+static void audit_print(const cli_args_t *args, const audit_event_t *event) {
+        if (args->audit.user != NULL &&
+                        strncmp(args->audit.user, event->user, AUDIT_USER_LEN) != 0) {
+                return;
+        }
+        if (args->audit.result != 0 && args->audit.result != event->result) {
+                return;
+        }
+        const time_t sec = event->time_ns / 1000000000;
+        struct tm tm;
+        char ts[32];
+        gmtime_r(&sec, &tm);
+        strftime(ts, sizeof(ts), "%Y-%m-%dT%H:%M:%S", &tm);
+        printf("%s.%03uZ %s result=%s attempts=%u uid=%u pid=%u "
+               "lookup=%.3fms prompt=%.3fms verify=%.3fms save=%.3fms\n",
+               ts, (unsigned int)(event->time_ns / 1000000 % 1000), event->user,
+               audit_result_name(event->result), event->attempts, event->uid, event->pid,
+               event->lookup_us / 1e3, event->prompt_us / 1e3,
+               event->verify_us / 1e3, event->save_us / 1e3);
+}
+
+static void action_audit(cli_args_t *args, backend_t *store, bool *modified) {
+        audit_t *log = NULL;
+        int err = audit_open(&log, auditfile, false);
+        checkerr_audit(err, "Open audit log");
+
+        // a writer which died mid-record leaves it pending, skip it after a while
+        const int pending_polls = 50;
+        const struct timespec poll = { .tv_sec = 0, .tv_nsec = 100 * 1000 * 1000 };
+        uint64_t seq = audit_tail(log);
+        int waited = 0;
+        for (;;) {
+                if (seq >= audit_head(log)) {
+                        if (!args->audit.follow) {
+                                break;
+                        }
+                        fflush(stdout);
+                        nanosleep(&poll, NULL);
+                        continue;
+                }
+                audit_event_t event;
+                err = audit_read(log, seq, &event);
+                if (err == ERR_AUDIT_PENDING && waited < pending_polls) {
+                        waited++;
+                        nanosleep(&poll, NULL);
+                        continue;
+                }
+                if (err == ERR_AUDIT_OVERWRITTEN) {
+                        // lapped by the writers, continue with the oldest record
+                        fprintf(stderr, "Warning: audit records lost\n");
+                        seq = audit_tail(log);
+                        continue;
+                }
+                if (err == 0) {
+                        audit_print(args, &event);
+                }
+                waited = 0;
+                seq++;
+        }
+        audit_close(log);
+}
+
+static void action_help(cli_args_t *args, backend_t *store, bool *modified) {
         fprintf(stderr, "Help: %s\n", args->cmd);
         usage(args->cmd);
 }
 
-static void action_version(cli_args_t *args, users_t *storage, bool *modified) {
+static void action_version(cli_args_t *args, backend_t *store, bool *modified) {
         printf("Build version: %s\n", BUILD_VERSION);
 }
 
+static void parse_list_opts(const char *name, int argc, char **argv, int *i,
+                            cli_args_t *args) {
+        for (; *i < argc; (*i)++) {
+                if (strcmp(argv[*i], "--prefix") == 0 && *i + 1 < argc) {
+                        (*i)++;
+                        args->list.prefix = argv[*i];
+                } else if (strcmp(argv[*i], "--after") == 0 && *i + 1 < argc) {
+                        (*i)++;
+                        args->list.after = argv[*i];
+                } else if (strcmp(argv[*i], "--limit") == 0 && *i + 1 < argc) {
+                        (*i)++;
+                        char *end = NULL;
+                        args->list.limit = strtoul(argv[*i], &end, 10);
+                        if (*end != '\0' || args->list.limit == 0) {
+                                fprintf(stderr, "Error: invalid limit: %s\n", argv[*i]);
+                                usage(name);
+                        }
+                } else if (strcmp(argv[*i], "--locked") == 0) {
+                        args->list.locked = true;
+                } else if (strcmp(argv[*i], "--format") == 0 && *i + 1 < argc) {
+                        (*i)++;
+                        if (strcmp(argv[*i], "text") == 0) {
+                                args->list.machine = false;
+                        } else if (bulk_parse_format(argv[*i], &args->list.format) == 0) {
+                                args->list.machine = true;
+                        } else {
+                                fprintf(stderr, "Error: unknown format: %s\n", argv[*i]);
+                                usage(name);
+                        }
+                } else {
+                        fprintf(stderr, "Error: unknown option: %s\n", argv[*i]);
+                        usage(name);
+                }
+        }
+}
+
+static void parse_bulk_opts(const char *name, int argc, char **argv, int *i,
+                            bulk_format_t *format, int *fd, bool *update) {
+        *format = BULK_FORMAT_CSV;
+        *fd = update != NULL ? STDIN_FILENO : STDOUT_FILENO;
+        for (; *i < argc; (*i)++) {
+                if (strcmp(argv[*i], "--format") == 0 && *i + 1 < argc) {
+                        (*i)++;
+                        if (bulk_parse_format(argv[*i], format) != 0) {
+                                fprintf(stderr, "Error: unknown format: %s\n", argv[*i]);
+                                usage(name);
+                        }
+                } else if (strcmp(argv[*i], "--fd") == 0 && *i + 1 < argc) {
+                        (*i)++;
+                        char *end = NULL;
+                        long val = strtol(argv[*i], &end, 10);
+                        if (*end != '\0' || val < 0 || val > 1024) {
+                                fprintf(stderr, "Error: invalid descriptor: %s\n", argv[*i]);
+                                usage(name);
+                        }
+                        *fd = (int)val;
+                } else if (update != NULL && strcmp(argv[*i], "--update") == 0) {
+                        *update = true;
+                } else {
+                        fprintf(stderr, "Error: unknown option: %s\n", argv[*i]);
+                        usage(name);
+                }
+        }
+}
+
+static void parse_calibrate_opts(const char *name, int argc, char **argv, int *i,
+                                 cli_args_t *args) {
+        args->calibrate.alg = KDF_ARGON2ID;
+        for (; *i < argc; (*i)++) {
+                if (strcmp(argv[*i], "--target-ms") == 0 && *i + 1 < argc) {
+                        (*i)++;
+                        char *end = NULL;
+                        long val = strtol(argv[*i], &end, 10);
+                        if (*end != '\0' || val <= 0 || val > 60000) {
+                                fprintf(stderr, "Error: invalid target: %s\n", argv[*i]);
+                                usage(name);
+                        }
+                        args->calibrate.target_ms = (unsigned int)val;
+                } else if (strcmp(argv[*i], "--alg") == 0 && *i + 1 < argc) {
+                        (*i)++;
+                        // sha256 variants have no cost to tune
+                        if (kdf_parse_alg(argv[*i], &args->calibrate.alg) != 0 ||
+                                        args->calibrate.alg == KDF_SHA256 ||
+                                        args->calibrate.alg == KDF_SHA256_PEPPER) {
+                                fprintf(stderr, "Error: unknown algorithm: %s\n", argv[*i]);
+                                usage(name);
+                        }
+                } else if (strcmp(argv[*i], "--save") == 0) {
+                        args->calibrate.save = true;
+                } else {
+                        fprintf(stderr, "Error: unknown option: %s\n", argv[*i]);
+                        usage(name);
+                }
+        }
+}
+
+static void parse_audit_opts(const char *name, int argc, char **argv, int *i,
+                             cli_args_t *args) {
+        for (; *i < argc; (*i)++) {
+                if (strcmp(argv[*i], "--user") == 0 && *i + 1 < argc) {
+                        (*i)++;
+                        args->audit.user = argv[*i];
+                } else if (strcmp(argv[*i], "--result") == 0 && *i + 1 < argc) {
+                        (*i)++;
+                        if (audit_parse_result(argv[*i], &args->audit.result) != 0) {
+                                fprintf(stderr, "Error: unknown result: %s\n", argv[*i]);
+                                usage(name);
+                        }
+                } else if (strcmp(argv[*i], "--follow") == 0) {
+                        args->audit.follow = true;
+                } else {
+                        fprintf(stderr, "Error: unknown option: %s\n", argv[*i]);
+                        usage(name);
+                }
+        }
+}
+
 static int read_pin(pin_source_t pin) {
         struct termios oldt, newt;
         tcgetattr(STDIN_FILENO, &oldt);
@@ -423,3 +1320,426 @@ READ_PIN_RET:
         tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
         return err;
 }
+
+static void parse_fsck_opts(const char *name, int argc, char **argv, int *i,
+                            cli_args_t *args) {
+        for (; *i < argc; (*i)++) {
+                if (strcmp(argv[*i], "--repair") == 0) {
+                        args->fsck.repair = true;
+                } else if (strcmp(argv[*i], "--threads") == 0 && *i + 1 < argc) {
+                        (*i)++;
+                        args->fsck.threads = atoi(argv[*i]);
+                        if (args->fsck.threads <= 0) {
+                                fprintf(stderr, "Error: invalid threads: %s\n", argv[*i]);
+                                usage(name);
+                        }
+                } else {
+                        fprintf(stderr, "Error: unknown option: %s\n", argv[*i]);
+                        usage(name);
+                }
+        }
+}
+
+static const char* store_uri(void) {
+        const char *storeuri = getenv("PINPAM_STORE");
+        if (storeuri == NULL || storeuri[0] == '\0') {
+                storeuri = srcfile;
+        }
+        return storeuri;
+}
+
+// the users file of the text store ppedit edits
+static const char* text_users_path(const char *msg) {
+        const backend_ops_t *ops = NULL;
+        const char *userspath = NULL;
+        checkerr_backend(backend_resolve(store_uri(), &ops, &userspath), msg);
+        if (ops != &backend_text) {
+                panic(msg, "Only text stores are supported");
+        }
+        return userspath;
+}
+
+// true if path is the users file of the text store ppedit edits
+static bool is_store_users(const char *path) {
+        const backend_ops_t *ops = NULL;
+        const char *userspath = NULL;
+        if (backend_resolve(store_uri(), &ops, &userspath) != 0 || ops != &backend_text) {
+                return false;
+        }
+        struct stat a, b;
+        if (stat(path, &a) != 0 || stat(userspath, &b) != 0) {
+                return strcmp(path, userspath) == 0;
+        }
+        return a.st_dev == b.st_dev && a.st_ino == b.st_ino;
+}
+
+// writers of the users file wait for each other and pam_pin.so rehashes,
+// the lock is held until exit
+static void lock_users(const char *userspath, const char *msg) {
+        int fd = -1;
+        if (users_lock(userspath, true, &fd) != 0) {
+                panic(msg, "Could not lock users file");
+        }
+}
+
+static void action_fsck(cli_args_t *args, backend_t *store, bool *modified) {
+        const char *userspath = text_users_path("Check users store");
+        if (args->fsck.repair) {
+                lock_users(userspath, "Check users store");
+        }
+
+        fsck_t *fsck = NULL;
+        int err = fsck_run(&fsck, userspath, varfile, args->fsck.threads);
+        checkerr_fsck(err, "Check files");
+        const fsck_report_t *report = fsck_report(fsck);
+        const char *paths[] = { [FSCK_USERS] = userspath, [FSCK_STATE] = varfile };
+        printf("%s: %zu records\n", userspath, report->records);
+        printf("%s: %zu entries\n", varfile, report->entries);
+        for (size_t i = 0; i < report->issues_len; i++) {
+                const fsck_issue_t *issue = &report->issues[i];
+                printf("%s:%zu: %s\n", paths[issue->file], issue->line,
+                       fsck_problem_name(issue->problem));
+        }
+        size_t total = 0;
+        for (int p = 0; p < FSCK_PROBLEMS; p++) {
+                total += report->problems[p];
+        }
+        if (total > report->issues_len) {
+                printf("... %zu more\n", total - report->issues_len);
+        }
+        printf("Malformed: %zu, bad hashes: %zu, duplicates: %zu, orphans: %zu\n",
+               report->problems[FSCK_MALFORMED], report->problems[FSCK_BAD_DIGEST],
+               report->problems[FSCK_DUPLICATE], report->problems[FSCK_ORPHAN]);
+        if (total > 0 && args->fsck.repair) {
+                err = fsck_repair(fsck);
+                checkerr_fsck(err, "Repair files");
+                printf("Repaired, %zu lines dropped\n", total);
+                invalidate_timestamps(args);
+        }
+        fsck_free(fsck);
+        if (total > 0 && !args->fsck.repair) {
+                exit(1);
+        }
+}
+
+static void parse_prune_opts(const char *name, int argc, char **argv, int *i,
+                             cli_args_t *args) {
+        for (; *i < argc; (*i)++) {
+                if (strcmp(argv[*i], "--dry-run") == 0) {
+                        args->prune.dry_run = true;
+                } else if (strcmp(argv[*i], "--passwd") == 0 && *i + 1 < argc) {
+                        (*i)++;
+                        args->prune.passwd = argv[*i];
+                } else {
+                        fprintf(stderr, "Error: unknown option: %s\n", argv[*i]);
+                        usage(name);
+                }
+        }
+}
+
+static void print_pruned(void *ctx, prune_file_t file, const char *username) {
+        const char * const *paths = ctx;
+        printf("%s: %s\n", paths[file], username);
+}
+
+static void action_prune(cli_args_t *args, backend_t *store, bool *modified) {
+        const char *userspath = text_users_path("Prune users store");
+        if (!args->prune.dry_run) {
+                lock_users(userspath, "Prune users store");
+        }
+
+        const char *paths[] = { [PRUNE_USERS] = userspath, [PRUNE_STATE] = varfile };
+        prune_report_t report;
+        int err = prune_run(userspath, varfile, args->prune.passwd, args->prune.dry_run,
+                            print_pruned, paths, &report);
+        checkerr_prune(err, "Prune users");
+        printf("Accounts: %zu, users removed: %zu of %zu, state entries removed: %zu of %zu\n",
+               report.accounts, report.removed[PRUNE_USERS], report.lines[PRUNE_USERS],
+               report.removed[PRUNE_STATE], report.lines[PRUNE_STATE]);
+        if (args->prune.dry_run) {
+                printf("Dry run, nothing changed\n");
+        } else if (report.removed[PRUNE_USERS] + report.removed[PRUNE_STATE] > 0) {
+                invalidate_timestamps(args);
+        }
+}
+
+static uint64_t parse_generation(const char *name, const char *arg) {
+        char *end = NULL;
+        errno = 0;
+        const unsigned long long val = strtoull(arg, &end, 10);
+        if (*end != '\0' || arg[0] == '-' || errno != 0) {
+                fprintf(stderr, "Error: invalid generation: %s\n", arg);
+                usage(name);
+        }
+        return val;
+}
+
+// delta and apply
+static void parse_delta_opts(const char *name, int argc, char **argv, int *i,
+                             cli_args_t *args) {
+        const bool apply = args->action == ACTION_APPLY;
+        args->delta.fd = apply ? STDIN_FILENO : STDOUT_FILENO;
+        args->delta.to = UINT64_MAX;
+        for (; *i < argc; (*i)++) {
+                if (!apply && strcmp(argv[*i], "--init") == 0) {
+                        args->delta.init = true;
+                } else if (!apply && strcmp(argv[*i], "--from") == 0 && *i + 1 < argc) {
+                        (*i)++;
+                        args->delta.export = true;
+                        args->delta.from = parse_generation(name, argv[*i]);
+                } else if (!apply && strcmp(argv[*i], "--to") == 0 && *i + 1 < argc) {
+                        (*i)++;
+                        args->delta.to = parse_generation(name, argv[*i]);
+                } else if (strcmp(argv[*i], "--fd") == 0 && *i + 1 < argc) {
+                        (*i)++;
+                        char *end = NULL;
+                        long val = strtol(argv[*i], &end, 10);
+                        if (*end != '\0' || val < 0 || val > 1024) {
+                                fprintf(stderr, "Error: invalid descriptor: %s\n", argv[*i]);
+                                usage(name);
+                        }
+                        args->delta.fd = (int)val;
+                } else {
+                        fprintf(stderr, "Error: unknown option: %s\n", argv[*i]);
+                        usage(name);
+                }
+        }
+        if (args->delta.to != UINT64_MAX && !args->delta.export) {
+                fprintf(stderr, "Error: --to needs --from\n");
+                usage(name);
+        }
+}
+
+static void action_delta(cli_args_t *args, backend_t *store, bool *modified) {
+        const char *userspath = text_users_path("Users generation");
+        if (args->delta.init) {
+                lock_users(userspath, "Users generation");
+        }
+        uint64_t gen = 0;
+        int err = args->delta.init ?
+                delta_init(userspath, &gen) : delta_generation(userspath, &gen);
+        checkerr_delta(err, "Users generation");
+        if (!args->delta.export) {
+                printf("Generation %" PRIu64 "\n", gen);
+                return;
+        }
+
+        const uint64_t to = args->delta.to == UINT64_MAX ? gen : args->delta.to;
+        if (isatty(args->delta.fd)) {
+                panic("Export changes", "Refusing to write a changeset to a terminal");
+        }
+        FILE *out = args->delta.fd == STDOUT_FILENO ?
+                stdout : fdopen(args->delta.fd, "w");
+        if (out == NULL) {
+                panic("Export changes", "Could not open output descriptor");
+        }
+        delta_info_t info;
+        err = delta_export(userspath, args->delta.from, to, out, &info);
+        checkerr_delta(err, "Export changes");
+        if (out != stdout) {
+                fclose(out);
+        }
+        fprintf(stderr, "Generations %" PRIu64 "..%" PRIu64 ": %zu changes\n",
+                info.from, info.to, info.changes);
+}
+
+static void action_apply(cli_args_t *args, backend_t *store, bool *modified) {
+        const char *userspath = text_users_path("Apply changes");
+        lock_users(userspath, "Apply changes");
+        FILE *in = args->delta.fd == STDIN_FILENO ?
+                stdin : fdopen(args->delta.fd, "r");
+        if (in == NULL) {
+                panic("Apply changes", "Could not open input descriptor");
+        }
+        delta_info_t info;
+        int err = delta_apply(userspath, in, &info);
+        checkerr_delta(err, "Apply changes");
+        if (in != stdin) {
+                fclose(in);
+        }
+        if (info.current) {
+                printf("Already at generation %" PRIu64 "\n", info.to);
+                return;
+        }
+        printf("Applied generations %" PRIu64 "..%" PRIu64 ": %zu changes\n",
+               info.from, info.to, info.changes);
+        invalidate_timestamps(args);
+}
+
+// diff and merge
+static void parse_merge_opts(const char *name, int argc, char **argv, int *i,
+                             cli_args_t *args) {
+        const bool merge = args->action == ACTION_MERGE;
+        const size_t npaths = merge ? 3 : 2;
+        size_t paths = 0;
+        for (; *i < argc; (*i)++) {
+                if (strcmp(argv[*i], "--mem") == 0 && *i + 1 < argc) {
+                        (*i)++;
+                        char *end = NULL;
+                        const long val = strtol(argv[*i], &end, 10);
+                        if (*end != '\0' || val <= 0 || val > 1 << 20) {
+                                fprintf(stderr, "Error: invalid memory: %s\n", argv[*i]);
+                                usage(name);
+                        }
+                        args->merge.mem = (size_t)val << 20;
+                } else if (merge && strcmp(argv[*i], "--output") == 0 && *i + 1 < argc) {
+                        (*i)++;
+                        args->merge.output = argv[*i];
+                } else if (argv[*i][0] != '-' && paths < npaths) {
+                        args->merge.paths[paths++] = argv[*i];
+                } else {
+                        fprintf(stderr, "Error: unknown option: %s\n", argv[*i]);
+                        usage(name);
+                }
+        }
+        if (paths < npaths) {
+                fprintf(stderr, "Error: users files not specified\n");
+                usage(name);
+        }
+}
+
+static void print_diff(void *ctx, merge_change_t change, const char *username) {
+        static const char marks[] = {
+                [MERGE_ADDED] = '+',
+                [MERGE_REMOVED] = '-',
+                [MERGE_CHANGED] = '~',
+        };
+        printf("%c %s\n", marks[change], username);
+}
+
+static void action_diff(cli_args_t *args, backend_t *store, bool *modified) {
+        merge_report_t report;
+        int err = merge_diff(args->merge.paths[0], args->merge.paths[1], args->merge.mem,
+                             print_diff, NULL, &report);
+        checkerr_merge(err, "Compare users files");
+        printf("Added: %zu, removed: %zu, changed: %zu\n", report.changes[MERGE_ADDED],
+               report.changes[MERGE_REMOVED], report.changes[MERGE_CHANGED]);
+        if (report.changes[MERGE_ADDED] + report.changes[MERGE_REMOVED] +
+                        report.changes[MERGE_CHANGED] > 0) {
+                exit(1);
+        }
+}
+
+static void print_conflict(void *ctx, merge_change_t change, const char *username) {
+        if (change == MERGE_CONFLICT) {
+                fprintf(stderr, "Conflict: %s\n", username);
+        }
+}
+
+static void action_merge(cli_args_t *args, backend_t *store, bool *modified) {
+        txn_t *txn = NULL;
+        FILE *out = stdout;
+        const bool live = args->merge.output != NULL && is_store_users(args->merge.output);
+        if (live) {
+                lock_users(args->merge.output, "Merge users files");
+        }
+        if (args->merge.output != NULL) {
+                const char *tmppath = NULL;
+                txn = txn_new();
+                if (txn == NULL || txn_add(txn, args->merge.output, &tmppath) != 0 ||
+                                (out = fopen(tmppath, "w")) == NULL) {
+                        panic("Merge users files", "Could not create output file");
+                }
+        }
+        merge_report_t report;
+        int err = merge_three(args->merge.paths[0], args->merge.paths[1], args->merge.paths[2],
+                              args->merge.mem, out, print_conflict, NULL, &report);
+        checkerr_merge(err, "Merge users files");
+        const size_t conflicts = report.changes[MERGE_CONFLICT];
+        fprintf(stderr, "Merged %zu users, added: %zu, removed: %zu, changed: %zu, conflicts: %zu\n",
+                report.users, report.changes[MERGE_ADDED], report.changes[MERGE_REMOVED],
+                report.changes[MERGE_CHANGED], conflicts);
+        if (txn != NULL) {
+                if (fclose(out) != 0) {
+                        panic("Merge users files", "Could not write output file");
+                }
+                // the output file is left as it is until the conflicts are resolved
+                if (conflicts == 0 && txn_commit(txn) != 0) {
+                        panic("Merge users files", "Could not replace output file");
+                }
+                if (conflicts == 0 && live) {
+                        invalidate_timestamps(args);
+                }
+                if (conflicts > 0) {
+                        fprintf(stderr, "%s is not written\n", args->merge.output);
+                }
+                txn_free(txn);
+        }
+        if (conflicts > 0) {
+                exit(1);
+        }
+}
+
+static void parse_status_opts(const char *name, int argc, char **argv, int *i,
+                              cli_args_t *args) {
+        for (; *i < argc; (*i)++) {
+                if (strcmp(argv[*i], "--prefix") == 0 && *i + 1 < argc) {
+                        (*i)++;
+                        args->status.prefix = argv[*i];
+                } else if (strcmp(argv[*i], "--locked") == 0) {
+                        args->status.locked = true;
+                } else if (strcmp(argv[*i], "--failed") == 0) {
+                        args->status.failed = true;
+                } else if (strcmp(argv[*i], "--format") == 0 && *i + 1 < argc) {
+                        (*i)++;
+                        if (strcmp(argv[*i], "text") == 0) {
+                                args->status.machine = false;
+                        } else if (bulk_parse_format(argv[*i], &args->status.format) == 0) {
+                                args->status.machine = true;
+                        } else {
+                                fprintf(stderr, "Error: unknown format: %s\n", argv[*i]);
+                                usage(name);
+                        }
+                } else {
+                        fprintf(stderr, "Error: unknown option: %s\n", argv[*i]);
+                        usage(name);
+                }
+        }
+}
+
+struct status {
+        const cli_args_t        *args;
+        size_t                  enrolled;
+        size_t                  failed;
+        size_t                  locked;
+        size_t                  orphans;        // attempts without a users record
+};
+
+static int print_status(void *ctx, const status_user_t *user) {
+        struct status *status = ctx;
+        const cli_args_t *args = status->args;
+        status->enrolled += user->enrolled;
+        status->orphans += !user->enrolled;
+        status->failed += user->attempts > 0;
+        status->locked += user->locked;
+        if ((args->status.locked && !user->locked) ||
+                        (args->status.failed && user->attempts == 0)) {
+                return 0;
+        }
+
+        if (!args->status.machine) {
+                printf(" * %s attempts=%d%s%s\n", user->username, user->attempts,
+                       user->locked ? " locked" : "", user->enrolled ? "" : " not-enrolled");
+        } else if (args->status.format == BULK_FORMAT_CSV) {
+                printf("%s,%d,%d,%d\n", user->username, user->enrolled, user->attempts,
+                       user->locked);
+        } else {
+                printf("{\"user\":");
+                bulk_json_string(stdout, user->username);
+                printf(",\"enrolled\":%s,\"attempts\":%d,\"locked\":%s}\n",
+                       user->enrolled ? "true" : "false", user->attempts,
+                       user->locked ? "true" : "false");
+        }
+        return 0;
+}
+
+static void action_status(cli_args_t *args, backend_t *store, bool *modified) {
+        const char *userspath = text_users_path("Users status");
+        struct status status = { .args = args };
+        int err = status_run(userspath, varfile, args->status.prefix, print_status, &status);
+        checkerr_status(err, "Users status");
+        // machine formats keep stdout to the records
+        fprintf(args->status.machine ? stderr : stdout,
+                "Enrolled: %zu, failed attempts: %zu, locked: %zu, not enrolled: %zu\n",
+                status.enrolled, status.failed, status.locked, status.orphans);
+}
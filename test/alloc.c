@@ -0,0 +1,155 @@
+#include "test.h"
+#include "../src/lib/alloc.h"
+#include "../src/lib/users.h"
+#include "../src/lib/state.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HEX "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+
+#define ALLOC_TEST_USERS 1000
+
+static void write_users(const char *path, size_t nusers) {
+        FILE *f = fopen(path, "w");
+        assert_non_null(f);
+        for (size_t i = 0; i < nusers; i++) {
+                fprintf(f, "user%04zu:" HEX "\n", i);
+        }
+        assert_int_equal(fclose(f), 0);
+}
+
+testfunc(alloc_counter) {
+        (void) state;  // Unused variable
+
+        alloc_counter_t *counter = alloc_counter_new(NULL);
+        assert_non_null(counter);
+        const alloc_t *alloc = alloc_counter(counter);
+        alloc_stats_t stats;
+
+        users_t *users = users_new_alloc(0, alloc);
+        assert_non_null(users);
+        kdf_params_t kdf;
+        kdf_default(&kdf);
+        char name[16];
+        // one username per new user, the arrays grow by doubling
+        alloc_counter_reset(counter);
+        for (size_t i = 0; i < ALLOC_TEST_USERS; i++) {
+                snprintf(name, sizeof(name), "user%04zu", i);
+                assert_int_equal(users_set(users, name, &kdf, (const uint8_t*)HEX), 0);
+        }
+        alloc_counter_stats(counter, &stats);
+        assert_true(stats.allocs >= ALLOC_TEST_USERS);
+        assert_true(stats.allocs <= ALLOC_TEST_USERS + 16);
+        assert_true(stats.reallocs <= 16);
+
+        // updates and lookups allocate nothing from the table
+        alloc_counter_reset(counter);
+        user_t *user = user_new();
+        for (size_t i = 0; i < ALLOC_TEST_USERS; i++) {
+                snprintf(name, sizeof(name), "user%04zu", i);
+                assert_int_equal(users_set(users, name, &kdf, (const uint8_t*)HEX), 0);
+                assert_int_equal(users_find(users, name, user), 0);
+        }
+        alloc_counter_stats(counter, &stats);
+        assert_int_equal(stats.allocs + stats.reallocs + stats.frees, 0);
+        user_free(user);
+        users_free(users);
+        alloc_counter_stats(counter, &stats);
+        assert_int_equal(stats.live, 0);
+
+        // a load allocates the usernames and the arrays only
+        char path[] = "/tmp/pinpam-alloc-XXXXXX";
+        const int fd = mkstemp(path);
+        assert_true(fd >= 0);
+        close(fd);
+        write_users(path, ALLOC_TEST_USERS);
+        alloc_counter_reset(counter);
+        users = users_new_alloc(0, alloc);
+        assert_int_equal(users_load(users, path), 0);
+        alloc_counter_stats(counter, &stats);
+        assert_true(stats.allocs <= ALLOC_TEST_USERS + 16);
+        users_free(users);
+        // the threaded loader keeps one arena of names per thread
+        alloc_counter_reset(counter);
+        users = users_new_alloc(0, alloc);
+        assert_int_equal(users_load_threads(users, path, 4), 0);
+        alloc_counter_stats(counter, &stats);
+        assert_true(stats.allocs <= 16);
+        assert_true(stats.peak >= ALLOC_TEST_USERS * 8);
+        // a missing file empties the storage
+        assert_int_equal(users_load(users, "/nonexistent/pinpam/users"), 0);
+        assert_int_equal(users_find(users, "user0000", NULL), ERR_USERS_USER_NOT_FOUND);
+        users_free(users);
+        alloc_counter_stats(counter, &stats);
+        assert_int_equal(stats.live, 0);
+
+        // the state frees its entries and itself
+        state_t *s = state_new_alloc(alloc);
+        assert_non_null(s);
+        for (size_t i = 0; i < 100; i++) {
+                snprintf(name, sizeof(name), "user%04zu", i);
+                state_set_attempts(s, name, 1);
+        }
+        state_t *copy = state_clone(s);
+        assert_non_null(copy);
+        assert_int_equal(state_freeze(copy), 0);
+        uint8_t attempts = 0;
+        state_get_attempts(copy, "user0042", &attempts);
+        assert_int_equal(attempts, 1);
+        state_free(copy);
+        state_free(s);
+        alloc_counter_stats(counter, &stats);
+        assert_int_equal(stats.live, 0);
+
+        alloc_counter_free(counter);
+        unlink(path);
+}
+
+testfunc(alloc_arena) {
+        (void) state;  // Unused variable
+
+        alloc_arena_t *arena = alloc_arena_new(4096);
+        assert_non_null(arena);
+        const alloc_t *alloc = alloc_arena(arena);
+
+        // the last allocation grows in place and is given back by free
+        char *a = alloc_malloc(alloc, 10);
+        assert_non_null(a);
+        assert_int_equal((uintptr_t)a % 16, 0);
+        memcpy(a, "123456789", 10);
+        char *grown = alloc_realloc(alloc, a, 100);
+        assert_true(grown == a);
+        char *b = alloc_malloc(alloc, 10);
+        assert_int_equal((uintptr_t)b % 16, 0);
+        alloc_free(alloc, b);
+        assert_true(alloc_malloc(alloc, 10) == b);
+        // others are copied
+        char *moved = alloc_realloc(alloc, a, 200);
+        assert_true(moved != a);
+        assert_string_equal(moved, "123456789");
+        // larger than a block
+        char *big = alloc_calloc(alloc, 1, 10000);
+        assert_non_null(big);
+        assert_int_equal(big[9999], 0);
+
+        users_t *users = users_new_alloc(0, alloc);
+        assert_non_null(users);
+        kdf_params_t kdf;
+        kdf_default(&kdf);
+        char name[16];
+        for (size_t i = 0; i < ALLOC_TEST_USERS; i++) {
+                snprintf(name, sizeof(name), "user%04zu", i);
+                assert_int_equal(users_set(users, name, &kdf, (const uint8_t*)HEX), 0);
+        }
+        for (size_t i = 0; i < ALLOC_TEST_USERS; i += 2) {
+                snprintf(name, sizeof(name), "user%04zu", i);
+                assert_int_equal(users_remove(users, name), 0);
+        }
+        assert_int_equal(users_find(users, "user0001", NULL), 0);
+        assert_int_equal(users_find(users, "user0002", NULL), ERR_USERS_USER_NOT_FOUND);
+        users_free(users);
+        assert_true(alloc_arena_size(arena) >= ALLOC_TEST_USERS * 16);
+        alloc_arena_free(arena);
+}
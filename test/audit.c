@@ -0,0 +1,98 @@
+#include "test.h"
+#include "../src/lib/audit.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define AUDIT_THREADS 8
+#define AUDIT_PER_THREAD 200
+
+static void* audit_writer(void *arg) {
+        audit_t *log = arg;
+        for (int i = 0; i < AUDIT_PER_THREAD; i++) {
+                audit_event_t event;
+                memset(&event, 0, sizeof(audit_event_t));
+                event.result = AUDIT_RESULT_OK;
+                event.attempts = i % 3;
+                event.verify_us = i;
+                snprintf(event.user, sizeof(event.user), "user%d", i);
+                audit_append(log, &event);
+        }
+        return NULL;
+}
+
+testfunc(audit_append) {
+        (void) state;  // Unused variable
+
+        char path[] = "/tmp/pinpam-audit-XXXXXX";
+        int fd = mkstemp(path);
+        assert_true(fd >= 0);
+        close(fd);
+        // an empty file is initialized by the first writer
+        audit_t *log = NULL;
+        assert_int_equal(audit_open(&log, path, true), 0);
+
+        pthread_t threads[AUDIT_THREADS];
+        for (int i = 0; i < AUDIT_THREADS; i++) {
+                assert_int_equal(pthread_create(&threads[i], NULL, audit_writer, log), 0);
+        }
+        for (int i = 0; i < AUDIT_THREADS; i++) {
+                pthread_join(threads[i], NULL);
+        }
+
+        audit_t *reader = NULL;
+        assert_int_equal(audit_open(&reader, path, false), 0);
+        assert_int_equal(audit_head(reader), AUDIT_THREADS * AUDIT_PER_THREAD);
+        assert_int_equal(audit_tail(reader), 0);
+        size_t users[AUDIT_PER_THREAD] = {0};
+        for (uint64_t seq = 0; seq < audit_head(reader); seq++) {
+                audit_event_t event;
+                assert_int_equal(audit_read(reader, seq, &event), 0);
+                assert_int_equal(event.seq, seq);
+                assert_int_equal(event.result, AUDIT_RESULT_OK);
+                int n = atoi(event.user + strlen("user"));
+                assert_int_equal(event.verify_us, n);
+                assert_int_equal(event.attempts, n % 3);
+                users[n]++;
+        }
+        for (int i = 0; i < AUDIT_PER_THREAD; i++) {
+                assert_int_equal(users[i], AUDIT_THREADS);
+        }
+        audit_event_t event;
+        assert_int_equal(audit_read(reader, audit_head(reader), &event), ERR_AUDIT_PENDING);
+        assert_int_equal(audit_append(reader, &event), ERR_AUDIT_READONLY);
+        audit_close(reader);
+        audit_close(log);
+        unlink(path);
+}
+
+testfunc(audit_wrap) {
+        (void) state;  // Unused variable
+
+        char path[] = "/tmp/pinpam-audit-XXXXXX";
+        int fd = mkstemp(path);
+        assert_true(fd >= 0);
+        close(fd);
+        audit_t *log = NULL;
+        assert_int_equal(audit_open(&log, path, true), 0);
+        audit_event_t event;
+        memset(&event, 0, sizeof(audit_event_t));
+        // longer usernames are truncated by the writer
+        memcpy(event.user, "a-very-long-username-truncated", AUDIT_USER_LEN);
+        for (int i = 0; i < AUDIT_CAPACITY + 10; i++) {
+                event.attempts = i % 256;
+                assert_int_equal(audit_append(log, &event), 0);
+        }
+        assert_int_equal(audit_tail(log), 10);
+        assert_int_equal(audit_read(log, 9, &event), ERR_AUDIT_OVERWRITTEN);
+        assert_int_equal(audit_read(log, 10, &event), 0);
+        assert_int_equal(event.attempts, 10);
+        assert_int_equal(strlen(event.user), AUDIT_USER_LEN);
+        audit_close(log);
+
+        // not an audit log
+        assert_int_equal(truncate(path, 100), 0);
+        assert_int_equal(audit_open(&log, path, false), ERR_AUDIT_INVALID);
+        unlink(path);
+}
@@ -0,0 +1,203 @@
+#include "test.h"
+#include "../src/lib/auth.h"
+#include "../src/lib/crypt.h"
+
+#include <string.h>
+
+// in-memory backend, every hook may be asked to block once
+struct backend {
+        users_t *users;
+        uint8_t attempts;
+        int saved;
+        int verified;
+        bool block_find;
+        bool block_save;
+        bool block_verified;
+};
+
+static int mem_find_user(void *ctx, const char *username, user_t *user) {
+        struct backend *b = ctx;
+        if (b->block_find) {
+                b->block_find = false;
+                return ERR_AUTH_AGAIN;
+        }
+        return users_find(b->users, username, user);
+}
+
+static int mem_load_attempts(void *ctx, const char *username, uint8_t *attempts) {
+        *attempts = ((struct backend*)ctx)->attempts;
+        return 0;
+}
+
+static int mem_update_attempts(void *ctx, const char *username, bool valid,
+                               uint8_t *attempts) {
+        struct backend *b = ctx;
+        if (b->block_save) {
+                b->block_save = false;
+                return ERR_AUTH_AGAIN;
+        }
+        if (b->attempts < PINPAM_AUTH_MAX_ATTEMPTS) {
+                b->attempts = valid ? 0 : b->attempts + 1;
+        }
+        *attempts = b->attempts;
+        b->saved++;
+        return 0;
+}
+
+static int mem_verified(void *ctx, const char *username, user_t *user,
+                        const pin_source_t pin) {
+        struct backend *b = ctx;
+        if (b->block_verified) {
+                b->block_verified = false;
+                return ERR_AUTH_AGAIN;
+        }
+        b->verified++;
+        return 0;
+}
+
+static void backend_init(struct backend *b, pinpam_auth_io_t *io) {
+        memset(b, 0, sizeof(struct backend));
+        b->users = users_new(0);
+        pin_source_t pin = {1, 2, 3, 4};
+        pin_hash_t pin_hash;
+        hash_pin(pin, pin_hash);
+        users_update(b->users, "john", pin_hash);
+
+        memset(io, 0, sizeof(pinpam_auth_io_t));
+        io->ctx = b;
+        io->find_user = mem_find_user;
+        io->load_attempts = mem_load_attempts;
+        io->update_attempts = mem_update_attempts;
+        io->verified = mem_verified;
+}
+
+testfunc(auth_retry) {
+        (void) state;  // Unused variable
+
+        struct backend b;
+        pinpam_auth_io_t io;
+        backend_init(&b, &io);
+        pin_source_t pin = {1, 2, 3, 4};
+        pin_source_t wrong = {0, 0, 0, 0};
+
+        pinpam_auth_t *auth = NULL;
+        pinpam_auth_status_t status;
+        assert_int_equal(pinpam_auth_begin(&auth, "john", &io, &status), 0);
+        assert_int_equal(status, PINPAM_AUTH_NEED_PIN);
+        assert_int_equal(pinpam_auth_submit(auth, wrong, &status), 0);
+        assert_int_equal(status, PINPAM_AUTH_RETRY);
+        assert_int_equal(b.attempts, 1);
+        // malformed input counts too
+        assert_int_equal(pinpam_auth_submit(auth, NULL, &status), 0);
+        assert_int_equal(status, PINPAM_AUTH_RETRY);
+        assert_int_equal(pinpam_auth_attempts(auth), 2);
+        assert_int_equal(pinpam_auth_submit(auth, pin, &status), 0);
+        assert_int_equal(status, PINPAM_AUTH_OK);
+        assert_int_equal(b.attempts, 0);
+        assert_int_equal(b.saved, 3);
+        assert_int_equal(b.verified, 1);
+        assert_int_equal(pinpam_auth_submit(auth, pin, &status), ERR_AUTH_SEQUENCE);
+        pinpam_auth_finish(auth);
+
+        assert_int_equal(pinpam_auth_begin(&auth, "jane", &io, &status), ERR_AUTH_USER);
+        assert_int_equal(pinpam_auth_cause(auth), ERR_USERS_USER_NOT_FOUND);
+        pinpam_auth_finish(auth);
+        users_free(b.users);
+}
+
+testfunc(auth_locked) {
+        (void) state;  // Unused variable
+
+        struct backend b;
+        pinpam_auth_io_t io;
+        backend_init(&b, &io);
+        pin_source_t pin = {1, 2, 3, 4};
+        pin_source_t wrong = {0, 0, 0, 0};
+
+        pinpam_auth_t *auth = NULL;
+        pinpam_auth_status_t status;
+        assert_int_equal(pinpam_auth_begin(&auth, "john", &io, &status), 0);
+        for (int i = 1; i < PINPAM_AUTH_MAX_ATTEMPTS; i++) {
+                assert_int_equal(pinpam_auth_submit(auth, wrong, &status), 0);
+                assert_int_equal(status, PINPAM_AUTH_RETRY);
+        }
+        assert_int_equal(pinpam_auth_submit(auth, wrong, &status), 0);
+        assert_int_equal(status, PINPAM_AUTH_LOCKED);
+        assert_int_equal(pinpam_auth_submit(auth, pin, &status), ERR_AUTH_SEQUENCE);
+        pinpam_auth_finish(auth);
+
+        // locked before any PIN is asked
+        assert_int_equal(pinpam_auth_begin(&auth, "john", &io, &status), 0);
+        assert_int_equal(status, PINPAM_AUTH_LOCKED);
+        assert_int_equal(b.verified, 0);
+        pinpam_auth_finish(auth);
+        users_free(b.users);
+}
+
+testfunc(auth_pending) {
+        (void) state;  // Unused variable
+
+        struct backend b;
+        pinpam_auth_io_t io;
+        backend_init(&b, &io);
+        pin_source_t pin = {1, 2, 3, 4};
+        b.block_find = true;
+        b.block_save = true;
+        b.block_verified = true;
+        b.attempts = 1;
+
+        pinpam_auth_t *auth = NULL;
+        pinpam_auth_status_t status;
+        assert_int_equal(pinpam_auth_begin(&auth, "john", &io, &status), 0);
+        assert_int_equal(status, PINPAM_AUTH_PENDING);
+        assert_int_equal(pinpam_auth_submit(auth, pin, &status), ERR_AUTH_SEQUENCE);
+        assert_int_equal(pinpam_auth_resume(auth, &status), 0);
+        assert_int_equal(status, PINPAM_AUTH_NEED_PIN);
+
+        assert_int_equal(pinpam_auth_submit(auth, pin, &status), 0);
+        assert_int_equal(status, PINPAM_AUTH_PENDING);
+        assert_int_equal(b.attempts, 1);
+        assert_int_equal(pinpam_auth_resume(auth, &status), 0);
+        assert_int_equal(status, PINPAM_AUTH_PENDING);
+        assert_int_equal(b.attempts, 0);
+        assert_int_equal(b.verified, 0);
+        assert_int_equal(pinpam_auth_resume(auth, &status), 0);
+        assert_int_equal(status, PINPAM_AUTH_OK);
+        assert_int_equal(b.verified, 1);
+        pinpam_auth_finish(auth);
+        users_free(b.users);
+}
+
+testfunc(auth_concurrent) {
+        (void) state;  // Unused variable
+
+        struct backend b;
+        pinpam_auth_io_t io;
+        backend_init(&b, &io);
+        pin_source_t pin = {1, 2, 3, 4};
+        pin_source_t wrong = {0, 0, 0, 0};
+
+        // both sessions load no failed attempts
+        pinpam_auth_t *first = NULL, *second = NULL;
+        pinpam_auth_status_t status;
+        assert_int_equal(pinpam_auth_begin(&first, "john", &io, &status), 0);
+        assert_int_equal(pinpam_auth_begin(&second, "john", &io, &status), 0);
+        assert_int_equal(status, PINPAM_AUTH_NEED_PIN);
+
+        for (int i = 1; i < PINPAM_AUTH_MAX_ATTEMPTS; i++) {
+                assert_int_equal(pinpam_auth_submit(first, wrong, &status), 0);
+                assert_int_equal(status, PINPAM_AUTH_RETRY);
+        }
+        // the failures of the first session count for the second one
+        assert_int_equal(pinpam_auth_submit(second, wrong, &status), 0);
+        assert_int_equal(status, PINPAM_AUTH_LOCKED);
+        assert_int_equal(pinpam_auth_attempts(second), PINPAM_AUTH_MAX_ATTEMPTS);
+        // and a valid PIN does not unlock the user
+        assert_int_equal(pinpam_auth_submit(first, pin, &status), 0);
+        assert_int_equal(status, PINPAM_AUTH_LOCKED);
+        assert_int_equal(b.attempts, PINPAM_AUTH_MAX_ATTEMPTS);
+        assert_int_equal(b.verified, 0);
+        pinpam_auth_finish(first);
+        pinpam_auth_finish(second);
+        users_free(b.users);
+}
@@ -0,0 +1,333 @@
+#include "test.h"
+#include "../src/lib/backend.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define MODEL_USERS 32
+#define WORKLOAD_OPS 2000
+
+/*
+ * The same pseudo random workload runs against every backend and each
+ * of them is compared with this model after every commit and reopen.
+ */
+struct model {
+        bool    present[MODEL_USERS];
+        uint8_t pin[MODEL_USERS];       // see make_pin
+        uint8_t attempts[MODEL_USERS];
+};
+
+static uint32_t next(uint32_t *seed) {
+        *seed ^= *seed << 13;
+        *seed ^= *seed >> 17;
+        *seed ^= *seed << 5;
+        return *seed;
+}
+
+// hex pin hash of the tag, the stores keep it as text
+static void make_pin(uint8_t tag, pin_hash_t pin) {
+        const char *hex = "0123456789abcdef";
+        memset(pin, '0', PIN_HASH_LEN);
+        pin[0] = hex[tag >> 4];
+        pin[1] = hex[tag & 0xf];
+}
+
+static int count_user(void *ctx, user_t *user) {
+        (*(size_t*)ctx)++;
+        return 0;
+}
+
+// reads the store from the visitor
+static int lookup_user(void *ctx, user_t *user) {
+        const char *name = user_get_name(user);
+        user_t *found = user_new();
+        uint8_t attempts;
+        assert_int_equal(backend_lookup(ctx, name, found), 0);
+        assert_int_equal(backend_get_attempts(ctx, name, &attempts), 0);
+        const char *stored = user_get_name(found);
+        assert_string_equal(stored, name);
+        free((void*)stored);
+        free((void*)name);
+        user_free(found);
+        return 0;
+}
+
+static void assert_model(backend_t *store, const struct model *model) {
+        user_t *user = user_new();
+        size_t present = 0;
+        for (int i = 0; i < MODEL_USERS; i++) {
+                char name[16];
+                snprintf(name, sizeof(name), "user%02d", i);
+                int err = backend_lookup(store, name, user);
+                if (!model->present[i]) {
+                        assert_int_equal(err, ERR_BACKEND_NOT_FOUND);
+                } else {
+                        pin_hash_t pin;
+                        make_pin(model->pin[i], pin);
+                        assert_int_equal(err, 0);
+                        const char *stored = user_get_name(user);
+                        assert_string_equal(stored, name);
+                        free((void*)stored);
+                        assert_true(user_check_pin(user, pin));
+                        present++;
+                }
+                uint8_t attempts = 0xff;
+                assert_int_equal(backend_get_attempts(store, name, &attempts), 0);
+                assert_int_equal(attempts, model->attempts[i]);
+        }
+        user_free(user);
+
+        size_t listed = 0;
+        assert_int_equal(backend_iterate(store, count_user, &listed), 0);
+        assert_int_equal(listed, present);
+
+        // user10 to user19 past the cursor
+        size_t expected = 0;
+        for (int i = 16; i < 20; i++) {
+                expected += model->present[i];
+        }
+        listed = 0;
+        assert_int_equal(backend_scan(store, "user1", "user15", count_user, &listed), 0);
+        assert_int_equal(listed, expected);
+        assert_int_equal(backend_scan(store, NULL, NULL, lookup_user, store), 0);
+}
+
+static void run_workload(const backend_ops_t *ops) {
+        tmpdir_t dir;
+        tmpdir_new(&dir, "backend");
+        char uri[96];
+        snprintf(uri, sizeof(uri), "%s:%s", ops->scheme, tmpdir_path(&dir, "users"));
+        const char *statepath = tmpdir_path(&dir, "state");
+
+        struct model model;
+        memset(&model, 0, sizeof(struct model));
+        kdf_params_t kdf;
+        kdf_default(&kdf);
+
+        backend_t *store = NULL;
+        assert_int_equal(backend_open(&store, uri, statepath), 0);
+        assert_true(store->ops == ops);
+        uint32_t seed = 2463534242u;
+        for (int op = 0; op < WORKLOAD_OPS; op++) {
+                const uint32_t r = next(&seed);
+                const int i = r % MODEL_USERS;
+                char name[16];
+                snprintf(name, sizeof(name), "user%02d", i);
+                switch ((r >> 8) % 8) {
+                        case 0:
+                        case 1:
+                        case 2: {
+                                pin_hash_t pin;
+                                model.pin[i] = r >> 16;
+                                make_pin(model.pin[i], pin);
+                                assert_int_equal(backend_upsert(store, name, &kdf, pin), 0);
+                                model.present[i] = true;
+                                break;
+                        }
+                        case 3:
+                        case 4:
+                                assert_int_equal(backend_remove(store, name),
+                                                 model.present[i] ? 0 : ERR_BACKEND_NOT_FOUND);
+                                model.present[i] = false;
+                                break;
+                        case 5:
+                        case 6:
+                                model.attempts[i] = (r >> 16) % 4;
+                                assert_int_equal(backend_set_attempts(store, name,
+                                                                      model.attempts[i]), 0);
+                                break;
+                        default:
+                                assert_int_equal(backend_commit(store, 0), 0);
+                                backend_close(store);
+                                assert_int_equal(backend_open(&store, uri, statepath), 0);
+                                assert_model(store, &model);
+                                break;
+                }
+        }
+        assert_int_equal(backend_commit(store, 0), 0);
+        backend_close(store);
+
+        // closing without a commit drops the changes
+        assert_int_equal(backend_open(&store, uri, statepath), 0);
+        pin_hash_t pin;
+        make_pin(0xaa, pin);
+        assert_int_equal(backend_upsert(store, "dropped", &kdf, pin), 0);
+        backend_close(store);
+        assert_int_equal(backend_open(&store, uri, statepath), 0);
+        user_t *user = user_new();
+        assert_int_equal(backend_lookup(store, "dropped", user), ERR_BACKEND_NOT_FOUND);
+        user_free(user);
+        assert_model(store, &model);
+        backend_close(store);
+
+        tmpdir_free(&dir);
+}
+
+testfunc(backend_differential) {
+        (void) state;  // Unused variable
+
+        for (size_t i = 0; backend_list(i) != NULL; i++) {
+                run_workload(backend_list(i));
+        }
+}
+
+testfunc(backend_resolve) {
+        (void) state;  // Unused variable
+
+        const backend_ops_t *ops = NULL;
+        const char *path = NULL;
+        assert_int_equal(backend_resolve("/etc/pinpam/users", &ops, &path), 0);
+        assert_true(ops == &backend_text);
+        assert_string_equal(path, "/etc/pinpam/users");
+        assert_int_equal(backend_resolve("./a:b", &ops, &path), 0);
+        assert_string_equal(path, "./a:b");
+        assert_int_equal(backend_resolve("text:/tmp/users", &ops, &path), 0);
+        assert_true(ops == &backend_text);
+        assert_string_equal(path, "/tmp/users");
+        assert_int_equal(backend_resolve("nosuch:/tmp/users", &ops, &path), ERR_BACKEND_SCHEME);
+
+        // btree keeps the attempts itself: backend_open drops the state
+        // file, a direct open with one is refused
+        tmpdir_t dir;
+        tmpdir_new(&dir, "backend");
+        char uri[96];
+        snprintf(uri, sizeof(uri), "btree:%s", tmpdir_path(&dir, "users"));
+        const char *statepath = tmpdir_path(&dir, "state");
+        backend_t *store = NULL;
+        assert_int_equal(backend_btree.open(&store, uri + 6, statepath), ERR_BACKEND_STATEPATH);
+        assert_int_equal(backend_open(&store, uri, statepath), 0);
+        backend_close(store);
+        assert_int_equal(access(statepath, F_OK), -1);
+        tmpdir_free(&dir);
+}
+
+testfunc(backend_lock) {
+        (void) state;  // Unused variable
+
+        tmpdir_t dir;
+        tmpdir_new(&dir, "backend");
+        const char *path = tmpdir_path(&dir, "users");
+        const char *lockpath = tmpdir_path(&dir, "users.lock");
+
+        // a second writer does not get the lock until the first one closes
+        backend_t *a = NULL, *b = NULL;
+        assert_int_equal(backend_open(&a, path, NULL), 0);
+        assert_int_equal(backend_open(&b, path, NULL), 0);
+        assert_int_equal(backend_lock(a, false), 0);
+        assert_int_equal(backend_lock(a, true), 0);
+        assert_int_equal(backend_lock(b, false), ERR_BACKEND_BUSY);
+        int fd = -1;
+        assert_int_equal(users_lock(path, false, &fd), ERR_USERS_BUSY);
+        backend_close(a);
+        assert_int_equal(backend_lock(b, false), 0);
+        backend_close(b);
+        assert_int_equal(users_lock(path, false, &fd), 0);
+        users_unlock(fd);
+
+        // the lock file is not followed
+        unlink(lockpath);
+        assert_int_equal(symlink(path, lockpath), 0);
+        assert_int_equal(users_lock(path, true, &fd), ERR_USERS_LOCK);
+        tmpdir_free(&dir);
+}
+
+struct order {
+        char    last[16];
+        size_t  count;
+};
+
+static int check_order(void *ctx, user_t *user) {
+        struct order *order = ctx;
+        const char *name = user_get_name(user);
+        assert_true(strcmp(order->last, name) < 0);
+        snprintf(order->last, sizeof(order->last), "%s", name);
+        free((void*)name);
+        order->count++;
+        return 0;
+}
+
+testfunc(backend_btree_large) {
+        (void) state;  // Unused variable
+
+        tmpdir_t dir;
+        tmpdir_new(&dir, "backend");
+        const char *path = tmpdir_path(&dir, "users");
+        char uri[96];
+        snprintf(uri, sizeof(uri), "btree:%s", path);
+        kdf_params_t kdf;
+        kdf_default(&kdf);
+        pin_hash_t pin;
+        make_pin(1, pin);
+
+        // enough users for a three level tree, added out of order
+        const size_t n = 20000;
+        backend_t *store = NULL;
+        assert_int_equal(backend_open(&store, uri, NULL), 0);
+        for (size_t i = 0; i < n; i++) {
+                char name[16];
+                snprintf(name, sizeof(name), "u%05zu", (i * 7919) % n);
+                assert_int_equal(backend_upsert(store, name, &kdf, pin), 0);
+        }
+        assert_int_equal(backend_commit(store, 0), 0);
+        backend_close(store);
+
+        // every other user goes, one commit each
+        assert_int_equal(backend_open(&store, uri, NULL), 0);
+        for (size_t i = 0; i < n; i += 2) {
+                char name[16];
+                snprintf(name, sizeof(name), "u%05zu", i);
+                assert_int_equal(backend_remove(store, name), 0);
+                if (i % 512 == 0) {
+                        assert_int_equal(backend_commit(store, 0), 0);
+                }
+        }
+        assert_int_equal(backend_commit(store, 0), 0);
+        struct stat st;
+        assert_int_equal(stat(path, &st), 0);
+        const off_t size = st.st_size;
+
+        user_t *user = user_new();
+        struct order order = {0};
+        assert_int_equal(backend_iterate(store, check_order, &order), 0);
+        assert_int_equal(order.count, n / 2);
+        assert_int_equal(backend_lookup(store, "u00000", user), ERR_BACKEND_NOT_FOUND);
+        assert_int_equal(backend_lookup(store, "u00001", user), 0);
+        assert_true(user_check_pin(user, pin));
+
+        // the odd users from u01231 to u01239, in order
+        memset(&order, 0, sizeof(order));
+        snprintf(order.last, sizeof(order.last), "u01230");
+        assert_int_equal(backend_scan(store, "u0123", "u01230", check_order, &order), 0);
+        assert_int_equal(order.count, 5);
+        assert_string_equal(order.last, "u01239");
+
+        // replaced pages are reused, the file does not grow
+        for (int round = 0; round < 200; round++) {
+                assert_int_equal(backend_set_attempts(store, "u00001", round % 3 + 1), 0);
+                assert_int_equal(backend_commit(store, 0), 0);
+        }
+        assert_int_equal(stat(path, &st), 0);
+        assert_true(st.st_size <= size + 16 * 4096);
+
+        // and the rest, down to an empty tree
+        for (size_t i = 1; i < n; i += 2) {
+                char name[16];
+                snprintf(name, sizeof(name), "u%05zu", i);
+                assert_int_equal(backend_remove(store, name), 0);
+        }
+        assert_int_equal(backend_commit(store, 0), 0);
+        backend_close(store);
+        assert_int_equal(backend_open(&store, uri, NULL), 0);
+        memset(&order, 0, sizeof(order));
+        assert_int_equal(backend_iterate(store, check_order, &order), 0);
+        // u00001 stays with its attempts, but it is not listed
+        assert_int_equal(order.count, 0);
+        uint8_t attempts = 0;
+        assert_int_equal(backend_get_attempts(store, "u00001", &attempts), 0);
+        assert_int_equal(attempts, 199 % 3 + 1);
+        user_free(user);
+        backend_close(store);
+
+        tmpdir_free(&dir);
+}
@@ -0,0 +1,125 @@
+#include "test.h"
+#include "../src/lib/bulk.h"
+
+#include <string.h>
+#include <unistd.h>
+
+static FILE* input(const char *text) {
+        return fmemopen((void*)text, strlen(text), "r");
+}
+
+testfunc(bulk_read_csv) {
+        (void) state;  // Unused variable
+
+        FILE *in = input("username,pin\n"
+                         "# comment\n"
+                         "john,1234\n"
+                         "\n"
+                         "jane,9F64A747E1B97F131FABB6B447296C9B6F0201E79FB3C5356E6C77E89B6A806A\n");
+        bulk_t *bulk = bulk_new();
+        assert_int_equal(bulk_read(bulk, in, BULK_FORMAT_CSV), 0);
+        assert_int_equal(bulk->len, 2);
+        assert_string_equal(bulk->records[0].username, "john");
+        assert_false(bulk->records[0].hashed);
+        assert_int_equal(bulk->records[0].line, 3);
+        assert_string_equal(bulk->records[1].username, "jane");
+        assert_true(bulk->records[1].hashed);
+
+        kdf_params_t kdf;
+        kdf_default(&kdf);
+        assert_int_equal(bulk_hash(bulk, &kdf, 2), 0);
+        // both records hold the digest of 1234 now
+        assert_memory_equal(bulk->records[0].pin_hash, bulk->records[1].pin_hash,
+                            PIN_HASH_LEN);
+        bulk_free(bulk);
+        fclose(in);
+
+        in = input("john,12a4\n");
+        bulk = bulk_new();
+        assert_int_equal(bulk_read(bulk, in, BULK_FORMAT_CSV), ERR_BULK_INVALID_PIN);
+        assert_int_equal(bulk->err_line, 1);
+        bulk_free(bulk);
+        fclose(in);
+
+        in = input("jo:hn,1234\n");
+        bulk = bulk_new();
+        assert_int_equal(bulk_read(bulk, in, BULK_FORMAT_CSV), ERR_BULK_INVALID_USER);
+        bulk_free(bulk);
+        fclose(in);
+}
+
+testfunc(bulk_read_jsonl) {
+        (void) state;  // Unused variable
+
+        FILE *in = input("{\"user\": \"john\", \"pin\": \"1234\"}\n"
+                         "{\"hash\":\"9f64a747e1b97f131fabb6b447296c9b6f0201e79fb3c5356e6c77e89b6a806a\",\"user\":\"j\\u0061ne\"}\n");
+        bulk_t *bulk = bulk_new();
+        assert_int_equal(bulk_read(bulk, in, BULK_FORMAT_JSONL), 0);
+        assert_int_equal(bulk->len, 2);
+        assert_string_equal(bulk->records[0].username, "john");
+        assert_string_equal(bulk->records[1].username, "jane");
+        assert_true(bulk->records[1].hashed);
+        bulk_free(bulk);
+        fclose(in);
+
+        in = input("{\"user\": \"john\"}\n");
+        bulk = bulk_new();
+        assert_int_equal(bulk_read(bulk, in, BULK_FORMAT_JSONL), ERR_BULK_INVALID_FORMAT);
+        bulk_free(bulk);
+        fclose(in);
+}
+
+testfunc(bulk_read_duplicate) {
+        (void) state;  // Unused variable
+
+        FILE *in = input("john,1234\njane,1111\njohn,4321\n");
+        bulk_t *bulk = bulk_new();
+        assert_int_equal(bulk_read(bulk, in, BULK_FORMAT_CSV), ERR_BULK_DUPLICATE);
+        assert_int_equal(bulk->err_line, 3);
+        bulk_free(bulk);
+        fclose(in);
+}
+
+testfunc(bulk_apply) {
+        (void) state;  // Unused variable
+
+        pin_hash_t pin = {1};
+        users_t *users = users_new(0);
+        users_update(users, "jane", pin);
+        char path[] = "/tmp/pinpam-bulk-XXXXXX";
+        int fd = mkstemp(path);
+        assert_true(fd >= 0);
+        close(fd);
+        assert_int_equal(users_dump(users, path), 0);
+        users_free(users);
+        backend_t *store = NULL;
+        assert_int_equal(backend_open(&store, path, NULL), 0);
+
+        FILE *in = input("john,1234\njane,1111\n");
+        bulk_t *bulk = bulk_new();
+        assert_int_equal(bulk_read(bulk, in, BULK_FORMAT_CSV), 0);
+        kdf_params_t kdf;
+        assert_int_equal(kdf_parse_spec("$pbkdf2-sha256$i=1000$", &kdf), 0);
+        assert_int_equal(bulk_hash(bulk, &kdf, 0), 0);
+
+        // existing user rejects the whole set
+        assert_int_equal(bulk_apply(bulk, store, false), ERR_BULK_EXISTS);
+        assert_int_equal(bulk->err_line, 2);
+        assert_int_equal(backend_lookup(store, "john", NULL), ERR_BACKEND_NOT_FOUND);
+
+        assert_int_equal(bulk_apply(bulk, store, true), 0);
+        assert_int_equal(backend_lookup(store, "john", NULL), 0);
+        user_t *u = user_new();
+        assert_int_equal(backend_lookup(store, "jane", u), 0);
+        assert_false(user_check_pin(u, pin));
+        pin_source_t src = {1, 1, 1, 1};
+        bool valid = false;
+        assert_int_equal(user_verify_pin(u, src, &valid), 0);
+        assert_true(valid);
+        user_free(u);
+
+        bulk_free(bulk);
+        fclose(in);
+        backend_close(store);
+        unlink(path);
+}
@@ -1,6 +1,8 @@
 #include "test.h"
 #include "../src/lib/crypt.h"
 
+#include <string.h>
+
 
 testfunc(hash_pin) {
         (void) state;  // Unused variable
@@ -13,3 +15,26 @@ testfunc(hash_pin) {
         assert_int_equal(ret, 0);
         assert_memory_equal(output, expect, sizeof(pin_hash_t));
 }
+
+testfunc(hash_pin_midstate) {
+        (void) state;  // Unused variable
+
+        uint8_t pepper[PIN_PEPPER_LEN];
+        uint8_t salt[16];
+        memset(pepper, 0x11, sizeof(pepper));
+        for (size_t i = 0; i < sizeof(salt); i++) {
+                salt[i] = i;
+        }
+        pin_source_t pin = {1, 2, 3, 4};
+        // SHA-256(pepper ‖ salt ‖ 16 zero bytes ‖ pin)
+        pin_hash_t expect = "32f0cc799e368e5969c7653faff169c25e2daae94e990571546d4eb5952dffef";
+
+        pin_midstate_t mid;
+        assert_int_equal(hash_pin_prefix(pepper, salt, sizeof(salt), &mid), 0);
+        pin_hash_t output;
+        hash_pin_midstate(&mid, pin, output);
+        assert_memory_equal(output, expect, sizeof(pin_hash_t));
+
+        uint8_t long_salt[PIN_PREFIX_LEN - PIN_PEPPER_LEN + 1] = {0};
+        assert_int_not_equal(hash_pin_prefix(pepper, long_salt, sizeof(long_salt), &mid), 0);
+}
@@ -0,0 +1,309 @@
+#include "test.h"
+#include "../src/lib/backend.h"
+#include "../src/lib/delta.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+
+#define HEX "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+
+struct host {
+        tmpdir_t        dir;
+        const char      *users;
+        const char      *state;
+        const char      *side[2];       // .gen, .log
+};
+
+static void host_new(struct host *h, const char *users) {
+        tmpdir_new(&h->dir, "delta");
+        h->users = tmpdir_path(&h->dir, "users");
+        h->state = tmpdir_path(&h->dir, "state");
+        h->side[0] = tmpdir_path(&h->dir, "users.gen");
+        h->side[1] = tmpdir_path(&h->dir, "users.log");
+        file_write(h->users, users);
+}
+
+static void host_free(struct host *h) {
+        tmpdir_free(&h->dir);
+}
+
+static void make_pin(int n, pin_hash_t out) {
+        memcpy(out, HEX, PIN_HASH_LEN);
+        out[0] = "0123456789abcdef"[n & 0xf];
+}
+
+// the source changes users through the text store as ppedit does
+static void source_commit(struct host *src, const char *add, int pin, const char *remove) {
+        backend_t *store = NULL;
+        assert_int_equal(backend_open(&store, src->users, src->state), 0);
+        if (add != NULL) {
+                kdf_params_t kdf;
+                kdf_default(&kdf);
+                kdf.alg = KDF_PBKDF2_SHA256;
+                kdf.cost = 1000;
+                memset(kdf.salt, pin, KDF_SALT_LEN);
+                pin_hash_t hash;
+                make_pin(pin, hash);
+                assert_int_equal(backend_upsert(store, add, &kdf, hash), 0);
+        }
+        if (remove != NULL) {
+                assert_int_equal(backend_remove(store, remove), 0);
+        }
+        assert_int_equal(backend_commit(store, 0), 0);
+        backend_close(store);
+}
+
+// pam_pin.so rehashes a record of any host on login
+static void local_rehash(struct host *h, const char *user) {
+        backend_t *store = NULL;
+        assert_int_equal(backend_open(&store, h->users, h->state), 0);
+        kdf_params_t kdf;
+        kdf_default(&kdf);
+        kdf.alg = KDF_SHA256_PEPPER;
+        pin_hash_t hash;
+        make_pin(9, hash);
+        assert_int_equal(backend_upsert(store, user, &kdf, hash), 0);
+        assert_int_equal(backend_commit(store, BACKEND_COMMIT_LOCAL), 0);
+        backend_close(store);
+}
+
+static FILE* export(struct host *src, uint64_t from, uint64_t to, delta_info_t *info) {
+        FILE *f = tmpfile();
+        assert_non_null(f);
+        assert_int_equal(delta_export(src->users, from, to, f, info), 0);
+        rewind(f);
+        return f;
+}
+
+static const char *initial = "alice:" HEX "\nbob:" HEX "\nfrank:" HEX "\n";
+
+testfunc(delta_roundtrip) {
+        (void) state;  // Unused variable
+
+        struct host src, dst;
+        host_new(&src, initial);
+        host_new(&dst, initial);
+
+        uint64_t gen = 0;
+        assert_int_equal(delta_generation(src.users, &gen), 0);
+        assert_int_equal(gen, 0);
+        assert_int_equal(delta_export(src.users, 0, 0, stdout, &(delta_info_t){0}),
+                         ERR_DELTA_DISABLED);
+        assert_int_equal(delta_init(src.users, &gen), 0);
+        assert_int_equal(gen, 1);
+        // a second init keeps the generation
+        assert_int_equal(delta_init(src.users, &gen), 0);
+        assert_int_equal(gen, 1);
+
+        source_commit(&src, "carol", 1, NULL);
+        source_commit(&src, "carol", 2, "alice");
+        source_commit(&src, "dave", 3, NULL);
+        assert_int_equal(delta_generation(src.users, &gen), 0);
+        assert_int_equal(gen, 4);
+
+        // a host without a generation file starts from the full set
+        delta_info_t info;
+        FILE *f = export(&src, 0, 3, &info);
+        assert_int_equal(info.changes, 4);      // bob, frank, carol, alice
+        assert_int_equal(delta_apply(dst.users, f, &info), 0);
+        assert_false(info.current);
+        assert_int_equal(info.to, 3);
+        assert_int_equal(delta_generation(dst.users, &gen), 0);
+        assert_int_equal(gen, 3);
+
+        // applied twice is a no-op
+        rewind(f);
+        assert_int_equal(delta_apply(dst.users, f, &info), 0);
+        assert_true(info.current);
+        fclose(f);
+
+        // a rehash on login is not a generation, the next changeset applies
+        // and replaces the record the source changed
+        local_rehash(&dst, "dave");
+        assert_int_equal(delta_generation(dst.users, &gen), 0);
+        assert_int_equal(gen, 3);
+
+        f = export(&src, 3, 4, &info);
+        assert_int_equal(info.changes, 1);
+        assert_int_equal(delta_apply(dst.users, f, &info), 0);
+        fclose(f);
+
+        char a[1024], b[1024];
+        file_read(dst.users, a, sizeof(a));
+        file_read(src.users, b, sizeof(b));
+        assert_non_null(strstr(a, "frank:" HEX));
+        assert_string_equal(a, b);
+        assert_null(strstr(a, "alice:"));
+        assert_non_null(strstr(a, "dave:$pbkdf2-sha256$"));
+
+        // a replica refuses commits of its own, its generation stays the
+        // source's and the next changeset is not taken for applied
+        backend_t *store = NULL;
+        assert_int_equal(backend_open(&store, dst.users, dst.state), 0);
+        kdf_params_t kdf;
+        kdf_default(&kdf);
+        pin_hash_t hash;
+        make_pin(5, hash);
+        assert_int_equal(backend_upsert(store, "erin", &kdf, hash), 0);
+        assert_int_equal(backend_commit(store, 0), ERR_BACKEND_COMMIT);
+        assert_int_equal(backend_cause(store), ERR_DELTA_REPLICA);
+        backend_close(store);
+        assert_int_equal(delta_generation(dst.users, &gen), 0);
+        assert_int_equal(gen, 4);
+        source_commit(&src, "erin", 6, NULL);
+        f = export(&src, 4, 5, &info);
+        assert_int_equal(delta_apply(dst.users, f, &info), 0);
+        assert_false(info.current);
+        assert_int_equal(info.changes, 1);
+        fclose(f);
+        assert_non_null(strstr(file_read(dst.users, a, sizeof(a)), "erin:"));
+
+        // the changesets of another source do not apply, whatever their
+        // generations
+        struct host other;
+        host_new(&other, initial);
+        assert_int_equal(delta_init(other.users, &gen), 0);
+        for (int i = 0; i < 4; i++) {
+                source_commit(&other, "zed", i, NULL);
+        }
+        f = export(&other, 5, 5, &info);
+        assert_int_equal(delta_apply(dst.users, f, &info), ERR_DELTA_SOURCE);
+        fclose(f);
+
+        // the source itself keeps committing
+        source_commit(&src, "frank", 7, NULL);
+        assert_int_equal(delta_generation(src.users, &gen), 0);
+        assert_int_equal(gen, 6);
+
+        host_free(&other);
+        host_free(&src);
+        host_free(&dst);
+}
+
+// a changeset of one upsert from generation 0 to 1 with a valid checksum
+static FILE* craft(const char *name, uint8_t alg, const kdf_params_t *kdf,
+                   const uint8_t *hash, size_t hash_len) {
+        uint8_t buf[256];
+        size_t pos = 0;
+        memcpy(buf, "PPDELTA2", 8);
+        memset(buf + 8, 0, 36);  // source, from, to, count
+        buf[32] = 1;    // to
+        buf[40] = 1;    // count
+        pos = 44;
+        buf[pos++] = 1; // upsert
+        buf[pos++] = strlen(name);
+        buf[pos++] = 0;
+        memcpy(buf + pos, name, strlen(name));
+        pos += strlen(name);
+        buf[pos++] = alg;
+        if (kdf != NULL) {
+                const uint32_t params[] = { kdf->cost, kdf->memory, kdf->parallel };
+                for (size_t i = 0; i < 12; i++) {
+                        buf[pos++] = params[i / 4] >> (8 * (i % 4));
+                }
+                memcpy(buf + pos, kdf->salt, KDF_SALT_LEN);
+                pos += KDF_SALT_LEN;
+        }
+        memcpy(buf + pos, hash, hash_len);
+        pos += hash_len;
+        unsigned int sum_len = 32;
+        assert_int_equal(EVP_Digest(buf, pos, buf + pos, &sum_len, EVP_sha256(), NULL), 1);
+        pos += sum_len;
+        FILE *f = tmpfile();
+        assert_non_null(f);
+        assert_int_equal(fwrite(buf, 1, pos, f), pos);
+        rewind(f);
+        return f;
+}
+
+testfunc(delta_apply_crafted) {
+        (void) state;  // Unused variable
+
+        struct host dst;
+        host_new(&dst, initial);
+        delta_info_t info;
+
+        // a raw hash must not add records of its own
+        char hash[PIN_HASH_LEN + 1];
+        snprintf(hash, sizeof(hash), "%.*s\nroot:%.*s", 20, HEX, 38, HEX);
+        FILE *f = craft("eve", KDF_SHA256 | 0x80, NULL, (const uint8_t*)hash, PIN_HASH_LEN);
+        assert_int_equal(delta_apply(dst.users, f, &info), ERR_DELTA_RECORD);
+        fclose(f);
+        memcpy(hash, HEX, PIN_HASH_LEN);
+        hash[7] = 'G';
+        f = craft("eve", KDF_SHA256 | 0x80, NULL, (const uint8_t*)hash, PIN_HASH_LEN);
+        assert_int_equal(delta_apply(dst.users, f, &info), ERR_DELTA_RECORD);
+        fclose(f);
+
+        // kdf parameters out of range
+        kdf_params_t kdf;
+        kdf_default(&kdf);
+        kdf.cost = 0;
+        uint8_t packed[PIN_HASH_LEN / 2] = {0};
+        f = craft("eve", KDF_PBKDF2_SHA256, &kdf, packed, sizeof(packed));
+        assert_int_equal(delta_apply(dst.users, f, &info), ERR_DELTA_RECORD);
+        fclose(f);
+
+        char a[1024];
+        assert_string_equal(file_read(dst.users, a, sizeof(a)), initial);
+        assert_int_equal(access(dst.side[0], F_OK), -1);
+
+        // a lowercase hex raw hash is a valid record
+        f = craft("eve", KDF_SHA256 | 0x80, NULL, (const uint8_t*)HEX, PIN_HASH_LEN);
+        assert_int_equal(delta_apply(dst.users, f, &info), 0);
+        fclose(f);
+        assert_non_null(strstr(file_read(dst.users, a, sizeof(a)), "eve:" HEX "\n"));
+
+        host_free(&dst);
+}
+
+testfunc(delta_apply_errors) {
+        (void) state;  // Unused variable
+
+        struct host src, dst;
+        host_new(&src, initial);
+        host_new(&dst, initial);
+        uint64_t gen = 0;
+        assert_int_equal(delta_init(src.users, &gen), 0);
+        source_commit(&src, "carol", 1, NULL);
+        source_commit(&src, NULL, 0, "bob");
+
+        // the host is at 0, not 1
+        delta_info_t info;
+        FILE *f = export(&src, 1, 3, &info);
+        assert_int_equal(delta_apply(dst.users, f, &info), ERR_DELTA_GENERATION);
+        fclose(f);
+        assert_int_equal(delta_export(src.users, 2, 4, stdout, &info), ERR_DELTA_GENERATION);
+
+        // a flipped byte fails the checksum
+        f = export(&src, 0, 3, &info);
+        assert_int_equal(fseek(f, 30, SEEK_SET), 0);
+        const int c = fgetc(f);
+        assert_int_equal(fseek(f, 30, SEEK_SET), 0);
+        fputc(c ^ 1, f);
+        rewind(f);
+        assert_int_equal(delta_apply(dst.users, f, &info), ERR_DELTA_CHECKSUM);
+        fclose(f);
+
+        f = tmpfile();
+        assert_non_null(f);
+        fputs("not a changeset", f);
+        rewind(f);
+        assert_int_equal(delta_apply(dst.users, f, &info), ERR_DELTA_FORMAT);
+        fclose(f);
+
+        // nothing was written
+        char a[1024];
+        assert_string_equal(file_read(dst.users, a, sizeof(a)), initial);
+        assert_int_equal(access(dst.side[0], F_OK), -1);
+
+        // fsck reports an uppercase digest, the source does not ship it
+        struct host bad;
+        host_new(&bad, "frank:0123456789ABCDEF0123456789abcdef0123456789abcdef0123456789abcdef\n");
+        assert_int_equal(delta_init(bad.users, &gen), ERR_DELTA_RECORD);
+        host_free(&bad);
+
+        host_free(&src);
+        host_free(&dst);
+}
@@ -0,0 +1,305 @@
+/*
+ * Licensed under the MIT License.
+ * See the LICENSE file in the project root for more information.
+ */
+
+/*
+ * I/O fault injection shim for tests and benchmarks:
+ *
+ *   LD_PRELOAD=build/test/faultio.so PINPAM_FAULT='<rule>[;<rule>...]' <cmd>
+ *
+ * rule: <call>:<fault>[@<n>][:<path substring>]
+ *   call:  fopen, getline, fprintf, fwrite, fclose, rename, fsync or *
+ *   fault: delay=<us>  sleep before the call
+ *          short       getline returns half of the line, fwrite half
+ *                      of the items
+ *          eacces, enospc, eio
+ *                      fail the call with the errno
+ *   @n:    inject from the n-th matching call on, counting from 1
+ *   path:  only calls on files whose path contains the substring,
+ *          "/pinpam" if omitted
+ *
+ * Example: fail the users file write after 100 records and slow down
+ * every fsync by 5ms:
+ *   PINPAM_FAULT='fwrite:enospc@100:/users;fsync:delay=5000'
+ *
+ * A preloaded process can replace the rules and their call counts with
+ * faultio_set(rules), NULL clears them; tests find it with dlsym.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#define FAULT_MAX_RULES 16
+#define FAULT_PATH_LEN 256
+
+typedef enum {
+        CALL_FOPEN = 0,
+        CALL_GETLINE,
+        CALL_FPRINTF,
+        CALL_FWRITE,
+        CALL_FCLOSE,
+        CALL_RENAME,
+        CALL_FSYNC,
+        CALL_ANY,
+} call_t;
+
+typedef enum {
+        FAULT_DELAY = 0,
+        FAULT_SHORT,
+        FAULT_ERRNO,
+} fault_t;
+
+struct rule {
+        call_t          call;
+        fault_t         fault;
+        long            arg;            // delay us or errno
+        unsigned long   from;
+        _Atomic unsigned long calls;
+        char            path[FAULT_PATH_LEN];
+};
+
+static const char * const call_names[] = {
+        [CALL_FOPEN] = "fopen",
+        [CALL_GETLINE] = "getline",
+        [CALL_FPRINTF] = "fprintf",
+        [CALL_FWRITE] = "fwrite",
+        [CALL_FCLOSE] = "fclose",
+        [CALL_RENAME] = "rename",
+        [CALL_FSYNC] = "fsync",
+        [CALL_ANY] = "*",
+};
+
+static struct rule rules[FAULT_MAX_RULES];
+static size_t rules_len = 0;
+// calls with rules, the others skip the path lookup
+static unsigned calls_mask = 0;
+
+static FILE* (*real_fopen)(const char*, const char*);
+static ssize_t (*real_getline)(char**, size_t*, FILE*);
+static int (*real_vfprintf)(FILE*, const char*, va_list);
+static size_t (*real_fwrite)(const void*, size_t, size_t, FILE*);
+static int (*real_fclose)(FILE*);
+static int (*real_rename)(const char*, const char*);
+static int (*real_fsync)(int);
+
+static int parse_rule(char *spec, struct rule *rule) {
+        char *call = strtok_r(spec, ":", &spec);
+        char *fault = strtok_r(NULL, ":", &spec);
+        char *path = strtok_r(NULL, "", &spec);
+        if (call == NULL || fault == NULL) {
+                return -1;
+        }
+        memset(rule, 0, sizeof(struct rule));
+        rule->call = CALL_ANY + 1;
+        for (int i = 0; i <= CALL_ANY; i++) {
+                if (strcmp(call, call_names[i]) == 0) {
+                        rule->call = i;
+                }
+        }
+        if (rule->call > CALL_ANY) {
+                return -1;
+        }
+        char *from = strchr(fault, '@');
+        if (from != NULL) {
+                *from++ = '\0';
+                rule->from = strtoul(from, NULL, 10);
+        }
+        if (strncmp(fault, "delay=", 6) == 0) {
+                rule->fault = FAULT_DELAY;
+                rule->arg = strtol(fault + 6, NULL, 10);
+        } else if (strcmp(fault, "short") == 0) {
+                rule->fault = FAULT_SHORT;
+        } else if (strcmp(fault, "eacces") == 0) {
+                rule->fault = FAULT_ERRNO;
+                rule->arg = EACCES;
+        } else if (strcmp(fault, "enospc") == 0) {
+                rule->fault = FAULT_ERRNO;
+                rule->arg = ENOSPC;
+        } else if (strcmp(fault, "eio") == 0) {
+                rule->fault = FAULT_ERRNO;
+                rule->arg = EIO;
+        } else {
+                return -1;
+        }
+        snprintf(rule->path, FAULT_PATH_LEN, "%s", path != NULL ? path : "/pinpam");
+        return 0;
+}
+
+void faultio_set(const char *spec);
+
+__attribute__((constructor))
+static void faultio_init(void) {
+        real_fopen = dlsym(RTLD_NEXT, "fopen");
+        real_getline = dlsym(RTLD_NEXT, "getline");
+        real_vfprintf = dlsym(RTLD_NEXT, "vfprintf");
+        real_fwrite = dlsym(RTLD_NEXT, "fwrite");
+        real_fclose = dlsym(RTLD_NEXT, "fclose");
+        real_rename = dlsym(RTLD_NEXT, "rename");
+        real_fsync = dlsym(RTLD_NEXT, "fsync");
+        faultio_set(getenv("PINPAM_FAULT"));
+}
+
+void faultio_set(const char *spec) {
+        // no call goes to the rules while they change
+        calls_mask = 0;
+        rules_len = 0;
+        if (spec == NULL) {
+                return;
+        }
+        unsigned mask = 0;
+        char *copy = strdup(spec);
+        char *save = NULL;
+        for (char *rule = strtok_r(copy, ";", &save);
+                        rule != NULL && rules_len < FAULT_MAX_RULES;
+                        rule = strtok_r(NULL, ";", &save)) {
+                if (parse_rule(rule, &rules[rules_len]) != 0) {
+                        fprintf(stderr, "faultio: invalid rule %s\n", rule);
+                        continue;
+                }
+                mask |= rules[rules_len].call == CALL_ANY ?
+                        ~0u : 1u << rules[rules_len].call;
+                rules_len++;
+        }
+        free(copy);
+        calls_mask = mask;
+}
+
+static bool fd_path(int fd, char *path, size_t len) {
+        char link[64];
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+        ssize_t n = readlink(link, path, len - 1);
+        if (n < 0) {
+                return false;
+        }
+        path[n] = '\0';
+        return true;
+}
+
+/*
+ * Apply the delays of matching rules and return the first matching
+ * rule with a short or errno fault.
+ */
+static struct rule* inject(call_t call, const char *path) {
+        struct rule *hit = NULL;
+        for (size_t i = 0; i < rules_len; i++) {
+                struct rule *rule = &rules[i];
+                if ((rule->call != call && rule->call != CALL_ANY) ||
+                                path == NULL || strstr(path, rule->path) == NULL) {
+                        continue;
+                }
+                if (atomic_fetch_add(&rule->calls, 1) + 1 < rule->from) {
+                        continue;
+                }
+                if (rule->fault == FAULT_DELAY) {
+                        struct timespec ts = {
+                                .tv_sec = rule->arg / 1000000,
+                                .tv_nsec = (rule->arg % 1000000) * 1000,
+                        };
+                        nanosleep(&ts, NULL);
+                } else if (hit == NULL) {
+                        hit = rule;
+                }
+        }
+        return hit;
+}
+
+static struct rule* inject_file(call_t call, FILE *f) {
+        char path[FAULT_PATH_LEN];
+        if (!(calls_mask & (1u << call)) || f == NULL ||
+                        !fd_path(fileno(f), path, sizeof(path))) {
+                return NULL;
+        }
+        return inject(call, path);
+}
+
+FILE* fopen(const char *path, const char *mode) {
+        struct rule *rule = calls_mask & (1u << CALL_FOPEN) ? inject(CALL_FOPEN, path) : NULL;
+        if (rule != NULL && rule->fault == FAULT_ERRNO) {
+                errno = rule->arg;
+                return NULL;
+        }
+        return real_fopen(path, mode);
+}
+
+ssize_t getline(char **line, size_t *len, FILE *f) {
+        struct rule *rule = inject_file(CALL_GETLINE, f);
+        if (rule != NULL && rule->fault == FAULT_ERRNO) {
+                errno = rule->arg;
+                return -1;
+        }
+        ssize_t n = real_getline(line, len, f);
+        if (rule != NULL && rule->fault == FAULT_SHORT && n > 1) {
+                n /= 2;
+                (*line)[n] = '\0';
+        }
+        return n;
+}
+
+int fprintf(FILE *f, const char *fmt, ...) {
+        struct rule *rule = inject_file(CALL_FPRINTF, f);
+        if (rule != NULL && rule->fault == FAULT_ERRNO) {
+                errno = rule->arg;
+                return -1;
+        }
+        va_list args;
+        va_start(args, fmt);
+        int n = real_vfprintf(f, fmt, args);
+        va_end(args);
+        return n;
+}
+
+size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE *f) {
+        struct rule *rule = inject_file(CALL_FWRITE, f);
+        if (rule != NULL && rule->fault == FAULT_ERRNO) {
+                errno = rule->arg;
+                return 0;
+        }
+        if (rule != NULL && rule->fault == FAULT_SHORT && nmemb > 1) {
+                nmemb /= 2;
+        }
+        return real_fwrite(ptr, size, nmemb, f);
+}
+
+int fclose(FILE *f) {
+        struct rule *rule = inject_file(CALL_FCLOSE, f);
+        // the stream is released even when close fails
+        int ret = real_fclose(f);
+        if (rule != NULL && rule->fault == FAULT_ERRNO) {
+                errno = rule->arg;
+                return EOF;
+        }
+        return ret;
+}
+
+int rename(const char *from, const char *to) {
+        struct rule *rule = calls_mask & (1u << CALL_RENAME) ? inject(CALL_RENAME, to) : NULL;
+        if (rule != NULL && rule->fault == FAULT_ERRNO) {
+                errno = rule->arg;
+                return -1;
+        }
+        return real_rename(from, to);
+}
+
+int fsync(int fd) {
+        char path[FAULT_PATH_LEN];
+        struct rule *rule = NULL;
+        if ((calls_mask & (1u << CALL_FSYNC)) && fd_path(fd, path, sizeof(path))) {
+                rule = inject(CALL_FSYNC, path);
+        }
+        if (rule != NULL && rule->fault == FAULT_ERRNO) {
+                errno = rule->arg;
+                return -1;
+        }
+        return real_fsync(fd);
+}
@@ -0,0 +1,163 @@
+#include "test.h"
+#include "../src/lib/fsck.h"
+#include "../src/lib/kdf.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#define HEX "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+#define BAD "0123456789ABCDEF0123456789abcdef0123456789abcdef0123456789abcdef"
+
+/*
+ * Long enough lines that three threads get a chunk each, the duplicates
+ * of alice and bob land in later chunks than their first lines.
+ */
+static void make_files(tmpdir_t *tmp) {
+        tmpdir_new(tmp, "fsck");
+
+        kdf_params_t kdf;
+        kdf_default(&kdf);
+        assert_int_equal(kdf_salt(&kdf), 0);
+        char prefix[KDF_PREFIX_MAX];
+        assert_int_equal(kdf_format(&kdf, prefix, sizeof(prefix)), 0);
+
+        char users[2048];
+        snprintf(users, sizeof(users),
+                 "alice:%s\n"           // 1
+                 "bob:%s" HEX "\n"      // 2
+                 "no colon here\n"      // 3, malformed
+                 "carol:" BAD "\n"      // 4, bad digest
+                 "alice:" HEX "\n"      // 5, duplicate
+                 "dave:" HEX "\n"       // 6
+                 "bob:" HEX "\n"        // 7, duplicate
+                 "erin:0123\n"          // 8, malformed
+                 "frank:$nosuch$" HEX "\n",     // 9, malformed
+                 HEX, prefix);
+        file_write(tmpdir_path(tmp, "users"), users);
+        file_write(tmpdir_path(tmp, "state"),
+                   "alice:2\n"          // 1
+                   "ghost:1\n"          // 2, orphan
+                   "dave:256\n"         // 3, malformed
+                   "alice:0\n"          // 4, duplicate
+                   "bob:x\n"            // 5, malformed
+                   "dave:3\n");         // 6
+}
+
+testfunc(fsck_check) {
+        (void) state;  // Unused variable
+
+        tmpdir_t tmp;
+        make_files(&tmp);
+        const char *users = tmpdir_path(&tmp, "users");
+        const char *statefile = tmpdir_path(&tmp, "state");
+        const struct {
+                fsck_file_t     file;
+                size_t          line;
+                fsck_problem_t  problem;
+        } expected[] = {
+                {FSCK_USERS, 3, FSCK_MALFORMED},
+                {FSCK_USERS, 4, FSCK_BAD_DIGEST},
+                {FSCK_USERS, 5, FSCK_DUPLICATE},
+                {FSCK_USERS, 7, FSCK_DUPLICATE},
+                {FSCK_USERS, 8, FSCK_MALFORMED},
+                {FSCK_USERS, 9, FSCK_MALFORMED},
+                {FSCK_STATE, 2, FSCK_ORPHAN},
+                {FSCK_STATE, 3, FSCK_MALFORMED},
+                {FSCK_STATE, 4, FSCK_DUPLICATE},
+                {FSCK_STATE, 5, FSCK_MALFORMED},
+        };
+        const size_t len = sizeof(expected) / sizeof(expected[0]);
+
+        // the result does not depend on how the files are split
+        for (int threads = 1; threads <= 4; threads++) {
+                fsck_t *fsck = NULL;
+                assert_int_equal(fsck_run(&fsck, users, statefile, threads), 0);
+                const fsck_report_t *report = fsck_report(fsck);
+                assert_int_equal(report->records, 9);
+                assert_int_equal(report->entries, 6);
+                assert_int_equal(report->problems[FSCK_MALFORMED], 5);
+                assert_int_equal(report->problems[FSCK_BAD_DIGEST], 1);
+                assert_int_equal(report->problems[FSCK_DUPLICATE], 3);
+                assert_int_equal(report->problems[FSCK_ORPHAN], 1);
+                assert_int_equal(report->issues_len, len);
+                for (size_t i = 0; i < len; i++) {
+                        assert_int_equal(report->issues[i].file, expected[i].file);
+                        assert_int_equal(report->issues[i].line, expected[i].line);
+                        assert_int_equal(report->issues[i].problem, expected[i].problem);
+                }
+                fsck_free(fsck);
+        }
+
+        // missing files are empty
+        const char *missing = tmpdir_path(&tmp, "missing");
+        fsck_t *fsck = NULL;
+        assert_int_equal(fsck_run(&fsck, missing, missing, 0), 0);
+        assert_int_equal(fsck_report(fsck)->records, 0);
+        assert_int_equal(fsck_report(fsck)->issues_len, 0);
+        fsck_free(fsck);
+        tmpdir_free(&tmp);
+}
+
+testfunc(fsck_repair) {
+        (void) state;  // Unused variable
+
+        tmpdir_t tmp;
+        make_files(&tmp);
+        const char *users = tmpdir_path(&tmp, "users");
+        const char *statefile = tmpdir_path(&tmp, "state");
+        fsck_t *fsck = NULL;
+        assert_int_equal(fsck_run(&fsck, users, statefile, 3), 0);
+        assert_int_equal(fsck_repair(fsck), 0);
+        fsck_free(fsck);
+
+        char buf[1024];
+        assert_string_equal(file_read(statefile, buf, sizeof(buf)), "alice:2\ndave:3\n");
+        file_read(users, buf, sizeof(buf));
+        assert_int_equal(strncmp(buf, "alice:" HEX "\nbob:", 11 + 64), 0);
+        assert_non_null(strstr(buf, "\ndave:" HEX "\n"));
+        assert_null(strstr(buf, "carol"));
+        assert_null(strstr(buf, "erin"));
+
+        assert_int_equal(fsck_run(&fsck, users, statefile, 3), 0);
+        const fsck_report_t *report = fsck_report(fsck);
+        assert_int_equal(report->records, 3);
+        assert_int_equal(report->entries, 2);
+        for (int p = 0; p < FSCK_PROBLEMS; p++) {
+                assert_int_equal(report->problems[p], 0);
+        }
+        // nothing to repair, the files stay
+        assert_int_equal(fsck_repair(fsck), 0);
+        fsck_free(fsck);
+        tmpdir_free(&tmp);
+}
+
+testfunc(fsck_group_member) {
+        (void) state;  // Unused variable
+
+        tmpdir_t tmp;
+        tmpdir_new(&tmp, "fsck");
+        const char *users = tmpdir_path(&tmp, "users");
+        const char *statefile = tmpdir_path(&tmp, "state");
+        // root is locked out with the PIN of @root, its attempts are kept
+        // under its own name
+        file_write(users, "alice:" HEX "\n@root:" HEX "\n");
+        file_write(statefile, "root:3\nghost:1\nalice:1\n");
+
+        fsck_t *fsck = NULL;
+        assert_int_equal(fsck_run(&fsck, users, statefile, 2), 0);
+        const fsck_report_t *report = fsck_report(fsck);
+        assert_int_equal(report->problems[FSCK_ORPHAN], 1);
+        assert_int_equal(report->issues_len, 1);
+        assert_int_equal(report->issues[0].line, 2);
+        assert_int_equal(fsck_repair(fsck), 0);
+        fsck_free(fsck);
+        char buf[64];
+        assert_string_equal(file_read(statefile, buf, sizeof(buf)), "root:3\nalice:1\n");
+
+        // without the @group record the member's attempts are orphans
+        file_write(users, "alice:" HEX "\n");
+        assert_int_equal(fsck_run(&fsck, users, statefile, 1), 0);
+        assert_int_equal(fsck_report(fsck)->problems[FSCK_ORPHAN], 1);
+        fsck_free(fsck);
+        tmpdir_free(&tmp);
+}
@@ -0,0 +1,139 @@
+#include "test.h"
+#include "../src/lib/groups.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int resolved;
+
+// userN is in groups gN and all, N % 3 == 0 are also in admins
+static int fake_groups(const char *username, char *names, size_t *len) {
+        resolved++;
+        int n;
+        if (sscanf(username, "user%d", &n) != 1) {
+                *len = 0;
+                return 0;
+        }
+        int used = snprintf(names, *len, "g%d%call", n, '\0');
+        if (n % 3 == 0) {
+                used += snprintf(names + used + 1, *len - used - 1, "admins") + 1;
+        }
+        *len = used + 1;
+        return 0;
+}
+
+struct visited {
+        char    names[4][16];
+        size_t  len;
+        const char *stop;       // stop at this group
+};
+
+static int visit_group(void *ctx, const char *group) {
+        struct visited *visited = ctx;
+        snprintf(visited->names[visited->len++], sizeof(visited->names[0]), "%s", group);
+        return visited->stop != NULL && strcmp(group, visited->stop) == 0 ? 5 : 0;
+}
+
+testfunc(groups_cache) {
+        (void) state;  // Unused variable
+
+        tmpdir_t dir;
+        tmpdir_new(&dir, "groups");
+        // the directory is made on open
+        tmpdir_path(&dir, "run");
+        const char *path = tmpdir_path(&dir, "run/groups.cache");
+
+        groups_cache_t *cache = NULL;
+        assert_int_equal(groups_cache_open(&cache, path, 3600, fake_groups), 0);
+        resolved = 0;
+        for (int round = 0; round < 2; round++) {
+                struct visited visited = {0};
+                assert_int_equal(groups_visit(cache, "user3", visit_group, &visited), 0);
+                assert_int_equal(visited.len, 3);
+                assert_string_equal(visited.names[0], "g3");
+                assert_string_equal(visited.names[1], "all");
+                assert_string_equal(visited.names[2], "admins");
+        }
+        assert_int_equal(resolved, 1);
+
+        // the visitor stops the visit
+        struct visited visited = {.stop = "all"};
+        assert_int_equal(groups_visit(cache, "user3", visit_group, &visited), 5);
+        assert_int_equal(visited.len, 2);
+
+        // unknown users are cached without groups
+        memset(&visited, 0, sizeof(visited));
+        assert_int_equal(groups_visit(cache, "nobody", visit_group, &visited), 0);
+        assert_int_equal(groups_visit(cache, "nobody", visit_group, &visited), 0);
+        assert_int_equal(visited.len, 0);
+        assert_int_equal(resolved, 2);
+
+        // more users than slots around a home slot evict the oldest
+        for (int i = 0; i < 20000; i++) {
+                char name[16];
+                snprintf(name, sizeof(name), "user%d", i);
+                memset(&visited, 0, sizeof(visited));
+                assert_int_equal(groups_visit(cache, name, visit_group, &visited), 0);
+                char expected[16];
+                snprintf(expected, sizeof(expected), "g%d", i);
+                assert_string_equal(visited.names[0], expected);
+                assert_int_equal(visited.len, i % 3 == 0 ? 3 : 2);
+        }
+        groups_cache_close(cache);
+
+        // other processes share the table, a shorter TTL drops the entries
+        // of the longer one
+        assert_int_equal(groups_cache_open(&cache, path, 3600, fake_groups), 0);
+        resolved = 0;
+        memset(&visited, 0, sizeof(visited));
+        assert_int_equal(groups_visit(cache, "user42", visit_group, &visited), 0);
+        assert_int_equal(resolved, 0);
+        groups_cache_close(cache);
+        assert_int_equal(groups_cache_open(&cache, path, 60, fake_groups), 0);
+        memset(&visited, 0, sizeof(visited));
+        assert_int_equal(groups_visit(cache, "user42", visit_group, &visited), 0);
+        assert_int_equal(resolved, 1);
+        groups_cache_close(cache);
+
+        // no cache asks every time
+        assert_int_equal(groups_cache_open(&cache, path, 0, fake_groups), 0);
+        for (int round = 0; round < 2; round++) {
+                memset(&visited, 0, sizeof(visited));
+                assert_int_equal(groups_visit(cache, "user42", visit_group, &visited), 0);
+        }
+        assert_int_equal(resolved, 3);
+        groups_cache_close(cache);
+
+        // a table others can write or a link is not mapped
+        assert_int_equal(chmod(path, 0644), 0);
+        assert_int_equal(groups_cache_open(&cache, path, 3600, fake_groups), ERR_GROUPS_UNSAFE);
+        unlink(path);
+        const char *target = tmpdir_path(&dir, "target");
+        assert_int_equal(symlink(target, path), 0);
+        assert_int_equal(groups_cache_open(&cache, path, 3600, fake_groups), ERR_GROUPS_OPEN);
+        assert_int_equal(access(target, F_OK), -1);
+
+        tmpdir_free(&dir);
+}
+
+testfunc(groups_nss) {
+        (void) state;  // Unused variable
+
+        // root is in the root group on every system
+        char names[GROUPS_LIST_MAX];
+        size_t len = sizeof(names);
+        assert_int_equal(groups_nss("root", names, &len), 0);
+        assert_true(len > 0);
+        assert_int_equal(names[len - 1], '\0');
+        bool found = false;
+        for (size_t pos = 0; pos < len; pos += strlen(names + pos) + 1) {
+                found = found || strcmp(names + pos, "root") == 0;
+        }
+        assert_true(found);
+
+        len = sizeof(names);
+        assert_int_equal(groups_nss("pinpam-no-such-user", names, &len), 0);
+        assert_int_equal(len, 0);
+}
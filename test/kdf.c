@@ -0,0 +1,206 @@
+#include "test.h"
+#include "../src/lib/kdf.h"
+#include "../src/lib/argon2.h"
+#include "../src/lib/users.h"
+
+#include <string.h>
+#include <unistd.h>
+
+testfunc(argon2id_rfc9106) {
+        (void) state;  // Unused variable
+
+        // RFC 9106, section 5.3
+        uint8_t pwd[32], salt[16], secret[8], ad[12];
+        memset(pwd, 0x01, sizeof(pwd));
+        memset(salt, 0x02, sizeof(salt));
+        memset(secret, 0x03, sizeof(secret));
+        memset(ad, 0x04, sizeof(ad));
+        const uint8_t expect[32] = {
+                0x0d, 0x64, 0x0d, 0xf5, 0x8d, 0x78, 0x76, 0x6c,
+                0x08, 0xc0, 0x37, 0xa3, 0x4a, 0x8b, 0x53, 0xc9,
+                0xd0, 0x1e, 0xf0, 0x45, 0x2d, 0x75, 0xb6, 0x5e,
+                0xb5, 0x25, 0x20, 0xe9, 0x6b, 0x01, 0xe6, 0x59,
+        };
+        argon2_input_t in = {
+                .pwd = pwd, .pwdlen = sizeof(pwd),
+                .salt = salt, .saltlen = sizeof(salt),
+                .secret = secret, .secretlen = sizeof(secret),
+                .ad = ad, .adlen = sizeof(ad),
+                .passes = 3, .memory = 32, .lanes = 4,
+        };
+        uint8_t out[32];
+        assert_int_equal(argon2id(&in, out, sizeof(out)), 0);
+        assert_memory_equal(out, expect, sizeof(out));
+
+        in.memory = 4 * in.lanes - 1;
+        assert_int_equal(argon2id(&in, out, sizeof(out)), ERR_ARGON2_PARAMS);
+}
+
+testfunc(kdf_hash) {
+        (void) state;  // Unused variable
+
+        pin_source_t pin = {1, 2, 3, 4};
+        kdf_params_t kdf;
+        pin_hash_t out;
+
+        kdf_default(&kdf);
+        assert_int_equal(kdf_hash(&kdf, pin, out), 0);
+        assert_memory_equal(out, "9f64a747e1b97f131fabb6b447296c9b6f0201e79fb3c5356e6c77e89b6a806a",
+                            PIN_HASH_LEN);
+
+        const char *value = "$pbkdf2-sha256$i=1000$000102030405060708090a0b0c0d0e0f$"
+                "ae0b6d042e93b5a584e5ec7aafddd82ef7bef46c6567cbd45088b6e9b5989e69";
+        const char *hash = NULL;
+        assert_int_equal(kdf_parse(value, &kdf, &hash), 0);
+        assert_int_equal(kdf.alg, KDF_PBKDF2_SHA256);
+        assert_int_equal(kdf.cost, 1000);
+        assert_int_equal(kdf_hash(&kdf, pin, out), 0);
+        assert_memory_equal(out, hash, PIN_HASH_LEN);
+        char prefix[KDF_PREFIX_MAX];
+        assert_int_equal(kdf_format(&kdf, prefix, sizeof(prefix)), 0);
+        assert_int_equal(strncmp(prefix, value, strlen(prefix)), 0);
+        assert_true(value + strlen(prefix) == hash);
+
+        value = "$scrypt$ln=10,r=8,p=1$000102030405060708090a0b0c0d0e0f$"
+                "c40b40519a47119ea3ae9923c80f0f0d72b1db436ee3bda0bafc8b8fdd33aa4c";
+        assert_int_equal(kdf_parse(value, &kdf, &hash), 0);
+        assert_int_equal(kdf_hash(&kdf, pin, out), 0);
+        assert_memory_equal(out, hash, PIN_HASH_LEN);
+
+        assert_int_equal(kdf_parse("$argon2id$t=1,m=7,p=1$000102030405060708090a0b0c0d0e0f$",
+                                   &kdf, &hash), ERR_KDF_PARAMS);
+        assert_int_equal(kdf_parse("$md5$i=1$000102030405060708090a0b0c0d0e0f$", &kdf, &hash),
+                         ERR_KDF_PARAMS);
+        assert_int_equal(kdf_parse("$pbkdf2-sha256$i=1000$0001$", &kdf, &hash), ERR_KDF_PARAMS);
+}
+
+testfunc(kdf_spec) {
+        (void) state;  // Unused variable
+
+        kdf_params_t kdf, parsed;
+        char spec[KDF_PREFIX_MAX];
+        assert_int_equal(kdf_parse_spec("$argon2id$t=2,m=65536,p=1$", &kdf), 0);
+        assert_int_equal(kdf.alg, KDF_ARGON2ID);
+        assert_int_equal(kdf.cost, 2);
+        assert_int_equal(kdf.memory, 65536);
+        assert_int_equal(kdf_format_spec(&kdf, spec, sizeof(spec)), 0);
+        assert_string_equal(spec, "$argon2id$t=2,m=65536,p=1$");
+        assert_int_equal(kdf_parse_spec(spec, &parsed), 0);
+        assert_false(kdf_cost_differs(&kdf, &parsed));
+        parsed.cost++;
+        assert_true(kdf_cost_differs(&kdf, &parsed));
+        // never to a weaker algorithm or a lower cost
+        assert_false(kdf_cost_differs(&parsed, &kdf));
+        kdf_params_t weaker;
+        assert_int_equal(kdf_parse_spec("$pbkdf2-sha256$i=100000$", &weaker), 0);
+        assert_false(kdf_cost_differs(&kdf, &weaker));
+        assert_true(kdf_cost_differs(&weaker, &kdf));
+        kdf_default(&weaker);
+        assert_false(kdf_cost_differs(&kdf, &weaker));
+        assert_true(kdf_cost_differs(&weaker, &kdf));
+
+        char path[] = "/tmp/pinpam-kdf-XXXXXX";
+        int fd = mkstemp(path);
+        assert_true(fd >= 0);
+        close(fd);
+        assert_int_equal(kdf_config_save(path, &kdf), 0);
+        assert_int_equal(kdf_config_load(path, &parsed), 0);
+        assert_false(kdf_cost_differs(&kdf, &parsed));
+        unlink(path);
+        // missing config keeps legacy hashing
+        assert_int_equal(kdf_config_load(path, &parsed), 0);
+        assert_int_equal(parsed.alg, KDF_SHA256);
+        assert_int_equal(kdf_config_read(path, &parsed), ERR_KDF_CONFIG_MISSING);
+        assert_int_equal(kdf_config_save("/nonexistent/pinpam/kdf", &kdf), ERR_KDF_CONFIG_OPEN);
+}
+
+testfunc(users_load_mixed_kdf) {
+        (void) state;  // Unused variable
+
+        char path[] = "/tmp/pinpam-users-XXXXXX";
+        int fd = mkstemp(path);
+        assert_true(fd >= 0);
+        FILE *f = fdopen(fd, "w");
+        fprintf(f, "john:9f64a747e1b97f131fabb6b447296c9b6f0201e79fb3c5356e6c77e89b6a806a\n");
+        fprintf(f, "jane:$pbkdf2-sha256$i=1000$000102030405060708090a0b0c0d0e0f$"
+                "ae0b6d042e93b5a584e5ec7aafddd82ef7bef46c6567cbd45088b6e9b5989e69\n");
+        fclose(f);
+
+        pin_source_t pin = {1, 2, 3, 4};
+        pin_source_t wrong = {4, 3, 2, 1};
+        users_t *users = users_new(0);
+        assert_int_equal(users_load(users, path), 0);
+        user_t *u = user_new();
+        kdf_params_t kdf;
+        bool valid = false;
+        assert_int_equal(users_find(users, "john", u), 0);
+        assert_int_equal(user_verify_pin(u, pin, &valid), 0);
+        assert_true(valid);
+        assert_int_equal(users_find(users, "jane", u), 0);
+        user_get_kdf(u, &kdf);
+        assert_int_equal(kdf.alg, KDF_PBKDF2_SHA256);
+        assert_int_equal(user_verify_pin(u, pin, &valid), 0);
+        assert_true(valid);
+        assert_int_equal(user_verify_pin(u, wrong, &valid), 0);
+        assert_false(valid);
+
+        // records keep their algorithm through a dump
+        assert_int_equal(users_dump(users, path), 0);
+        users_free(users);
+        users = users_new(0);
+        assert_int_equal(users_load(users, path), 0);
+        assert_int_equal(users_find(users, "jane", u), 0);
+        assert_int_equal(user_verify_pin(u, pin, &valid), 0);
+        assert_true(valid);
+
+        user_free(u);
+        users_free(users);
+        unlink(path);
+}
+
+testfunc(kdf_pepper) {
+        (void) state;  // Unused variable
+
+        uint8_t pepper[PIN_PEPPER_LEN];
+        memset(pepper, 0x11, sizeof(pepper));
+        const char *value = "$sha256-pepper$$000102030405060708090a0b0c0d0e0f$"
+                "32f0cc799e368e5969c7653faff169c25e2daae94e990571546d4eb5952dffef";
+        kdf_params_t kdf;
+        const char *hash = NULL;
+        assert_int_equal(kdf_parse(value, &kdf, &hash), 0);
+        assert_int_equal(kdf.alg, KDF_SHA256_PEPPER);
+
+        pin_source_t pin = {1, 2, 3, 4};
+        pin_source_t wrong = {1, 2, 3, 5};
+        pin_hash_t out;
+        // no pepper, no verification
+        kdf_set_pepper(NULL);
+        assert_int_equal(kdf_hash(&kdf, pin, out), ERR_KDF_PEPPER);
+
+        kdf_set_pepper(pepper);
+        assert_int_equal(kdf_hash(&kdf, pin, out), 0);
+        assert_memory_equal(out, hash, PIN_HASH_LEN);
+
+        users_t *users = users_new(0);
+        pin_hash_t pin_hash;
+        memcpy(pin_hash, hash, PIN_HASH_LEN);
+        assert_int_equal(users_set(users, "john", &kdf, pin_hash), 0);
+        bool valid = false;
+        // the second call reuses the cached midstate
+        assert_int_equal(users_verify_pin(users, "john", pin, &valid), 0);
+        assert_true(valid);
+        assert_int_equal(users_verify_pin(users, "john", wrong, &valid), 0);
+        assert_false(valid);
+        assert_int_equal(users_verify_pin(users, "jane", pin, &valid),
+                         ERR_USERS_USER_NOT_FOUND);
+
+        // a new pepper invalidates cached midstates
+        pepper[0] ^= 1;
+        kdf_set_pepper(pepper);
+        assert_int_equal(users_verify_pin(users, "john", pin, &valid), 0);
+        assert_false(valid);
+
+        kdf_set_pepper(NULL);
+        assert_int_equal(users_verify_pin(users, "john", pin, &valid), ERR_KDF_PEPPER);
+        users_free(users);
+}
@@ -0,0 +1,177 @@
+#include "test.h"
+#include "../src/lib/merge.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#define HEX "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+#define HEX2 "fedcba9876543210fedcba9876543210fedcba9876543210fedcba9876543210"
+
+static void collect(void *ctx, merge_change_t change, const char *username) {
+        lines_add(ctx, "%s:%s", merge_change_name(change), username);
+}
+
+// base, ours and theirs
+static void files_new(tmpdir_t *dir, const char *paths[3]) {
+        tmpdir_new(dir, "merge");
+        for (int i = 0; i < 3; i++) {
+                char name[2] = {'0' + i, '\0'};
+                paths[i] = tmpdir_path(dir, name);
+        }
+}
+
+testfunc(merge_diff) {
+        (void) state;  // Unused variable
+
+        tmpdir_t dir;
+        const char *paths[3];
+        files_new(&dir, paths);
+        file_write(paths[0],
+                   "carol:" HEX "\n"
+                   "alice:" HEX "\n"
+                   "no colon here\n"
+                   "bob:" HEX "\n"
+                   "bob:" HEX2 "\n");      // the first bob counts
+        file_write(paths[1],
+                   "dave:" HEX "\n"
+                   "bob:" HEX "\n"
+                   "carol:$pbkdf2-sha256$i=1000$00000000000000000000000000000000$" HEX);
+
+        lines_t changes = {0};
+        merge_report_t report;
+        assert_int_equal(merge_diff(paths[0], paths[1], 0, collect, &changes, &report), 0);
+        assert_int_equal(report.users, 4);
+        assert_int_equal(report.runs, 0);
+        assert_int_equal(report.changes[MERGE_ADDED], 1);
+        assert_int_equal(report.changes[MERGE_REMOVED], 1);
+        assert_int_equal(report.changes[MERGE_CHANGED], 1);
+        assert_int_equal(changes.len, 3);
+        assert_string_equal(changes.lines[0], "removed:alice");
+        assert_string_equal(changes.lines[1], "changed:carol");
+        assert_string_equal(changes.lines[2], "added:dave");
+
+        // a file is the same as itself, a missing file is an error
+        assert_int_equal(merge_diff(paths[1], paths[1], 0, NULL, NULL, &report), 0);
+        assert_int_equal(report.changes[MERGE_CHANGED], 0);
+        assert_int_equal(merge_diff(paths[0], paths[2], 0, NULL, NULL, &report),
+                         ERR_MERGE_OPEN);
+
+        tmpdir_free(&dir);
+}
+
+testfunc(merge_three) {
+        (void) state;  // Unused variable
+
+        tmpdir_t dir;
+        const char *paths[3];
+        files_new(&dir, paths);
+        file_write(paths[0],
+                   "same:" HEX "\n"
+                   "ours:" HEX "\n"
+                   "theirs:" HEX "\n"
+                   "both:" HEX "\n"
+                   "conflict:" HEX "\n"
+                   "gone:" HEX "\n"
+                   "edited:" HEX "\n");
+        file_write(paths[1],
+                   "edited:" HEX2 "\n"
+                   "same:" HEX "\n"
+                   "ours:" HEX2 "\n"
+                   "theirs:" HEX "\n"
+                   "both:" HEX2 "\n"
+                   "conflict:" HEX2 "\n"
+                   "new:" HEX "\n");
+        file_write(paths[2],
+                   "same:" HEX "\n"
+                   "ours:" HEX "\n"
+                   "both:" HEX2 "\n"
+                   "conflict:$sha256-pepper$$" HEX "\n"
+                   "gone:" HEX "\n");
+
+        FILE *out = tmpfile();
+        assert_non_null(out);
+        lines_t changes = {0};
+        merge_report_t report;
+        assert_int_equal(merge_three(paths[0], paths[1], paths[2], 0, out,
+                                     collect, &changes, &report), 0);
+        assert_int_equal(report.users, 8);
+        assert_int_equal(report.changes[MERGE_CONFLICT], 2);
+        assert_int_equal(report.changes[MERGE_ADDED], 1);
+        assert_int_equal(report.changes[MERGE_REMOVED], 2);
+        assert_int_equal(report.changes[MERGE_CHANGED], 2);
+        assert_int_equal(changes.len, 7);
+        assert_string_equal(changes.lines[0], "changed:both");
+        assert_string_equal(changes.lines[1], "conflict:conflict");
+        // removed on one side and changed on the other
+        assert_string_equal(changes.lines[2], "conflict:edited");
+        assert_string_equal(changes.lines[3], "removed:gone");
+        assert_string_equal(changes.lines[4], "added:new");
+        assert_string_equal(changes.lines[5], "changed:ours");
+        assert_string_equal(changes.lines[6], "removed:theirs");
+
+        rewind(out);
+        char buf[1024];
+        const size_t len = fread(buf, 1, sizeof(buf) - 1, out);
+        buf[len] = '\0';
+        fclose(out);
+        assert_string_equal(buf,
+                            "both:" HEX2 "\n"
+                            "conflict:" HEX "\n"
+                            "edited:" HEX "\n"
+                            "new:" HEX "\n"
+                            "ours:" HEX2 "\n"
+                            "same:" HEX "\n");
+
+        tmpdir_free(&dir);
+}
+
+testfunc(merge_spill) {
+        (void) state;  // Unused variable
+
+        tmpdir_t dir;
+        const char *paths[3];
+        files_new(&dir, paths);
+        const int nusers = 20000;
+        FILE *a = fopen(paths[0], "w");
+        FILE *b = fopen(paths[1], "w");
+        assert_non_null(a);
+        assert_non_null(b);
+        for (int i = 0; i < nusers; i++) {
+                // both in a different order than sorted
+                const int ia = (i * 7919) % nusers;
+                const int ib = nusers - 1 - i;
+                fprintf(a, "user%d:" HEX "\n", ia);
+                if (ib % 1000 != 1) {
+                        fprintf(b, "user%d:%s\n", ib, ib % 1000 == 2 ? HEX2 : HEX);
+                }
+        }
+        // later duplicates in other runs do not count
+        for (int i = 0; i < nusers; i += 100) {
+                fprintf(a, "user%d:" HEX2 "\n", i);
+        }
+        assert_int_equal(fclose(a), 0);
+        assert_int_equal(fclose(b), 0);
+
+        merge_report_t report;
+        assert_int_equal(merge_diff(paths[0], paths[1], 2 * MERGE_MEM_MIN, NULL, NULL,
+                                    &report), 0);
+        assert_true(report.runs > 4);
+        assert_int_equal(report.users, nusers);
+        assert_int_equal(report.changes[MERGE_ADDED], 0);
+        assert_int_equal(report.changes[MERGE_REMOVED], nusers / 1000);
+        assert_int_equal(report.changes[MERGE_CHANGED], nusers / 1000);
+
+        // a line longer than the sort buffer
+        FILE *c = fopen(paths[2], "w");
+        assert_non_null(c);
+        fputs("long:", c);
+        for (int i = 0; i < MERGE_MEM_MIN; i++) {
+                fputc('0', c);
+        }
+        fputc('\n', c);
+        assert_int_equal(fclose(c), 0);
+        assert_int_equal(merge_diff(paths[0], paths[2], 2 * MERGE_MEM_MIN, NULL, NULL,
+                                    &report), ERR_MERGE_LINE);
+
+        tmpdir_free(&dir);
+}
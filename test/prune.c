@@ -0,0 +1,106 @@
+#include "test.h"
+#include "../src/lib/prune.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define HEX "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+
+static void collect(void *ctx, prune_file_t file, const char *username) {
+        lines_add(ctx, "%s:%s", file == PRUNE_USERS ? "users" : "state", username);
+}
+
+static const char *users_content =
+        "alice:" HEX "\n"
+        "bob:" HEX "\n"
+        "@wheel:" HEX "\n"
+        "no colon here\n"
+        "carol:" HEX "\n"
+        "dave:" HEX;            // no newline at the end
+
+testfunc(prune_run) {
+        (void) state;  // Unused variable
+
+        tmpdir_t dir;
+        tmpdir_new(&dir, "prune");
+        const char *users = tmpdir_path(&dir, "users");
+        const char *statefile = tmpdir_path(&dir, "state");
+        const char *passwd = tmpdir_path(&dir, "passwd");
+        file_write(users, users_content);
+        file_write(statefile, "bob:1\nalice:2\nghost:3\n");
+        // a name listed twice is one account
+        file_write(passwd,
+                   "alice:x:1000:1000::/home/alice:/bin/sh\n"
+                   "carol:x:1001:1001::/home/carol:/bin/sh\n"
+                   "alice:x:1000:1000::/home/alice:/bin/sh\n");
+
+        lines_t pruned = {0};
+        prune_report_t report;
+        char buf[1024];
+        assert_int_equal(prune_run(users, statefile, passwd, true, collect, &pruned, &report), 0);
+        assert_int_equal(report.accounts, 2);
+        assert_int_equal(report.lines[PRUNE_USERS], 6);
+        assert_int_equal(report.lines[PRUNE_STATE], 3);
+        assert_int_equal(report.removed[PRUNE_USERS], 2);
+        assert_int_equal(report.removed[PRUNE_STATE], 2);
+        assert_int_equal(pruned.len, 4);
+        assert_string_equal(pruned.lines[0], "users:bob");
+        assert_string_equal(pruned.lines[1], "users:dave");
+        assert_string_equal(pruned.lines[2], "state:bob");
+        assert_string_equal(pruned.lines[3], "state:ghost");
+        // a dry run changes nothing
+        assert_string_equal(file_read(users, buf, sizeof(buf)), users_content);
+        assert_string_equal(file_read(statefile, buf, sizeof(buf)), "bob:1\nalice:2\nghost:3\n");
+
+        assert_int_equal(prune_run(users, statefile, passwd, false, NULL, NULL, &report), 0);
+        assert_string_equal(file_read(users, buf, sizeof(buf)),
+                            "alice:" HEX "\n"
+                            "@wheel:" HEX "\n"
+                            "no colon here\n"
+                            "carol:" HEX "\n");
+        assert_string_equal(file_read(statefile, buf, sizeof(buf)), "alice:2\n");
+
+        // a file without orphans is not written
+        file_write(statefile, "alice:1\nghost:1\n");
+        struct stat before, after;
+        assert_int_equal(stat(users, &before), 0);
+        assert_int_equal(prune_run(users, statefile, passwd, false, NULL, NULL, &report), 0);
+        assert_int_equal(report.removed[PRUNE_USERS], 0);
+        assert_int_equal(report.removed[PRUNE_STATE], 1);
+        assert_int_equal(stat(users, &after), 0);
+        assert_int_equal(before.st_ino, after.st_ino);
+        assert_string_equal(file_read(statefile, buf, sizeof(buf)), "alice:1\n");
+
+        // no accounts would drop everything
+        file_write(passwd, "");
+        assert_int_equal(prune_run(users, statefile, passwd, false, NULL, NULL, &report),
+                         ERR_PRUNE_ACCOUNTS);
+        unlink(passwd);
+        assert_int_equal(prune_run(users, statefile, passwd, false, NULL, NULL, &report),
+                         ERR_PRUNE_OPEN);
+        assert_non_null(strstr(file_read(users, buf, sizeof(buf)), "carol:"));
+
+        tmpdir_free(&dir);
+}
+
+testfunc(prune_nss) {
+        (void) state;  // Unused variable
+
+        tmpdir_t dir;
+        tmpdir_new(&dir, "prune");
+        const char *users = tmpdir_path(&dir, "users");
+        const char *missing = tmpdir_path(&dir, "missing");
+        file_write(users, "root:" HEX "\npinpam-no-such-user:" HEX "\n");
+
+        // root is an account on every system, a missing state file is empty
+        lines_t pruned = {0};
+        prune_report_t report;
+        assert_int_equal(prune_run(users, missing, NULL, true, collect, &pruned, &report), 0);
+        assert_true(report.accounts > 0);
+        assert_int_equal(report.lines[PRUNE_STATE], 0);
+        assert_int_equal(pruned.len, 1);
+        assert_string_equal(pruned.lines[0], "users:pinpam-no-such-user");
+
+        tmpdir_free(&dir);
+}
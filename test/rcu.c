@@ -0,0 +1,198 @@
+#include "test.h"
+#include "../src/lib/rcu.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#define HEX "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+
+#define RCU_TEST_READERS 4
+#define RCU_TEST_UPDATES 300
+
+static int add_carol(void *ctx, users_t *users, state_t *state) {
+        (void) ctx;
+        kdf_params_t kdf;
+        kdf_default(&kdf);
+        state_set_attempts(state, "alice", 0);
+        state_set_attempts(state, "carol", 1);
+        return users_set(users, "carol", &kdf, (const uint8_t*)HEX);
+}
+
+static int fail_update(void *ctx, users_t *users, state_t *state) {
+        (void) ctx;
+        users_remove(users, "alice");
+        return 42;
+}
+
+static int count_user(void *ctx, user_t *user) {
+        (void) user;
+        (*(size_t*)ctx)++;
+        return 0;
+}
+
+testfunc(rcu_snapshots) {
+        (void) state;  // Unused variable
+
+        tmpdir_t dir;
+        tmpdir_new(&dir, "rcu");
+        const char *userspath = tmpdir_path(&dir, "users");
+        const char *statepath = tmpdir_path(&dir, "state");
+        file_write(userspath, "alice:" HEX "\nbob:" HEX "\n");
+        file_write(statepath, "alice:2\n");
+
+        rcu_t *rcu = rcu_new();
+        assert_non_null(rcu);
+        rcu_reader_t *reader = rcu_reader_new(rcu);
+        assert_non_null(reader);
+        const rcu_snapshot_t *snap = rcu_pin(reader);
+        assert_int_equal(rcu_generation(snap), 0);
+        assert_int_equal(rcu_find(snap, "alice", NULL), ERR_USERS_USER_NOT_FOUND);
+        rcu_unpin(reader);
+
+        assert_int_equal(rcu_load(rcu, userspath, statepath), 0);
+        snap = rcu_pin(reader);
+        assert_int_equal(rcu_generation(snap), 1);
+        user_t *user = user_new();
+        assert_int_equal(rcu_find(snap, "alice", user), 0);
+        const char *name = user_get_name(user);
+        assert_string_equal(name, "alice");
+        free((void*)name);
+        assert_int_equal(rcu_attempts(snap, "alice"), 2);
+        assert_int_equal(rcu_attempts(snap, "bob"), 0);
+        rcu_unpin(reader);
+
+        // an update publishes a changed copy, a failed one nothing
+        assert_int_equal(rcu_update(rcu, add_carol, NULL), 0);
+        assert_int_equal(rcu_update(rcu, fail_update, NULL), 42);
+        snap = rcu_pin(reader);
+        assert_int_equal(rcu_generation(snap), 2);
+        assert_int_equal(rcu_find(snap, "alice", user), 0);
+        assert_int_equal(rcu_find(snap, "carol", user), 0);
+        assert_int_equal(rcu_attempts(snap, "alice"), 0);
+        assert_int_equal(rcu_attempts(snap, "carol"), 1);
+        size_t count = 0;
+        assert_int_equal(rcu_scan_prefix(snap, "", NULL, count_user, &count), 0);
+        assert_int_equal(count, 3);
+        rcu_unpin(reader);
+
+        // a missing users file is empty as for the loader, unreadable ones fail
+        assert_int_equal(rcu_load(rcu, dir.dir, statepath), ERR_RCU_USERS);
+        snap = rcu_pin(reader);
+        assert_int_equal(rcu_generation(snap), 2);
+        rcu_unpin(reader);
+
+        // the slots are reused once freed
+        rcu_reader_t *readers[RCU_READERS_MAX];
+        readers[0] = reader;
+        for (size_t i = 1; i < RCU_READERS_MAX; i++) {
+                readers[i] = rcu_reader_new(rcu);
+                assert_non_null(readers[i]);
+        }
+        assert_null(rcu_reader_new(rcu));
+        rcu_reader_free(readers[7]);
+        readers[7] = rcu_reader_new(rcu);
+        assert_non_null(readers[7]);
+        for (size_t i = 0; i < RCU_READERS_MAX; i++) {
+                rcu_reader_free(readers[i]);
+        }
+
+        user_free(user);
+        rcu_free(rcu);
+        tmpdir_free(&dir);
+}
+
+struct rcu_run {
+        rcu_t           *rcu;
+        atomic_bool     done;
+        atomic_size_t   reads;
+        atomic_size_t   errors;
+        size_t          updates;
+};
+
+// generation g has the user gen-g, not gen-(g-1), and g attempts of counter
+static int next_generation(void *ctx, users_t *users, state_t *state) {
+        struct rcu_run *run = ctx;
+        kdf_params_t kdf;
+        kdf_default(&kdf);
+        char name[32];
+        const size_t gen = ++run->updates;
+        snprintf(name, sizeof(name), "gen-%zu", gen);
+        int err = users_set(users, name, &kdf, (const uint8_t*)HEX);
+        snprintf(name, sizeof(name), "gen-%zu", gen - 1);
+        if (err == 0 && gen > 1) {
+                err = users_remove(users, name);
+        }
+        state_set_attempts(state, "counter", gen % 256);
+        return err;
+}
+
+static void* rcu_read_loop(void *arg) {
+        struct rcu_run *run = arg;
+        rcu_reader_t *reader = rcu_reader_new(run->rcu);
+        if (reader == NULL) {
+                atomic_fetch_add(&run->errors, 1);
+                return NULL;
+        }
+        user_t *user = user_new();
+        char name[32];
+        while (!atomic_load(&run->done)) {
+                const rcu_snapshot_t *snap = rcu_pin(reader);
+                const uint64_t gen = rcu_generation(snap);
+                size_t errors = 0;
+                if (gen > 0) {
+                        snprintf(name, sizeof(name), "gen-%zu", (size_t)gen);
+                        errors += rcu_find(snap, name, user) != 0;
+                        snprintf(name, sizeof(name), "gen-%zu", (size_t)gen - 1);
+                        errors += rcu_find(snap, name, NULL) != ERR_USERS_USER_NOT_FOUND;
+                        errors += rcu_attempts(snap, "counter") != gen % 256;
+                }
+                rcu_unpin(reader);
+                atomic_fetch_add(&run->errors, errors);
+                atomic_fetch_add(&run->reads, 1);
+        }
+        user_free(user);
+        rcu_reader_free(reader);
+        return NULL;
+}
+
+testfunc(rcu_concurrent) {
+        (void) state;  // Unused variable
+
+        struct rcu_run run;
+        run.rcu = rcu_new();
+        assert_non_null(run.rcu);
+        atomic_init(&run.done, false);
+        atomic_init(&run.reads, 0);
+        atomic_init(&run.errors, 0);
+        run.updates = 0;
+
+        pthread_t threads[RCU_TEST_READERS];
+        for (int i = 0; i < RCU_TEST_READERS; i++) {
+                assert_int_equal(pthread_create(&threads[i], NULL, rcu_read_loop, &run), 0);
+        }
+        // every snapshot a reader pins is consistent while the writer
+        // replaces them, the writer lets reads in between on a single CPU
+        for (int i = 0; i < RCU_TEST_UPDATES; i++) {
+                const size_t reads = atomic_load(&run.reads);
+                while (atomic_load(&run.reads) == reads) {
+                        sched_yield();
+                }
+                assert_int_equal(rcu_update(run.rcu, next_generation, &run), 0);
+        }
+        atomic_store(&run.done, true);
+        for (int i = 0; i < RCU_TEST_READERS; i++) {
+                pthread_join(threads[i], NULL);
+        }
+        assert_int_equal(atomic_load(&run.errors), 0);
+        assert_true(atomic_load(&run.reads) > 0);
+
+        rcu_reader_t *reader = rcu_reader_new(run.rcu);
+        const rcu_snapshot_t *snap = rcu_pin(reader);
+        assert_int_equal(rcu_generation(snap), RCU_TEST_UPDATES);
+        rcu_reader_free(reader);
+        rcu_free(run.rcu);
+}
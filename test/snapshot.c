@@ -0,0 +1,173 @@
+#include "test.h"
+#include "../src/lib/snapshot.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+testfunc(snapshot_rebuild) {
+        (void) state;  // Unused variable
+
+        tmpdir_t dir;
+        tmpdir_new(&dir, "snap");
+        const char *src = tmpdir_path(&dir, "users");
+        tmpdir_path(&dir, "run");
+        const char *snap = tmpdir_path(&dir, "run/users.snap");
+        tmpdir_path(&dir, "run/users.snap.lock");
+
+        pin_hash_t pin1 = {'1'};
+        pin_hash_t pin2 = {'2'};
+        users_t *users = users_new(0);
+        users_update(users, "John", pin1);
+        users_update(users, "Jane", pin2);
+        assert_int_equal(users_dump(users, src), 0);
+
+        // missing snapshot is built by the first caller
+        snapshot_t *s = NULL;
+        assert_int_equal(snapshot_open(&s, src, snap), 0);
+        assert_true(snapshot_rebuilt(s));
+        assert_int_equal(snapshot_len(s), 2);
+        user_t *u = user_new();
+        assert_int_equal(snapshot_find(s, "Jane", u), 0);
+        assert_true(user_check_pin(u, pin2));
+        assert_int_equal(snapshot_find(s, "Jan", NULL), ERR_USERS_USER_NOT_FOUND);
+        assert_int_equal(snapshot_find(s, "Janet", NULL), ERR_USERS_USER_NOT_FOUND);
+        snapshot_close(s);
+
+        // fresh snapshot is mapped as is
+        assert_int_equal(snapshot_open(&s, src, snap), 0);
+        assert_false(snapshot_rebuilt(s));
+        snapshot_close(s);
+
+        // users file change invalidates it
+        users_remove(users, "John");
+        assert_int_equal(users_dump(users, src), 0);
+        assert_int_equal(snapshot_open(&s, src, snap), 0);
+        assert_true(snapshot_rebuilt(s));
+        assert_int_equal(snapshot_find(s, "John", u), ERR_USERS_USER_NOT_FOUND);
+        assert_int_equal(snapshot_find(s, "Jane", u), 0);
+        snapshot_close(s);
+
+        user_free(u);
+        users_free(users);
+        tmpdir_free(&dir);
+}
+
+testfunc(snapshot_front_coding) {
+        (void) state;  // Unused variable
+
+        tmpdir_t dir;
+        tmpdir_new(&dir, "snap");
+        const char *src = tmpdir_path(&dir, "users");
+        const char *snap = tmpdir_path(&dir, "users.snap");
+        tmpdir_path(&dir, "users.snap.lock");
+
+        // names sharing long prefixes, some a prefix of others
+        static const char * const prefixes[] = {"svc-", "adm-", "ext.", "a", "ab"};
+        const size_t n = 300;
+        kdf_params_t kdf;
+        kdf_default(&kdf);
+        pin_hash_t pin;
+        memset(pin, 'a', PIN_HASH_LEN);
+        users_t *users = users_new(0);
+        for (size_t p = 0; p < 5; p++) {
+                for (size_t i = 0; i < n; i++) {
+                        char name[32];
+                        snprintf(name, sizeof(name), "%s%zu", prefixes[p], i);
+                        // a second, salted kdf for one prefix
+                        kdf.alg = p == 2 ? KDF_PBKDF2_SHA256 : KDF_SHA256;
+                        kdf.cost = p == 2 ? 1000 : 0;
+                        kdf.salt[0] = p == 2 ? i : 0;
+                        pin[PIN_HASH_LEN - 1] = "0123456789abcdef"[i % 16];
+                        assert_int_equal(users_set(users, name, &kdf, pin), 0);
+                }
+        }
+        assert_int_equal(users_dump(users, src), 0);
+
+        snapshot_t *s = NULL;
+        assert_int_equal(snapshot_open(&s, src, snap), 0);
+        assert_int_equal(snapshot_len(s), 5 * n);
+        user_t *u = user_new();
+        for (size_t p = 0; p < 5; p++) {
+                for (size_t i = 0; i < n; i++) {
+                        char name[32], absent[40];
+                        snprintf(name, sizeof(name), "%s%zu", prefixes[p], i);
+                        assert_int_equal(snapshot_find(s, name, u), 0);
+                        pin[PIN_HASH_LEN - 1] = "0123456789abcdef"[i % 16];
+                        assert_true(user_check_pin(u, pin));
+                        user_get_kdf(u, &kdf);
+                        assert_int_equal(kdf.alg, p == 2 ? KDF_PBKDF2_SHA256 : KDF_SHA256);
+                        assert_int_equal(kdf.salt[0], p == 2 ? (uint8_t)i : 0);
+
+                        snprintf(absent, sizeof(absent), "%s-", name);
+                        assert_int_equal(snapshot_find(s, absent, NULL), ERR_USERS_USER_NOT_FOUND);
+                        snprintf(absent, sizeof(absent), "%s/", name);
+                        assert_int_equal(snapshot_find(s, absent, NULL), ERR_USERS_USER_NOT_FOUND);
+                }
+        }
+        assert_int_equal(snapshot_find(s, "", NULL), ERR_USERS_USER_NOT_FOUND);
+        assert_int_equal(snapshot_find(s, "0", NULL), ERR_USERS_USER_NOT_FOUND);
+        assert_int_equal(snapshot_find(s, "abc", NULL), ERR_USERS_USER_NOT_FOUND);
+        assert_int_equal(snapshot_find(s, "svc-", NULL), ERR_USERS_USER_NOT_FOUND);
+        assert_int_equal(snapshot_find(s, "zzz", NULL), ERR_USERS_USER_NOT_FOUND);
+        snapshot_close(s);
+
+        user_free(u);
+        users_free(users);
+        tmpdir_free(&dir);
+}
+
+testfunc(snapshot_untrusted) {
+        (void) state;  // Unused variable
+
+        tmpdir_t dir;
+        tmpdir_new(&dir, "snap");
+        const char *src = tmpdir_path(&dir, "users");
+        const char *run = tmpdir_path(&dir, "run");
+        const char *other = tmpdir_path(&dir, "run/other");
+        const char *snap = tmpdir_path(&dir, "run/users.snap");
+        const char *lock = tmpdir_path(&dir, "run/users.snap.lock");
+
+        pin_hash_t pin = {'1'};
+        users_t *users = users_new(0);
+        users_update(users, "John", pin);
+        assert_int_equal(users_dump(users, src), 0);
+        snapshot_t *s = NULL;
+        assert_int_equal(snapshot_open(&s, src, snap), 0);
+        snapshot_close(s);
+
+        // a symlink to a fresh snapshot is replaced by a rebuilt one
+        assert_int_equal(rename(snap, other), 0);
+        assert_int_equal(symlink(other, snap), 0);
+        assert_int_equal(snapshot_open(&s, src, snap), 0);
+        assert_true(snapshot_rebuilt(s));
+        snapshot_close(s);
+        struct stat st;
+        assert_int_equal(lstat(snap, &st), 0);
+        assert_true(S_ISREG(st.st_mode));
+
+        // so is a snapshot others can write
+        assert_int_equal(chmod(snap, 0666), 0);
+        assert_int_equal(snapshot_open(&s, src, snap), 0);
+        assert_true(snapshot_rebuilt(s));
+        snapshot_close(s);
+        assert_int_equal(stat(snap, &st), 0);
+        assert_int_equal(st.st_mode & 0777, 0600);
+
+        // a symlinked lock is not taken
+        assert_int_equal(unlink(lock), 0);
+        assert_int_equal(symlink(other, lock), 0);
+        assert_int_equal(unlink(snap), 0);
+        assert_int_equal(snapshot_open(&s, src, snap), ERR_SNAPSHOT_LOCK);
+        assert_int_equal(unlink(lock), 0);
+
+        // nor is a directory everyone can write
+        assert_int_equal(chmod(run, 0777), 0);
+        assert_int_equal(snapshot_open(&s, src, snap), ERR_SNAPSHOT_UNSAFE);
+        assert_int_equal(chmod(run, 01777), 0);
+        assert_int_equal(snapshot_open(&s, src, snap), 0);
+        snapshot_close(s);
+
+        users_free(users);
+        tmpdir_free(&dir);
+}
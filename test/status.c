@@ -0,0 +1,114 @@
+#include "test.h"
+#include "../src/lib/state.h"
+#include "../src/lib/status.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HEX "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef"
+
+static int visit_entry(void *ctx, const char *user, uint8_t attempts) {
+        lines_add(ctx, "%s:%d", user, attempts);
+        return 0;
+}
+
+testfunc(state_lookup) {
+        (void) state;  // Unused variable
+
+        tmpdir_t dir;
+        tmpdir_new(&dir, "state");
+        const char *path = tmpdir_path(&dir, "state");
+        file_write(path, "alice:1\nbob:2\nalice:3\n");
+
+        state_t *s = state_new();
+        assert_non_null(s);
+        assert_int_equal(state_load(s, path), 0);
+        // the first lookup scans, the later ones use the index, the same
+        // first entry counts for both
+        for (int i = 0; i < 3; i++) {
+                uint8_t attempts = 9;
+                state_get_attempts(s, "alice", &attempts);
+                assert_int_equal(attempts, 1);
+                state_get_attempts(s, "carol", &attempts);
+                assert_int_equal(attempts, 0);
+        }
+        state_set_attempts(s, "carol", 2);
+        state_set_attempts(s, "alice", 0);
+        uint8_t attempts = 9;
+        state_get_attempts(s, "carol", &attempts);
+        assert_int_equal(attempts, 2);
+        state_get_attempts(s, "alice", &attempts);
+        assert_int_equal(attempts, 0);
+
+        lines_t visited = {0};
+        assert_int_equal(state_visit(s, visit_entry, &visited), 0);
+        assert_int_equal(visited.len, 3);
+        assert_string_equal(visited.lines[0], "alice:0");
+        assert_string_equal(visited.lines[1], "bob:2");
+        assert_string_equal(visited.lines[2], "carol:2");
+
+        state_free(s);
+        tmpdir_free(&dir);
+}
+
+static int collect(void *ctx, const status_user_t *user) {
+        lines_add(ctx, "%s:%d:%c%c", user->username, user->attempts, user->enrolled ? 'e' : '-',
+                  user->locked ? 'l' : '-');
+        return 0;
+}
+
+testfunc(status_run) {
+        (void) state;  // Unused variable
+
+        tmpdir_t dir;
+        tmpdir_new(&dir, "status");
+        const char *users = tmpdir_path(&dir, "users");
+        const char *statefile = tmpdir_path(&dir, "state");
+        file_write(users,
+                   "svc-b:" HEX "\n"
+                   "alice:" HEX "\n"
+                   "svc-a:" HEX "\n");
+        file_write(statefile, "svc-z:1\nsvc-a:3\nghost:2\nalice:1\n");
+
+        lines_t statuses = {0};
+        assert_int_equal(status_run(users, statefile, NULL, collect, &statuses), 0);
+        assert_int_equal(statuses.len, 5);
+        assert_string_equal(statuses.lines[0], "alice:1:e-");
+        assert_string_equal(statuses.lines[1], "svc-a:3:el");
+        assert_string_equal(statuses.lines[2], "svc-b:0:e-");
+        assert_string_equal(statuses.lines[3], "svc-z:1:--");
+        assert_string_equal(statuses.lines[4], "ghost:2:--");
+
+        memset(&statuses, 0, sizeof(statuses));
+        assert_int_equal(status_run(users, statefile, "svc-", collect, &statuses), 0);
+        assert_int_equal(statuses.len, 3);
+        assert_string_equal(statuses.lines[2], "svc-z:1:--");
+
+        // members of a group with a record are enrolled
+        file_write(users, "alice:" HEX "\n@root:" HEX "\n");
+        file_write(statefile, "root:3\nghost:2\n");
+        memset(&statuses, 0, sizeof(statuses));
+        assert_int_equal(status_run(users, statefile, NULL, collect, &statuses), 0);
+        assert_int_equal(statuses.len, 4);
+        assert_string_equal(statuses.lines[2], "root:3:el");
+        assert_string_equal(statuses.lines[3], "ghost:2:--");
+
+        // no state file, no attempts
+        file_write(users,
+                   "svc-b:" HEX "\n"
+                   "alice:" HEX "\n"
+                   "svc-a:" HEX "\n");
+        unlink(statefile);
+        memset(&statuses, 0, sizeof(statuses));
+        assert_int_equal(status_run(users, statefile, NULL, collect, &statuses), 0);
+        assert_int_equal(statuses.len, 3);
+        assert_string_equal(statuses.lines[1], "svc-a:0:e-");
+
+        // as the loader a missing users file is empty
+        unlink(users);
+        memset(&statuses, 0, sizeof(statuses));
+        assert_int_equal(status_run(users, statefile, NULL, collect, &statuses), 0);
+        assert_int_equal(statuses.len, 0);
+        tmpdir_free(&dir);
+}
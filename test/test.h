@@ -8,10 +8,110 @@
 
 #define testfunc(name) void test_##name(void **state)
 
+/*
+ * test/util.c: the files of a test live in /tmp/pinpam-<name>-XXXXXX.
+ * tmpdir_path names a file or subdirectory in it, tmpdir_free removes
+ * the named ones, last first, and asserts nothing else is left.
+ */
+#define TMPDIR_FILES 12
+
+typedef struct tmpdir {
+        char    dir[40];
+        char    paths[TMPDIR_FILES][80];
+        size_t  len;
+} tmpdir_t;
+
+void tmpdir_new(tmpdir_t *tmp, const char *name);
+const char* tmpdir_path(tmpdir_t *tmp, const char *file);
+void tmpdir_free(tmpdir_t *tmp);
+
+void file_write(const char *path, const char *content);
+// up to size - 1 bytes of the file
+char* file_read(const char *path, char *buf, size_t size);
+
+// what a visit callback saw, in order
+typedef struct lines {
+        char    lines[16][48];
+        size_t  len;
+} lines_t;
+
+void lines_add(lines_t *lines, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
 testfunc(users_update);
 testfunc(users_remove);
 testfunc(users_iterate);
+testfunc(users_find_after_remove);
+testfunc(users_dump);
+testfunc(users_dump_faults);
+testfunc(users_scan);
+testfunc(users_load_threads);
+testfunc(users_remove_compact);
+testfunc(users_remove_duplicate);
 
 testfunc(hash_pin);
+testfunc(hash_pin_midstate);
+
+testfunc(bulk_read_csv);
+testfunc(bulk_read_jsonl);
+testfunc(bulk_read_duplicate);
+testfunc(bulk_apply);
+
+testfunc(txn_commit);
+testfunc(txn_abort);
+testfunc(txn_rollback);
+
+testfunc(snapshot_rebuild);
+testfunc(snapshot_front_coding);
+testfunc(snapshot_untrusted);
+
+testfunc(argon2id_rfc9106);
+testfunc(kdf_hash);
+testfunc(kdf_spec);
+testfunc(users_load_mixed_kdf);
+testfunc(kdf_pepper);
+
+testfunc(auth_retry);
+testfunc(auth_locked);
+testfunc(auth_pending);
+testfunc(auth_concurrent);
+
+testfunc(audit_append);
+testfunc(audit_wrap);
+testfunc(trace_spans);
+
+testfunc(backend_differential);
+testfunc(backend_resolve);
+testfunc(backend_lock);
+testfunc(backend_btree_large);
+
+testfunc(fsck_check);
+testfunc(fsck_repair);
+testfunc(fsck_group_member);
+
+testfunc(groups_cache);
+testfunc(groups_nss);
+
+testfunc(tstamp_check);
+testfunc(tstamp_invalidate);
+
+testfunc(prune_run);
+testfunc(prune_nss);
+
+testfunc(delta_roundtrip);
+testfunc(delta_apply_errors);
+testfunc(delta_apply_crafted);
+
+testfunc(merge_diff);
+testfunc(merge_three);
+testfunc(merge_spill);
+
+testfunc(state_lookup);
+testfunc(status_run);
+
+testfunc(rcu_snapshots);
+testfunc(rcu_concurrent);
+
+testfunc(alloc_counter);
+testfunc(alloc_arena);
 
 #endif
@@ -6,7 +6,62 @@ int main(void) {
         cmocka_unit_test(test_users_update),
         cmocka_unit_test(test_users_remove),
         cmocka_unit_test(test_users_iterate),
+        cmocka_unit_test(test_users_find_after_remove),
+        cmocka_unit_test(test_users_dump),
+        cmocka_unit_test(test_users_dump_faults),
+        cmocka_unit_test(test_users_scan),
+        cmocka_unit_test(test_users_load_threads),
+        cmocka_unit_test(test_users_remove_compact),
+        cmocka_unit_test(test_users_remove_duplicate),
         cmocka_unit_test(test_hash_pin),
+        cmocka_unit_test(test_hash_pin_midstate),
+        cmocka_unit_test(test_bulk_read_csv),
+        cmocka_unit_test(test_bulk_read_jsonl),
+        cmocka_unit_test(test_bulk_read_duplicate),
+        cmocka_unit_test(test_bulk_apply),
+        cmocka_unit_test(test_txn_commit),
+        cmocka_unit_test(test_txn_abort),
+        cmocka_unit_test(test_txn_rollback),
+        cmocka_unit_test(test_snapshot_rebuild),
+        cmocka_unit_test(test_snapshot_front_coding),
+        cmocka_unit_test(test_snapshot_untrusted),
+        cmocka_unit_test(test_argon2id_rfc9106),
+        cmocka_unit_test(test_kdf_hash),
+        cmocka_unit_test(test_kdf_spec),
+        cmocka_unit_test(test_users_load_mixed_kdf),
+        cmocka_unit_test(test_kdf_pepper),
+        cmocka_unit_test(test_auth_retry),
+        cmocka_unit_test(test_auth_locked),
+        cmocka_unit_test(test_auth_pending),
+        cmocka_unit_test(test_auth_concurrent),
+        cmocka_unit_test(test_audit_append),
+        cmocka_unit_test(test_audit_wrap),
+        cmocka_unit_test(test_trace_spans),
+        cmocka_unit_test(test_backend_differential),
+        cmocka_unit_test(test_backend_resolve),
+        cmocka_unit_test(test_backend_lock),
+        cmocka_unit_test(test_backend_btree_large),
+        cmocka_unit_test(test_fsck_check),
+        cmocka_unit_test(test_fsck_repair),
+        cmocka_unit_test(test_fsck_group_member),
+        cmocka_unit_test(test_groups_cache),
+        cmocka_unit_test(test_groups_nss),
+        cmocka_unit_test(test_tstamp_check),
+        cmocka_unit_test(test_tstamp_invalidate),
+        cmocka_unit_test(test_prune_run),
+        cmocka_unit_test(test_prune_nss),
+        cmocka_unit_test(test_delta_roundtrip),
+        cmocka_unit_test(test_delta_apply_errors),
+        cmocka_unit_test(test_delta_apply_crafted),
+        cmocka_unit_test(test_merge_diff),
+        cmocka_unit_test(test_merge_three),
+        cmocka_unit_test(test_merge_spill),
+        cmocka_unit_test(test_state_lookup),
+        cmocka_unit_test(test_status_run),
+        cmocka_unit_test(test_rcu_snapshots),
+        cmocka_unit_test(test_rcu_concurrent),
+        cmocka_unit_test(test_alloc_counter),
+        cmocka_unit_test(test_alloc_arena),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
@@ -0,0 +1,63 @@
+#include "test.h"
+#include "../src/lib/trace.h"
+#include "../src/lib/users.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static size_t count(const char *s, const char *needle) {
+        size_t n = 0;
+        for (const char *p = strstr(s, needle); p != NULL; p = strstr(p + 1, needle)) {
+                n++;
+        }
+        return n;
+}
+
+testfunc(trace_spans) {
+        (void) state;  // Unused variable
+
+        char path[] = "/tmp/pinpam-trace-XXXXXX";
+        int fd = mkstemp(path);
+        assert_true(fd >= 0);
+        close(fd);
+
+        // no-ops before the start
+        trace_begin("ignored");
+        trace_end("ignored");
+        assert_false(trace_enabled());
+        assert_int_equal(trace_flush(), 0);
+
+        assert_int_equal(trace_start(path), 0);
+        assert_true(trace_enabled());
+        FILE *f = fopen(path, "w");
+        assert_non_null(f);
+        fprintf(f, "alice:%064d\nbob:%064d\n", 0, 1);
+        fclose(f);
+        users_t *storage = users_new(10);
+        assert_int_equal(users_load(storage, path), 0);
+        users_find(storage, "nobody", NULL);
+        users_free(storage);
+        assert_int_equal(trace_flush(), 0);
+        assert_false(trace_enabled());
+
+        // the trace of this process, next to the path
+        char trace[sizeof(path) + 16];
+        snprintf(trace, sizeof(trace), "%s.%d", path, getpid());
+        f = fopen(trace, "r");
+        assert_non_null(f);
+        char buf[8192];
+        size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+        buf[len] = '\0';
+        fclose(f);
+        unlink(trace);
+        unlink(path);
+
+        assert_non_null(strstr(buf, "\"traceEvents\":["));
+        assert_null(strstr(buf, "ignored"));
+        assert_int_equal(count(buf, "\"name\":\"users_load\""), 2);
+        assert_int_equal(count(buf, "\"name\":\"users_scan_line\""), 2);
+        assert_int_equal(count(buf, "\"name\":\"users_find\""), 2);
+        assert_int_equal(count(buf, "\"ph\":\"B\""), count(buf, "\"ph\":\"E\""));
+}
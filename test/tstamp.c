@@ -0,0 +1,116 @@
+#include "test.h"
+#include "../src/lib/tstamp.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static void key_of(tstamp_key_t *key, pid_t sid, const char *tty) {
+        memset(key, 0, sizeof(tstamp_key_t));
+        key->uid = 1000;
+        key->sid = sid;
+        key->start = 4242;
+        snprintf(key->tty, sizeof(key->tty), "%s", tty);
+}
+
+static bool fresh_for(const char *dir, const char *username, const tstamp_key_t *key,
+                      unsigned int timeout) {
+        bool fresh = true;
+        assert_int_equal(tstamp_check(dir, username, key, timeout, &fresh), 0);
+        return fresh;
+}
+
+testfunc(tstamp_check) {
+        (void) state;  // Unused variable
+
+        tmpdir_t dir;
+        tmpdir_new(&dir, "tstamp");
+        // the directory is made on update
+        const char *tsdir = tmpdir_path(&dir, "ts");
+
+        tstamp_key_t key, other;
+        key_of(&key, 100, "pts/1");
+        assert_false(fresh_for(tsdir, "alice", &key, 60));
+        assert_int_equal(tstamp_update(tsdir, "alice", &key), 0);
+        assert_true(fresh_for(tsdir, "alice", &key, 60));
+        // disabled, or another user
+        assert_false(fresh_for(tsdir, "alice", &key, 0));
+        assert_false(fresh_for(tsdir, "bob", &key, 60));
+
+        // another terminal, session or a reused session id
+        key_of(&other, 100, "pts/2");
+        assert_false(fresh_for(tsdir, "alice", &other, 60));
+        key_of(&other, 101, "pts/1");
+        assert_false(fresh_for(tsdir, "alice", &other, 60));
+        key_of(&other, 100, "pts/1");
+        other.start++;
+        assert_false(fresh_for(tsdir, "alice", &other, 60));
+
+        // more sessions than records replace the oldest
+        for (int sid = 1; sid <= TSTAMP_RECORDS; sid++) {
+                key_of(&other, sid, "tty1");
+                assert_int_equal(tstamp_update(tsdir, "alice", &other), 0);
+                assert_true(fresh_for(tsdir, "alice", &other, 60));
+        }
+        assert_false(fresh_for(tsdir, "alice", &key, 60));
+        const char *path = tmpdir_path(&dir, "ts/alice");
+        struct stat st, again;
+        assert_int_equal(stat(path, &st), 0);
+        assert_int_equal(st.st_mode & 0777, 0600);
+        // a fresh verification of a recorded session takes its record
+        key_of(&other, 1, "tty1");
+        assert_int_equal(tstamp_update(tsdir, "alice", &other), 0);
+        assert_int_equal(stat(path, &again), 0);
+        assert_int_equal(again.st_size, st.st_size);
+
+        // a file others may write is not trusted
+        assert_int_equal(chmod(path, 0644), 0);
+        bool fresh = true;
+        assert_int_equal(tstamp_check(tsdir, "alice", &other, 60, &fresh), ERR_TSTAMP_UNSAFE);
+        assert_false(fresh);
+        assert_int_equal(tstamp_update(tsdir, "alice", &other), ERR_TSTAMP_UNSAFE);
+
+        // names that are not file names
+        assert_int_equal(tstamp_update(tsdir, "../alice", &key), ERR_TSTAMP_NAME);
+        assert_int_equal(tstamp_update(tsdir, ".alice", &key), ERR_TSTAMP_NAME);
+        assert_int_equal(tstamp_update(tsdir, "", &key), ERR_TSTAMP_NAME);
+
+        assert_int_equal(tstamp_invalidate(tsdir, NULL), 0);
+        assert_int_equal(access(path, F_OK), -1);
+        tmpdir_free(&dir);
+}
+
+testfunc(tstamp_invalidate) {
+        (void) state;  // Unused variable
+
+        tmpdir_t tmp;
+        tmpdir_new(&tmp, "tstamp");
+        const char *dir = tmp.dir;
+        // nothing to remove
+        assert_int_equal(tstamp_invalidate(dir, "alice"), 0);
+
+        tstamp_key_t key;
+        tstamp_key(&key, "/dev/pts/7");
+        assert_int_equal(key.uid, getuid());
+        assert_int_equal(key.sid, getsid(0));
+        assert_string_equal(key.tty, "pts/7");
+        const char *users[] = {"alice", "bob", "carol"};
+        for (size_t i = 0; i < 3; i++) {
+                assert_int_equal(tstamp_update(dir, users[i], &key), 0);
+        }
+
+        assert_int_equal(tstamp_invalidate(dir, "bob"), 0);
+        assert_true(fresh_for(dir, "alice", &key, 60));
+        assert_false(fresh_for(dir, "bob", &key, 60));
+        assert_true(fresh_for(dir, "carol", &key, 60));
+
+        assert_int_equal(tstamp_invalidate(dir, NULL), 0);
+        for (size_t i = 0; i < 3; i++) {
+                assert_false(fresh_for(dir, users[i], &key, 60));
+        }
+        tmpdir_free(&tmp);
+        // a missing directory has nothing to remove
+        assert_int_equal(tstamp_invalidate(dir, NULL), 0);
+}
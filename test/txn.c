@@ -0,0 +1,87 @@
+#include "test.h"
+#include "../src/lib/txn.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static void assert_file(const char *path, const char *text) {
+        char buf[64];
+        assert_string_equal(file_read(path, buf, sizeof(buf)), text);
+}
+
+testfunc(txn_commit) {
+        (void) state;  // Unused variable
+
+        tmpdir_t dir;
+        tmpdir_new(&dir, "txn");
+        const char *a = tmpdir_path(&dir, "users");
+        const char *b = tmpdir_path(&dir, "state");
+        file_write(a, "old users\n");
+
+        txn_t *txn = txn_new();
+        const char *tmp = NULL;
+        assert_int_equal(txn_add(txn, a, &tmp), 0);
+        file_write(tmp, "new users\n");
+        assert_int_equal(txn_add(txn, b, &tmp), 0);
+        file_write(tmp, "new state\n");
+        // targets are untouched before commit
+        assert_file(a, "old users\n");
+        assert_int_equal(access(b, F_OK), -1);
+
+        assert_int_equal(txn_commit(txn), 0);
+        txn_free(txn);
+        assert_file(a, "new users\n");
+        assert_file(b, "new state\n");
+
+        tmpdir_free(&dir);
+}
+
+testfunc(txn_abort) {
+        (void) state;  // Unused variable
+
+        tmpdir_t dir;
+        tmpdir_new(&dir, "txn");
+        const char *a = tmpdir_path(&dir, "users");
+        file_write(a, "old users\n");
+
+        txn_t *txn = txn_new();
+        const char *tmp = NULL;
+        assert_int_equal(txn_add(txn, a, &tmp), 0);
+        file_write(tmp, "new users\n");
+        txn_free(txn);
+
+        assert_file(a, "old users\n");
+        // temporary file is removed, directory is empty
+        tmpdir_free(&dir);
+}
+
+testfunc(txn_rollback) {
+        (void) state;  // Unused variable
+
+        tmpdir_t dir;
+        tmpdir_new(&dir, "txn");
+        const char *a = tmpdir_path(&dir, "users");
+        const char *b = tmpdir_path(&dir, "state");
+        const char *c = tmpdir_path(&dir, "new");
+        file_write(a, "old users\n");
+        // a directory at the second target fails its rename
+        assert_int_equal(mkdir(b, 0700), 0);
+
+        txn_t *txn = txn_new();
+        const char *tmp = NULL;
+        assert_int_equal(txn_add(txn, a, &tmp), 0);
+        file_write(tmp, "new users\n");
+        assert_int_equal(txn_add(txn, c, &tmp), 0);
+        file_write(tmp, "new file\n");
+        assert_int_equal(txn_add(txn, b, &tmp), 0);
+        file_write(tmp, "new state\n");
+        assert_int_equal(txn_commit(txn), ERR_TXN_RENAME);
+        txn_free(txn);
+
+        // the replaced file is restored, the created one is gone, no
+        // temporary file or backup is left
+        assert_file(a, "old users\n");
+        assert_int_equal(access(c, F_OK), -1);
+        tmpdir_free(&dir);
+}
@@ -1,6 +1,12 @@
+#define _GNU_SOURCE
 #include "test.h"
 #include "../src/lib/users.h"
 
+#include <dlfcn.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
 testfunc(users_update) {
         (void) state;  // Unused variable
 
@@ -93,6 +99,393 @@ void test_users_iterate(void **state) {
         ok = users_iterator_next(iter, u);
         assert_false(ok);
 
+        // records added while iterating move the array, the iterator
+        // follows it and reaches them
+        char name[8];
+        for (int i = 0; i < 64; i++) {
+                snprintf(name, sizeof(name), "u%02d", i);
+                users_update(users, name, pin1);
+        }
+        ok = users_iterator_next(iter, u);
+        assert_true(ok);
+        const char* name3 = user_get_name(u);
+        assert_string_equal(name3, "u00");
+        free((void*)name3);
+
+        users_iterator_free(iter);
         user_free(u);
         users_free(users);
 }
+
+void test_users_find_after_remove(void **state) {
+        (void) state;  // Unused variable
+
+        pin_hash_t pin1 = {1};
+        pin_hash_t pin2 = {2};
+        pin_hash_t pin3 = {3};
+
+        users_t *users = users_new(0);
+        users_update(users, "John", pin1);
+        users_update(users, "Jane", pin2);
+        users_update(users, "Alice", pin3);
+
+        // remove from the front shifts the following records
+        assert_int_equal(users_remove(users, "John"), 0);
+        assert_int_equal(users_remove(users, "John"), ERR_USERS_USER_NOT_FOUND);
+
+        user_t *u = user_new();
+        assert_int_equal(users_find(users, "Jane", u), 0);
+        assert_true(user_check_pin(u, pin2));
+        assert_int_equal(users_find(users, "Alice", u), 0);
+        assert_true(user_check_pin(u, pin3));
+
+        users_update(users, "Alice", pin1);
+        assert_int_equal(users_find(users, "Alice", u), 0);
+        assert_true(user_check_pin(u, pin1));
+
+        user_free(u);
+        users_free(users);
+}
+
+void test_users_dump(void **state) {
+        (void) state;  // Unused variable
+
+        pin_hash_t pin = {1};
+        users_t *users = users_new(4);
+        users_update(users, "John", pin);
+
+        char path[] = "/tmp/pinpam-users-XXXXXX";
+        int fd = mkstemp(path);
+        assert_true(fd >= 0);
+        close(fd);
+        assert_int_equal(chmod(path, 0600), 0);
+
+        // the file is replaced, its permissions are kept
+        assert_int_equal(users_dump(users, path), 0);
+        struct stat st;
+        assert_int_equal(stat(path, &st), 0);
+        assert_int_equal(st.st_mode & 07777, 0600);
+        users_t *loaded = users_new(4);
+        assert_int_equal(users_load(loaded, path), 0);
+        assert_int_equal(users_find(loaded, "John", NULL), 0);
+        users_free(loaded);
+        unlink(path);
+
+        assert_int_equal(users_dump(users, "/nonexistent/pinpam/users"), ERR_USERS_OPEN);
+        users_free(users);
+}
+
+testfunc(users_dump_faults) {
+        (void) state;  // Unused variable
+
+        // make test preloads the shim, see test/faultio.c
+        void (*faultio_set)(const char *rules) = dlsym(RTLD_DEFAULT, "faultio_set");
+        if (faultio_set == NULL) {
+                skip();
+        }
+        tmpdir_t dir;
+        tmpdir_new(&dir, "dump");
+        const char *path = tmpdir_path(&dir, "users");
+        pin_hash_t pin;
+        memset(pin, 'a', PIN_HASH_LEN);
+        users_t *users = users_new(0);
+        char name[8];
+        for (int i = 0; i < 8; i++) {
+                snprintf(name, sizeof(name), "u%d", i);
+                users_update(users, name, pin);
+        }
+        static const char original[] =
+                "old:bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb\n";
+        file_write(path, original);
+
+        // a failed write or sync leaves the file as it was, and no
+        // temporary file behind for tmpdir_free to trip on
+        static const char * const faults[] = {
+                "fprintf:enospc@3", "fprintf:eio", "fwrite:enospc@5", "fwrite:eio",
+                "fclose:enospc", "fsync:enospc", "fsync:eio",
+        };
+        char rules[160], buf[256];
+        for (size_t i = 0; i < sizeof(faults) / sizeof(faults[0]); i++) {
+                snprintf(rules, sizeof(rules), "%s:%s", faults[i], dir.dir);
+                faultio_set(rules);
+                const int err = users_dump(users, path);
+                faultio_set(NULL);
+                assert_int_equal(err, ERR_USERS_WRITE);
+                assert_string_equal(file_read(path, buf, sizeof(buf)), original);
+        }
+        assert_int_equal(users_dump(users, path), 0);
+        assert_string_not_equal(file_read(path, buf, sizeof(buf)), original);
+
+        users_free(users);
+        tmpdir_free(&dir);
+}
+
+struct scan {
+        char    names[8][16];
+        size_t  len;
+        size_t  stop;   // stop after this many, 0 - never
+};
+
+static int scan_user(void *ctx, user_t *user) {
+        struct scan *scan = ctx;
+        const char *name = user_get_name(user);
+        snprintf(scan->names[scan->len++], sizeof(scan->names[0]), "%s", name);
+        free((void*)name);
+        return scan->len == scan->stop ? 7 : 0;
+}
+
+testfunc(users_scan) {
+        (void) state;  // Unused variable
+
+        pin_hash_t pin = {1};
+        users_t *users = users_new(0);
+        users_update(users, "svc-b", pin);
+        users_update(users, "adm", pin);
+        users_update(users, "svc-a", pin);
+        users_update(users, "svc", pin);
+        users_update(users, "svd", pin);
+
+        struct scan scan = {0};
+        assert_int_equal(users_scan_prefix(users, "svc", NULL, scan_user, &scan), 0);
+        assert_int_equal(scan.len, 3);
+        assert_string_equal(scan.names[0], "svc");
+        assert_string_equal(scan.names[1], "svc-a");
+        assert_string_equal(scan.names[2], "svc-b");
+
+        // cursor: the prefix after the last listed user
+        memset(&scan, 0, sizeof(scan));
+        assert_int_equal(users_scan_prefix(users, "svc", "svc-a", scan_user, &scan), 0);
+        assert_int_equal(scan.len, 1);
+        assert_string_equal(scan.names[0], "svc-b");
+        memset(&scan, 0, sizeof(scan));
+        assert_int_equal(users_scan_prefix(users, "svc-", "adm", scan_user, &scan), 0);
+        assert_int_equal(scan.len, 2);
+
+        memset(&scan, 0, sizeof(scan));
+        assert_int_equal(users_scan_range(users, "adm", "svd", scan_user, &scan), 0);
+        assert_int_equal(scan.len, 3);
+        assert_string_equal(scan.names[0], "svc");
+        memset(&scan, 0, sizeof(scan));
+        scan.stop = 2;
+        assert_int_equal(users_scan_range(users, NULL, NULL, scan_user, &scan), 7);
+        assert_int_equal(scan.len, 2);
+        assert_string_equal(scan.names[0], "adm");
+
+        // the sorted view follows changes
+        users_remove(users, "svc");
+        users_update(users, "svc-0", pin);
+        memset(&scan, 0, sizeof(scan));
+        assert_int_equal(users_scan_prefix(users, "svc", NULL, scan_user, &scan), 0);
+        assert_int_equal(scan.len, 3);
+        assert_string_equal(scan.names[0], "svc-0");
+        memset(&scan, 0, sizeof(scan));
+        assert_int_equal(users_scan_prefix(users, "x", NULL, scan_user, &scan), 0);
+        assert_int_equal(scan.len, 0);
+        users_free(users);
+}
+
+static void assert_same_users(users_t *a, users_t *b) {
+        user_iterator_t *ia = users_iterate(a);
+        user_iterator_t *ib = users_iterate(b);
+        user_t *ua = user_new();
+        user_t *ub = user_new();
+        size_t len = 0;
+        while (users_iterator_next(ia, ua)) {
+                assert_true(users_iterator_next(ib, ub));
+                const char *na = user_get_name(ua);
+                const char *nb = user_get_name(ub);
+                assert_string_equal(na, nb);
+                pin_hash_t pa, pb;
+                user_get_pin_hash(ua, pa);
+                user_get_pin_hash(ub, pb);
+                assert_memory_equal(pa, pb, PIN_HASH_LEN);
+                kdf_params_t ka, kb;
+                user_get_kdf(ua, &ka);
+                user_get_kdf(ub, &kb);
+                char fa[KDF_PREFIX_MAX], fb[KDF_PREFIX_MAX];
+                assert_int_equal(kdf_format(&ka, fa, sizeof(fa)), 0);
+                assert_int_equal(kdf_format(&kb, fb, sizeof(fb)), 0);
+                assert_string_equal(fa, fb);
+
+                // duplicated names find the same record
+                assert_int_equal(users_find(a, na, ua), 0);
+                assert_int_equal(users_find(b, na, ub), 0);
+                user_get_pin_hash(ua, pa);
+                user_get_pin_hash(ub, pb);
+                assert_memory_equal(pa, pb, PIN_HASH_LEN);
+                free((void*)na);
+                free((void*)nb);
+                len++;
+        }
+        assert_false(users_iterator_next(ib, ub));
+        assert_true(len > 0);
+        user_free(ua);
+        user_free(ub);
+        users_iterator_free(ia);
+        users_iterator_free(ib);
+}
+
+// duplicates of earlier users across the chunks, the last line has no
+// line break
+static void write_users(const char *path, int broken) {
+        FILE *f = fopen(path, "w");
+        assert_non_null(f);
+        kdf_params_t kdf;
+        assert_int_equal(kdf_parse_spec("$pbkdf2-sha256$i=1000$", &kdf), 0);
+        assert_int_equal(kdf_salt(&kdf), 0);
+        char prefix[KDF_PREFIX_MAX];
+        assert_int_equal(kdf_format(&kdf, prefix, sizeof(prefix)), 0);
+        for (int i = 0; i < 60; i++) {
+                if (i == broken) {
+                        fprintf(f, "broken line\n");
+                }
+                fprintf(f, "user%02d:%s%064d%s", i % 45, i % 3 == 0 ? prefix : "", i,
+                        i < 59 ? "\n" : "");
+        }
+        fclose(f);
+}
+
+testfunc(users_load_threads) {
+        (void) state;  // Unused variable
+
+        char path[] = "/tmp/pinpam-users-XXXXXX";
+        int fd = mkstemp(path);
+        assert_true(fd >= 0);
+        close(fd);
+
+        // the second pass stops at a malformed line with the same records
+        for (int broken = -1; broken <= 40; broken += 41) {
+                write_users(path, broken);
+                users_t *expected = users_new(4);
+                const int err = users_load(expected, path);
+                assert_int_equal(err, broken < 0 ? 0 : ERR_USERS_INVALID_FORMAT);
+                for (int threads = 0; threads <= 7; threads++) {
+                        users_t *loaded = users_new(4);
+                        assert_int_equal(users_load_threads(loaded, path, threads), err);
+                        assert_same_users(expected, loaded);
+
+                        // arena names are not freed with their records
+                        assert_int_equal(users_remove(loaded, "user01"), 0);
+                        assert_int_equal(users_update(loaded, "added", (pin_hash_t){1}), 0);
+                        users_free(loaded);
+                }
+                users_free(expected);
+        }
+
+        users_t *missing = users_new(4);
+        assert_int_equal(users_load_threads(missing, "/nonexistent/pinpam/users", 2), 0);
+        assert_int_equal(users_find(missing, "user00", NULL), ERR_USERS_USER_NOT_FOUND);
+        users_free(missing);
+        unlink(path);
+}
+
+static size_t iterate_names(users_t *users, char names[][8], size_t cap) {
+        user_iterator_t *iter = users_iterate(users);
+        user_t *user = user_new();
+        size_t len = 0;
+        while (users_iterator_next(iter, user)) {
+                assert_true(len < cap);
+                const char *name = user_get_name(user);
+                snprintf(names[len++], 8, "%s", name);
+                free((void*)name);
+        }
+        user_free(user);
+        users_iterator_free(iter);
+        return len;
+}
+
+static int count_user(void *ctx, user_t *user) {
+        size_t *count = ctx;
+        (*count)++;
+        return 0;
+}
+
+testfunc(users_remove_compact) {
+        (void) state;  // Unused variable
+
+        pin_hash_t pin = {1};
+        pin_hash_t pin2 = {2};
+        users_t *users = users_new(0);
+        char name[8];
+        for (int i = 0; i < 200; i++) {
+                snprintf(name, sizeof(name), "u%03d", i);
+                users_update(users, name, i == 150 ? pin2 : pin);
+        }
+
+        // tombstones keep the order of the rest
+        for (int i = 0; i < 40; i++) {
+                snprintf(name, sizeof(name), "u%03d", i);
+                assert_int_equal(users_remove(users, name), 0);
+        }
+        assert_int_equal(users_remove(users, "u000"), ERR_USERS_USER_NOT_FOUND);
+        static char names[256][8];
+        assert_int_equal(iterate_names(users, names, 256), 160);
+        assert_string_equal(names[0], "u040");
+        assert_string_equal(names[159], "u199");
+        size_t count = 0;
+        assert_int_equal(users_scan_prefix(users, "u0", NULL, count_user, &count), 0);
+        assert_int_equal(count, 60);
+        // a removed user added again goes last
+        users_update(users, "u000", pin);
+        assert_int_equal(iterate_names(users, names, 256), 161);
+        assert_string_equal(names[160], "u000");
+
+        // past a quarter of tombstones the slots are compacted
+        for (int i = 40; i < 100; i++) {
+                snprintf(name, sizeof(name), "u%03d", i);
+                assert_int_equal(users_remove(users, name), 0);
+        }
+        assert_int_equal(iterate_names(users, names, 256), 101);
+        assert_string_equal(names[0], "u100");
+        assert_string_equal(names[100], "u000");
+        user_t *user = user_new();
+        assert_int_equal(users_find(users, "u150", user), 0);
+        assert_true(user_check_pin(user, pin2));
+        users_update(users, "u150", pin);
+        assert_int_equal(users_find(users, "u150", user), 0);
+        assert_true(user_check_pin(user, pin));
+        assert_int_equal(users_find(users, "u099", user), ERR_USERS_USER_NOT_FOUND);
+        count = 0;
+        assert_int_equal(users_scan_prefix(users, "u0", NULL, count_user, &count), 0);
+        assert_int_equal(count, 1);
+        user_free(user);
+        users_free(users);
+}
+
+testfunc(users_remove_duplicate) {
+        (void) state;  // Unused variable
+
+        tmpdir_t dir;
+        tmpdir_new(&dir, "users");
+        const char *path = tmpdir_path(&dir, "users");
+        pin_hash_t pin;
+        memset(pin, '3', PIN_HASH_LEN);
+
+        // both loaders keep the later records of a name
+        for (int threads = 0; threads <= 2; threads++) {
+                file_write(path, "bob:1111111111111111111111111111111111111111111111111111111111111111\n"
+                                 "ann:1111111111111111111111111111111111111111111111111111111111111111\n"
+                                 "bob:2222222222222222222222222222222222222222222222222222222222222222\n");
+                users_t *users = users_new(0);
+                assert_int_equal(threads == 0 ? users_load(users, path) :
+                                 users_load_threads(users, path, threads), 0);
+                // every record of the name goes, not only the first one
+                assert_int_equal(users_remove(users, "bob"), 0);
+                assert_int_equal(users_remove(users, "bob"), ERR_USERS_USER_NOT_FOUND);
+                static char names[4][8];
+                assert_int_equal(iterate_names(users, names, 4), 1);
+                assert_int_equal(users_update(users, "bob", pin), 0);
+                assert_int_equal(users_dump(users, path), 0);
+                users_free(users);
+
+                users = users_new(0);
+                assert_int_equal(users_load(users, path), 0);
+                user_t *user = user_new();
+                assert_int_equal(users_find(users, "bob", user), 0);
+                assert_true(user_check_pin(user, pin));
+                assert_int_equal(iterate_names(users, names, 4), 2);
+                user_free(user);
+                users_free(users);
+        }
+        tmpdir_free(&dir);
+}
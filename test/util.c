@@ -0,0 +1,56 @@
+#include "test.h"
+
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+
+void tmpdir_new(tmpdir_t *tmp, const char *name) {
+        snprintf(tmp->dir, sizeof(tmp->dir), "/tmp/pinpam-%s-XXXXXX", name);
+        assert_non_null(mkdtemp(tmp->dir));
+        tmp->len = 0;
+}
+
+const char* tmpdir_path(tmpdir_t *tmp, const char *file) {
+        char path[sizeof(tmp->paths[0])];
+        snprintf(path, sizeof(path), "%s/%s", tmp->dir, file);
+        for (size_t i = 0; i < tmp->len; i++) {
+                if (strcmp(tmp->paths[i], path) == 0) {
+                        return tmp->paths[i];
+                }
+        }
+        assert_true(tmp->len < TMPDIR_FILES);
+        memcpy(tmp->paths[tmp->len], path, sizeof(path));
+        return tmp->paths[tmp->len++];
+}
+
+void tmpdir_free(tmpdir_t *tmp) {
+        // last first, files of a subdirectory go before it
+        while (tmp->len > 0) {
+                remove(tmp->paths[--tmp->len]);
+        }
+        assert_int_equal(rmdir(tmp->dir), 0);
+}
+
+void file_write(const char *path, const char *content) {
+        FILE *f = fopen(path, "w");
+        assert_non_null(f);
+        fputs(content, f);
+        assert_int_equal(fclose(f), 0);
+}
+
+char* file_read(const char *path, char *buf, size_t size) {
+        FILE *f = fopen(path, "r");
+        assert_non_null(f);
+        const size_t len = fread(buf, 1, size - 1, f);
+        buf[len] = '\0';
+        fclose(f);
+        return buf;
+}
+
+void lines_add(lines_t *lines, const char *fmt, ...) {
+        assert_true(lines->len < sizeof(lines->lines) / sizeof(lines->lines[0]));
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(lines->lines[lines->len++], sizeof(lines->lines[0]), fmt, args);
+        va_end(args);
+}